@@ -36,6 +36,7 @@
 #include "simplesslerrorhandler.h"
 #include "syncengine.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 #include "config.h"
 #include "csync_exclude.h"
 
@@ -81,6 +82,7 @@ struct CmdOptions
     int restartTimes;
     int downlimit;
     int uplimit;
+    QString traceFile;
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -194,6 +196,7 @@ void help()
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "  --logdebug             More verbose logging" << std::endl;
     std::cout << "  --path                 Path to a folder on a remote server" << std::endl;
+    std::cout << "  --trace <file>         Record a performance trace of the sync, for ui.perfetto.dev" << std::endl;
     std::cout << "" << std::endl;
     exit(0);
 }
@@ -272,6 +275,8 @@ void parseOptions(const QStringList &app_args, CmdOptions *options)
             Logger::instance()->setLogDebug(true);
         } else if (option == "--path" && !it.peekNext().startsWith("-")) {
             options->remotePath = it.next();
+        } else if (option == "--trace" && !it.peekNext().startsWith("-")) {
+            options->traceFile = it.next();
         }
         else {
             help();
@@ -339,6 +344,11 @@ int main(int argc, char **argv)
         qSetMessagePattern("%{time MM-dd hh:mm:ss:zzz} [ %{type} %{category} ]%{if-debug}\t[ %{function} ]%{endif}:\t%{message}");
     }
 
+    if (!options.traceFile.isEmpty() && !Tracing::start(options.traceFile)) {
+        std::cerr << "Could not write the trace to '" << qPrintable(options.traceFile) << "'" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     AccountPtr account = Account::create();
 
     if (!account) {
@@ -548,5 +558,6 @@ restart_sync:
         qWarning() << "Another sync is needed, but not done because restart count is exceeded" << restartCount;
     }
 
+    Tracing::stop();
     return resultCode;
 }
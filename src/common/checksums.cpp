@@ -19,10 +19,15 @@
 #include "filesystembase.h"
 #include "common/checksums.h"
 #include "asserts.h"
+#include "tracing.h"
 
 #include <QLoggingCategory>
 #include <qtconcurrentrun.h>
 #include <QCryptographicHash>
+#include <QThread>
+#include <QThreadPool>
+
+#include <vector>
 
 #ifdef ZLIB_FOUND
 #include <zlib.h>
@@ -82,53 +87,153 @@
  * - SHA256
  * - SHA3-256 (requires Qt 5.9)
  *
+ * Computation
+ * -----------
+ *
+ * Files are read in large blocks and every block is fed to all requested
+ * algorithms, so an upload that needs both a content and a transmission
+ * checksum reads the file only once. Asynchronous computations run on a
+ * dedicated, bounded thread pool: they are mostly limited by the disk and
+ * should neither starve nor be starved by other QtConcurrent users.
+ *
  */
 
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcChecksums, "nextcloud.sync.checksums", QtInfoMsg)
 
-#define BUFSIZE qint64(500 * 1024) // 500 KiB
+#define BUFSIZE qint64(1024 * 1024) // 1 MiB
+
+namespace {
+
+class ChecksumThreadPool : public QThreadPool
+{
+public:
+    ChecksumThreadPool()
+    {
+        setMaxThreadCount(qBound(1, QThread::idealThreadCount(), 4));
+    }
+};
+
+Q_GLOBAL_STATIC(ChecksumThreadPool, checksumThreadPool)
+
+/* One running digest of a multi-checksum calculation */
+class Digest
+{
+public:
+    explicit Digest(const QByteArray &type)
+    {
+        if (type == checkSumMD5C) {
+            _hash = std::make_unique<QCryptographicHash>(QCryptographicHash::Md5);
+        } else if (type == checkSumSHA1C) {
+            _hash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha1);
+        } else if (type == checkSumSHA2C) {
+            _hash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha256);
+        }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        else if (type == checkSumSHA3C) {
+            _hash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha3_256);
+        }
+#endif
+#ifdef ZLIB_FOUND
+        else if (type == checkSumAdlerC) {
+            _isAdler = true;
+            _adler = adler32(0L, Z_NULL, 0);
+        }
+#endif
+        else if (!type.isEmpty()) {
+            qCWarning(lcChecksums) << "Unknown checksum type:" << type;
+        }
+    }
+
+    bool isValid() const { return _hash || _isAdler; }
+
+    void addData(const char *data, qint64 size)
+    {
+        if (_hash) {
+            _hash->addData(data, static_cast<int>(size));
+        }
+#ifdef ZLIB_FOUND
+        else if (_isAdler) {
+            _adler = adler32(_adler, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(size));
+        }
+#endif
+    }
 
-static QByteArray calcCryptoHash(QIODevice *device, QCryptographicHash::Algorithm algo)
+    QByteArray result(qint64 totalSize) const
+    {
+        if (_hash)
+            return _hash->result().toHex();
+        // adler32 of an empty file was never reported
+        if (_isAdler && totalSize > 0)
+            return QByteArray::number(_adler, 16);
+        return QByteArray();
+    }
+
+private:
+    std::unique_ptr<QCryptographicHash> _hash;
+    bool _isAdler = false;
+    unsigned long _adler = 0;
+};
+
+QVector<QByteArray> calcChecksums(QIODevice *device, const QVector<QByteArray> &types,
+    const ComputeChecksum::DataObserver &observer = ComputeChecksum::DataObserver())
 {
-     QByteArray arr;
-     QCryptographicHash crypto( algo );
+    QVector<QByteArray> results(types.size());
+
+    std::vector<Digest> digests;
+    digests.reserve(types.size());
+    bool anyValid = false;
+    for (const auto &type : types) {
+        digests.emplace_back(type);
+        anyValid |= digests.back().isValid();
+    }
+    if ((!anyValid && !observer) || !device->isReadable())
+        return results;
 
-     if (crypto.addData(device)) {
-         arr = crypto.result().toHex();
-     }
-     return arr;
- }
+    // Large blocks keep the per-read overhead low, QCryptographicHash::addData(QIODevice *)
+    // would only read 1 KiB at a time
+    QByteArray buf(BUFSIZE, Qt::Uninitialized);
+    qint64 totalSize = 0;
+    while (true) {
+        const qint64 size = device->read(buf.data(), BUFSIZE);
+        if (size < 0)
+            return results;
+        if (size == 0)
+            break;
+        for (auto &digest : digests)
+            digest.addData(buf.constData(), size);
+        if (observer)
+            observer(buf.constData(), size);
+        totalSize += size;
+    }
+
+    for (int i = 0; i < types.size(); ++i)
+        results[i] = digests[i].result(totalSize);
+    return results;
+}
+
+QByteArray calcChecksum(QIODevice *device, const QByteArray &type)
+{
+    return calcChecksums(device, { type }).first();
+}
+
+}
 
 QByteArray calcMd5(QIODevice *device)
 {
-    return calcCryptoHash(device, QCryptographicHash::Md5);
+    return calcChecksum(device, checkSumMD5C);
 }
 
 QByteArray calcSha1(QIODevice *device)
 {
-    return calcCryptoHash(device, QCryptographicHash::Sha1);
+    return calcChecksum(device, checkSumSHA1C);
 }
 
 #ifdef ZLIB_FOUND
 QByteArray calcAdler32(QIODevice *device)
 {
-    if (device->size() == 0)
-    {
-        return QByteArray();
-    }
-    QByteArray buf(BUFSIZE, Qt::Uninitialized);
-
-    unsigned int adler = adler32(0L, Z_NULL, 0);
-    qint64 size = 0;
-    while (!device->atEnd()) {
-        size = device->read(buf.data(), BUFSIZE);
-        if (size > 0)
-            adler = adler32(adler, (const Bytef *)buf.data(), size);
-    }
-
-    return QByteArray::number(adler, 16);
+    return calcChecksum(device, checkSumAdlerC);
 }
 #endif
 
@@ -225,16 +330,36 @@ QByteArray ComputeChecksum::checksumType() const
     return _checksumType;
 }
 
+void ComputeChecksum::setAdditionalChecksumTypes(const QVector<QByteArray> &types)
+{
+    _additionalChecksumTypes = types;
+}
+
+void ComputeChecksum::setDataObserver(const DataObserver &observer)
+{
+    _dataObserver = observer;
+}
+
+QByteArray ComputeChecksum::checksum(const QByteArray &type) const
+{
+    if (type == _checksumType)
+        return _checksums.value(0);
+    const auto index = _additionalChecksumTypes.indexOf(type);
+    if (index < 0)
+        return QByteArray();
+    return _checksums.value(index + 1);
+}
+
 void ComputeChecksum::start(const QString &filePath)
 {
-    qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
+    qCInfo(lcChecksums) << "Computing" << checksumType() << _additionalChecksumTypes << "checksum of" << filePath << "in a thread";
     startImpl(std::make_unique<QFile>(filePath));
 }
 
 void ComputeChecksum::start(std::unique_ptr<QIODevice> device)
 {
     ENFORCE(device);
-    qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of device" << device.get() << "in a thread";
+    qCInfo(lcChecksums) << "Computing" << checksumType() << _additionalChecksumTypes << "checksum of device" << device.get() << "in a thread";
     ASSERT(!device->parent());
 
     startImpl(std::move(device));
@@ -251,19 +376,26 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
     auto sharedDevice = QSharedPointer<QIODevice>(device.release());
 
     // Bug: The thread will keep running even if ComputeChecksum is deleted.
-    auto type = checksumType();
-    _watcher.setFuture(QtConcurrent::run([sharedDevice, type]() {
-        if (!sharedDevice->open(QIODevice::ReadOnly)) {
-            if (auto file = qobject_cast<QFile *>(sharedDevice.data())) {
+    auto types = QVector<QByteArray>{ checksumType() } + _additionalChecksumTypes;
+    _checksums.clear();
+    const auto observer = _dataObserver;
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), [sharedDevice, types, observer]() {
+        // Files are read in large blocks anyway, QFile's own buffer would only add a copy
+        const auto file = qobject_cast<QFile *>(sharedDevice.data());
+        QIODevice::OpenMode mode = QIODevice::ReadOnly;
+        if (file)
+            mode |= QIODevice::Unbuffered;
+        if (!sharedDevice->open(mode)) {
+            if (file) {
                 qCWarning(lcChecksums) << "Could not open file" << file->fileName()
                         << "for reading to compute a checksum" << file->errorString();
             } else {
                 qCWarning(lcChecksums) << "Could not open device" << sharedDevice.data()
                         << "for reading to compute a checksum" << sharedDevice->errorString();
             }
-            return QByteArray();
+            return QVector<QByteArray>(types.size());
         }
-        auto result = ComputeChecksum::computeNow(sharedDevice.data(), type);
+        auto result = ComputeChecksum::computeNow(sharedDevice.data(), types, observer);
         sharedDevice->close();
         return result;
     }));
@@ -272,7 +404,7 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
 QByteArray ComputeChecksum::computeNowOnFile(const QString &filePath, const QByteArray &checksumType)
 {
     QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
         qCWarning(lcChecksums) << "Could not open file" << filePath << "for reading and computing checksum" << file.errorString();
         return QByteArray();
     }
@@ -281,39 +413,28 @@ QByteArray ComputeChecksum::computeNowOnFile(const QString &filePath, const QByt
 }
 
 QByteArray ComputeChecksum::computeNow(QIODevice *device, const QByteArray &checksumType)
+{
+    // for an unknown checksum or no checksum, we're done right now
+    return computeNow(device, QVector<QByteArray>{ checksumType }).first();
+}
+
+QVector<QByteArray> ComputeChecksum::computeNow(QIODevice *device, const QVector<QByteArray> &checksumTypes,
+    const DataObserver &observer)
 {
     if (!checksumComputationEnabled()) {
         qCWarning(lcChecksums) << "Checksum computation disabled by environment variable";
-        return QByteArray();
+        return QVector<QByteArray>(checksumTypes.size());
     }
 
-    if (checksumType == checkSumMD5C) {
-        return calcMd5(device);
-    } else if (checksumType == checkSumSHA1C) {
-        return calcSha1(device);
-    } else if (checksumType == checkSumSHA2C) {
-        return calcCryptoHash(device, QCryptographicHash::Sha256);
-    }
-#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
-    else if (checksumType == checkSumSHA3C) {
-        return calcCryptoHash(device, QCryptographicHash::Sha3_256);
-    }
-#endif
-#ifdef ZLIB_FOUND
-    else if (checksumType == checkSumAdlerC) {
-        return calcAdler32(device);
-    }
-#endif
-    // for an unknown checksum or no checksum, we're done right now
-    if (!checksumType.isEmpty()) {
-        qCWarning(lcChecksums) << "Unknown checksum type:" << checksumType;
-    }
-    return QByteArray();
+    const auto file = qobject_cast<QFile *>(device);
+    Tracing::Scope trace("checksum", "compute checksum", file ? file->fileName() : QString());
+    return calcChecksums(device, checksumTypes, observer);
 }
 
 void ComputeChecksum::slotCalculationDone()
 {
-    QByteArray checksum = _watcher.future().result();
+    _checksums = _watcher.future().result();
+    QByteArray checksum = _checksums.value(0);
     if (!checksum.isNull()) {
         emit done(_checksumType, checksum);
     } else {
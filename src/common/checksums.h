@@ -24,6 +24,7 @@
 #include <QObject>
 #include <QByteArray>
 #include <QFutureWatcher>
+#include <QVector>
 
 #include <memory>
 
@@ -90,6 +91,32 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Sets checksum types that are computed in the same pass over the data
+     * as checksumType(), for callers that need more than one digest of a file.
+     *
+     * done() still only reports checksumType(). The other values can be
+     * fetched with checksum() from a slot connected to done().
+     */
+    void setAdditionalChecksumTypes(const QVector<QByteArray> &types);
+
+    /**
+     * The computed checksum for \a type, null if it was not requested or
+     * the calculation failed. Only valid once done() was emitted.
+     */
+    QByteArray checksum(const QByteArray &type) const;
+
+    /// Sees every block of the data the checksums are computed from
+    using DataObserver = std::function<void(const char *data, qint64 size)>;
+
+    /**
+     * Sets a function that is passed the data while it is read, for callers
+     * that need more from a file than its digests.
+     *
+     * It is called in the thread that computes the checksums.
+     */
+    void setDataObserver(const DataObserver &observer);
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -112,6 +139,15 @@ public:
      */
     static QByteArray computeNow(QIODevice *device, const QByteArray &checksumType);
 
+    /**
+     * Computes several checksums synchronously, reading the device only once.
+     *
+     * The result has one entry per requested type, in the same order. Entries
+     * for unknown types are null. \a observer is passed the data as it is read.
+     */
+    static QVector<QByteArray> computeNow(QIODevice *device, const QVector<QByteArray> &checksumTypes,
+        const DataObserver &observer = DataObserver());
+
     /**
      * Computes the checksum synchronously on file. Convenience wrapper for computeNow().
      */
@@ -127,9 +163,12 @@ private:
     void startImpl(std::unique_ptr<QIODevice> device);
 
     QByteArray _checksumType;
+    QVector<QByteArray> _additionalChecksumTypes;
+    QVector<QByteArray> _checksums;
+    DataObserver _dataObserver;
 
     // watcher for the checksum calculation thread
-    QFutureWatcher<QByteArray> _watcher;
+    QFutureWatcher<QVector<QByteArray>> _watcher;
 };
 
 /**
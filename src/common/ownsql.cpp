@@ -17,6 +17,7 @@
  */
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
 #include <QString>
 #include <QFile>
@@ -210,7 +211,11 @@ bool SqlDatabase::commit()
     if (!_db) {
         return false;
     }
+    QElapsedTimer timer;
+    timer.start();
     SQLITE_DO(sqlite3_exec(_db, "COMMIT", nullptr, nullptr, nullptr));
+    _statistics.commitCount++;
+    _statistics.commitTimeNs += timer.nsecsElapsed();
     return _errId == SQLITE_OK;
 }
 
@@ -299,6 +304,10 @@ bool SqlQuery::exec()
         return false;
     }
 
+    if (_sqldb) {
+        _sqldb->_statistics.statementCount++;
+    }
+
     // Don't do anything for selects, that is how we use the lib :-|
     if (!isSelect() && !isPragma()) {
         int rc = 0, n = 0;
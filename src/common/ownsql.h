@@ -53,6 +53,20 @@ public:
     QString error() const;
     sqlite3 *sqliteDb();
 
+    /**
+     * Counters about the work done on this connection.
+     *
+     * Only used for benchmarking, they are never reset implicitly.
+     */
+    struct Statistics
+    {
+        quint64 statementCount = 0; // calls to SqlQuery::exec()
+        quint64 commitCount = 0;
+        qint64 commitTimeNs = 0; // time spent in COMMIT
+    };
+    const Statistics &statistics() const { return _statistics; }
+    void resetStatistics() { _statistics = Statistics(); }
+
 private:
     enum class CheckDbResult {
         Ok,
@@ -67,6 +81,7 @@ private:
     sqlite3 *_db = nullptr;
     QString _error; // last error string
     int _errId = 0;
+    Statistics _statistics;
 
     friend class SqlQuery;
     QSet<SqlQuery *> _queries;
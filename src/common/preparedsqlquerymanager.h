@@ -67,6 +67,7 @@ public:
         GetAllFilesQuery,
         ListFilesInPathQuery,
         SetFileRecordQuery,
+        SetFileRecordsQuery,
         SetFileRecordChecksumQuery,
         SetFileRecordLocalMetadataQuery,
         GetDownloadInfoQuery,
@@ -75,6 +76,9 @@ public:
         GetUploadInfoQuery,
         SetUploadInfoQuery,
         DeleteUploadInfoQuery,
+        GetChunkIndexQuery,
+        SetChunkIndexQuery,
+        DeleteChunkIndexQuery,
         DeleteFileRecordPhash,
         DeleteFileRecordRecursively,
         GetErrorBlacklistQuery,
@@ -17,14 +17,21 @@
  */
 
 #include <QCryptographicHash>
+#include <QDataStream>
 #include <QFile>
 #include <QLoggingCategory>
 #include <QStringList>
 #include <QElapsedTimer>
 #include <QUrl>
 #include <QDir>
+#include <QDeadlineTimer>
+#include <QThread>
 #include <sqlite3.h>
+#include <algorithm>
 #include <cstring>
+#include <numeric>
+#include <utility>
+#include <vector>
 
 #include "common/syncjournaldb.h"
 #include "version.h"
@@ -32,6 +39,7 @@
 #include "common/asserts.h"
 #include "common/checksums.h"
 #include "common/preparedsqlquerymanager.h"
+#include "common/tracing.h"
 
 #include "common/c_jhash.h"
 
@@ -76,6 +84,186 @@ static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &que
     rec._lockstate._lockTimeout = query.int64Value(18);
 }
 
+namespace {
+    // Compares path||'/' like the ORDER BY of listFilesInPath(). In this order
+    // everything below a folder directly follows the folder itself.
+    bool pathLess(const QByteArray &a, const QByteArray &b)
+    {
+        const int common = qMin(a.size(), b.size());
+        const int cmp = std::memcmp(a.constData(), b.constData(), common);
+        if (cmp != 0)
+            return cmp < 0;
+        if (a.size() < b.size())
+            return '/' <= static_cast<uchar>(b.at(common));
+        if (a.size() > b.size())
+            return static_cast<uchar>(a.at(common)) < '/';
+        return false;
+    }
+
+    // The shard of a path is picked by its top level folder, so that a folder
+    // shares its shard with all its parents and everything below it.
+    int metadataShardOf(const char *path, int size, int count)
+    {
+        const auto slash = static_cast<const char *>(std::memchr(path, '/', size));
+        const auto length = slash ? slash - path : size;
+        return static_cast<int>(c_jhash64(reinterpret_cast<const uint8_t *>(path), length, 0) % static_cast<uint64_t>(count));
+    }
+
+    const char metadataShardsKey[] = "metadata_shards";
+
+    // Merges the sorted records read from a shard, starting at shardBegin, into
+    // the ones read from the shards before, so that all are sorted like path||'/'
+    void mergeShardRecords(std::vector<SyncJournalFileRecord> &records, size_t shardBegin)
+    {
+        std::inplace_merge(records.begin(), records.begin() + static_cast<std::ptrdiff_t>(shardBegin), records.end(),
+            [](const SyncJournalFileRecord &a, const SyncJournalFileRecord &b) {
+                return pathLess(a._path, b._path);
+            });
+    }
+}
+
+/**
+ * A part of the metadata table in its own database, see SyncJournalDb::setMetadataShardCount()
+ *
+ * The connection is only used with the mutex locked. It's locked after
+ * SyncJournalDb::_mutex, and shards are locked in the order of their index.
+ */
+class SyncJournalDb::MetadataShard
+{
+public:
+    explicit MetadataShard(const QString &fileName)
+        : fileName(fileName)
+    {
+    }
+
+    // Writes made during a transaction of the journal are committed with it
+    void joinTransaction()
+    {
+        if (!inTransaction && db.transaction()) {
+            inTransaction = true;
+        }
+    }
+
+    void commitTransaction()
+    {
+        if (!inTransaction) {
+            return;
+        }
+        if (!db.commit()) {
+            qCWarning(lcDb) << "ERROR committing to the database:" << fileName << db.error();
+        }
+        inTransaction = false;
+    }
+
+    const QString fileName;
+    QMutex mutex;
+    SqlDatabase db;
+    PreparedSqlQueryManager queryManager;
+    bool inTransaction = false;
+};
+
+/**
+ * The metadata table sorted by path, see SyncJournalDb::loadFileRecordSnapshot()
+ */
+class SyncJournalDb::FileRecordSnapshot
+{
+public:
+    using Records = std::vector<SyncJournalFileRecord>;
+
+    explicit FileRecordSnapshot(Records &&records)
+        : _records(std::move(records))
+    {
+        std::sort(_records.begin(), _records.end(), [](const SyncJournalFileRecord &a, const SyncJournalFileRecord &b) {
+            return pathLess(a._path, b._path);
+        });
+    }
+
+    size_t size() const { return _records.size(); }
+
+    SyncJournalFileRecord *find(const QByteArray &path)
+    {
+        const auto it = lowerBound(_records.begin(), _records.end(), path);
+        return it != _records.end() && it->_path == path ? &*it : nullptr;
+    }
+
+    void listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+    {
+        const QByteArray prefix = path.isEmpty() ? QByteArray() : path + '/';
+        auto it = path.isEmpty() ? _records.cbegin() : upperBound(path);
+        while (it != _records.cend() && it->_path.startsWith(prefix)) {
+            // Report the direct children and jump over everything below them
+            const int slash = it->_path.indexOf('/', prefix.size());
+            if (slash < 0) {
+                rowCallback(*it);
+            }
+            const QByteArray child = slash < 0 ? it->_path : it->_path.left(slash);
+            it = subtreeEnd(it + 1, _records.cend(), child);
+        }
+    }
+
+    void set(const SyncJournalFileRecord &record)
+    {
+        const auto it = lowerBound(_records.begin(), _records.end(), record._path);
+        if (it != _records.end() && it->_path == record._path) {
+            *it = record;
+        } else {
+            _records.insert(it, record);
+        }
+    }
+
+    // Same as the UPDATE of schedulePathForRemoteDiscovery(): path and its parents
+    void invalidateFolderEtags(const QByteArray &path)
+    {
+        for (int end = path.size(); end > 0; end = path.lastIndexOf('/', end - 1)) {
+            const auto record = find(path.left(end));
+            if (record && record->_type == ItemTypeDirectory) {
+                record->_etag = "_invalid_";
+            }
+        }
+    }
+
+    void remove(const QByteArray &path, bool recursively)
+    {
+        const auto begin = lowerBound(_records.begin(), _records.end(), path);
+        if (begin == _records.end() || (!recursively && begin->_path != path))
+            return;
+        const auto end = recursively ? subtreeEnd(begin, _records.end(), path) : begin + 1;
+        _records.erase(begin, end);
+    }
+
+private:
+    template <typename Iterator>
+    static Iterator lowerBound(Iterator from, Iterator end, const QByteArray &path)
+    {
+        return std::lower_bound(from, end, path, [](const SyncJournalFileRecord &record, const QByteArray &path) {
+            return pathLess(record._path, path);
+        });
+    }
+
+    /* The end of the records of path and below, starting at path or its first child
+     *
+     * They are next to each other, but a sibling like "a0.txt" sorts before "a0",
+     * so there is no key to look the end up with.
+     */
+    template <typename Iterator>
+    static Iterator subtreeEnd(Iterator from, Iterator end, const QByteArray &path)
+    {
+        const QByteArray pathSlash = path + '/';
+        return std::partition_point(from, end, [&](const SyncJournalFileRecord &record) {
+            return record._path == path || record._path.startsWith(pathSlash);
+        });
+    }
+
+    Records::const_iterator upperBound(const QByteArray &path) const
+    {
+        return std::upper_bound(_records.cbegin(), _records.cend(), path, [](const QByteArray &path, const SyncJournalFileRecord &record) {
+            return pathLess(path, record._path);
+        });
+    }
+
+    Records _records;
+};
+
 static QByteArray defaultJournalMode(const QString &dbPath)
 {
 #if defined(Q_OS_WIN)
@@ -98,6 +286,25 @@ static QByteArray defaultJournalMode(const QString &dbPath)
     return "WAL";
 }
 
+// Set locking mode to avoid issues with WAL on Windows
+static QByteArray sqliteLockingMode()
+{
+    static const QByteArray envLockingMode = qgetenv("OWNCLOUD_SQLITE_LOCKING_MODE");
+    return envLockingMode.isEmpty() ? QByteArrayLiteral("EXCLUSIVE") : envLockingMode;
+}
+
+static void createParentHashFunction(sqlite3 *db)
+{
+    sqlite3_create_function(db, "parent_hash", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                [] (sqlite3_context *ctx,int, sqlite3_value **argv) {
+                                    auto text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+                                    const char *end = std::strrchr(text, '/');
+                                    if (!end) end = text;
+                                    sqlite3_result_int64(ctx, c_jhash64(reinterpret_cast<const uint8_t*>(text),
+                                                                        end - text, 0));
+                                }, nullptr, nullptr);
+}
+
 SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     : QObject(parent)
     , _dbFile(dbFilePath)
@@ -110,6 +317,9 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     if (_journalMode.isEmpty()) {
         _journalMode = defaultJournalMode(_dbFile);
     }
+
+    static const int envMetadataShards = qEnvironmentVariableIntValue("OWNCLOUD_JOURNAL_SHARDS");
+    setMetadataShardCount(envMetadataShards);
 }
 
 QString SyncJournalDb::makeDbName(const QString &localPath,
@@ -215,6 +425,52 @@ QString SyncJournalDb::databaseFilePath() const
     return _dbFile;
 }
 
+void SyncJournalDb::setMetadataShardCount(int count)
+{
+    QMutexLocker locker(&_mutex);
+    count = qBound(0, count, 64);
+    if (count == _metadataShardCount) {
+        return;
+    }
+    if (_db.isOpen()) {
+        closeLocked();
+    }
+
+    _metadataShardCount = count;
+    _metadataShards.clear();
+    for (int i = 0; i < count; ++i) {
+        _metadataShards.push_back(std::make_unique<MetadataShard>(metadataShardFileName(i)));
+    }
+}
+
+int SyncJournalDb::metadataShardCount()
+{
+    QMutexLocker locker(&_mutex);
+    return _metadataShardCount;
+}
+
+QString SyncJournalDb::metadataShardFileName(int index) const
+{
+    auto base = _dbFile;
+    if (base.endsWith(QLatin1String(".db"))) {
+        base.chop(3);
+    }
+    return base + QStringLiteral(".metadata-%1.db").arg(index);
+}
+
+QStringList SyncJournalDb::metadataShardFilePaths() const
+{
+    // Also the ones of another shard count, which are left over until the journal is opened again
+    const QFileInfo first(metadataShardFileName(0));
+    const auto pattern = first.fileName().replace(QStringLiteral("-0.db"), QStringLiteral("-*.db"));
+    QStringList paths;
+    const auto names = first.dir().entryList({ pattern }, QDir::Files | QDir::Hidden);
+    for (const auto &name : names) {
+        paths.append(first.dir().filePath(name));
+    }
+    return paths;
+}
+
 // Note that this does not change the size of the -wal file, but it is supposed to make
 // the normal .db faster since the changes from the wal will be incorporated into it.
 // Then the next sync (and the SocketAPI) will have a faster access.
@@ -227,6 +483,15 @@ void SyncJournalDb::walCheckpoint()
     if (pragma1.exec()) {
         qCDebug(lcDb) << "took" << t.elapsed() << "msec";
     }
+
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        if (shard->db.isOpen()) {
+            SqlQuery pragma(shard->db);
+            pragma.prepare("PRAGMA wal_checkpoint(FULL);");
+            pragma.exec();
+        }
+    }
 }
 
 void SyncJournalDb::startTransaction()
@@ -245,10 +510,16 @@ void SyncJournalDb::startTransaction()
 void SyncJournalDb::commitTransaction()
 {
     if (_transaction == 1) {
+        Tracing::Scope trace("journal", "commit");
+        // The shards' records refer to checksum types of the journal, so it goes first
         if (!_db.commit()) {
             qCWarning(lcDb) << "ERROR committing to the database:" << _db.error();
             return;
         }
+        for (const auto &shard : _metadataShards) {
+            QMutexLocker shardLocker(&shard->mutex);
+            shard->commitTransaction();
+        }
         _transaction = 0;
     } else {
         qCDebug(lcDb) << "No database Transaction to commit";
@@ -278,7 +549,7 @@ bool SyncJournalDb::checkConnect()
         // has become unavailable - and then some operations may cause crashes. See #6049
         if (!QFile::exists(_dbFile)) {
             qCWarning(lcDb) << "Database open, but file" << _dbFile << "does not exist";
-            close();
+            closeLocked();
             return false;
         }
         return true;
@@ -310,11 +581,7 @@ bool SyncJournalDb::checkConnect()
         qCInfo(lcDb) << "sqlite3 version" << pragma1.stringValue(0);
     }
 
-    // Set locking mode to avoid issues with WAL on Windows
-    static QByteArray locking_mode_env = qgetenv("OWNCLOUD_SQLITE_LOCKING_MODE");
-    if (locking_mode_env.isEmpty())
-        locking_mode_env = "EXCLUSIVE";
-    pragma1.prepare("PRAGMA locking_mode=" + locking_mode_env + ";");
+    pragma1.prepare("PRAGMA locking_mode=" + sqliteLockingMode() + ";");
     if (!pragma1.exec()) {
         return sqlFail(QStringLiteral("Set PRAGMA locking_mode"), pragma1);
     } else {
@@ -357,13 +624,14 @@ bool SyncJournalDb::checkConnect()
         return sqlFail(QStringLiteral("Set PRAGMA case_sensitivity"), pragma1);
     }
 
-    sqlite3_create_function(_db.sqliteDb(), "parent_hash", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
-                                [] (sqlite3_context *ctx,int, sqlite3_value **argv) {
-                                    auto text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
-                                    const char *end = std::strrchr(text, '/');
-                                    if (!end) end = text;
-                                    sqlite3_result_int64(ctx, c_jhash64(reinterpret_cast<const uint8_t*>(text),
-                                                                        end - text, 0));
+    createParentHashFunction(_db.sqliteDb());
+
+    // Used to move the metadata into its shards, see migrateMetadataShards()
+    sqlite3_create_function(_db.sqliteDb(), "metadata_shard", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                [] (sqlite3_context *ctx, int, sqlite3_value **argv) {
+                                    const auto text = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+                                    const auto count = sqlite3_value_int(argv[1]);
+                                    sqlite3_result_int(ctx, text && count > 0 ? metadataShardOf(text, sqlite3_value_bytes(argv[0]), count) : 0);
                                 }, nullptr, nullptr);
 
     /* Because insert is so slow, we do everything in a transaction, and only need one call to commit */
@@ -424,6 +692,7 @@ bool SyncJournalDb::checkConnect()
                         "tmpfile VARCHAR(4096),"
                         "etag VARCHAR(32),"
                         "errorcount INTEGER,"
+                        "segments BLOB,"
                         "PRIMARY KEY(path)"
                         ");");
 
@@ -446,6 +715,18 @@ bool SyncJournalDb::checkConnect()
         return sqlFail(QStringLiteral("Create table uploadinfo"), createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS chunkindex("
+                        "path VARCHAR(4096),"
+                        "etag VARCHAR(32),"
+                        "averagechunksize INTEGER(8),"
+                        "chunks BLOB,"
+                        "PRIMARY KEY(path)"
+                        ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table chunkindex"), createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -516,6 +797,15 @@ bool SyncJournalDb::checkConnect()
         return sqlFail(QStringLiteral("Create table conflicts"), createQuery);
     }
 
+    // create the filestatus table, see SyncFileStatusTracker
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS filestatus("
+                        "path TEXT PRIMARY KEY,"
+                        "status INTEGER"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table filestatus"), createQuery);
+    }
+
     createQuery.prepare("CREATE TABLE IF NOT EXISTS version("
                         "major INTEGER(8),"
                         "minor INTEGER(8),"
@@ -591,9 +881,6 @@ bool SyncJournalDb::checkConnect()
      *  to get back the files that were gone.
      *  In 1.8.1 we had a fix to re-get the data, but this one here is better
      */
-    if (forceRemoteDiscovery) {
-        forceRemoteDiscoveryNextSyncLocked();
-    }
     const auto deleteDownloadInfo = _queryManager.get(PreparedSqlQueryManager::DeleteDownloadInfoQuery, QByteArrayLiteral("DELETE FROM downloadinfo WHERE path=?1"), _db);
     if (!deleteDownloadInfo) {
         return sqlFail(QStringLiteral("prepare _deleteDownloadInfoQuery"), *deleteDownloadInfo);
@@ -620,6 +907,18 @@ bool SyncJournalDb::checkConnect()
     // don't start a new transaction now
     commitInternal(QStringLiteral("checkConnect End"), false);
 
+    if (!migrateMetadataShards() || !openMetadataShards()) {
+        qCWarning(lcDb) << "Could not set up the metadata shards of" << _dbFile;
+        closeMetadataShards();
+        _db.close();
+        return false;
+    }
+
+    // The metadata may only be in the shards now
+    if (forceRemoteDiscovery) {
+        forceRemoteDiscoveryNextSyncLocked();
+    }
+
     // This avoid reading from the DB if we already know it is empty
     // thereby speeding up the initial discovery significantly.
     _metadataTableIsEmpty = (getFileRecordCount() == 0);
@@ -635,110 +934,441 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    // Otherwise a batch the writer already took would reopen the database
+    stopFileRecordWriter();
+
     QMutexLocker locker(&_mutex);
+    closeLocked();
+}
+
+void SyncJournalDb::closeLocked()
+{
     qCInfo(lcDb) << "Closing DB" << _dbFile;
 
+    writeQueuedFileRecords();
     commitTransaction();
 
+    closeMetadataShards();
     _db.close();
     clearEtagStorageFilter();
+    _checksymTypeCache.clear();
     _metadataTableIsEmpty = false;
 }
 
-
-bool SyncJournalDb::updateDatabaseStructure()
-{
-    if (!updateMetadataTableStructure())
-        return false;
-    if (!updateErrorBlacklistTableStructure())
-        return false;
-    return true;
-}
-
-bool SyncJournalDb::updateMetadataTableStructure()
+bool SyncJournalDb::migrateMetadataShards()
 {
+    closeMetadataShards();
 
-    auto columns = tableColumns("metadata");
-    bool re = true;
-
-    // check if the file_id column is there and create it if not
-    if (columns.isEmpty()) {
+    // Not keyValueStoreGetInt(), a failure must not look like unsharded metadata
+    SqlQuery query(_db);
+    query.prepare("SELECT value FROM key_value_store WHERE key=?1;");
+    query.bindValue(1, QByteArray(metadataShardsKey));
+    if (!query.exec()) {
         return false;
     }
+    const auto storedCount = query.next().hasData ? query.intValue(0) : 0;
+    if (storedCount == 0 && _metadataShardCount == 0) {
+        return true;
+    }
 
-    const auto addColumn = [this, &columns, &re] (const QString &columnName, const QString &dataType, const bool withIndex = false) {
-        const auto latin1ColumnName = columnName.toLatin1();
-        if (columns.indexOf(latin1ColumnName) == -1) {
-            SqlQuery query(_db);
-            const auto request = QStringLiteral("ALTER TABLE metadata ADD COLUMN %1 %2;").arg(columnName).arg(dataType);
-            query.prepare(request.toLatin1());
-            if (!query.exec()) {
-                sqlFail(QStringLiteral("updateMetadataTableStructure: add %1 column").arg(columnName), query);
-                re = false;
-            }
-
-            if (withIndex) {
-                query.prepare(QStringLiteral("CREATE INDEX metadata_%1 ON metadata(%1);").arg(columnName).toLatin1());
-                if (!query.exec()) {
-                    sqlFail(QStringLiteral("updateMetadataTableStructure: create index %1").arg(columnName), query);
-                    re = false;
-                }
-            }
-            commitInternal(QStringLiteral("update database structure: add %1 column").arg(columnName));
+    const auto exec = [&query](const QByteArray &sql) {
+        query.prepare(sql);
+        if (!query.exec()) {
+            qCWarning(lcDb) << "Moving the metadata failed:" << sql << query.error();
+            return false;
         }
+        return true;
     };
-
-    addColumn(QStringLiteral("fileid"), QStringLiteral("VARCHAR(128)"), true);
-    addColumn(QStringLiteral("remotePerm"), QStringLiteral("VARCHAR(128)"));
-    addColumn(QStringLiteral("filesize"), QStringLiteral("BIGINT"));
-
-    if (true) {
-        SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_inode ON metadata(inode);");
+    const auto storeCount = [&query](int count) {
+        query.prepare("INSERT OR REPLACE INTO key_value_store (key, value) VALUES (?1, ?2);");
+        query.bindValue(1, QByteArray(metadataShardsKey));
+        query.bindValue(2, count);
+        return query.exec();
+    };
+    const auto attach = [&query](const QString &fileName) {
+        query.prepare("ATTACH DATABASE ?1 AS shard;");
+        query.bindValue(1, fileName);
         if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index inode"), query);
-            re = false;
+            qCWarning(lcDb) << "Could not attach" << fileName << query.error();
+            return false;
         }
-        commitInternal(QStringLiteral("update database structure: add inode index"));
-    }
+        return true;
+    };
 
-    if (true) {
-        SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_path ON metadata(path);");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index path"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add path index"));
+    // The journal keeps the up to date, but empty, metadata table the shards copy
+    QVector<QPair<QByteArray, QByteArray>> columns;
+    query.prepare("PRAGMA main.table_info('metadata');");
+    if (!query.exec()) {
+        return false;
     }
+    while (query.next().hasData) {
+        columns.append({ query.baValue(1), query.baValue(2) });
+    }
+    QByteArrayList columnNames;
+    for (const auto &column : qAsConst(columns)) {
+        columnNames.append(column.first);
+    }
+    const auto columnList = columnNames.join(", ");
 
-    if (true) {
-        SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_parent ON metadata(parent_hash(path));");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index parent"), query);
-            re = false;
+    // Each shard is attached on its own, SQLite allows only a few at once.
+    // Until the number of shards is stored the records in the journal are
+    // the valid ones, so an interrupted move starts over.
+    if (storedCount != 0 && storedCount != _metadataShardCount) {
+        qCInfo(lcDb) << "Moving the metadata out of" << storedCount << "shards";
+        // Left over by an interrupted move, the shards are still the valid ones
+        if (!exec("DELETE FROM main.metadata;")) {
+            return false;
+        }
+        for (int i = 0; i < storedCount; ++i) {
+            if (!QFile::exists(metadataShardFileName(i))) {
+                qCWarning(lcDb) << "The metadata shard" << metadataShardFileName(i) << "is missing, its files are discovered again";
+                continue;
+            }
+            if (!attach(metadataShardFileName(i))) {
+                return false;
+            }
+            const bool moved = exec("INSERT OR REPLACE INTO main.metadata (" + columnList + ") SELECT " + columnList + " FROM shard.metadata;");
+            if (!exec("DETACH DATABASE shard;") || !moved) {
+                return false;
+            }
+        }
+        if (!storeCount(0)) {
+            return false;
+        }
+        for (int i = 0; i < storedCount; ++i) {
+            const auto fileName = metadataShardFileName(i);
+            for (const auto &suffix : { QString(), QStringLiteral("-wal"), QStringLiteral("-shm"), QStringLiteral("-journal") }) {
+                QFile::remove(fileName + suffix);
+            }
         }
-        commitInternal(QStringLiteral("update database structure: add parent index"));
     }
 
-    addColumn(QStringLiteral("ignoredChildrenRemote"), QStringLiteral("INT"));
-    addColumn(QStringLiteral("contentChecksum"), QStringLiteral("TEXT"));
-    addColumn(QStringLiteral("contentChecksumTypeId"), QStringLiteral("INTEGER"));
-    addColumn(QStringLiteral("e2eMangledName"), QStringLiteral("TEXT"));
-    addColumn(QStringLiteral("isE2eEncrypted"), QStringLiteral("INTEGER"));
+    if (_metadataShardCount == 0) {
+        return true;
+    }
 
-    auto uploadInfoColumns = tableColumns("uploadinfo");
-    if (uploadInfoColumns.isEmpty())
+    // "CREATE TABLE metadata(..." or "CREATE INDEX metadata_path ON metadata(..."
+    QByteArray createTable;
+    QVector<QPair<QByteArray, QByteArray>> createIndexes;
+    query.prepare("SELECT type, name, sql FROM main.sqlite_master WHERE tbl_name = 'metadata' AND sql IS NOT NULL;");
+    if (!query.exec()) {
         return false;
-    if (!uploadInfoColumns.contains("contentChecksum")) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE uploadinfo ADD COLUMN contentChecksum TEXT;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksum column"), query);
-            re = false;
+    }
+    while (query.next().hasData) {
+        if (query.baValue(0) == "table") {
+            createTable = query.baValue(2);
+        } else {
+            createIndexes.append({ query.baValue(1), query.baValue(2) });
         }
-        commitInternal(QStringLiteral("update database structure: add contentChecksum col for uploadinfo"));
+    }
+    const auto inShard = [](const QByteArray &sql, const QByteArray &name) -> QByteArray {
+        const auto at = sql.indexOf(name);
+        return sql.left(at) + "IF NOT EXISTS shard." + sql.mid(at);
+    };
+
+    const bool moveRecords = storedCount != _metadataShardCount;
+    if (moveRecords) {
+        qCInfo(lcDb) << "Moving the metadata into" << _metadataShardCount << "shards";
+    }
+    for (int i = 0; i < _metadataShardCount; ++i) {
+        if (!attach(metadataShardFileName(i))) {
+            return false;
+        }
+        const bool ok = [&] {
+            if (!exec(inShard(createTable, "metadata"))) {
+                return false;
+            }
+            // Columns added to the journal since the shard was created
+            QVector<QByteArray> shardColumns;
+            query.prepare("PRAGMA shard.table_info('metadata');");
+            if (!query.exec()) {
+                return false;
+            }
+            while (query.next().hasData) {
+                shardColumns.append(query.baValue(1));
+            }
+            for (const auto &column : qAsConst(columns)) {
+                if (!shardColumns.contains(column.first) && !exec("ALTER TABLE shard.metadata ADD COLUMN " + column.first + ' ' + column.second + ';')) {
+                    return false;
+                }
+            }
+            for (const auto &index : qAsConst(createIndexes)) {
+                if (!exec(inShard(index.second, index.first))) {
+                    return false;
+                }
+            }
+            // The records are read joined with the shard's copy of the checksum types,
+            // so its ids must be the journal's. The shard is committed on its own and
+            // may know a type the journal lost, the records of which are mapped to the
+            // id the journal has for that name.
+            if (!exec("CREATE TABLE IF NOT EXISTS shard.checksumtype(id INTEGER PRIMARY KEY, name TEXT UNIQUE);")
+                || !_db.transaction()) {
+                return false;
+            }
+            const bool checksumTypesSynced = exec("INSERT OR IGNORE INTO main.checksumtype (name) SELECT name FROM shard.checksumtype;")
+                && exec("UPDATE shard.metadata SET contentChecksumTypeId = ("
+                        "SELECT m.id FROM shard.checksumtype s JOIN main.checksumtype m ON m.name = s.name WHERE s.id = contentChecksumTypeId)"
+                        " WHERE contentChecksumTypeId IN ("
+                        "SELECT s.id FROM shard.checksumtype s JOIN main.checksumtype m ON m.name = s.name WHERE m.id != s.id);")
+                && exec("DELETE FROM shard.checksumtype;")
+                && exec("INSERT INTO shard.checksumtype SELECT id, name FROM main.checksumtype;");
+            if (!_db.commit() || !checksumTypesSynced) {
+                return false;
+            }
+            if (!moveRecords) {
+                return true;
+            }
+            if (!_db.transaction()) {
+                return false;
+            }
+            const bool moved = exec("DELETE FROM shard.metadata;")
+                && exec("INSERT INTO shard.metadata (" + columnList + ") SELECT " + columnList + " FROM main.metadata"
+                    " WHERE metadata_shard(path, " + QByteArray::number(_metadataShardCount) + ") = " + QByteArray::number(i) + ';');
+            return _db.commit() && moved;
+        }();
+        if (!exec("DETACH DATABASE shard;") || !ok) {
+            return false;
+        }
+    }
+
+    if (moveRecords) {
+        if (!_db.transaction()) {
+            return false;
+        }
+        const bool moved = exec("DELETE FROM main.metadata;") && storeCount(_metadataShardCount);
+        if (!_db.commit() || !moved) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SyncJournalDb::openMetadataShards()
+{
+    // With WAL journal the NORMAL sync mode is safe from corruption,
+    // otherwise use the standard FULL mode.
+    const QByteArray synchronousMode = QString::fromUtf8(_journalMode).compare(QStringLiteral("wal"), Qt::CaseInsensitive) == 0 ? "NORMAL" : "FULL";
+
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        if (!shard->db.openOrCreateReadWrite(shard->fileName)) {
+            qCWarning(lcDb) << "Error opening the metadata shard" << shard->fileName << shard->db.error();
+            return false;
+        }
+
+        const QByteArrayList pragmas = {
+            "PRAGMA locking_mode=" + sqliteLockingMode() + ";",
+            "PRAGMA journal_mode=" + _journalMode + ";",
+            "PRAGMA synchronous = " + synchronousMode + ";",
+            "PRAGMA case_sensitive_like = ON;",
+        };
+        SqlQuery pragma(shard->db);
+        for (const auto &sql : pragmas) {
+            pragma.prepare(sql);
+            if (!pragma.exec()) {
+                qCWarning(lcDb) << "Setting up the metadata shard" << shard->fileName << "failed:" << sql << pragma.error();
+                return false;
+            }
+        }
+        createParentHashFunction(shard->db.sqliteDb());
+
+        FileSystem::setFileHidden(shard->fileName, true);
+        FileSystem::setFileHidden(shard->fileName + QStringLiteral("-wal"), true);
+        FileSystem::setFileHidden(shard->fileName + QStringLiteral("-shm"), true);
+        FileSystem::setFileHidden(shard->fileName + QStringLiteral("-journal"), true);
+    }
+    _metadataShardsOpen = !_metadataShards.empty();
+    return true;
+}
+
+void SyncJournalDb::closeMetadataShards()
+{
+    _metadataShardsOpen = false;
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        shard->commitTransaction();
+        shard->db.close();
+    }
+}
+
+template <typename Query>
+bool SyncJournalDb::onMetadataOf(const QByteArray &path, MetadataAccess access, Query &&query)
+{
+    const auto shardOf = [this, &path]() -> MetadataShard & {
+        return *_metadataShards[metadataShardOf(path.constData(), path.size(), static_cast<int>(_metadataShards.size()))];
+    };
+
+    // Reading doesn't wait for writes to the journal or to the other shards
+    if (access == MetadataAccess::Read && _metadataShardsOpen && !_hasQueuedFileRecords) {
+        auto &shard = shardOf();
+        QMutexLocker shardLocker(&shard.mutex);
+        if (shard.db.isOpen()) {
+            return query(shard.db, shard.queryManager);
+        }
+    }
+
+    QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
+    if (!checkConnect()) {
+        return false;
+    }
+    if (_metadataShards.empty()) {
+        return query(_db, _queryManager);
+    }
+    if (!_metadataShardsOpen) {
+        return false;
+    }
+
+    auto &shard = shardOf();
+    QMutexLocker shardLocker(&shard.mutex);
+    if (access == MetadataAccess::Read) {
+        locker.unlock();
+    } else if (_transaction == 1) {
+        shard.joinTransaction();
+    }
+    return query(shard.db, shard.queryManager);
+}
+
+template <typename Query>
+bool SyncJournalDb::onAllMetadata(MetadataAccess access, Query &&query)
+{
+    QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
+    if (!checkConnect()) {
+        return false;
+    }
+    if (_metadataShards.empty()) {
+        return query(_db, _queryManager);
+    }
+    if (!_metadataShardsOpen) {
+        return false;
+    }
+
+    if (access == MetadataAccess::Read) {
+        locker.unlock();
+    }
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        if (!shard->db.isOpen()) {
+            return false;
+        }
+        if (access == MetadataAccess::Write && _transaction == 1) {
+            shard->joinTransaction();
+        }
+        if (!query(shard->db, shard->queryManager)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool SyncJournalDb::updateDatabaseStructure()
+{
+    if (!updateMetadataTableStructure())
+        return false;
+    if (!updateErrorBlacklistTableStructure())
+        return false;
+    return true;
+}
+
+bool SyncJournalDb::updateMetadataTableStructure()
+{
+
+    auto columns = tableColumns("metadata");
+    bool re = true;
+
+    // check if the file_id column is there and create it if not
+    if (columns.isEmpty()) {
+        return false;
+    }
+
+    const auto addColumn = [this, &columns, &re] (const QString &columnName, const QString &dataType, const bool withIndex = false) {
+        const auto latin1ColumnName = columnName.toLatin1();
+        if (columns.indexOf(latin1ColumnName) == -1) {
+            SqlQuery query(_db);
+            const auto request = QStringLiteral("ALTER TABLE metadata ADD COLUMN %1 %2;").arg(columnName).arg(dataType);
+            query.prepare(request.toLatin1());
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add %1 column").arg(columnName), query);
+                re = false;
+            }
+
+            if (withIndex) {
+                query.prepare(QStringLiteral("CREATE INDEX metadata_%1 ON metadata(%1);").arg(columnName).toLatin1());
+                if (!query.exec()) {
+                    sqlFail(QStringLiteral("updateMetadataTableStructure: create index %1").arg(columnName), query);
+                    re = false;
+                }
+            }
+            commitInternal(QStringLiteral("update database structure: add %1 column").arg(columnName));
+        }
+    };
+
+    addColumn(QStringLiteral("fileid"), QStringLiteral("VARCHAR(128)"), true);
+    addColumn(QStringLiteral("remotePerm"), QStringLiteral("VARCHAR(128)"));
+    addColumn(QStringLiteral("filesize"), QStringLiteral("BIGINT"));
+
+    if (true) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_inode ON metadata(inode);");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index inode"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add inode index"));
+    }
+
+    if (true) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_path ON metadata(path);");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index path"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add path index"));
+    }
+
+    if (true) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_parent ON metadata(parent_hash(path));");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index parent"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add parent index"));
+    }
+
+    addColumn(QStringLiteral("ignoredChildrenRemote"), QStringLiteral("INT"));
+    addColumn(QStringLiteral("contentChecksum"), QStringLiteral("TEXT"));
+    addColumn(QStringLiteral("contentChecksumTypeId"), QStringLiteral("INTEGER"));
+    addColumn(QStringLiteral("e2eMangledName"), QStringLiteral("TEXT"));
+    addColumn(QStringLiteral("isE2eEncrypted"), QStringLiteral("INTEGER"));
+
+    auto uploadInfoColumns = tableColumns("uploadinfo");
+    if (uploadInfoColumns.isEmpty())
+        return false;
+    if (!uploadInfoColumns.contains("contentChecksum")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE uploadinfo ADD COLUMN contentChecksum TEXT;");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksum column"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add contentChecksum col for uploadinfo"));
+    }
+
+    auto downloadInfoColumns = tableColumns("downloadinfo");
+    if (downloadInfoColumns.isEmpty())
+        return false;
+    if (!downloadInfoColumns.contains("segments")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN segments BLOB;");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: add segments column"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: add segments col for downloadinfo"));
     }
 
     auto conflictsColumns = tableColumns("conflicts");
@@ -863,91 +1493,220 @@ qint64 SyncJournalDb::getPHash(const QByteArray &file)
     return h;
 }
 
-Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
+namespace {
+    const char fileRecordColumns[] = "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, "
+                                     "contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted, lock, lockType, lockOwnerDisplayName, lockOwnerId, "
+                                     "lockOwnerEditor, lockTime, lockTimeout) ";
+    const int fileRecordColumnCount = 25;
+
+    // SQLite before 3.32 allows at most 999 parameters per statement
+    const int fileRecordsPerStatement = 32;
+
+    QByteArray multiRowSetFileRecordSql()
+    {
+        QByteArray sql = QByteArrayLiteral("INSERT OR REPLACE INTO metadata ") + fileRecordColumns + "VALUES ";
+        for (int row = 0; row < fileRecordsPerStatement; ++row) {
+            sql += row == 0 ? "(" : ", (";
+            for (int column = 1; column <= fileRecordColumnCount; ++column) {
+                if (column > 1)
+                    sql += ", ";
+                sql += '?' + QByteArray::number(row * fileRecordColumnCount + column);
+            }
+            sql += ')';
+        }
+        sql += ';';
+        return sql;
+    }
+
+    void bindFileRecord(SqlQuery &query, int offset, const SyncJournalFileRecord &record, int contentChecksumTypeId, const QByteArray &checksum)
+    {
+        QByteArray etag(record._etag);
+        if (etag.isEmpty()) {
+            etag = "";
+        }
+        QByteArray fileId(record._fileId);
+        if (fileId.isEmpty()) {
+            fileId = "";
+        }
+
+        query.bindValue(offset + 1, SyncJournalDb::getPHash(record._path));
+        query.bindValue(offset + 2, record._path.length());
+        query.bindValue(offset + 3, record._path);
+        query.bindValue(offset + 4, record._inode);
+        query.bindValue(offset + 5, 0); // uid Not used
+        query.bindValue(offset + 6, 0); // gid Not used
+        query.bindValue(offset + 7, 0); // mode Not used
+        query.bindValue(offset + 8, record._modtime);
+        query.bindValue(offset + 9, record._type);
+        query.bindValue(offset + 10, etag);
+        query.bindValue(offset + 11, fileId);
+        query.bindValue(offset + 12, record._remotePerm.toDbValue());
+        query.bindValue(offset + 13, record._fileSize);
+        query.bindValue(offset + 14, record._serverHasIgnoredFiles ? 1 : 0);
+        query.bindValue(offset + 15, checksum);
+        query.bindValue(offset + 16, contentChecksumTypeId);
+        query.bindValue(offset + 17, record._e2eMangledName);
+        query.bindValue(offset + 18, record._isE2eEncrypted);
+        query.bindValue(offset + 19, record._lockstate._locked ? 1 : 0);
+        query.bindValue(offset + 20, record._lockstate._lockOwnerType);
+        query.bindValue(offset + 21, record._lockstate._lockOwnerDisplayName);
+        query.bindValue(offset + 22, record._lockstate._lockOwnerId);
+        query.bindValue(offset + 23, record._lockstate._lockEditorApp);
+        query.bindValue(offset + 24, record._lockstate._lockTime);
+        query.bindValue(offset + 25, record._lockstate._lockTimeout);
+    }
+}
+
+Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &record)
+{
+    return setFileRecords({ record });
+}
+
+Result<void, QString> SyncJournalDb::setFileRecords(const QVector<SyncJournalFileRecord> &records)
 {
-    SyncJournalFileRecord record = _record;
     QMutexLocker locker(&_mutex);
-
-    if (!_etagStorageFilter.isEmpty()) {
-        // If we are a directory that should not be read from db next time, don't write the etag
-        QByteArray prefix = record._path + "/";
-        foreach (const QByteArray &it, _etagStorageFilter) {
-            if (it.startsWith(prefix)) {
-                qCInfo(lcDb) << "Filtered writing the etag of" << prefix << "because it is a prefix of" << it;
-                record._etag = "_invalid_";
-                break;
+    writeQueuedFileRecords();
+    const auto result = setFileRecordsLocked(records);
+    if (result) {
+        if (const auto snapshot = snapshotForCurrentThread()) {
+            for (auto record : records) {
+                applyEtagStorageFilter(record);
+                snapshot->set(record);
             }
         }
     }
+    return result;
+}
+
+void SyncJournalDb::applyEtagStorageFilter(SyncJournalFileRecord &record) const
+{
+    if (_etagStorageFilter.isEmpty() || record._etag == "_invalid_") {
+        return;
+    }
+    // If we are a directory that should not be read from db next time, don't write the etag
+    QByteArray prefix = record._path + "/";
+    foreach (const QByteArray &it, _etagStorageFilter) {
+        if (it.startsWith(prefix)) {
+            qCInfo(lcDb) << "Filtered writing the etag of" << prefix << "because it is a prefix of" << it;
+            record._etag = "_invalid_";
+            break;
+        }
+    }
+}
 
-    qCInfo(lcDb) << "Updating file record for path:" << record.path() << "inode:" << record._inode
-                 << "modtime:" << record._modtime << "type:" << record._type
-                 << "etag:" << record._etag << "fileId:" << record._fileId << "remotePerm:" << record._remotePerm.toString()
-                 << "fileSize:" << record._fileSize << "checksum:" << record._checksumHeader
-                 << "e2eMangledName:" << record.e2eMangledName() << "isE2eEncrypted:" << record._isE2eEncrypted
-                 << "lock:" << (record._lockstate._locked ? "true" : "false") << "lock owner type:" << record._lockstate._lockOwnerType
-                 << "lock owner:" << record._lockstate._lockOwnerDisplayName << "lock owner id:" << record._lockstate._lockOwnerId
-                 << "lock editor:" << record._lockstate._lockEditorApp;
+Result<void, QString> SyncJournalDb::setFileRecordsLocked(QVector<SyncJournalFileRecord> records)
+{
+    if (records.isEmpty()) {
+        return {};
+    }
+
+    for (auto &record : records) {
+        applyEtagStorageFilter(record);
+
+        qCInfo(lcDb) << "Updating file record for path:" << record.path() << "inode:" << record._inode
+                     << "modtime:" << record._modtime << "type:" << record._type
+                     << "etag:" << record._etag << "fileId:" << record._fileId << "remotePerm:" << record._remotePerm.toString()
+                     << "fileSize:" << record._fileSize << "checksum:" << record._checksumHeader
+                     << "e2eMangledName:" << record.e2eMangledName() << "isE2eEncrypted:" << record._isE2eEncrypted
+                     << "lock:" << (record._lockstate._locked ? "true" : "false") << "lock owner type:" << record._lockstate._lockOwnerType
+                     << "lock owner:" << record._lockstate._lockOwnerDisplayName << "lock owner id:" << record._lockstate._lockOwnerId
+                     << "lock editor:" << record._lockstate._lockEditorApp;
+    }
 
-    const qint64 phash = getPHash(record._path);
     if (!checkConnect()) {
         qCWarning(lcDb) << "Failed to connect database.";
         return tr("Failed to connect database."); // checkConnect failed.
     }
 
-    int plen = record._path.length();
-
-    QByteArray etag(record._etag);
-    if (etag.isEmpty()) {
-        etag = "";
-    }
-    QByteArray fileId(record._fileId);
-    if (fileId.isEmpty()) {
-        fileId = "";
-    }
-    QByteArray remotePerm = record._remotePerm.toDbValue();
-    QByteArray checksumType, checksum;
-    parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
-    int contentChecksumTypeId = mapChecksumType(checksumType);
+    // Checksum types are mapped before binding, mapChecksumType() may run its own queries
+    QVector<int> contentChecksumTypeIds;
+    QVector<QByteArray> checksums;
+    contentChecksumTypeIds.reserve(records.size());
+    checksums.reserve(records.size());
+    for (const auto &record : qAsConst(records)) {
+        QByteArray checksumType, checksum;
+        parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
+        contentChecksumTypeIds.append(mapChecksumType(checksumType));
+        checksums.append(checksum);
+    }
+
+    // Writes the records with the given indexes
+    const auto writeRecords = [&](SqlDatabase &db, PreparedSqlQueryManager &queries, const QVector<int> &rows) -> Result<void, QString> {
+        int index = 0;
+        while (rows.size() - index >= fileRecordsPerStatement) {
+            static const QByteArray sql = multiRowSetFileRecordSql();
+            const auto query = queries.get(PreparedSqlQueryManager::SetFileRecordsQuery, sql, db);
+            if (!query) {
+                return query->error();
+            }
+            for (int row = 0; row < fileRecordsPerStatement; ++row, ++index) {
+                const auto i = rows.at(index);
+                bindFileRecord(*query, row * fileRecordColumnCount, records.at(i), contentChecksumTypeIds.at(i), checksums.at(i));
+            }
+            if (!query->exec()) {
+                return query->error();
+            }
+        }
 
-    const auto query = _queryManager.get(PreparedSqlQueryManager::SetFileRecordQuery, QByteArrayLiteral("INSERT OR REPLACE INTO metadata "
-                                                                                                        "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, "
-                                                                                                        "contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted, lock, lockType, lockOwnerDisplayName, lockOwnerId, "
-                                                                                                        "lockOwnerEditor, lockTime, lockTimeout) "
-                                                                                                        "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25);"),
-        _db);
-    if (!query) {
-        return query->error();
-    }
-
-    query->bindValue(1, phash);
-    query->bindValue(2, plen);
-    query->bindValue(3, record._path);
-    query->bindValue(4, record._inode);
-    query->bindValue(5, 0); // uid Not used
-    query->bindValue(6, 0); // gid Not used
-    query->bindValue(7, 0); // mode Not used
-    query->bindValue(8, record._modtime);
-    query->bindValue(9, record._type);
-    query->bindValue(10, etag);
-    query->bindValue(11, fileId);
-    query->bindValue(12, remotePerm);
-    query->bindValue(13, record._fileSize);
-    query->bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
-    query->bindValue(15, checksum);
-    query->bindValue(16, contentChecksumTypeId);
-    query->bindValue(17, record._e2eMangledName);
-    query->bindValue(18, record._isE2eEncrypted);
-    query->bindValue(19, record._lockstate._locked ? 1 : 0);
-    query->bindValue(20, record._lockstate._lockOwnerType);
-    query->bindValue(21, record._lockstate._lockOwnerDisplayName);
-    query->bindValue(22, record._lockstate._lockOwnerId);
-    query->bindValue(23, record._lockstate._lockEditorApp);
-    query->bindValue(24, record._lockstate._lockTime);
-    query->bindValue(25, record._lockstate._lockTimeout);
+        for (; index < rows.size(); ++index) {
+            const auto query = queries.get(PreparedSqlQueryManager::SetFileRecordQuery, QByteArrayLiteral("INSERT OR REPLACE INTO metadata ") + fileRecordColumns
+                    + "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18, ?19, ?20, ?21, ?22, ?23, ?24, ?25);",
+                db);
+            if (!query) {
+                return query->error();
+            }
+            const auto i = rows.at(index);
+            bindFileRecord(*query, 0, records.at(i), contentChecksumTypeIds.at(i), checksums.at(i));
+            if (!query->exec()) {
+                return query->error();
+            }
+        }
+        return {};
+    };
 
-    if (!query->exec()) {
-        return query->error();
+    // All rows are written in one transaction, unless a sync already keeps one open
+    if (_metadataShards.empty()) {
+        QVector<int> rows(records.size());
+        std::iota(rows.begin(), rows.end(), 0);
+        const bool ownTransaction = _transaction == 0 && records.size() > 1;
+        if (ownTransaction) {
+            startTransaction();
+        }
+        const auto result = writeRecords(_db, _queryManager, rows);
+        if (ownTransaction) {
+            commitTransaction();
+        }
+        if (!result) {
+            return result;
+        }
+    } else {
+        if (!_metadataShardsOpen) {
+            return tr("Failed to connect database.");
+        }
+        QVector<QVector<int>> rowsOfShards(static_cast<int>(_metadataShards.size()));
+        for (int i = 0; i < records.size(); ++i) {
+            const auto &path = records.at(i)._path;
+            rowsOfShards[metadataShardOf(path.constData(), path.size(), rowsOfShards.size())].append(i);
+        }
+        for (int i = 0; i < rowsOfShards.size(); ++i) {
+            const auto &rows = rowsOfShards.at(i);
+            if (rows.isEmpty()) {
+                continue;
+            }
+            auto &shard = *_metadataShards[i];
+            QMutexLocker shardLocker(&shard.mutex);
+            const bool ownTransaction = _transaction == 0 && rows.size() > 1 && shard.db.transaction();
+            if (_transaction == 1) {
+                shard.joinTransaction();
+            }
+            const auto result = writeRecords(shard.db, shard.queryManager, rows);
+            if (ownTransaction && !shard.db.commit()) {
+                qCWarning(lcDb) << "ERROR committing to the database:" << shard.fileName << shard.db.error();
+            }
+            if (!result) {
+                return result;
+            }
+        }
     }
 
     // Can't be true anymore.
@@ -956,6 +1715,173 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
     return {};
 }
 
+void SyncJournalDb::queueFileRecord(const SyncJournalFileRecord &record)
+{
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        // Reading _etagStorageFilter without the lock is fine, only this thread changes it
+        auto stored = record;
+        applyEtagStorageFilter(stored);
+        snapshot->set(stored);
+    }
+
+    QMutexLocker locker(&_queueMutex);
+    if (!_writerThread) {
+        _stopWriter = false;
+        _writerThread = QThread::create([this] { fileRecordWriterLoop(); });
+        _writerThread->setObjectName(QStringLiteral("JournalWriter"));
+        _writerThread->start();
+    }
+    _queuedFileRecords.append(record);
+    _hasQueuedFileRecords = true;
+    _queueCondition.wakeOne();
+}
+
+Result<void, QString> SyncJournalDb::flushQueuedFileRecords()
+{
+    QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
+    const auto error = std::exchange(_queuedWriteError, QString());
+    if (!error.isEmpty()) {
+        return error;
+    }
+    return {};
+}
+
+bool SyncJournalDb::loadFileRecordSnapshot()
+{
+    discardFileRecordSnapshot();
+
+    QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
+    if (!checkConnect()) {
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    FileRecordSnapshot::Records records;
+    const auto loaded = onAllMetadata(MetadataAccess::Read, [this, &records](SqlDatabase &db, PreparedSqlQueryManager &) {
+        if (_metadataTableIsEmpty) {
+            return true;
+        }
+        SqlQuery query(db);
+        if (query.prepare(GET_FILE_RECORD_QUERY) != 0 || !query.exec()) {
+            return false;
+        }
+        forever {
+            auto next = query.next();
+            if (!next.ok)
+                return false;
+            if (!next.hasData)
+                break;
+            records.emplace_back();
+            fillFileRecordFromGetQuery(records.back(), query);
+        }
+        return true;
+    });
+    if (!loaded) {
+        return false;
+    }
+
+    _snapshot = std::make_unique<FileRecordSnapshot>(std::move(records));
+    _snapshotThread = QThread::currentThread();
+    qCInfo(lcDb) << "Loaded a snapshot of" << _snapshot->size() << "file records in" << timer.elapsed() << "ms";
+    return true;
+}
+
+void SyncJournalDb::discardFileRecordSnapshot()
+{
+    if (!snapshotForCurrentThread()) {
+        return;
+    }
+    _snapshotThread = nullptr;
+    _snapshot.reset();
+}
+
+SyncJournalDb::FileRecordSnapshot *SyncJournalDb::snapshotForCurrentThread() const
+{
+    if (_snapshotThread != QThread::currentThread()) {
+        return nullptr;
+    }
+    return _snapshot.get();
+}
+
+void SyncJournalDb::invalidateFileRecordSnapshot()
+{
+    if (snapshotForCurrentThread()) {
+        qCInfo(lcDb) << "Discarding the file record snapshot, the metadata table was changed in bulk";
+        discardFileRecordSnapshot();
+    } else if (_snapshotThread != nullptr) {
+        qCWarning(lcDb) << "The metadata table was changed from another thread while a snapshot is in use";
+    }
+}
+
+void SyncJournalDb::writeQueuedFileRecords()
+{
+    if (!_hasQueuedFileRecords) {
+        return;
+    }
+
+    QVector<SyncJournalFileRecord> records;
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        records.swap(_queuedFileRecords);
+        _hasQueuedFileRecords = false;
+    }
+
+    const auto result = setFileRecordsLocked(records);
+    if (!result && _queuedWriteError.isEmpty()) {
+        qCWarning(lcDb) << "Writing queued file records failed:" << result.error();
+        _queuedWriteError = result.error();
+    }
+}
+
+void SyncJournalDb::fileRecordWriterLoop()
+{
+    // Waiting a bit after the first record makes the batches larger
+    const int batchDelayMsec = 200;
+    const int maximumBatchSize = 1000;
+
+    while (true) {
+        {
+            QMutexLocker queueLocker(&_queueMutex);
+            while (_queuedFileRecords.isEmpty() && !_stopWriter) {
+                _queueCondition.wait(&_queueMutex);
+            }
+            if (_stopWriter) {
+                return;
+            }
+            QDeadlineTimer deadline(batchDelayMsec);
+            while (_queuedFileRecords.size() < maximumBatchSize && !_stopWriter && _queueCondition.wait(&_queueMutex, deadline)) {
+            }
+        }
+
+        // Outside of a transaction the batch is committed by setFileRecordsLocked()
+        // here, so that the other threads don't wait for the fsync. The transaction
+        // of a sync is only committed by its owner.
+        QMutexLocker locker(&_mutex);
+        if (!_hasQueuedFileRecords) {
+            continue; // somebody else was faster
+        }
+        writeQueuedFileRecords();
+    }
+}
+
+void SyncJournalDb::stopFileRecordWriter()
+{
+    QThread *thread = nullptr;
+    {
+        QMutexLocker queueLocker(&_queueMutex);
+        _stopWriter = true;
+        _queueCondition.wakeAll();
+        thread = std::exchange(_writerThread, nullptr);
+    }
+    if (thread) {
+        thread->wait();
+        delete thread;
+    }
+}
+
 void SyncJournalDb::keyValueStoreSet(const QString &key, QVariant value)
 {
     QMutexLocker locker(&_mutex);
@@ -1013,19 +1939,18 @@ void SyncJournalDb::keyValueStoreDelete(const QString &key)
 // TODO: filename -> QBytearray?
 bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 {
-    QMutexLocker locker(&_mutex);
-
-    if (checkConnect()) {
+    const auto path = filename.toUtf8();
+    const auto deleted = onMetadataOf(path, MetadataAccess::Write, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
         // if (!recursively) {
         // always delete the actual file.
 
         {
-            const auto query = _queryManager.get(PreparedSqlQueryManager::DeleteFileRecordPhash, QByteArrayLiteral("DELETE FROM metadata WHERE phash=?1"), _db);
+            const auto query = queries.get(PreparedSqlQueryManager::DeleteFileRecordPhash, QByteArrayLiteral("DELETE FROM metadata WHERE phash=?1"), db);
             if (!query) {
                 return false;
             }
 
-            const qint64 phash = getPHash(filename.toUtf8());
+            const qint64 phash = getPHash(path);
             query->bindValue(1, phash);
 
             if (!query->exec()) {
@@ -1034,7 +1959,7 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
         }
 
         if (recursively) {
-            const auto query = _queryManager.get(PreparedSqlQueryManager::DeleteFileRecordRecursively, QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")), _db);
+            const auto query = queries.get(PreparedSqlQueryManager::DeleteFileRecordRecursively, QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")), db);
             if (!query)
                 return false;
             query->bindValue(1, filename);
@@ -1043,30 +1968,39 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
             }
         }
         return true;
-    } else {
-        qCWarning(lcDb) << "Failed to connect database.";
-        return false; // checkConnect failed.
+    });
+    if (!deleted) {
+        return false;
     }
+
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        snapshot->remove(path, recursively);
+    }
+    return true;
 }
 
 
 bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
-
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
     rec->_path.clear();
     Q_ASSERT(!rec->isValid());
 
-    if (_metadataTableIsEmpty)
-        return true; // no error, yet nothing found (rec->isValid() == false)
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        if (const auto found = snapshot->find(filename)) {
+            *rec = *found;
+        }
+        return true;
+    }
 
-    if (!checkConnect())
-        return false;
+    // The shard's lock must not be held while closing
+    bool failed = false;
+    const auto found = onMetadataOf(filename, MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty || filename.isEmpty())
+            return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!filename.isEmpty()) {
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetFileRecordQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _db);
+        const auto query = queries.get(PreparedSqlQueryManager::GetFileRecordQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), db);
         if (!query) {
             return false;
         }
@@ -1074,7 +2008,7 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
         query->bindValue(1, getPHash(filename));
 
         if (!query->exec()) {
-            close();
+            failed = true;
             return false;
         }
 
@@ -1082,35 +2016,35 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
         if (!next.ok) {
             QString err = query->error();
             qCWarning(lcDb) << "No journal entry found for" << filename << "Error:" << err;
-            close();
+            failed = true;
             return false;
         }
         if (next.hasData) {
             fillFileRecordFromGetQuery(*rec, *query);
         }
+        return true;
+    });
+    if (failed) {
+        closeLocked();
     }
-    return true;
+    return found;
 }
 
 bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
-
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
     rec->_path.clear();
     Q_ASSERT(!rec->isValid());
 
-    if (_metadataTableIsEmpty) {
-        return true; // no error, yet nothing found (rec->isValid() == false)
-    }
-
-    if (!checkConnect()) {
-        return false;
-    }
+    // The shards' locks must not be held while closing
+    bool failed = false;
+    const auto searched = onAllMetadata(MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty || mangledName.isEmpty() || rec->isValid()) {
+            return true; // no error, yet nothing found (rec->isValid() == false)
+        }
 
-    if (!mangledName.isEmpty()) {
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetFileRecordQueryByMangledName, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"), _db);
+        const auto query = queries.get(PreparedSqlQueryManager::GetFileRecordQueryByMangledName, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"), db);
         if (!query) {
             return false;
         }
@@ -1118,7 +2052,7 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
         query->bindValue(1, mangledName);
 
         if (!query->exec()) {
-            close();
+            failed = true;
             return false;
         }
 
@@ -1126,98 +2060,113 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
         if (!next.ok) {
             QString err = query->error();
             qCWarning(lcDb) << "No journal entry found for mangled name" << mangledName << "Error: " << err;
-            close();
+            failed = true;
             return false;
         }
         if (next.hasData) {
             fillFileRecordFromGetQuery(*rec, *query);
         }
+        return true;
+    });
+    if (failed) {
+        closeLocked();
     }
-    return true;
+    return searched;
 }
 
 bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
-
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
     rec->_path.clear();
     Q_ASSERT(!rec->isValid());
 
-    if (!inode || _metadataTableIsEmpty)
+    if (!inode)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!checkConnect())
-        return false;
-    const auto query = _queryManager.get(PreparedSqlQueryManager::GetFileRecordQueryByInode, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), _db);
-    if (!query)
-        return false;
+    return onAllMetadata(MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty || rec->isValid())
+            return true;
 
-    query->bindValue(1, inode);
+        const auto query = queries.get(PreparedSqlQueryManager::GetFileRecordQueryByInode, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), db);
+        if (!query)
+            return false;
 
-    if (!query->exec())
-        return false;
+        query->bindValue(1, inode);
 
-    auto next = query->next();
-    if (!next.ok)
-        return false;
-    if (next.hasData)
-        fillFileRecordFromGetQuery(*rec, *query);
+        if (!query->exec())
+            return false;
 
-    return true;
+        auto next = query->next();
+        if (!next.ok)
+            return false;
+        if (next.hasData)
+            fillFileRecordFromGetQuery(*rec, *query);
+
+        return true;
+    });
 }
 
 bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
-
-    if (fileId.isEmpty() || _metadataTableIsEmpty)
+    if (fileId.isEmpty())
         return true; // no error, yet nothing found (rec->isValid() == false)
 
-    if (!checkConnect())
-        return false;
-
-    const auto query = _queryManager.get(PreparedSqlQueryManager::GetFileRecordQueryByFileId, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), _db);
-    if (!query) {
-        return false;
-    }
+    // The callback may use the journal again, which the lock of a shard doesn't allow
+    const bool collect = !_metadataShards.empty();
+    std::vector<SyncJournalFileRecord> found;
+    const auto searched = onAllMetadata(MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty)
+            return true;
 
-    query->bindValue(1, fileId);
+        const auto query = queries.get(PreparedSqlQueryManager::GetFileRecordQueryByFileId, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), db);
+        if (!query) {
+            return false;
+        }
 
-    if (!query->exec())
-        return false;
+        query->bindValue(1, fileId);
 
-    forever {
-        auto next = query->next();
-        if (!next.ok)
+        if (!query->exec())
             return false;
-        if (!next.hasData)
-            break;
 
-        SyncJournalFileRecord rec;
-        fillFileRecordFromGetQuery(rec, *query);
+        forever {
+            auto next = query->next();
+            if (!next.ok)
+                return false;
+            if (!next.hasData)
+                break;
+
+            SyncJournalFileRecord rec;
+            fillFileRecordFromGetQuery(rec, *query);
+            if (collect) {
+                found.push_back(std::move(rec));
+            } else {
+                rowCallback(rec);
+            }
+        }
+        return true;
+    });
+
+    for (const auto &rec : found) {
         rowCallback(rec);
     }
-
-    return true;
+    return searched;
 }
 
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
-
-    if (_metadataTableIsEmpty)
-        return true; // no error, yet nothing found
-
-    if (!checkConnect())
-        return false;
+    // The callback may use the journal again, which the lock of a shard doesn't
+    // allow, so with shards the records are collected first. The mangled names
+    // of encrypted files may be in any shard, so all of them are searched.
+    const bool collect = !_metadataShards.empty();
+    std::vector<SyncJournalFileRecord> found;
 
-    auto _exec = [&rowCallback](SqlQuery &query) {
+    auto _exec = [&](SqlQuery &query) {
         if (!query.exec()) {
             return false;
         }
 
+        const auto shardBegin = found.size();
         forever {
             auto next = query.next();
             if (!next.ok)
@@ -1227,26 +2176,35 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
 
             SyncJournalFileRecord rec;
             fillFileRecordFromGetQuery(rec, query);
-            rowCallback(rec);
+            if (collect) {
+                found.push_back(std::move(rec));
+            } else {
+                rowCallback(rec);
+            }
         }
+        mergeShardRecords(found, shardBegin);
         return true;
     };
 
-    if(path.isEmpty()) {
-        // Since the path column doesn't store the starting /, the getFilesBelowPathQuery
-        // can't be used for the root path "". It would scan for (path > '/' and path < '0')
-        // and find nothing. So, unfortunately, we have to use a different query for
-        // retrieving the whole tree.
+    const auto listed = onAllMetadata(MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty)
+            return true; // no error, yet nothing found
 
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetAllFilesQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), _db);
-        if (!query) {
-            return false;
-        }
-        return _exec(*query);
-    } else {
-        // This query is used to skip discovery and fill the tree from the
-        // database instead
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetFilesBelowPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE " IS_PREFIX_PATH_OF("?1", "path")
+        if(path.isEmpty()) {
+            // Since the path column doesn't store the starting /, the getFilesBelowPathQuery
+            // can't be used for the root path "". It would scan for (path > '/' and path < '0')
+            // and find nothing. So, unfortunately, we have to use a different query for
+            // retrieving the whole tree.
+
+            const auto query = queries.get(PreparedSqlQueryManager::GetAllFilesQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), db);
+            if (!query) {
+                return false;
+            }
+            return _exec(*query);
+        } else {
+            // This query is used to skip discovery and fill the tree from the
+            // database instead
+            const auto query = queries.get(PreparedSqlQueryManager::GetFilesBelowPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE " IS_PREFIX_PATH_OF("?1", "path")
                                                                                                                 " OR " IS_PREFIX_PATH_OF("?1", "e2eMangledName")
                                                                                                                 // We want to ensure that the contents of a directory are sorted
                                                                                                                 // directly behind the directory itself. Without this ORDER BY
@@ -1254,71 +2212,111 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
                                                                                                                 // With the trailing /, we get foo-2, foo, foo/file. This property
                                                                                                                 // is used in fill_tree_from_db().
                                                                                                                 " ORDER BY path||'/' ASC"),
-            _db);
-        if (!query) {
-            return false;
+                db);
+            if (!query) {
+                return false;
+            }
+            query->bindValue(1, path);
+            return _exec(*query);
         }
-        query->bindValue(1, path);
-        return _exec(*query);
+    });
+
+    for (const auto &rec : found) {
+        rowCallback(rec);
     }
+    return listed;
 }
 
 bool SyncJournalDb::listFilesInPath(const QByteArray& path,
                                     const std::function<void (const SyncJournalFileRecord &)>& rowCallback)
 {
-    QMutexLocker locker(&_mutex);
-
-    if (_metadataTableIsEmpty)
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        snapshot->listFilesInPath(path, rowCallback);
         return true;
-
-    if (!checkConnect())
-        return false;
-
-    const auto query = _queryManager.get(PreparedSqlQueryManager::ListFilesInPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE parent_hash(path) = ?1 ORDER BY path||'/' ASC"), _db);
-    if (!query) {
-        return false;
     }
-    query->bindValue(1, getPHash(path));
 
-    if (!query->exec())
-        return false;
+    // The callback may use the journal again, which the lock of a shard doesn't allow
+    const bool collect = !_metadataShards.empty();
+    std::vector<SyncJournalFileRecord> found;
+    const auto list = [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        if (_metadataTableIsEmpty)
+            return true;
 
-    forever {
-        auto next = query->next();
-        if (!next.ok)
+        const auto query = queries.get(PreparedSqlQueryManager::ListFilesInPathQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE parent_hash(path) = ?1 ORDER BY path||'/' ASC"), db);
+        if (!query) {
             return false;
-        if (!next.hasData)
-            break;
+        }
+        query->bindValue(1, getPHash(path));
 
-        SyncJournalFileRecord rec;
-        fillFileRecordFromGetQuery(rec, *query);
-        if (!rec._path.startsWith(path) || rec._path.indexOf("/", path.size() + 1) > 0) {
-            qWarning(lcDb) << "hash collision" << path << rec.path();
-            continue;
+        if (!query->exec())
+            return false;
+
+        const auto shardBegin = found.size();
+        forever {
+            auto next = query->next();
+            if (!next.ok)
+                return false;
+            if (!next.hasData)
+                break;
+
+            SyncJournalFileRecord rec;
+            fillFileRecordFromGetQuery(rec, *query);
+            if (!rec._path.startsWith(path) || rec._path.indexOf("/", path.size() + 1) > 0) {
+                qWarning(lcDb) << "hash collision" << path << rec.path();
+                continue;
+            }
+            if (collect) {
+                found.push_back(std::move(rec));
+            } else {
+                rowCallback(rec);
+            }
         }
+        mergeShardRecords(found, shardBegin);
+        return true;
+    };
+
+    // The top level items are spread over all shards
+    const auto listed = path.isEmpty() ? onAllMetadata(MetadataAccess::Read, list) : onMetadataOf(path, MetadataAccess::Read, list);
+    for (const auto &rec : found) {
         rowCallback(rec);
     }
-
-    return true;
+    return listed;
 }
 
 int SyncJournalDb::getFileRecordCount()
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
 
-    SqlQuery query(_db);
-    query.prepare("SELECT COUNT(*) FROM metadata");
+    const auto countRecords = [](SqlDatabase &db) {
+        SqlQuery query(db);
+        query.prepare("SELECT COUNT(*) FROM metadata");
+
+        if (!query.exec()) {
+            return -1;
+        }
+
+        if (query.next().hasData) {
+            int count = query.intValue(0);
+            return count;
+        }
 
-    if (!query.exec()) {
         return -1;
-    }
+    };
 
-    if (query.next().hasData) {
-        int count = query.intValue(0);
-        return count;
+    if (_metadataShards.empty()) {
+        return countRecords(_db);
     }
-
-    return -1;
+    int count = 0;
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        const auto shardCount = shard->db.isOpen() ? countRecords(shard->db) : -1;
+        if (shardCount < 0) {
+            return -1;
+        }
+        count += shardCount;
+    }
+    return count;
 }
 
 bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
@@ -1326,6 +2324,7 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     const QByteArray &contentChecksumType)
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
 
     qCInfo(lcDb) << "Updating file checksum" << filename << contentChecksum << contentChecksumType;
 
@@ -1337,17 +2336,29 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
 
     int checksumTypeId = mapChecksumType(contentChecksumType);
 
-    const auto query = _queryManager.get(PreparedSqlQueryManager::SetFileRecordChecksumQuery, QByteArrayLiteral("UPDATE metadata"
-                                                                                                                " SET contentChecksum = ?2, contentChecksumTypeId = ?3"
-                                                                                                                " WHERE phash == ?1;"),
-        _db);
-    if (!query) {
+    const auto updated = onMetadataOf(filename.toUtf8(), MetadataAccess::Write, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        const auto query = queries.get(PreparedSqlQueryManager::SetFileRecordChecksumQuery, QByteArrayLiteral("UPDATE metadata"
+                                                                                                              " SET contentChecksum = ?2, contentChecksumTypeId = ?3"
+                                                                                                              " WHERE phash == ?1;"),
+            db);
+        if (!query) {
+            return false;
+        }
+        query->bindValue(1, phash);
+        query->bindValue(2, contentChecksum);
+        query->bindValue(3, checksumTypeId);
+        return query->exec();
+    });
+    if (!updated) {
         return false;
     }
-    query->bindValue(1, phash);
-    query->bindValue(2, contentChecksum);
-    query->bindValue(3, checksumTypeId);
-    return query->exec();
+
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        if (const auto record = snapshot->find(filename.toUtf8())) {
+            record->_checksumHeader = contentChecksumType.isEmpty() ? QByteArray() : contentChecksumType + ':' + contentChecksum;
+        }
+    }
+    return true;
 }
 
 bool SyncJournalDb::updateLocalMetadata(const QString &filename,
@@ -1355,6 +2366,7 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
 
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
 
     qCInfo(lcDb) << "Updating local metadata for:" << filename << modtime << size << inode;
 
@@ -1364,52 +2376,69 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
         return false;
     }
 
-    const auto query = _queryManager.get(PreparedSqlQueryManager::SetFileRecordLocalMetadataQuery, QByteArrayLiteral("UPDATE metadata"
-                                                                                                                     " SET inode=?2, modtime=?3, filesize=?4"
-                                                                                                                     " WHERE phash == ?1;"),
-        _db);
-    if (!query) {
+    const auto updated = onMetadataOf(filename.toUtf8(), MetadataAccess::Write, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        const auto query = queries.get(PreparedSqlQueryManager::SetFileRecordLocalMetadataQuery, QByteArrayLiteral("UPDATE metadata"
+                                                                                                                   " SET inode=?2, modtime=?3, filesize=?4"
+                                                                                                                   " WHERE phash == ?1;"),
+            db);
+        if (!query) {
+            return false;
+        }
+
+        query->bindValue(1, phash);
+        query->bindValue(2, inode);
+        query->bindValue(3, modtime);
+        query->bindValue(4, size);
+        return query->exec();
+    });
+    if (!updated) {
         return false;
     }
 
-    query->bindValue(1, phash);
-    query->bindValue(2, inode);
-    query->bindValue(3, modtime);
-    query->bindValue(4, size);
-    return query->exec();
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        if (const auto record = snapshot->find(filename.toUtf8())) {
+            record->_inode = inode;
+            record->_modtime = modtime;
+            record->_fileSize = size;
+        }
+    }
+    return true;
 }
 
 Optional<SyncJournalDb::HasHydratedDehydrated> SyncJournalDb::hasHydratedOrDehydratedFiles(const QByteArray &filename)
 {
-    QMutexLocker locker(&_mutex);
-    if (!checkConnect())
-        return {};
+    HasHydratedDehydrated result;
+    const auto countTypes = [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+        const auto query = queries.get(PreparedSqlQueryManager::CountDehydratedFilesQuery, QByteArrayLiteral("SELECT DISTINCT type FROM metadata"
+                                                                                                             " WHERE (" IS_PREFIX_PATH_OR_EQUAL("?1", "path") " OR ?1 == '');"),
+            db);
+        if (!query) {
+            return false;
+        }
 
-    const auto query = _queryManager.get(PreparedSqlQueryManager::CountDehydratedFilesQuery, QByteArrayLiteral("SELECT DISTINCT type FROM metadata"
-                                                                                                               " WHERE (" IS_PREFIX_PATH_OR_EQUAL("?1", "path") " OR ?1 == '');"),
-        _db);
-    if (!query) {
-        return {};
-    }
+        query->bindValue(1, filename);
+        if (!query->exec())
+            return false;
 
-    query->bindValue(1, filename);
-    if (!query->exec())
-        return {};
+        forever {
+            auto next = query->next();
+            if (!next.ok)
+                return false;
+            if (!next.hasData)
+                break;
+            auto type = static_cast<ItemType>(query->intValue(0));
+            if (type == ItemTypeFile || type == ItemTypeVirtualFileDehydration)
+                result.hasHydrated = true;
+            if (type == ItemTypeVirtualFile || type == ItemTypeVirtualFileDownload)
+                result.hasDehydrated = true;
+        }
+        return true;
+    };
 
-    HasHydratedDehydrated result;
-    forever {
-        auto next = query->next();
-        if (!next.ok)
-            return {};
-        if (!next.hasData)
-            break;
-        auto type = static_cast<ItemType>(query->intValue(0));
-        if (type == ItemTypeFile || type == ItemTypeVirtualFileDehydration)
-            result.hasHydrated = true;
-        if (type == ItemTypeVirtualFile || type == ItemTypeVirtualFileDownload)
-            result.hasDehydrated = true;
+    const auto counted = filename.isEmpty() ? onAllMetadata(MetadataAccess::Read, countTypes) : onMetadataOf(filename, MetadataAccess::Read, countTypes);
+    if (!counted) {
+        return {};
     }
-
     return result;
 }
 
@@ -1420,6 +2449,20 @@ static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo *res)
     res->_etag = query.baValue(1);
     res->_errorCount = query.intValue(2);
     res->_valid = ok;
+
+    // The segments are stored as a sequence of (start, end, downloaded) triples
+    const auto segments = query.baValue(3);
+    QDataStream stream(segments);
+    while (!stream.atEnd()) {
+        SyncJournalDb::DownloadInfo::Segment segment;
+        stream >> segment.start >> segment.end >> segment.downloaded;
+        if (stream.status() != QDataStream::Ok) {
+            qCWarning(lcDb) << "Invalid download segments, starting over";
+            res->_segments.clear();
+            break;
+        }
+        res->_segments.append(segment);
+    }
 }
 
 static bool deleteBatch(SqlQuery &query, const QStringList &entries, const QString &name)
@@ -1447,7 +2490,7 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
     DownloadInfo res;
 
     if (checkConnect()) {
-        const auto query = _queryManager.get(PreparedSqlQueryManager::GetDownloadInfoQuery, QByteArrayLiteral("SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE path=?1"), _db);
+        const auto query = _queryManager.get(PreparedSqlQueryManager::GetDownloadInfoQuery, QByteArrayLiteral("SELECT tmpfile, etag, errorcount, segments FROM downloadinfo WHERE path=?1"), _db);
         if (!query) {
             return res;
         }
@@ -1476,16 +2519,22 @@ void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::Do
 
     if (i._valid) {
         const auto query = _queryManager.get(PreparedSqlQueryManager::SetDownloadInfoQuery, QByteArrayLiteral("INSERT OR REPLACE INTO downloadinfo "
-                                                                                                              "(path, tmpfile, etag, errorcount) "
-                                                                                                              "VALUES ( ?1 , ?2, ?3, ?4 )"),
+                                                                                                              "(path, tmpfile, etag, errorcount, segments) "
+                                                                                                              "VALUES ( ?1 , ?2, ?3, ?4, ?5 )"),
             _db);
         if (!query) {
             return;
         }
+        QByteArray segments;
+        QDataStream stream(&segments, QIODevice::WriteOnly);
+        for (const auto &segment : i._segments) {
+            stream << segment.start << segment.end << segment.downloaded;
+        }
         query->bindValue(1, file);
         query->bindValue(2, i._tmpfile);
         query->bindValue(3, i._etag);
         query->bindValue(4, i._errorCount);
+        query->bindValue(5, segments);
         query->exec();
     } else {
         const auto query = _queryManager.get(PreparedSqlQueryManager::DeleteDownloadInfoQuery);
@@ -1505,7 +2554,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount, segments, path FROM downloadinfo");
 
     if (!query.exec()) {
         return empty_result;
@@ -1515,7 +2564,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
 
     while (query.next().hasData) {
-        const QString file = query.stringValue(3); // path
+        const QString file = query.stringValue(4); // path
         if (!keep.contains(file)) {
             superfluousPaths.append(file);
             DownloadInfo info;
@@ -1654,6 +2703,135 @@ QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
     return ids;
 }
 
+SyncJournalDb::ChunkIndex SyncJournalDb::getChunkIndex(const QString &file)
+{
+    QMutexLocker locker(&_mutex);
+
+    ChunkIndex res;
+
+    if (checkConnect()) {
+        const auto query = _queryManager.get(PreparedSqlQueryManager::GetChunkIndexQuery, QByteArrayLiteral("SELECT etag, averagechunksize, chunks FROM chunkindex WHERE path=?1"), _db);
+        if (!query) {
+            return res;
+        }
+        query->bindValue(1, file);
+
+        if (!query->exec()) {
+            return res;
+        }
+
+        if (query->next().hasData) {
+            res._etag = query->baValue(0);
+            res._averageChunkSize = query->int64Value(1);
+
+            // The chunks are stored as a sequence of (size, hash) pairs, the offsets follow from the sizes
+            QDataStream stream(query->baValue(2));
+            qint64 offset = 0;
+            while (!stream.atEnd()) {
+                ChunkIndex::Chunk chunk;
+                stream >> chunk.size >> chunk.hash;
+                if (stream.status() != QDataStream::Ok || chunk.size <= 0) {
+                    qCWarning(lcDb) << "Invalid chunk index for" << file;
+                    return ChunkIndex();
+                }
+                chunk.offset = offset;
+                offset += chunk.size;
+                res._chunks.append(chunk);
+            }
+            res._valid = true;
+        }
+    }
+    return res;
+}
+
+void SyncJournalDb::setChunkIndex(const QString &file, const ChunkIndex &index)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!checkConnect()) {
+        return;
+    }
+
+    if (index._valid) {
+        const auto query = _queryManager.get(PreparedSqlQueryManager::SetChunkIndexQuery, QByteArrayLiteral("INSERT OR REPLACE INTO chunkindex "
+                                                                                                            "(path, etag, averagechunksize, chunks) "
+                                                                                                            "VALUES ( ?1 , ?2, ?3 , ?4 )"),
+            _db);
+        if (!query) {
+            return;
+        }
+
+        QByteArray chunks;
+        QDataStream stream(&chunks, QIODevice::WriteOnly);
+        for (const auto &chunk : index._chunks) {
+            stream << chunk.size << chunk.hash;
+        }
+
+        query->bindValue(1, file);
+        query->bindValue(2, index._etag);
+        query->bindValue(3, index._averageChunkSize);
+        query->bindValue(4, chunks);
+        query->exec();
+    } else {
+        const auto query = _queryManager.get(PreparedSqlQueryManager::DeleteChunkIndexQuery, QByteArrayLiteral("DELETE FROM chunkindex WHERE path=?1"), _db);
+        if (!query) {
+            return;
+        }
+        query->bindValue(1, file);
+        query->exec();
+    }
+}
+
+void SyncJournalDb::deleteEntriesWithoutFileRecord(const QByteArray &table)
+{
+    // The metadata is in other databases, each path is looked up in its shard
+    SqlQuery query("SELECT path FROM " + table + " WHERE path != '';", _db);
+    QStringList stalePaths;
+    while (query.next().hasData) {
+        const auto path = query.baValue(0);
+        bool found = false;
+        const auto searched = onMetadataOf(path, MetadataAccess::Read, [&](SqlDatabase &db, PreparedSqlQueryManager &queries) {
+            const auto recordQuery = queries.get(PreparedSqlQueryManager::GetFileRecordQuery, QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), db);
+            if (!recordQuery) {
+                return false;
+            }
+            recordQuery->bindValue(1, getPHash(path));
+            if (!recordQuery->exec()) {
+                return false;
+            }
+            found = recordQuery->next().hasData && recordQuery->baValue(0) == path;
+            return true;
+        });
+        if (!searched) {
+            qCWarning(lcDb) << "Could not look up the records of" << table;
+            return;
+        }
+        if (!found) {
+            stalePaths.append(QString::fromUtf8(path));
+        }
+    }
+
+    SqlQuery delQuery(_db);
+    delQuery.prepare("DELETE FROM " + table + " WHERE path = ?1;");
+    deleteBatch(delQuery, stalePaths, QString::fromLatin1(table));
+}
+
+void SyncJournalDb::deleteStaleChunkIndexes()
+{
+    QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
+    if (!checkConnect())
+        return;
+
+    if (!_metadataShards.empty()) {
+        deleteEntriesWithoutFileRecord("chunkindex");
+        return;
+    }
+
+    SqlQuery delQuery("DELETE FROM chunkindex WHERE path NOT IN (SELECT path from metadata);", _db);
+    delQuery.exec();
+}
+
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
     QMutexLocker locker(&_mutex);
@@ -1717,9 +2895,15 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
 void SyncJournalDb::deleteStaleFlagsEntries()
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
     if (!checkConnect())
         return;
 
+    if (!_metadataShards.empty()) {
+        deleteEntriesWithoutFileRecord("flags");
+        return;
+    }
+
     SqlQuery delQuery("DELETE FROM flags WHERE path != '' AND path NOT IN (SELECT path from metadata);", _db);
     delQuery.exec();
 }
@@ -1944,18 +3128,82 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
     commitInternal(QStringLiteral("setSelectiveSyncList"));
 }
 
+bool SyncJournalDb::getFileStatusCache(const std::function<void(const QString &path, int status)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return false;
+
+    SqlQuery query("SELECT path, status FROM filestatus", _db);
+    if (!query.exec()) {
+        qCWarning(lcDb) << "SQL error when reading the file status cache" << query.error();
+        return false;
+    }
+    forever {
+        auto next = query.next();
+        if (!next.ok)
+            return false;
+        if (!next.hasData)
+            break;
+        rowCallback(query.stringValue(0), query.intValue(1));
+    }
+    return true;
+}
+
+void SyncJournalDb::updateFileStatusCache(const QStringList &removedPaths, const QHash<QString, int> &statuses)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect())
+        return;
+
+    startTransaction();
+
+    if (!removedPaths.isEmpty()) {
+        SqlQuery delQuery("DELETE FROM filestatus WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path"), _db);
+        for (const auto &path : removedPaths) {
+            delQuery.reset_and_clear_bindings();
+            delQuery.bindValue(1, path);
+            if (!delQuery.exec())
+                qCWarning(lcDb) << "SQL error when deleting from the file status cache" << path << delQuery.error();
+        }
+    }
+
+    SqlQuery setQuery("INSERT OR REPLACE INTO filestatus (path, status) VALUES (?1, ?2)", _db);
+    SqlQuery delQuery("DELETE FROM filestatus WHERE path=?1", _db);
+    for (auto it = statuses.cbegin(); it != statuses.cend(); ++it) {
+        auto &query = it.value() ? setQuery : delQuery;
+        query.reset_and_clear_bindings();
+        query.bindValue(1, it.key());
+        if (it.value())
+            query.bindValue(2, it.value());
+        if (!query.exec())
+            qCWarning(lcDb) << "SQL error when updating the file status cache" << it.key() << query.error();
+    }
+
+    commitInternal(QStringLiteral("updateFileStatusCache"));
+}
+
 void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
 
     if (!checkConnect()) {
         return;
     }
 
-    SqlQuery query(_db);
-    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path"));
-    query.bindValue(1, path);
-    query.exec();
+    const auto avoidRenames = [&path](SqlDatabase &db, PreparedSqlQueryManager &) {
+        SqlQuery query(db);
+        query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path"));
+        query.bindValue(1, path);
+        return query.exec();
+    };
+    if (path.isEmpty()) {
+        onAllMetadata(MetadataAccess::Write, avoidRenames);
+    } else {
+        onMetadataOf(path, MetadataAccess::Write, avoidRenames);
+    }
+    invalidateFileRecordSnapshot();
 
     // We also need to remove the ETags so the update phase refreshes the directory paths
     // on the next sync
@@ -1965,6 +3213,7 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
 {
     QMutexLocker locker(&_mutex);
+    writeQueuedFileRecords();
 
     if (!checkConnect()) {
         return;
@@ -1975,12 +3224,18 @@ void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
     if (argument.endsWith('/'))
         argument.chop(1);
 
-    SqlQuery query(_db);
-    // This query will match entries for which the path is a prefix of fileName
-    // Note: CSYNC_FTW_TYPE_DIR == 2
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE " IS_PREFIX_PATH_OR_EQUAL("path", "?1") " AND type == 2;");
-    query.bindValue(1, argument);
-    query.exec();
+    // The parents of a path are in its shard
+    onMetadataOf(argument, MetadataAccess::Write, [&argument](SqlDatabase &db, PreparedSqlQueryManager &) {
+        SqlQuery query(db);
+        // This query will match entries for which the path is a prefix of fileName
+        // Note: CSYNC_FTW_TYPE_DIR == 2
+        query.prepare("UPDATE metadata SET md5='_invalid_' WHERE " IS_PREFIX_PATH_OR_EQUAL("path", "?1") " AND type == 2;");
+        query.bindValue(1, argument);
+        return query.exec();
+    });
+    if (const auto snapshot = snapshotForCurrentThread()) {
+        snapshot->invalidateFolderEtags(argument);
+    }
 
     // Prevent future overwrite of the etags of this folder and all
     // parent folders for this sync
@@ -2006,10 +3261,25 @@ void SyncJournalDb::forceRemoteDiscoveryNextSync()
 
 void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 {
+    writeQueuedFileRecords();
     qCInfo(lcDb) << "Forcing remote re-discovery by deleting folder Etags";
-    SqlQuery deleteRemoteFolderEtagsQuery(_db);
-    deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
-    deleteRemoteFolderEtagsQuery.exec();
+    const auto deleteRemoteFolderEtags = [](SqlDatabase &db) {
+        SqlQuery deleteRemoteFolderEtagsQuery(db);
+        deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
+        deleteRemoteFolderEtagsQuery.exec();
+    };
+    deleteRemoteFolderEtags(_db);
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        if (!shard->db.isOpen()) {
+            continue;
+        }
+        if (_transaction == 1) {
+            shard->joinTransaction();
+        }
+        deleteRemoteFolderEtags(shard->db);
+    }
+    invalidateFileRecordSnapshot();
 }
 
 
@@ -2076,6 +3346,22 @@ int SyncJournalDb::mapChecksumType(const QByteArray &checksumType)
         }
         auto value = query->intValue(0);
         _checksymTypeCache[checksumType] = value;
+
+        // The shards' records are read joined with their copy of the table
+        for (const auto &shard : _metadataShards) {
+            QMutexLocker shardLocker(&shard->mutex);
+            if (!shard->db.isOpen()) {
+                continue;
+            }
+            if (_transaction == 1) {
+                shard->joinTransaction();
+            }
+            SqlQuery insertQuery(shard->db);
+            insertQuery.prepare("INSERT OR IGNORE INTO checksumtype (id, name) VALUES (?1, ?2);");
+            insertQuery.bindValue(1, value);
+            insertQuery.bindValue(2, checksumType);
+            insertQuery.exec();
+        }
         return value;
     }
 }
@@ -2212,31 +3498,46 @@ QByteArray SyncJournalDb::conflictFileBaseName(const QByteArray &conflictName)
 void SyncJournalDb::clearFileTable()
 {
     QMutexLocker lock(&_mutex);
+    onAllMetadata(MetadataAccess::Write, [](SqlDatabase &db, PreparedSqlQueryManager &) {
+        SqlQuery query(db);
+        query.prepare("DELETE FROM metadata;");
+        return query.exec();
+    });
     SqlQuery query(_db);
-    query.prepare("DELETE FROM metadata;");
+    query.prepare("DELETE FROM filestatus;");
     query.exec();
+    invalidateFileRecordSnapshot();
 }
 
 void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path)
 {
     QMutexLocker lock(&_mutex);
+    writeQueuedFileRecords();
     if (!checkConnect())
         return;
 
-    static_assert(ItemTypeVirtualFile == 4 && ItemTypeVirtualFileDownload == 5, "");
-    SqlQuery query("UPDATE metadata SET type=5 WHERE "
-                   "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '') "
-                   "AND type=4;", _db);
-    query.bindValue(1, path);
-    query.exec();
+    const auto markForDownload = [&path](SqlDatabase &db, PreparedSqlQueryManager &) {
+        static_assert(ItemTypeVirtualFile == 4 && ItemTypeVirtualFileDownload == 5, "");
+        SqlQuery query("UPDATE metadata SET type=5 WHERE "
+                       "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '') "
+                       "AND type=4;", db);
+        query.bindValue(1, path);
+        query.exec();
 
-    // We also must make sure we do not read the files from the database (same logic as in schedulePathForRemoteDiscovery)
-    // This includes all the parents up to the root, but also all the directory within the selected dir.
-    static_assert(ItemTypeDirectory == 2, "");
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE "
-                  "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '' OR " IS_PREFIX_PATH_OR_EQUAL("path", "?1") ") AND type == 2;");
-    query.bindValue(1, path);
-    query.exec();
+        // We also must make sure we do not read the files from the database (same logic as in schedulePathForRemoteDiscovery)
+        // This includes all the parents up to the root, but also all the directory within the selected dir.
+        static_assert(ItemTypeDirectory == 2, "");
+        query.prepare("UPDATE metadata SET md5='_invalid_' WHERE "
+                      "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '' OR " IS_PREFIX_PATH_OR_EQUAL("path", "?1") ") AND type == 2;");
+        query.bindValue(1, path);
+        return query.exec();
+    };
+    if (path.isEmpty()) {
+        onAllMetadata(MetadataAccess::Write, markForDownload);
+    } else {
+        onMetadataOf(path, MetadataAccess::Write, markForDownload);
+    }
+    invalidateFileRecordSnapshot();
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::rawForPath(const QByteArray &path)
@@ -2413,6 +3714,30 @@ bool SyncJournalDb::isOpen()
     return _db.isOpen();
 }
 
+SqlDatabase::Statistics SyncJournalDb::statistics()
+{
+    QMutexLocker lock(&_mutex);
+    auto statistics = _db.statistics();
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        const auto &shardStatistics = shard->db.statistics();
+        statistics.statementCount += shardStatistics.statementCount;
+        statistics.commitCount += shardStatistics.commitCount;
+        statistics.commitTimeNs += shardStatistics.commitTimeNs;
+    }
+    return statistics;
+}
+
+void SyncJournalDb::resetStatistics()
+{
+    QMutexLocker lock(&_mutex);
+    _db.resetStatistics();
+    for (const auto &shard : _metadataShards) {
+        QMutexLocker shardLocker(&shard->mutex);
+        shard->db.resetStatistics();
+    }
+}
+
 void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 {
     qCDebug(lcDb) << "Transaction commit" << context << (startTrans ? "and starting new transaction" : "");
@@ -2435,7 +3760,8 @@ bool operator==(const SyncJournalDb::DownloadInfo &lhs,
     return lhs._errorCount == rhs._errorCount
         && lhs._etag == rhs._etag
         && lhs._tmpfile == rhs._tmpfile
-        && lhs._valid == rhs._valid;
+        && lhs._valid == rhs._valid
+        && lhs._segments == rhs._segments;
 }
 
 bool operator==(const SyncJournalDb::UploadInfo &lhs,
@@ -24,7 +24,11 @@
 #include <QHash>
 #include <QMutex>
 #include <QVariant>
+#include <QWaitCondition>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -33,6 +37,8 @@
 #include "common/result.h"
 #include "common/pinstate.h"
 
+class QThread;
+
 namespace OCC {
 class SyncJournalFileRecord;
 
@@ -68,6 +74,39 @@ public:
     bool listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
     Result<void, QString> setFileRecord(const SyncJournalFileRecord &record);
 
+    /** Writes several records in one transaction, with multi-row statements. */
+    Result<void, QString> setFileRecords(const QVector<SyncJournalFileRecord> &records);
+
+    /** Writes the record later from a background thread.
+     *
+     * The writer thread collects the queued records and stores them with
+     * setFileRecords(), so the caller never waits for SQLite. While a
+     * transaction is open they become part of it and are committed with it.
+     * All functions reading or changing the metadata table write the queued
+     * records first, so they always see them.
+     *
+     * Errors are reported by flushQueuedFileRecords().
+     */
+    void queueFileRecord(const SyncJournalFileRecord &record);
+
+    /** Writes everything queued with queueFileRecord().
+     *
+     * Returns the first error that happened while writing queued records since
+     * the last call.
+     */
+    Result<void, QString> flushQueuedFileRecords();
+
+    /** Loads the whole metadata table into memory for the upcoming discovery.
+     *
+     * Until discardFileRecordSnapshot() is called, getFileRecord() and
+     * listFilesInPath() called from this thread are answered from a sorted
+     * in-memory copy without SQLite queries and without locking. Changes made
+     * through this class are applied to both. Other threads still use the
+     * database and must not change the metadata table meanwhile.
+     */
+    bool loadFileRecordSnapshot();
+    void discardFileRecordSnapshot();
+
     void keyValueStoreSet(const QString &key, QVariant value);
     qint64 keyValueStoreGetInt(const QString &key, qint64 defaultValue);
     void keyValueStoreDelete(const QString &key);
@@ -104,10 +143,25 @@ public:
 
     struct DownloadInfo
     {
+        /// A byte range of a segmented download
+        struct Segment
+        {
+            qint64 start = 0;
+            qint64 end = 0; // exclusive
+            qint64 downloaded = 0; // bytes written from start on
+
+            bool operator==(const Segment &other) const
+            {
+                return start == other.start && end == other.end && downloaded == other.downloaded;
+            }
+        };
+
         QString _tmpfile;
         QByteArray _etag;
         int _errorCount = 0;
         bool _valid = false;
+        /// Empty unless the file is downloaded in several parallel segments
+        QVector<Segment> _segments;
     };
     struct UploadInfo
     {
@@ -126,6 +180,27 @@ public:
         bool isChunked() const { return _transferid != 0; }
     };
 
+    /**
+     * Content defined chunks of the file version that was last uploaded.
+     *
+     * Used by the delta upload to find the parts of a modified file that
+     * the server already has.
+     */
+    struct ChunkIndex
+    {
+        struct Chunk
+        {
+            qint64 offset = 0;
+            qint64 size = 0;
+            QByteArray hash; // raw SHA256 of the chunk data
+        };
+
+        QByteArray _etag; // etag of the server version the chunks describe
+        qint64 _averageChunkSize = 0;
+        QVector<Chunk> _chunks;
+        bool _valid = false;
+    };
+
     struct PollInfo
     {
         QString _file; // The relative path of a file
@@ -144,6 +219,12 @@ public:
     // Return the list of transfer ids that were removed.
     QVector<uint> deleteStaleUploadInfos(const QSet<QString> &keep);
 
+    ChunkIndex getChunkIndex(const QString &file);
+    /// Stores the index, or removes it if \a index is not valid
+    void setChunkIndex(const QString &file, const ChunkIndex &index);
+    /// Delete chunk indexes of files that are no longer in the metadata table
+    void deleteStaleChunkIndexes();
+
     SyncJournalErrorBlacklistRecord errorBlacklistEntry(const QString &);
     bool deleteStaleErrorBlacklistEntries(const QSet<QString> &keep);
 
@@ -174,6 +255,14 @@ public:
     /* Write the selective sync list (remove all other entries of that list */
     void setSelectiveSyncList(SelectiveSyncListType type, const QStringList &list);
 
+    /// Calls \a rowCallback with the file statuses kept by SyncFileStatusTracker
+    bool getFileStatusCache(const std::function<void(const QString &path, int status)> &rowCallback);
+    /**
+     * Deletes the statuses of \a removedPaths and everything below them,
+     * then stores \a statuses. A status of 0 deletes the path's entry.
+     */
+    void updateFileStatusCache(const QStringList &removedPaths, const QHash<QString, int> &statuses);
+
     /**
      * Make sure that on the next sync fileName and its parents are discovered from the server.
      *
@@ -223,9 +312,29 @@ public:
     /** Returns whether the db is currently openend. */
     bool isOpen();
 
-    /** Close the database */
+    /** Statement and commit counters of the underlying connections, for benchmarks. */
+    SqlDatabase::Statistics statistics();
+    void resetStatistics();
+
+    /** Close the database, after writing what was queued with queueFileRecord() */
     void close();
 
+    /** Spreads the metadata table over count database files next to the journal.
+     *
+     * The records of a top level folder and everything below it share one
+     * file, which has its own connection and lock, so that reading a subtree
+     * doesn't wait for writes to other ones. 0 keeps the metadata in the
+     * journal itself. The records are moved when the journal is opened the
+     * next time. The default comes from OWNCLOUD_JOURNAL_SHARDS.
+     *
+     * Closes the journal, so it must not be used by other threads meanwhile.
+     */
+    void setMetadataShardCount(int count);
+    int metadataShardCount();
+
+    /** The files setMetadataShardCount() spreads the metadata over, to remove them with the journal. */
+    QStringList metadataShardFilePaths() const;
+
     /**
      * Returns the checksum type for an id.
      */
@@ -381,21 +490,60 @@ private:
     void commitTransaction();
     QVector<QByteArray> tableColumns(const QByteArray &table);
     bool checkConnect();
+    // Same as close() but without stopping the writer, must be called with _mutex locked
+    void closeLocked();
 
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
+    Result<void, QString> setFileRecordsLocked(QVector<SyncJournalFileRecord> records);
+
+    // Writes the records given to queueFileRecord(), must be called with _mutex locked
+    void writeQueuedFileRecords();
+    void fileRecordWriterLoop();
+    void stopFileRecordWriter();
+
+    // Changes the etag of records below folders passed to avoidReadFromDbOnNextSync()
+    void applyEtagStorageFilter(SyncJournalFileRecord &record) const;
+
+    class FileRecordSnapshot;
+    // The snapshot if it was loaded by the calling thread, nullptr otherwise
+    FileRecordSnapshot *snapshotForCurrentThread() const;
+    // To be called by changes that the snapshot can't follow
+    void invalidateFileRecordSnapshot();
+
     // Returns the integer id of the checksum type
     //
     // Returns 0 on failure and for empty checksum types.
     int mapChecksumType(const QByteArray &checksumType);
 
+    class MetadataShard;
+    QString metadataShardFileName(int index) const;
+    // Moves the records into the configured shards, called by checkConnect()
+    bool migrateMetadataShards();
+    bool openMetadataShards();
+    void closeMetadataShards();
+    // Deletes the entries of table of which the path has no file record
+    void deleteEntriesWithoutFileRecord(const QByteArray &table);
+
+    // Runs query on the connection holding the metadata of path, or on each
+    // of them. Reads only keep the lock of that connection, writes keep _mutex
+    // and join the current transaction.
+    enum class MetadataAccess {
+        Read,
+        Write
+    };
+    template <typename Query>
+    bool onMetadataOf(const QByteArray &path, MetadataAccess access, Query &&query);
+    template <typename Query>
+    bool onAllMetadata(MetadataAccess access, Query &&query);
+
     SqlDatabase _db;
     QString _dbFile;
     QRecursiveMutex _mutex; // Public functions are protected with the mutex.
     QMap<QByteArray, int> _checksymTypeCache;
     int _transaction;
-    bool _metadataTableIsEmpty;
+    std::atomic<bool> _metadataTableIsEmpty;
 
     /* Storing etags to these folders, or their parent folders, is filtered out.
      *
@@ -420,6 +568,25 @@ private:
     QByteArray _journalMode;
 
     PreparedSqlQueryManager _queryManager;
+
+    // Background writer, see queueFileRecord(). _queueMutex is always locked after _mutex.
+    QMutex _queueMutex;
+    QWaitCondition _queueCondition;
+    QVector<SyncJournalFileRecord> _queuedFileRecords;
+    std::atomic<bool> _hasQueuedFileRecords{false};
+    QString _queuedWriteError;
+    QThread *_writerThread = nullptr;
+    bool _stopWriter = false;
+
+    // See loadFileRecordSnapshot(). Only used by _snapshotThread, other threads only look at the pointer.
+    std::unique_ptr<FileRecordSnapshot> _snapshot;
+    std::atomic<QThread *> _snapshotThread{nullptr};
+
+    // See setMetadataShardCount(). Only changed while no other thread uses the
+    // journal, readers look at the shards without locking _mutex.
+    int _metadataShardCount = 0;
+    std::vector<std::unique_ptr<MetadataShard>> _metadataShards;
+    std::atomic<bool> _metadataShardsOpen{false};
 };
 
 bool OCSYNC_EXPORT
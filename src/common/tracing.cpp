@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "tracing.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+#include <chrono>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTracing, "nextcloud.sync.tracing", QtInfoMsg)
+
+namespace Tracing {
+
+    namespace Detail {
+        std::atomic<bool> enabled{ false };
+    }
+
+    namespace {
+
+        // Field numbers of the messages in perfetto/protos/perfetto/trace/
+        namespace TraceField {
+            constexpr quint32 packet = 1;
+        }
+        namespace PacketField {
+            constexpr quint32 timestamp = 8;
+            constexpr quint32 trustedPacketSequenceId = 10;
+            constexpr quint32 trackEvent = 11;
+            constexpr quint32 internedData = 12;
+            constexpr quint32 sequenceFlags = 13;
+            constexpr quint32 trackDescriptor = 60;
+        }
+        namespace EventField {
+            constexpr quint32 categoryIids = 3;
+            constexpr quint32 debugAnnotations = 4;
+            constexpr quint32 type = 9;
+            constexpr quint32 nameIid = 10;
+            constexpr quint32 trackUuid = 11;
+        }
+        namespace AnnotationField {
+            constexpr quint32 nameIid = 1;
+            constexpr quint32 stringValue = 6;
+        }
+        namespace InternedField {
+            constexpr quint32 eventCategories = 1;
+            constexpr quint32 eventNames = 2;
+            constexpr quint32 debugAnnotationNames = 3;
+            // of each entry
+            constexpr quint32 iid = 1;
+            constexpr quint32 name = 2;
+        }
+        namespace TrackField {
+            constexpr quint32 uuid = 1;
+            constexpr quint32 name = 2;
+            constexpr quint32 process = 3;
+            constexpr quint32 thread = 4;
+            constexpr quint32 parentUuid = 5;
+        }
+        namespace ProcessField {
+            constexpr quint32 pid = 1;
+            constexpr quint32 processName = 6;
+        }
+        namespace ThreadField {
+            constexpr quint32 pid = 1;
+            constexpr quint32 tid = 2;
+            constexpr quint32 threadName = 5;
+        }
+
+        enum EventType {
+            SliceBegin = 1,
+            SliceEnd = 2,
+            Instant = 3,
+        };
+
+        enum SequenceFlags {
+            IncrementalStateCleared = 1,
+            NeedsIncrementalState = 2,
+        };
+
+        // Our only packet sequence, all packets are written under the tracer's mutex
+        constexpr quint64 sequenceId = 1;
+        constexpr quint64 processTrackUuid = 1;
+        // The interned name of the detail of any event
+        constexpr quint64 detailNameIid = 1;
+
+        // Written to the file in chunks of at least that size
+        constexpr int writeBufferSize = 64 * 1024;
+
+        class ProtoMessage
+        {
+        public:
+            void addVarint(quint32 field, quint64 value)
+            {
+                putVarint((field << 3) | 0);
+                putVarint(value);
+            }
+
+            void addBytes(quint32 field, const QByteArray &value)
+            {
+                putVarint((field << 3) | 2);
+                putVarint(static_cast<quint64>(value.size()));
+                _data += value;
+            }
+
+            void addMessage(quint32 field, const ProtoMessage &message) { addBytes(field, message._data); }
+
+            bool isEmpty() const { return _data.isEmpty(); }
+            const QByteArray &data() const { return _data; }
+
+        private:
+            void putVarint(quint64 value)
+            {
+                while (value >= 0x80) {
+                    _data += static_cast<char>((value & 0x7f) | 0x80);
+                    value >>= 7;
+                }
+                _data += static_cast<char>(value);
+            }
+
+            QByteArray _data;
+        };
+
+        quint64 now()
+        {
+            return static_cast<quint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                                            .count());
+        }
+
+        struct ThreadTrack
+        {
+            quint64 session = 0;
+            quint64 uuid = 0;
+        };
+        thread_local ThreadTrack threadTrack;
+
+        struct Lanes
+        {
+            QVector<bool> busy;
+            QVector<quint64> uuids;
+        };
+
+        class Tracer
+        {
+        public:
+            ~Tracer() { stop(); }
+
+            bool start(const QString &fileName)
+            {
+                QMutexLocker locker(&_mutex);
+                stopLocked();
+                _file.setFileName(fileName);
+                if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                    qCWarning(lcTracing) << "Could not open" << fileName << "for the trace" << _file.errorString();
+                    return false;
+                }
+                ++_session;
+                _nextTrackUuid = processTrackUuid + 1;
+                _nextIid = detailNameIid + 1;
+
+                ProtoMessage process;
+                process.addVarint(ProcessField::pid, static_cast<quint64>(QCoreApplication::applicationPid()));
+                process.addBytes(ProcessField::processName, QCoreApplication::applicationName().toUtf8());
+                ProtoMessage track;
+                track.addVarint(TrackField::uuid, processTrackUuid);
+                track.addMessage(TrackField::process, process);
+
+                ProtoMessage annotationName;
+                annotationName.addVarint(InternedField::iid, detailNameIid);
+                annotationName.addBytes(InternedField::name, QByteArrayLiteral("detail"));
+                ProtoMessage interned;
+                interned.addMessage(InternedField::debugAnnotationNames, annotationName);
+
+                ProtoMessage packet;
+                packet.addMessage(PacketField::trackDescriptor, track);
+                packet.addMessage(PacketField::internedData, interned);
+                packet.addVarint(PacketField::trustedPacketSequenceId, sequenceId);
+                packet.addVarint(PacketField::sequenceFlags, IncrementalStateCleared);
+                writePacket(packet);
+
+                qCInfo(lcTracing) << "Writing a trace to" << fileName;
+                Detail::enabled = true;
+                return true;
+            }
+
+            void stop()
+            {
+                QMutexLocker locker(&_mutex);
+                stopLocked();
+            }
+
+            QString fileName()
+            {
+                QMutexLocker locker(&_mutex);
+                return _file.isOpen() ? _file.fileName() : QString();
+            }
+
+            void event(EventType type, const char *category, const char *name, const QString &detail)
+            {
+                const auto timestamp = now();
+                QMutexLocker locker(&_mutex);
+                if (!_file.isOpen())
+                    return;
+                writeEvent(timestamp, type, currentThreadTrack(), category, name, detail);
+            }
+
+            int beginAsync(const char *category, const char *name, const QString &detail)
+            {
+                const auto timestamp = now();
+                QMutexLocker locker(&_mutex);
+                if (!_file.isOpen())
+                    return -1;
+
+                auto &lanes = _lanes[category];
+                int lane = lanes.busy.indexOf(false);
+                if (lane < 0) {
+                    lane = lanes.busy.size();
+                    lanes.busy.append(false);
+                    lanes.uuids.append(_nextTrackUuid++);
+
+                    ProtoMessage track;
+                    track.addVarint(TrackField::uuid, lanes.uuids[lane]);
+                    track.addVarint(TrackField::parentUuid, processTrackUuid);
+                    track.addBytes(TrackField::name, QByteArray(category) + ' ' + QByteArray::number(lane + 1));
+                    writeTrackDescriptor(track);
+                }
+                lanes.busy[lane] = true;
+                writeEvent(timestamp, SliceBegin, lanes.uuids[lane], category, name, detail);
+                return lane;
+            }
+
+            void endAsync(const char *category, int lane)
+            {
+                const auto timestamp = now();
+                QMutexLocker locker(&_mutex);
+                auto it = _lanes.find(category);
+                // The trace was restarted in between
+                if (!_file.isOpen() || it == _lanes.end() || lane >= it->busy.size() || !it->busy[lane])
+                    return;
+                it->busy[lane] = false;
+                writeEvent(timestamp, SliceEnd, it->uuids[lane], nullptr, nullptr, QString());
+            }
+
+        private:
+            void stopLocked()
+            {
+                if (!_file.isOpen())
+                    return;
+                Detail::enabled = false;
+                _file.write(_buffer);
+                _file.close();
+                qCInfo(lcTracing) << "Wrote the trace to" << _file.fileName();
+                _buffer.clear();
+                _categoryIids.clear();
+                _nameIids.clear();
+                _lanes.clear();
+            }
+
+            quint64 currentThreadTrack()
+            {
+                if (threadTrack.session == _session)
+                    return threadTrack.uuid;
+                threadTrack.session = _session;
+                threadTrack.uuid = _nextTrackUuid++;
+
+                auto threadName = QThread::currentThread()->objectName();
+                if (threadName.isEmpty()) {
+                    const bool isMain = QCoreApplication::instance() && QCoreApplication::instance()->thread() == QThread::currentThread();
+                    threadName = isMain ? QStringLiteral("main") : QStringLiteral("thread %1").arg(threadTrack.uuid);
+                }
+                ProtoMessage thread;
+                thread.addVarint(ThreadField::pid, static_cast<quint64>(QCoreApplication::applicationPid()));
+                // Only needs to be unique within the trace
+                thread.addVarint(ThreadField::tid, threadTrack.uuid);
+                thread.addBytes(ThreadField::threadName, threadName.toUtf8());
+                ProtoMessage track;
+                track.addVarint(TrackField::uuid, threadTrack.uuid);
+                track.addMessage(TrackField::thread, thread);
+                writeTrackDescriptor(track);
+                return threadTrack.uuid;
+            }
+
+            quint64 intern(QHash<const char *, quint64> &iids, const char *string, quint32 field, ProtoMessage &interned)
+            {
+                auto it = iids.find(string);
+                if (it != iids.end())
+                    return *it;
+                const auto iid = _nextIid++;
+                iids.insert(string, iid);
+                ProtoMessage entry;
+                entry.addVarint(InternedField::iid, iid);
+                entry.addBytes(InternedField::name, QByteArray(string));
+                interned.addMessage(field, entry);
+                return iid;
+            }
+
+            void writeEvent(quint64 timestamp, EventType type, quint64 trackUuid, const char *category, const char *name, const QString &detail)
+            {
+                ProtoMessage interned;
+                ProtoMessage event;
+                event.addVarint(EventField::type, type);
+                event.addVarint(EventField::trackUuid, trackUuid);
+                if (category)
+                    event.addVarint(EventField::categoryIids, intern(_categoryIids, category, InternedField::eventCategories, interned));
+                if (name)
+                    event.addVarint(EventField::nameIid, intern(_nameIids, name, InternedField::eventNames, interned));
+                if (!detail.isEmpty()) {
+                    ProtoMessage annotation;
+                    annotation.addVarint(AnnotationField::nameIid, detailNameIid);
+                    annotation.addBytes(AnnotationField::stringValue, detail.toUtf8());
+                    event.addMessage(EventField::debugAnnotations, annotation);
+                }
+
+                ProtoMessage packet;
+                packet.addVarint(PacketField::timestamp, timestamp);
+                packet.addMessage(PacketField::trackEvent, event);
+                if (!interned.isEmpty())
+                    packet.addMessage(PacketField::internedData, interned);
+                packet.addVarint(PacketField::trustedPacketSequenceId, sequenceId);
+                packet.addVarint(PacketField::sequenceFlags, NeedsIncrementalState);
+                writePacket(packet);
+            }
+
+            void writeTrackDescriptor(const ProtoMessage &track)
+            {
+                ProtoMessage packet;
+                packet.addMessage(PacketField::trackDescriptor, track);
+                packet.addVarint(PacketField::trustedPacketSequenceId, sequenceId);
+                writePacket(packet);
+            }
+
+            void writePacket(const ProtoMessage &packet)
+            {
+                // The file is a Trace message, which is nothing but its packets
+                ProtoMessage trace;
+                trace.addMessage(TraceField::packet, packet);
+                _buffer += trace.data();
+                if (_buffer.size() >= writeBufferSize) {
+                    _file.write(_buffer);
+                    _buffer.clear();
+                }
+            }
+
+            QMutex _mutex;
+            QFile _file;
+            QByteArray _buffer;
+            quint64 _session = 0;
+            quint64 _nextTrackUuid = processTrackUuid + 1;
+            quint64 _nextIid = detailNameIid + 1;
+            QHash<const char *, quint64> _categoryIids;
+            QHash<const char *, quint64> _nameIids;
+            QHash<const char *, Lanes> _lanes;
+        };
+
+        Q_GLOBAL_STATIC(Tracer, tracer)
+    }
+
+    bool start(const QString &fileName)
+    {
+        return tracer()->start(fileName);
+    }
+
+    void stop()
+    {
+        tracer()->stop();
+    }
+
+    QString fileName()
+    {
+        return tracer()->fileName();
+    }
+
+    void Detail::beginSlice(const char *category, const char *name, const QString &detail)
+    {
+        tracer()->event(SliceBegin, category, name, detail);
+    }
+
+    void Detail::endSlice()
+    {
+        tracer()->event(SliceEnd, nullptr, nullptr, QString());
+    }
+
+    int Detail::beginAsyncSlice(const char *category, const char *name, const QString &detail)
+    {
+        return tracer()->beginAsync(category, name, detail);
+    }
+
+    void Detail::endAsyncSlice(const char *category, int lane)
+    {
+        tracer()->endAsync(category, lane);
+    }
+
+    void Detail::instant(const char *category, const char *name, const QString &detail)
+    {
+        tracer()->event(Instant, category, name, detail);
+    }
+
+}
+
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <QString>
+
+#include <atomic>
+#include <utility>
+
+namespace OCC {
+
+/**
+ * @brief Opt-in trace of where a sync spends its time
+ *
+ * Records begin and end events into a file in the Perfetto protobuf trace
+ * format, to be opened with https://ui.perfetto.dev (or trace_processor for
+ * queries). Event names are interned, so a slice takes a few bytes only.
+ *
+ * Slices that begin and end within one function go onto the track of their
+ * thread, see Tracing::Scope. Asynchronous ones, like network jobs, overlap
+ * on the same thread; each category gets as many tracks ("lanes") as it has
+ * slices running at once, see Tracing::AsyncSlice.
+ *
+ * Categories and names must be string literals or otherwise outlive the
+ * trace, only their address is kept for interning.
+ *
+ * While no trace is recorded, an event costs one relaxed atomic load.
+ *
+ * @ingroup libsync
+ */
+namespace Tracing {
+
+    /// Starts writing a trace to fileName, stopping any previous one
+    OCSYNC_EXPORT bool start(const QString &fileName);
+    OCSYNC_EXPORT void stop();
+    /// The file the trace is written to, empty if none is recorded
+    OCSYNC_EXPORT QString fileName();
+
+    namespace Detail {
+        extern OCSYNC_EXPORT std::atomic<bool> enabled;
+
+        OCSYNC_EXPORT void beginSlice(const char *category, const char *name, const QString &detail);
+        OCSYNC_EXPORT void endSlice();
+        OCSYNC_EXPORT int beginAsyncSlice(const char *category, const char *name, const QString &detail);
+        OCSYNC_EXPORT void endAsyncSlice(const char *category, int lane);
+        OCSYNC_EXPORT void instant(const char *category, const char *name, const QString &detail);
+    }
+
+    inline bool isEnabled()
+    {
+        return Detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    /** An event without duration on the track of the current thread
+     *
+     * Check isEnabled() first if \a detail is costly to build.
+     */
+    inline void instant(const char *category, const char *name, const QString &detail = QString())
+    {
+        if (isEnabled())
+            Detail::instant(category, name, detail);
+    }
+
+    /// A slice on the track of the current thread, lasting as long as the object
+    class Scope
+    {
+    public:
+        Scope(const char *category, const char *name, const QString &detail = QString())
+            : _active(isEnabled())
+        {
+            if (_active)
+                Detail::beginSlice(category, name, detail);
+        }
+        ~Scope()
+        {
+            if (_active)
+                Detail::endSlice();
+        }
+        Q_DISABLE_COPY(Scope)
+
+    private:
+        bool _active;
+    };
+
+    /// A slice that ends in another call than it began, at the latest when the object is destroyed
+    class AsyncSlice
+    {
+    public:
+        AsyncSlice() = default;
+        ~AsyncSlice() { end(); }
+        Q_DISABLE_COPY(AsyncSlice)
+
+        void begin(const char *category, const char *name, const QString &detail = QString())
+        {
+            end();
+            if (isEnabled()) {
+                _category = category;
+                _lane = Detail::beginAsyncSlice(category, name, detail);
+            }
+        }
+        void end()
+        {
+            if (_lane >= 0)
+                Detail::endAsyncSlice(_category, std::exchange(_lane, -1));
+        }
+
+    private:
+        const char *_category = nullptr;
+        int _lane = -1;
+    };
+
+}
+
+}
@@ -36,6 +36,7 @@
 #include <QString>
 #include <QFileInfo>
 #include <QDir>
+#include <QRegularExpression>
 
 /** Expands C-like escape sequences (in place)
  */
@@ -215,6 +216,20 @@ static QString leftIncludeLast(const QString &arr, const QChar &c)
     return arr.left(arr.lastIndexOf(c, arr.size() - 2) + 1);
 }
 
+static CSYNC_EXCLUDE_TYPE toExcludeType(ExcludeMatcher::Match match)
+{
+    switch (match) {
+    case ExcludeMatcher::Excluded:
+        return CSYNC_FILE_EXCLUDE_LIST;
+    case ExcludeMatcher::ExcludedAndRemove:
+        return CSYNC_FILE_EXCLUDE_AND_REMOVE;
+    case ExcludeMatcher::NoMatch:
+    case ExcludeMatcher::Triggered:
+        break;
+    }
+    return CSYNC_NOT_EXCLUDED;
+}
+
 using namespace OCC;
 
 ExcludedFiles::ExcludedFiles(const QString &localPath)
@@ -307,13 +322,7 @@ void ExcludedFiles::loadExcludeFilePatterns(const QString &basePath, QFile &file
 bool ExcludedFiles::reloadExcludeFiles()
 {
     _allExcludes.clear();
-    // clear all regex
-    _bnameTraversalRegexFile.clear();
-    _bnameTraversalRegexDir.clear();
-    _fullTraversalRegexFile.clear();
-    _fullTraversalRegexDir.clear();
-    _fullRegexFile.clear();
-    _fullRegexDir.clear();
+    _matchers.clear();
 
     bool success = true;
     const auto keys = _excludeFiles.keys();
@@ -439,59 +448,29 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QString &path, Ite
         }
     }
 
+    const auto matchers = matchersFor(path);
+
     // Check the bname part of the path to see whether the full
-    // regex should be run.
+    // patterns should be checked.
     QStringRef bnameStr(&path);
     int lastSlash = path.lastIndexOf(QLatin1Char('/'));
     if (lastSlash >= 0) {
         bnameStr = path.midRef(lastSlash + 1);
     }
 
-    QString basePath(_localPath + path);
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, QLatin1Char('/'));
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _bnameTraversalRegexDir.contains(basePath)) {
-            m = _bnameTraversalRegexDir[basePath].match(bnameStr);
-        } else if (filetype == ItemTypeFile
-            && _bnameTraversalRegexFile.contains(basePath)) {
-            m = _bnameTraversalRegexFile[basePath].match(bnameStr);
-        } else {
-            continue;
-        }
-
-        if (!m.hasMatch())
+    for (const auto matcher : matchers) {
+        const auto bnameMatch = matcher->bnameMatch(bnameStr, filetype);
+        if (bnameMatch == ExcludeMatcher::NoMatch)
             return CSYNC_NOT_EXCLUDED;
-        if (m.capturedStart(QStringLiteral("exclude")) != -1) {
-            return CSYNC_FILE_EXCLUDE_LIST;
-        } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
-            return CSYNC_FILE_EXCLUDE_AND_REMOVE;
-        }
+        if (bnameMatch != ExcludeMatcher::Triggered)
+            return toExcludeType(bnameMatch);
     }
 
-    // third capture: full path matching is triggered
-    basePath = _localPath + path;
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, QLatin1Char('/'));
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _fullTraversalRegexDir.contains(basePath)) {
-            m = _fullTraversalRegexDir[basePath].match(path);
-        } else if (filetype == ItemTypeFile
-            && _fullTraversalRegexFile.contains(basePath)) {
-            m = _fullTraversalRegexFile[basePath].match(path);
-        } else {
-            continue;
-        }
-
-        if (m.hasMatch()) {
-            if (m.capturedStart(QStringLiteral("exclude")) != -1) {
-                return CSYNC_FILE_EXCLUDE_LIST;
-            } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
-                return CSYNC_FILE_EXCLUDE_AND_REMOVE;
-            }
-        }
+    // a trigger matched: check the full path patterns
+    for (const auto matcher : matchers) {
+        const auto fullMatch = matcher->traversalMatch(path, filetype);
+        if (fullMatch != ExcludeMatcher::NoMatch)
+            return toExcludeType(fullMatch);
     }
     return CSYNC_NOT_EXCLUDED;
 }
@@ -510,32 +489,39 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::fullPatternMatch(const QString &p, ItemType fi
     if (path.startsWith(_localPath))
         path = path.mid(_localPath.size());
 
-    QString basePath(_localPath + path);
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, QLatin1Char('/'));
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _fullRegexDir.contains(basePath)) {
-            m = _fullRegexDir[basePath].match(p);
-        } else if (filetype == ItemTypeFile
-            && _fullRegexFile.contains(basePath)) {
-            m = _fullRegexFile[basePath].match(p);
-        } else {
-            continue;
-        }
-
-        if (m.hasMatch()) {
-            if (m.capturedStart(QStringLiteral("exclude")) != -1) {
-                return CSYNC_FILE_EXCLUDE_LIST;
-            } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
-                return CSYNC_FILE_EXCLUDE_AND_REMOVE;
-            }
-        }
+    const auto matchers = matchersFor(path);
+    for (const auto matcher : matchers) {
+        const auto fullMatch = matcher->fullMatch(p, filetype);
+        if (fullMatch != ExcludeMatcher::NoMatch)
+            return toExcludeType(fullMatch);
     }
 
     return CSYNC_NOT_EXCLUDED;
 }
 
+QVarLengthArray<const ExcludeMatcher *, 4> ExcludedFiles::matchersFor(const QString &path) const
+{
+    // The base paths we would get by walking up from the parent of
+    // _localPath + path to _localPath
+    QVarLengthArray<const ExcludeMatcher *, 4> result;
+    if (path.isEmpty())
+        return result;
+    const int maxRelativeSize = path.size() < 2 ? 0 : path.lastIndexOf(QLatin1Char('/'), path.size() - 2) + 1;
+
+    // Parents sort before their children
+    for (auto it = _matchers.constEnd(); it != _matchers.constBegin();) {
+        --it;
+        const QString &basePath = it.key();
+        const int relativeSize = basePath.size() - _localPath.size();
+        if (relativeSize < 0 || relativeSize > maxRelativeSize || !basePath.startsWith(_localPath))
+            continue;
+        if (path.midRef(0, relativeSize) != basePath.midRef(_localPath.size()))
+            continue;
+        result.append(&it.value());
+    }
+    return result;
+}
+
 /**
  * On linux we used to use fnmatch with FNM_PATHNAME, but the windows function we used
  * didn't have that behavior. wildcardsMatchSlash can be used to control which behavior
@@ -669,13 +655,7 @@ QString ExcludedFiles::extractBnameTrigger(const QString &exclude, bool wildcard
 
 void ExcludedFiles::prepare()
 {
-    // clear all regex
-    _bnameTraversalRegexFile.clear();
-    _bnameTraversalRegexDir.clear();
-    _fullTraversalRegexFile.clear();
-    _fullTraversalRegexDir.clear();
-    _fullRegexFile.clear();
-    _fullRegexDir.clear();
+    _matchers.clear();
 
     const auto keys = _allExcludes.keys();
     for (auto const & basePath : keys)
@@ -686,47 +666,11 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
 {
     Q_ASSERT(_allExcludes.contains(basePath));
 
-    // Build regular expressions for the different cases.
-    //
-    // To compose the _bnameTraversalRegex, _fullTraversalRegex and _fullRegex
-    // patterns we collect several subgroups of patterns here.
-    //
-    // * The "full" group will contain all patterns that contain a non-trailing
-    //   slash. They only make sense in the fullRegex and fullTraversalRegex.
-    // * The "bname" group contains all patterns without a non-trailing slash.
-    //   These need separate handling in the _fullRegex (slash-containing
-    //   patterns must be anchored to the front, these don't need it)
-    // * The "bnameTrigger" group contains the bname part of all patterns in the
-    //   "full" group. These and the "bname" group become _bnameTraversalRegex.
-    //
-    // To complicate matters, the exclude patterns have two binary attributes
-    // meaning we'll end up with 4 variants:
-    // * "]" patterns mean "EXCLUDE_AND_REMOVE", they get collected in the
-    //   pattern strings ending in "Remove". The others go to "Keep".
-    // * trailing-slash patterns match directories only. They get collected
-    //   in the pattern strings saying "Dir", the others go into "FileDir"
-    //   because they match files and directories.
-
-    QString fullFileDirKeep;
-    QString fullFileDirRemove;
-    QString fullDirKeep;
-    QString fullDirRemove;
-
-    QString bnameFileDirKeep;
-    QString bnameFileDirRemove;
-    QString bnameDirKeep;
-    QString bnameDirRemove;
-
-    QString bnameTriggerFileDir;
-    QString bnameTriggerDir;
-
-    auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
-        QString &pattern = dirOnly ? dirPattern : fileDirPattern;
-        if (!pattern.isEmpty())
-            pattern.append(QLatin1Char('|'));
-        pattern.append(appendMe);
-    };
+    ExcludeMatcher matcher(_wildcardsMatchSlash, OCC::Utility::fsCasePreserving() ? Qt::CaseInsensitive : Qt::CaseSensitive);
 
+    // The exclude patterns have two binary attributes:
+    // * "]" patterns mean "EXCLUDE_AND_REMOVE"
+    // * trailing-slash patterns match directories only
     for (auto exclude : _allExcludes.value(basePath)) {
         if (exclude[0] == QLatin1Char('\n'))
             continue; // empty line
@@ -743,13 +687,9 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
 
         bool fullPath = exclude.contains(QLatin1Char('/'));
 
-        /* Use QRegularExpression, append to the right pattern */
-        auto &bnameFileDir = removeExcluded ? bnameFileDirRemove : bnameFileDirKeep;
-        auto &bnameDir = removeExcluded ? bnameDirRemove : bnameDirKeep;
-        auto &fullFileDir = removeExcluded ? fullFileDirRemove : fullFileDirKeep;
-        auto &fullDir = removeExcluded ? fullDirRemove : fullDirKeep;
-
-        if (fullPath) {
+        if (!fullPath) {
+            matcher.addBnamePattern(exclude, matchDirOnly, removeExcluded);
+        } else {
             // The full pattern is matched against a path relative to _localPath, however exclude is
             // relative to basePath at this point.
             // We know for sure that both _localPath and basePath are absolute and that basePath is
@@ -757,110 +697,13 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
             auto relPath = basePath.mid(_localPath.size());
             // Make exclude relative to _localPath
             exclude.prepend(relPath);
-        }
-        auto regexExclude = convertToRegexpSyntax(exclude, _wildcardsMatchSlash);
-        if (!fullPath) {
-            regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
-        } else {
-            regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
+            matcher.addFullPattern(exclude, matchDirOnly, removeExcluded);
 
             // For activation, trigger on the 'bname' part of the full pattern.
-            QString bnameExclude = extractBnameTrigger(exclude, _wildcardsMatchSlash);
-            auto regexBname = convertToRegexpSyntax(bnameExclude, true);
-            regexAppend(bnameTriggerFileDir, bnameTriggerDir, regexBname, matchDirOnly);
+            matcher.addTrigger(extractBnameTrigger(exclude, _wildcardsMatchSlash), matchDirOnly);
         }
     }
 
-    // The empty pattern would match everything - change it to match-nothing
-    auto emptyMatchNothing = [](QString &pattern) {
-        if (pattern.isEmpty())
-            pattern = QStringLiteral("a^");
-    };
-    emptyMatchNothing(fullFileDirKeep);
-    emptyMatchNothing(fullFileDirRemove);
-    emptyMatchNothing(fullDirKeep);
-    emptyMatchNothing(fullDirRemove);
-
-    emptyMatchNothing(bnameFileDirKeep);
-    emptyMatchNothing(bnameFileDirRemove);
-    emptyMatchNothing(bnameDirKeep);
-    emptyMatchNothing(bnameDirRemove);
-
-    emptyMatchNothing(bnameTriggerFileDir);
-    emptyMatchNothing(bnameTriggerDir);
-
-    // The bname regex is applied to the bname only, so it must be
-    // anchored in the beginning and in the end. It has the structure:
-    // (exclude)|(excluderemove)|(bname triggers).
-    // If the third group matches, the fullActivatedRegex needs to be applied
-    // to the full path.
-    _bnameTraversalRegexFile[basePath].setPattern(
-        QStringLiteral("^(?P<exclude>%1)$|"
-                       "^(?P<excluderemove>%2)$|"
-                       "^(?P<trigger>%3)$")
-            .arg(bnameFileDirKeep, bnameFileDirRemove, bnameTriggerFileDir));
-    _bnameTraversalRegexDir[basePath].setPattern(
-        QStringLiteral("^(?P<exclude>%1|%2)$|"
-                       "^(?P<excluderemove>%3|%4)$|"
-                       "^(?P<trigger>%5|%6)$")
-            .arg(bnameFileDirKeep, bnameDirKeep, bnameFileDirRemove, bnameDirRemove, bnameTriggerFileDir, bnameTriggerDir));
-
-    // The full traveral regex is applied to the full path if the trigger capture of
-    // the bname regex matches. Its basic form is (exclude)|(excluderemove)".
-    // This pattern can be much simpler than fullRegex since we can assume a traversal
-    // situation and doesn't need to look for bname patterns in parent paths.
-    _fullTraversalRegexFile[basePath].setPattern(
-        // Full patterns are anchored to the beginning
-        QStringLiteral("^(?P<exclude>%1)(?:$|/)"
-                       "|"
-                       "^(?P<excluderemove>%2)(?:$|/)")
-            .arg(fullFileDirKeep, fullFileDirRemove));
-    _fullTraversalRegexDir[basePath].setPattern(
-        QStringLiteral("^(?P<exclude>%1|%2)(?:$|/)"
-                       "|"
-                       "^(?P<excluderemove>%3|%4)(?:$|/)")
-            .arg(fullFileDirKeep, fullDirKeep, fullFileDirRemove, fullDirRemove));
-
-    // The full regex is applied to the full path and incorporates both bname and
-    // full-path patterns. It has the form "(exclude)|(excluderemove)".
-    _fullRegexFile[basePath].setPattern(
-        QStringLiteral("(?P<exclude>"
-                       // Full patterns are anchored to the beginning
-                       "^(?:%1)(?:$|/)|"
-                       // Simple bname patterns can be any path component
-                       "(?:^|/)(?:%2)(?:$|/)|"
-                       // When checking a file for exclusion we must check all parent paths
-                       // against the dir-only patterns as well.
-                       "(?:^|/)(?:%3)/)"
-                       "|"
-                       "(?P<excluderemove>"
-                       "^(?:%4)(?:$|/)|"
-                       "(?:^|/)(?:%5)(?:$|/)|"
-                       "(?:^|/)(?:%6)/)")
-            .arg(fullFileDirKeep, bnameFileDirKeep, bnameDirKeep, fullFileDirRemove, bnameFileDirRemove, bnameDirRemove));
-    _fullRegexDir[basePath].setPattern(
-        QStringLiteral("(?P<exclude>"
-                       "^(?:%1|%2)(?:$|/)|"
-                       "(?:^|/)(?:%3|%4)(?:$|/))"
-                       "|"
-                       "(?P<excluderemove>"
-                       "^(?:%5|%6)(?:$|/)|"
-                       "(?:^|/)(?:%7|%8)(?:$|/))")
-            .arg(fullFileDirKeep, fullDirKeep, bnameFileDirKeep, bnameDirKeep, fullFileDirRemove, fullDirRemove, bnameFileDirRemove, bnameDirRemove));
-
-    QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
-    if (OCC::Utility::fsCasePreserving())
-        patternOptions |= QRegularExpression::CaseInsensitiveOption;
-    _bnameTraversalRegexFile[basePath].setPatternOptions(patternOptions);
-    _bnameTraversalRegexFile[basePath].optimize();
-    _bnameTraversalRegexDir[basePath].setPatternOptions(patternOptions);
-    _bnameTraversalRegexDir[basePath].optimize();
-    _fullTraversalRegexFile[basePath].setPatternOptions(patternOptions);
-    _fullTraversalRegexFile[basePath].optimize();
-    _fullTraversalRegexDir[basePath].setPatternOptions(patternOptions);
-    _fullTraversalRegexDir[basePath].optimize();
-    _fullRegexFile[basePath].setPatternOptions(patternOptions);
-    _fullRegexFile[basePath].optimize();
-    _fullRegexDir[basePath].setPatternOptions(patternOptions);
-    _fullRegexDir[basePath].optimize();
+    matcher.compile();
+    _matchers[basePath] = std::move(matcher);
 }
@@ -24,11 +24,13 @@
 #include "ocsynclib.h"
 
 #include "csync.h"
+#include "csync_exclude_matcher.h"
 
 #include <QObject>
 #include <QSet>
 #include <QString>
 #include <QRegularExpression>
+#include <QVarLengthArray>
 
 #include <functional>
 
@@ -142,6 +144,14 @@ public:
      */
     CSYNC_EXCLUDE_TYPE traversalPatternMatch(const QString &path, ItemType filetype);
 
+    /**
+     * Translates an exclude pattern to a regular expression.
+     *
+     * Patterns are matched by ExcludeMatcher, this defines the semantics it
+     * follows and serves as a reference for tests and benchmarks.
+     */
+    static QString convertToRegexpSyntax(QString exclude, bool wildcardsMatchSlash);
+
 public slots:
     /**
      * Reloads the exclude patterns from the registered paths.
@@ -198,16 +208,15 @@ private:
     };
 
     /**
-     * Generate optimized regular expressions for the exclude patterns anchored to basePath.
+     * Compile the exclude patterns anchored to basePath into an ExcludeMatcher.
      *
-     * The optimization works in two steps: First, all supported patterns are put
-     * into _fullRegexFile/_fullRegexDir. These regexes can be applied to the full
-     * path to determine whether it is excluded or not.
+     * The patterns are split in two groups: the "full" ones contain a
+     * non-trailing slash and are matched against the start of the path, the
+     * "bname" ones can match any path component.
      *
-     * The second is a performance optimization. The particularly common use
-     * case for excludes during a sync run is "traversal": Instead of checking
-     * the full path every time, we check each parent path with the traversal
-     * function incrementally.
+     * The particularly common use case for excludes during a sync run is
+     * "traversal": Instead of checking the full path every time, we check each
+     * parent path with the traversal function incrementally.
      *
      * Example: When the sync run eventually arrives at "a/b/c it can assume
      * that the traversal matching has already been run on "a", "a/b"
@@ -218,9 +227,8 @@ private:
      *   full("a/b/c/d") == traversal("a") || traversal("a/b") || traversal("a/b/c")
      *
      * The traversal matcher can be extremely fast because it has a fast early-out
-     * case: It checks the bname part of the path against _bnameTraversalRegex
-     * and only runs a simplified _fullTraversalRegex on the whole path if bname
-     * activation for it was triggered.
+     * case: It only checks the bname of the path, and only checks the full
+     * patterns if the bname matches the bname part of one of them, a "trigger".
      *
      * Note: The traversal matcher will return not-excluded on some paths that the
      * full matcher would exclude. Example: "b" is excluded. traversal("b/c")
@@ -231,7 +239,9 @@ private:
     void prepare();
 
     static QString extractBnameTrigger(const QString &exclude, bool wildcardsMatchSlash);
-    static QString convertToRegexpSyntax(QString exclude, bool wildcardsMatchSlash);
+
+    /// The matchers of the base paths containing the folder-relative path, the deepest first
+    QVarLengthArray<const ExcludeMatcher *, 4> matchersFor(const QString &path) const;
 
     QString _localPath;
 
@@ -245,12 +255,7 @@ private:
     QMap<BasePathString, QStringList> _allExcludes;
 
     /// see prepare()
-    QMap<BasePathString, QRegularExpression> _bnameTraversalRegexFile;
-    QMap<BasePathString, QRegularExpression> _bnameTraversalRegexDir;
-    QMap<BasePathString, QRegularExpression> _fullTraversalRegexFile;
-    QMap<BasePathString, QRegularExpression> _fullTraversalRegexDir;
-    QMap<BasePathString, QRegularExpression> _fullRegexFile;
-    QMap<BasePathString, QRegularExpression> _fullRegexDir;
+    QMap<BasePathString, ExcludeMatcher> _matchers;
 
     bool _excludeConflictFiles = true;
 
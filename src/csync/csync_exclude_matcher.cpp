@@ -0,0 +1,591 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "csync_exclude_matcher.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QVarLengthArray>
+
+#include <algorithm>
+
+namespace {
+
+// What a pattern does when it matches
+enum : quint8 {
+    KeepFileDir = 0x01,
+    RemoveFileDir = 0x02,
+    KeepDir = 0x04,
+    RemoveDir = 0x08,
+    TriggerFileDir = 0x10,
+    TriggerDir = 0x20,
+};
+const quint8 keepFlags = KeepFileDir | KeepDir;
+const quint8 removeFlags = RemoveFileDir | RemoveDir;
+const quint8 triggerFlags = TriggerFileDir | TriggerDir;
+const quint8 fileDirFlags = KeepFileDir | RemoveFileDir | TriggerFileDir;
+const quint8 allFlags = fileDirFlags | KeepDir | RemoveDir | TriggerDir;
+
+// Patterns are split across several DFAs above this number of states
+const int maxDfaStates = 2048;
+
+// Sets with larger ranges only match the case folded characters of the range ends
+const int maxFoldedRange = 256;
+
+quint8 patternFlags(bool dirOnly, bool removeExcluded)
+{
+    if (removeExcluded)
+        return dirOnly ? RemoveDir : RemoveFileDir;
+    return dirOnly ? KeepDir : KeepFileDir;
+}
+
+/// The flags that apply to the last component of a path of this type
+quint8 lastComponentFlags(ItemType type)
+{
+    return type == ItemTypeDirectory ? allFlags : fileDirFlags;
+}
+
+ExcludeMatcher::Match toMatch(quint8 flags)
+{
+    if (flags & keepFlags)
+        return ExcludeMatcher::Excluded;
+    if (flags & removeFlags)
+        return ExcludeMatcher::ExcludedAndRemove;
+    if (flags & triggerFlags)
+        return ExcludeMatcher::Triggered;
+    return ExcludeMatcher::NoMatch;
+}
+
+bool isMatchable(ItemType type)
+{
+    return type == ItemTypeFile || type == ItemTypeDirectory;
+}
+
+// Like in the regular expressions, a surrogate pair is one character
+uint readChar(const QChar *&it, const QChar *end)
+{
+    const auto ch = *it++;
+    if (ch.isHighSurrogate() && it != end && it->isLowSurrogate())
+        return QChar::surrogateToUcs4(ch, *it++);
+    return ch.unicode();
+}
+
+uint readCharBackwards(const QChar *begin, const QChar *&it)
+{
+    const auto ch = *--it;
+    if (ch.isLowSurrogate() && it != begin && (it - 1)->isHighSurrogate()) {
+        --it;
+        return QChar::surrogateToUcs4(*it, ch);
+    }
+    return ch.unicode();
+}
+}
+
+ExcludeMatcher::ExcludeMatcher(bool wildcardsMatchSlash, Qt::CaseSensitivity caseSensitivity)
+    : _wildcardsMatchSlash(wildcardsMatchSlash)
+    , _caseSensitivity(caseSensitivity)
+    , _prefixTrie(1)
+    , _suffixTrie(1)
+{
+}
+
+void ExcludeMatcher::addBnamePattern(const QString &pattern, bool dirOnly, bool removeExcluded)
+{
+    _bnamePatterns.append(pattern);
+    addPattern(pattern, patternFlags(dirOnly, removeExcluded), false);
+}
+
+void ExcludeMatcher::addFullPattern(const QString &pattern, bool dirOnly, bool removeExcluded)
+{
+    _fullPatterns.append(pattern);
+    addPattern(pattern, patternFlags(dirOnly, removeExcluded), true);
+}
+
+void ExcludeMatcher::addTrigger(const QString &pattern, bool dirOnly)
+{
+    _triggers.append(pattern);
+    addPattern(pattern, dirOnly ? TriggerDir : TriggerFileDir, false);
+}
+
+void ExcludeMatcher::addPattern(const QString &pattern, quint8 flags, bool fullPath)
+{
+    auto glob = parse(pattern, flags);
+    if (fullPath) {
+        _fullGlobs.push_back(std::move(glob));
+    } else if (!insertIntoTrie(glob)) {
+        _bnameGlobs.push_back(std::move(glob));
+    }
+}
+
+uint ExcludeMatcher::fold(uint ch) const
+{
+    if (_caseSensitivity == Qt::CaseSensitive)
+        return ch;
+    return QChar::toCaseFolded(ch);
+}
+
+ExcludeMatcher::Glob ExcludeMatcher::parse(const QString &pattern, quint8 flags) const
+{
+    // Same syntax as ExcludedFiles::convertToRegexpSyntax()
+    Glob glob;
+    glob.flags = flags;
+    auto addChar = [&](uint ch) {
+        glob.tokens.push_back({ Token::Char, fold(ch), -1 });
+    };
+    auto addRange = [&](CharSet &set, uint first, uint last) {
+        if (last < first)
+            return;
+        set.ranges.emplace_back(first, last);
+        if (_caseSensitivity == Qt::CaseSensitive)
+            return;
+        if (last - first >= static_cast<uint>(maxFoldedRange)) {
+            set.ranges.emplace_back(fold(first), fold(first));
+            set.ranges.emplace_back(fold(last), fold(last));
+            return;
+        }
+        for (auto ch = first; ch <= last; ++ch) {
+            const auto folded = fold(ch);
+            if (folded != ch)
+                set.ranges.emplace_back(folded, folded);
+        }
+    };
+
+    const auto len = pattern.size();
+    const auto data = pattern.constData();
+    // Reads the character at i and moves i past it
+    auto readCharAt = [&](int &i) {
+        auto it = data + i;
+        const auto ch = readChar(it, data + len);
+        i = static_cast<int>(it - data);
+        return ch;
+    };
+    for (int i = 0; i < len; ++i) {
+        const auto ch = pattern[i];
+        switch (ch.unicode()) {
+        case '*':
+            glob.tokens.push_back({ Token::AnyString, 0, -1 });
+            break;
+        case '?':
+            glob.tokens.push_back({ Token::AnyChar, 0, -1 });
+            break;
+        case '[': {
+            // Find the end of the bracket expression
+            auto j = i + 1;
+            for (; j < len; ++j) {
+                if (pattern[j] == QLatin1Char(']'))
+                    break;
+                if (j != len - 1 && pattern[j] == QLatin1Char('\\') && pattern[j + 1] == QLatin1Char(']'))
+                    ++j;
+            }
+            if (j == len) {
+                // no matching ], a literal [
+                addChar(ch.unicode());
+                break;
+            }
+            CharSet set;
+            auto k = i + 1;
+            if (k < j && (pattern[k] == QLatin1Char('!') || pattern[k] == QLatin1Char('^'))) {
+                set.negated = true;
+                ++k;
+            }
+            auto setChar = [&] {
+                if (pattern[k] == QLatin1Char('\\') && k + 1 < j)
+                    ++k;
+                return readCharAt(k);
+            };
+            while (k < j) {
+                const auto first = setChar();
+                if (k + 1 < j && pattern[k] == QLatin1Char('-')) {
+                    ++k;
+                    addRange(set, first, setChar());
+                } else {
+                    addRange(set, first, first);
+                }
+            }
+            glob.tokens.push_back({ Token::Set, 0, static_cast<int>(glob.sets.size()) });
+            glob.sets.push_back(std::move(set));
+            i = j;
+            break;
+        }
+        case '\\':
+            if (i == len - 1) {
+                addChar(ch.unicode());
+                break;
+            }
+            // '\*' is a '*', but '\z' is '\z'
+            switch (pattern[i + 1].unicode()) {
+            case '*':
+            case '?':
+            case '[':
+            case '\\':
+                break;
+            default:
+                addChar(ch.unicode());
+                break;
+            }
+            ++i;
+            addChar(readCharAt(i));
+            --i;
+            break;
+        default:
+            addChar(readCharAt(i));
+            --i;
+            break;
+        }
+    }
+    return glob;
+}
+
+bool ExcludeMatcher::insertIntoTrie(const Glob &glob)
+{
+    // Only "name", "prefix*", "*suffix" and "*" go into the tries
+    const auto &tokens = glob.tokens;
+    int anyStrings = 0;
+    for (const auto &token : tokens) {
+        if (token.type == Token::AnyChar || token.type == Token::Set)
+            return false;
+        if (token.type == Token::AnyString)
+            ++anyStrings;
+    }
+    const bool isPrefix = anyStrings == 1 && tokens.back().type == Token::AnyString;
+    const bool isSuffix = anyStrings == 1 && tokens.front().type == Token::AnyString;
+    if (anyStrings > 1 || (anyStrings == 1 && !isPrefix && !isSuffix))
+        return false;
+
+    auto insert = [](std::vector<TrieNode> &trie, auto begin, auto end) {
+        int node = 0;
+        for (auto it = begin; it != end; ++it) {
+            auto &children = trie[node].children;
+            auto child = std::find_if(children.begin(), children.end(), [&](const auto &c) { return c.first == it->ch; });
+            if (child != children.end()) {
+                node = child->second;
+            } else {
+                children.emplace_back(it->ch, static_cast<int>(trie.size()));
+                node = static_cast<int>(trie.size());
+                trie.emplace_back();
+            }
+        }
+        return node;
+    };
+
+    if (anyStrings == 0) {
+        _prefixTrie[insert(_prefixTrie, tokens.begin(), tokens.end())].exact |= glob.flags;
+    } else if (isPrefix) {
+        _prefixTrie[insert(_prefixTrie, tokens.begin(), tokens.end() - 1)].any |= glob.flags;
+    } else {
+        _suffixTrie[insert(_suffixTrie, tokens.rbegin(), tokens.rend() - 1)].any |= glob.flags;
+    }
+    return true;
+}
+
+void ExcludeMatcher::compile()
+{
+    auto byChar = [](const std::pair<uint, int> &a, const std::pair<uint, int> &b) { return a.first < b.first; };
+    for (auto &node : _prefixTrie)
+        std::sort(node.children.begin(), node.children.end(), byChar);
+    for (auto &node : _suffixTrie)
+        std::sort(node.children.begin(), node.children.end(), byChar);
+
+    buildDfas(_bnameDfas, _bnameGlobs.cbegin(), _bnameGlobs.cend());
+    buildDfas(_fullDfas, _fullGlobs.cbegin(), _fullGlobs.cend());
+    _bnameGlobs.clear();
+    _fullGlobs.clear();
+}
+
+void ExcludeMatcher::buildDfas(std::vector<Dfa> &dfas, std::vector<Glob>::const_iterator begin, std::vector<Glob>::const_iterator end) const
+{
+    if (begin == end)
+        return;
+    Dfa dfa;
+    if (buildDfa(dfa, begin, end, end - begin > 1)) {
+        dfas.push_back(std::move(dfa));
+        return;
+    }
+    const auto middle = begin + (end - begin) / 2;
+    buildDfas(dfas, begin, middle);
+    buildDfas(dfas, middle, end);
+}
+
+bool ExcludeMatcher::buildDfa(Dfa &dfa, std::vector<Glob>::const_iterator begin, std::vector<Glob>::const_iterator end, bool limited) const
+{
+    // The character classes: the slash, every character of the patterns and
+    // every range of their sets start a class.
+    auto &boundaries = dfa.classBoundaries;
+    boundaries = { 0, '/', '/' + 1 };
+    for (auto glob = begin; glob != end; ++glob) {
+        for (const auto &token : glob->tokens) {
+            if (token.type == Token::Char) {
+                boundaries.push_back(static_cast<int>(token.ch));
+                boundaries.push_back(static_cast<int>(token.ch) + 1);
+            }
+        }
+        for (const auto &set : glob->sets) {
+            for (const auto &range : set.ranges) {
+                boundaries.push_back(static_cast<int>(range.first));
+                boundaries.push_back(static_cast<int>(range.second) + 1);
+            }
+        }
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+    while (boundaries.back() > QChar::LastValidCodePoint)
+        boundaries.pop_back();
+    dfa.classCount = static_cast<int>(boundaries.size());
+    for (int ch = 0; ch < 128; ++ch)
+        dfa.asciiClass[ch] = static_cast<quint16>(std::upper_bound(boundaries.begin(), boundaries.end(), ch) - boundaries.begin() - 1);
+
+    // The NFA has a position before every token of a pattern, and one after
+    // its last token where it matches.
+    struct Position
+    {
+        const Glob *glob;
+        const Token *token; // null at the end of the pattern
+    };
+    std::vector<Position> positions;
+    QByteArray start;
+    for (auto glob = begin; glob != end; ++glob) {
+        start.append(char(1));
+        for (const auto &token : glob->tokens) {
+            positions.push_back({ &*glob, &token });
+            start.append(char(0));
+        }
+        positions.push_back({ &*glob, nullptr });
+    }
+    const auto positionCount = static_cast<int>(positions.size());
+    const auto classCount = dfa.classCount;
+
+    std::vector<char> consumes(static_cast<size_t>(positionCount) * classCount, 0);
+    for (int p = 0; p < positionCount; ++p) {
+        const auto token = positions[p].token;
+        if (!token)
+            continue;
+        for (int c = 0; c < classCount; ++c) {
+            const auto ch = static_cast<uint>(boundaries[c]);
+            bool result = false;
+            switch (token->type) {
+            case Token::Char:
+                result = ch == token->ch;
+                break;
+            case Token::AnyChar:
+            case Token::AnyString:
+                result = _wildcardsMatchSlash || ch != '/';
+                break;
+            case Token::Set: {
+                const auto &set = positions[p].glob->sets[token->set];
+                const bool inSet = std::any_of(set.ranges.begin(), set.ranges.end(),
+                    [&](const std::pair<uint, uint> &range) { return range.first <= ch && ch <= range.second; });
+                result = inSet != set.negated;
+                break;
+            }
+            }
+            consumes[static_cast<size_t>(p) * classCount + c] = result;
+        }
+    }
+
+    // '*' can also match nothing
+    auto closure = [&](QByteArray &set) {
+        for (int p = 0; p < positionCount; ++p) {
+            if (set[p] && positions[p].token && positions[p].token->type == Token::AnyString)
+                set[p + 1] = 1;
+        }
+    };
+
+    // Subset construction
+    QHash<QByteArray, int> ids;
+    std::vector<QByteArray> states;
+    auto stateId = [&](const QByteArray &set) {
+        const auto it = ids.constFind(set);
+        if (it != ids.constEnd())
+            return it.value();
+        const auto id = static_cast<int>(states.size());
+        ids.insert(set, id);
+        states.push_back(set);
+        quint8 accept = 0;
+        for (int p = 0; p < positionCount; ++p) {
+            if (set[p] && !positions[p].token)
+                accept |= positions[p].glob->flags;
+        }
+        dfa.accept.push_back(accept);
+        return id;
+    };
+
+    closure(start);
+    stateId(start);
+    for (size_t state = 0; state < states.size(); ++state) {
+        if (limited && states.size() > static_cast<size_t>(maxDfaStates))
+            return false;
+        const auto current = states[state];
+        dfa.transitions.resize((state + 1) * classCount);
+        for (int c = 0; c < classCount; ++c) {
+            QByteArray next(positionCount, 0);
+            for (int p = 0; p < positionCount; ++p) {
+                if (!current[p] || !consumes[static_cast<size_t>(p) * classCount + c])
+                    continue;
+                // '*' stays, everything else moves on
+                next[positions[p].token->type == Token::AnyString ? p : p + 1] = 1;
+            }
+            closure(next);
+            dfa.transitions[state * classCount + c] = stateId(next);
+        }
+    }
+    dfa.dead = ids.value(QByteArray(positionCount, 0), -1);
+    return true;
+}
+
+int ExcludeMatcher::charClass(const Dfa &dfa, uint ch) const
+{
+    if (ch < 128)
+        return dfa.asciiClass[ch];
+    return static_cast<int>(std::upper_bound(dfa.classBoundaries.begin(), dfa.classBoundaries.end(), static_cast<int>(ch)) - dfa.classBoundaries.begin() - 1);
+}
+
+void ExcludeMatcher::trieMatch(const QChar *begin, const QChar *end, quint8 *exact, quint8 *prefix, quint8 *suffix) const
+{
+    auto child = [](const std::vector<TrieNode> &trie, int node, uint ch) {
+        const auto &children = trie[node].children;
+        const auto it = std::lower_bound(children.begin(), children.end(), ch,
+            [](const std::pair<uint, int> &c, uint value) { return c.first < value; });
+        return it != children.end() && it->first == ch ? it->second : -1;
+    };
+
+    int node = 0;
+    *prefix = _prefixTrie[0].any;
+    for (auto it = begin; it != end && node >= 0;) {
+        node = child(_prefixTrie, node, fold(readChar(it, end)));
+        if (node >= 0)
+            *prefix |= _prefixTrie[node].any;
+    }
+    *exact = node >= 0 ? _prefixTrie[node].exact : 0;
+
+    node = 0;
+    *suffix = _suffixTrie[0].any;
+    for (auto it = end; it != begin && node >= 0;) {
+        node = child(_suffixTrie, node, fold(readCharBackwards(begin, it)));
+        if (node >= 0)
+            *suffix |= _suffixTrie[node].any;
+    }
+}
+
+void ExcludeMatcher::runDfas(const std::vector<Dfa> &dfas, const QChar *begin, const QChar *end, quint8 *atSlash, quint8 *atEnd) const
+{
+    for (const auto &dfa : dfas) {
+        int state = 0;
+        for (auto it = begin; it != end && state != dfa.dead;) {
+            const auto ch = readChar(it, end);
+            if (ch == '/')
+                *atSlash |= dfa.accept[state];
+            state = dfa.transitions[state * dfa.classCount + charClass(dfa, fold(ch))];
+        }
+        if (state != dfa.dead)
+            *atEnd |= dfa.accept[state];
+    }
+}
+
+ExcludeMatcher::Match ExcludeMatcher::bnameMatch(const QStringRef &bname, ItemType type) const
+{
+    if (!isMatchable(type))
+        return NoMatch;
+
+    const auto begin = bname.unicode();
+    const auto end = begin + bname.size();
+    quint8 exact = 0;
+    quint8 prefix = 0;
+    quint8 suffix = 0;
+    quint8 atSlash = 0;
+    quint8 atEnd = 0;
+    trieMatch(begin, end, &exact, &prefix, &suffix);
+    runDfas(_bnameDfas, begin, end, &atSlash, &atEnd);
+    return toMatch((exact | prefix | suffix | atEnd) & lastComponentFlags(type));
+}
+
+ExcludeMatcher::Match ExcludeMatcher::traversalMatch(const QString &path, ItemType type) const
+{
+    if (!isMatchable(type))
+        return NoMatch;
+
+    quint8 atSlash = 0;
+    quint8 atEnd = 0;
+    runDfas(_fullDfas, path.constData(), path.constData() + path.size(), &atSlash, &atEnd);
+    return toMatch((atSlash | atEnd) & lastComponentFlags(type) & ~triggerFlags);
+}
+
+ExcludeMatcher::Match ExcludeMatcher::fullMatch(const QString &path, ItemType type) const
+{
+    if (!isMatchable(type))
+        return NoMatch;
+
+    const auto data = path.constData();
+    const auto size = path.size();
+    QVarLengthArray<int, 32> starts;
+    starts.append(0);
+    for (int i = 0; i < size; ++i) {
+        if (data[i] == QLatin1Char('/'))
+            starts.append(i + 1);
+    }
+    const auto count = starts.size();
+    const auto last = count - 1;
+    const auto lastFlags = lastComponentFlags(type) & ~triggerFlags;
+    const auto innerFlags = allFlags & ~triggerFlags;
+
+    QVarLengthArray<quint8, 32> exact(count);
+    QVarLengthArray<quint8, 32> prefix(count);
+    QVarLengthArray<quint8, 32> suffix(count);
+    for (int i = 0; i < count; ++i) {
+        const auto end = i < last ? starts[i + 1] - 1 : size;
+        trieMatch(data + starts[i], data + end, &exact[i], &prefix[i], &suffix[i]);
+    }
+    // The "*suffix" matches of the components from i on that are followed by a slash
+    QVarLengthArray<quint8, 32> innerSuffixFrom(count + 1);
+    std::fill(innerSuffixFrom.begin(), innerSuffixFrom.end(), quint8(0));
+    for (int i = last - 1; i >= 0; --i)
+        innerSuffixFrom[i] = innerSuffixFrom[i + 1] | suffix[i];
+
+    // The full patterns are anchored at the start
+    quint8 fullAtSlash = 0;
+    quint8 fullAtEnd = 0;
+    runDfas(_fullDfas, data, data + size, &fullAtSlash, &fullAtEnd);
+    quint8 matched = (fullAtSlash | fullAtEnd) & lastFlags;
+
+    // The bname patterns from the start of every component, up to the end
+    // of that component or, if wildcards match slashes, of a later one.
+    for (int i = 0; i < count; ++i) {
+        quint8 atSlash = 0;
+        quint8 atEnd = 0;
+        runDfas(_bnameDfas, data + starts[i], data + size, &atSlash, &atEnd);
+        (i < last ? atSlash : atEnd) |= exact[i] | prefix[i] | suffix[i];
+        if (_wildcardsMatchSlash && i < last) {
+            atSlash |= innerSuffixFrom[i + 1];
+            if (i + 1 < last)
+                atSlash |= prefix[i];
+            atEnd |= prefix[i] | suffix[last];
+        }
+        matched |= (atSlash & innerFlags) | (atEnd & lastFlags);
+
+        // Like the first match of a regular expression: the matches that
+        // start first win, an excluding one over one that also removes.
+        // Component 1 starts with the slash before it, at the same position
+        // as an empty component 0.
+        if (i == 0 && count > 1 && starts[1] == 1)
+            continue;
+        if (const auto match = toMatch(matched))
+            return match;
+    }
+    return NoMatch;
+}
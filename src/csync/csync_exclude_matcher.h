@@ -0,0 +1,182 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_EXCLUDE_MATCHER_H
+#define _CSYNC_EXCLUDE_MATCHER_H
+
+#include "ocsynclib.h"
+
+#include "csync.h"
+
+#include <QString>
+#include <QStringList>
+
+#include <utility>
+#include <vector>
+
+/**
+ * Matches paths against the exclude patterns of one base path.
+ *
+ * The patterns are compiled once by compile():
+ *
+ * * Patterns without wildcards, and patterns of the form "prefix*",
+ *   "*suffix" and "*" go into two tries over the characters of a name.
+ *   These are most of the patterns of the usual exclude lists.
+ * * All the other patterns are combined into a DFA, the full path patterns
+ *   into a second one. Should a DFA get too large, the patterns are split
+ *   across several of them.
+ *
+ * Matching then reads every character of a path a constant number of times
+ * per component it is checked from, without any backtracking. Characters are
+ * code points, so a surrogate pair is matched by a single '?' or set.
+ *
+ * The pattern syntax and the matching rules are the ones of the regular
+ * expressions ExcludedFiles used to generate, see
+ * ExcludedFiles::convertToRegexpSyntax().
+ */
+class OCSYNC_EXPORT ExcludeMatcher
+{
+public:
+    enum Match {
+        NoMatch,
+        Excluded,
+        ExcludedAndRemove,
+        /// Only the bname part of a full path pattern matched, see bnameMatch()
+        Triggered,
+    };
+
+    explicit ExcludeMatcher(bool wildcardsMatchSlash = false, Qt::CaseSensitivity caseSensitivity = Qt::CaseSensitive);
+
+    /** A pattern without slash, matching any path component.
+     *
+     * dirOnly patterns only match directories, removeExcluded ones
+     * result in ExcludedAndRemove.
+     */
+    void addBnamePattern(const QString &pattern, bool dirOnly, bool removeExcluded);
+
+    /// A pattern matching the start of the path, up to a slash or the end
+    void addFullPattern(const QString &pattern, bool dirOnly, bool removeExcluded);
+
+    /// The bname part of a full pattern, see bnameMatch()
+    void addTrigger(const QString &pattern, bool dirOnly);
+
+    /// To be called once all patterns are added
+    void compile();
+
+    /**
+     * Matches the name of a file against the bname patterns and the triggers.
+     *
+     * Used during traversal, where the parent directories were checked
+     * already. Triggered means that the full path patterns need to be checked
+     * with traversalMatch().
+     */
+    Match bnameMatch(const QStringRef &bname, ItemType type) const;
+
+    /// Matches the path against the full path patterns only
+    Match traversalMatch(const QString &path, ItemType type) const;
+
+    /// Matches every component of the path against all patterns
+    Match fullMatch(const QString &path, ItemType type) const;
+
+    /// The patterns as they were added, for tests
+    const QStringList &bnamePatterns() const { return _bnamePatterns; }
+    const QStringList &fullPatterns() const { return _fullPatterns; }
+    const QStringList &triggers() const { return _triggers; }
+
+private:
+    struct CharSet
+    {
+        bool negated = false;
+        std::vector<std::pair<uint, uint>> ranges;
+    };
+
+    struct Token
+    {
+        enum Type : quint8 {
+            Char,
+            AnyChar, // ?
+            AnyString, // *
+            Set, // [...]
+        };
+        Type type;
+        uint ch; // for Char
+        int set; // for Set, index in Glob::sets
+    };
+
+    struct Glob
+    {
+        std::vector<Token> tokens;
+        std::vector<CharSet> sets;
+        quint8 flags;
+    };
+
+    struct TrieNode
+    {
+        std::vector<std::pair<uint, int>> children;
+        quint8 exact = 0; // the name ends here
+        quint8 any = 0; // "prefix*" in the forward trie, "*suffix" in the reversed one
+    };
+
+    struct Dfa
+    {
+        // The characters are mapped to classes that behave the same in all
+        // patterns, classBoundaries holds the first character of every class.
+        std::vector<int> classBoundaries;
+        quint16 asciiClass[128];
+        int classCount = 0;
+        std::vector<int> transitions; // state * classCount + class
+        std::vector<quint8> accept;
+        int dead = -1;
+    };
+
+    void addPattern(const QString &pattern, quint8 flags, bool fullPath);
+    Glob parse(const QString &pattern, quint8 flags) const;
+    bool insertIntoTrie(const Glob &glob);
+    void buildDfas(std::vector<Dfa> &dfas, std::vector<Glob>::const_iterator begin, std::vector<Glob>::const_iterator end) const;
+    bool buildDfa(Dfa &dfa, std::vector<Glob>::const_iterator begin, std::vector<Glob>::const_iterator end, bool limited) const;
+
+    uint fold(uint ch) const;
+    int charClass(const Dfa &dfa, uint ch) const;
+
+    /// Matches of the tries for a name, split by the kind of pattern
+    void trieMatch(const QChar *begin, const QChar *end, quint8 *exact, quint8 *prefix, quint8 *suffix) const;
+
+    /** Runs the DFAs from begin, collecting the flags of the patterns that
+     * match up to a slash and up to the end.
+     */
+    void runDfas(const std::vector<Dfa> &dfas, const QChar *begin, const QChar *end, quint8 *atSlash, quint8 *atEnd) const;
+
+    bool _wildcardsMatchSlash;
+    Qt::CaseSensitivity _caseSensitivity;
+
+    std::vector<Glob> _bnameGlobs;
+    std::vector<Glob> _fullGlobs;
+
+    std::vector<TrieNode> _prefixTrie;
+    std::vector<TrieNode> _suffixTrie; // over the reversed names
+    std::vector<Dfa> _bnameDfas;
+    std::vector<Dfa> _fullDfas;
+
+    QStringList _bnamePatterns;
+    QStringList _fullPatterns;
+    QStringList _triggers;
+};
+
+#endif /* _CSYNC_EXCLUDE_MATCHER_H */
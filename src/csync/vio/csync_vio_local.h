@@ -23,6 +23,8 @@
 
 #include <QString>
 
+#include <vector>
+
 struct csync_vio_handle_t;
 namespace OCC {
 class Vfs;
@@ -32,6 +34,15 @@ csync_vio_handle_t OCSYNC_EXPORT *csync_vio_local_opendir(const QString &name);
 int OCSYNC_EXPORT csync_vio_local_closedir(csync_vio_handle_t *dhandle);
 std::unique_ptr<csync_file_stat_t> OCSYNC_EXPORT csync_vio_local_readdir(csync_vio_handle_t *dhandle, OCC::Vfs *vfs);
 
+/**
+ * Reads all remaining entries of the directory at once into entries.
+ *
+ * The entries are the same as csync_vio_local_readdir() would return, but they are
+ * stored in one contiguous vector that can be reused for the next directory.
+ * Returns 0 on success, -1 with errno set on error.
+ */
+int OCSYNC_EXPORT csync_vio_local_readdir_batch(csync_vio_handle_t *dhandle, std::vector<csync_file_stat_t> *entries, OCC::Vfs *vfs);
+
 int OCSYNC_EXPORT csync_vio_local_stat(const QString &uri, csync_file_stat_t *buf);
 
 #endif /* _CSYNC_VIO_LOCAL_H */
@@ -26,7 +26,14 @@
 #include <dirent.h>
 #include <cstdio>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "c_private.h"
 #include "c_lib.h"
@@ -45,21 +52,37 @@ Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "nextcloud.sync.csync.vio_local", QtInfoMsg)
  */
 
 struct csync_vio_handle_t {
+#ifdef __linux__
+  int fd;
+  // csync_vio_local_readdir() reads the whole directory on its first call
+  std::vector<csync_file_stat_t> entries;
+  size_t nextEntry;
+  bool entriesRead;
+#else
   DIR *dh;
+#endif
   QByteArray path;
 };
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
+static void _csync_vio_local_set_type(mode_t mode, csync_file_stat_t *buf);
 
 csync_vio_handle_t *csync_vio_local_opendir(const QString &name) {
     QScopedPointer<csync_vio_handle_t> handle(new csync_vio_handle_t{});
 
     auto dirname = QFile::encodeName(name);
 
+#ifdef __linux__
+    handle->fd = open(dirname.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (handle->fd < 0) {
+        return nullptr;
+    }
+#else
     handle->dh = _topendir(dirname.constData());
     if (!handle->dh) {
         return nullptr;
     }
+#endif
 
     handle->path = dirname;
     return handle.take();
@@ -67,11 +90,140 @@ csync_vio_handle_t *csync_vio_local_opendir(const QString &name) {
 
 int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
     Q_ASSERT(dhandle);
+#ifdef __linux__
+    auto rc = close(dhandle->fd);
+#else
     auto rc = _tclosedir(dhandle->dh);
+#endif
     delete dhandle;
     return rc;
 }
 
+#ifdef __linux__
+
+/*
+ * Linux: read the directory with large getdents64 batches instead of one readdir
+ * call per entry, and only stat what d_type can't tell us.
+ */
+
+static const size_t getdentsBufferSize = 64 * 1024;
+
+static int _csync_vio_local_statat(int dirfd, const char *name, csync_file_stat_t *buf)
+{
+#ifdef STATX_TYPE
+    static std::atomic<bool> statxUnsupported(false);
+    if (!statxUnsupported.load(std::memory_order_relaxed)) {
+        struct statx sx;
+        // Only ask for what discovery uses, the rest can be expensive on network file systems
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE, &sx) == 0) {
+            _csync_vio_local_set_type(sx.stx_mode, buf);
+            buf->inode = sx.stx_ino;
+            buf->modtime = sx.stx_mtime.tv_sec;
+            buf->size = sx.stx_size;
+            return 0;
+        }
+        if (errno == ENOSYS) {
+            // Kernel older than 4.11
+            statxUnsupported = true;
+        } else if (errno != EPERM) {
+            // EPERM: some container seccomp profiles block statx, try fstatat
+            return -1;
+        }
+    }
+#endif
+
+    struct stat sb;
+    if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+    _csync_vio_local_set_type(sb.st_mode, buf);
+    buf->inode = sb.st_ino;
+    buf->modtime = sb.st_mtime;
+    buf->size = sb.st_size;
+    return 0;
+}
+
+int csync_vio_local_readdir_batch(csync_vio_handle_t *handle, std::vector<csync_file_stat_t> *entries, OCC::Vfs *vfs) {
+  entries->clear();
+
+  // Shared by all directories listed by this thread
+  thread_local std::unique_ptr<char[]> buffer;
+  if (!buffer) {
+      buffer.reset(new char[getdentsBufferSize]);
+  }
+
+  while (true) {
+      const auto bytes = syscall(SYS_getdents64, handle->fd, buffer.get(), getdentsBufferSize);
+      if (bytes < 0) {
+          return -1;
+      }
+      if (bytes == 0) {
+          break;
+      }
+
+      for (long offset = 0; offset < bytes;) {
+          const auto dirent = reinterpret_cast<const struct dirent64 *>(buffer.get() + offset);
+          offset += dirent->d_reclen;
+          if (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0) {
+              continue;
+          }
+
+          entries->emplace_back();
+          auto &file_stat = entries->back();
+          file_stat.path = QFile::decodeName(dirent->d_name).toUtf8();
+          if (file_stat.path.isNull()) {
+              file_stat.original_path = handle->path % '/' % QByteArray() % static_cast<const char *>(dirent->d_name);
+              qCWarning(lcCSyncVIOLocal) << "Invalid characters in file/directory name, please rename:" << dirent->d_name << handle->path;
+              continue;
+          }
+
+          switch (dirent->d_type) {
+          case DT_FIFO:
+          case DT_CHR:
+          case DT_BLK:
+              // Never synced, file_stat.type stays ItemTypeSkip
+              break;
+          case DT_LNK:
+          case DT_SOCK:
+              // Excluded by the discovery, the stat data would not be used
+              file_stat.type = ItemTypeSoftLink;
+              break;
+          default:
+              // DT_DIR, DT_REG and DT_UNKNOWN: we need the inode, size and mtime anyway
+              if (_csync_vio_local_statat(handle->fd, dirent->d_name, &file_stat) < 0) {
+                  // Will get excluded by _csync_detect_update.
+                  file_stat.type = ItemTypeSkip;
+              }
+              break;
+          }
+
+          // Override type for virtual files if desired
+          if (vfs) {
+              const auto result = vfs->statTypeVirtualFile(&file_stat, &handle->path);
+              Q_UNUSED(result)
+          }
+      }
+  }
+
+  return 0;
+}
+
+std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *handle, OCC::Vfs *vfs) {
+  if (!handle->entriesRead) {
+      handle->entriesRead = true;
+      if (csync_vio_local_readdir_batch(handle, &handle->entries, vfs) < 0) {
+          return {};
+      }
+  }
+
+  if (handle->nextEntry >= handle->entries.size()) {
+      return {};
+  }
+  return std::make_unique<csync_file_stat_t>(std::move(handle->entries[handle->nextEntry++]));
+}
+
+#else
+
 std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *handle, OCC::Vfs *vfs) {
 
   struct _tdirent *dirent = nullptr;
@@ -131,6 +283,19 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
   return file_stat;
 }
 
+int csync_vio_local_readdir_batch(csync_vio_handle_t *handle, std::vector<csync_file_stat_t> *entries, OCC::Vfs *vfs) {
+  entries->clear();
+  while (true) {
+      errno = 0;
+      auto file_stat = csync_vio_local_readdir(handle, vfs);
+      if (!file_stat) {
+          return errno != 0 ? -1 : 0;
+      }
+      entries->push_back(std::move(*file_stat));
+  }
+}
+
+#endif
 
 int csync_vio_local_stat(const QString &uri, csync_file_stat_t *buf)
 {
@@ -145,7 +310,23 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
         return -1;
     }
 
-    switch (sb.st_mode & S_IFMT) {
+    _csync_vio_local_set_type(sb.st_mode, buf);
+
+#ifdef __APPLE__
+  if (sb.st_flags & UF_HIDDEN) {
+      buf->is_hidden = true;
+  }
+#endif
+
+  buf->inode = sb.st_ino;
+  buf->modtime = sb.st_mtime;
+  buf->size = sb.st_size;
+  return 0;
+}
+
+static void _csync_vio_local_set_type(mode_t mode, csync_file_stat_t *buf)
+{
+    switch (mode & S_IFMT) {
     case S_IFDIR:
       buf->type = ItemTypeDirectory;
       break;
@@ -160,15 +341,4 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
       buf->type = ItemTypeSkip;
       break;
   }
-
-#ifdef __APPLE__
-  if (sb.st_flags & UF_HIDDEN) {
-      buf->is_hidden = true;
-  }
-#endif
-
-  buf->inode = sb.st_ino;
-  buf->modtime = sb.st_mtime;
-  buf->size = sb.st_size;
-  return 0;
 }
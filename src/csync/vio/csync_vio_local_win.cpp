@@ -184,6 +184,17 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *h
     return file_stat;
 }
 
+int csync_vio_local_readdir_batch(csync_vio_handle_t *handle, std::vector<csync_file_stat_t> *entries, OCC::Vfs *vfs) {
+  entries->clear();
+  while (true) {
+      auto file_stat = csync_vio_local_readdir(handle, vfs);
+      if (!file_stat) {
+          return errno != 0 ? -1 : 0;
+      }
+      entries->push_back(std::move(*file_stat));
+  }
+}
+
 int csync_vio_local_stat(const QString &uri, csync_file_stat_t *buf)
 {
     /* Almost nothing to do since csync_vio_local_readdir already filled up most of the information
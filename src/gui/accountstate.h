@@ -260,7 +260,6 @@ private:
 
     QTimer _checkConnectionTimer;
     QElapsedTimer _lastCheckConnectionTimer;
-
 };
 
 class AccountApp : public QObject
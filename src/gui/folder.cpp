@@ -611,6 +611,7 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
 
     // Also schedule this folder for a sync, but only after some delay:
     // The sync will not upload files that were changed too recently.
+    _scheduleForLocalChanges = true;
     scheduleThisFolderSoon();
 }
 
@@ -810,6 +811,14 @@ void Folder::wipeForRemoval()
     QFile::remove(stateDbFile + "-wal");
     QFile::remove(stateDbFile + "-journal");
 
+    const auto metadataShards = _journal.metadataShardFilePaths();
+    for (const auto &shardFile : metadataShards) {
+        QFile::remove(shardFile);
+        QFile::remove(shardFile + "-shm");
+        QFile::remove(shardFile + "-wal");
+        QFile::remove(shardFile + "-journal");
+    }
+
     _vfs->stop();
     _vfs->unregisterFolder();
     _vfs.reset(nullptr); // warning: folder now in an invalid state
@@ -916,6 +925,9 @@ void Folder::setSyncOptions()
     opt.fillFromEnvironmentVariables();
     opt.verifyChunkSizes();
 
+    // Shared with the other folders syncing at the same time
+    opt._resourceShare = FolderMan::instance()->resourceShare(this);
+
     _engine->setSyncOptions(opt);
 }
 
@@ -1124,7 +1136,12 @@ void Folder::slotLogPropagationStart()
 
 void Folder::slotScheduleThisFolder()
 {
-    FolderMan::instance()->scheduleFolder(this);
+    if (_scheduleForLocalChanges) {
+        _scheduleForLocalChanges = false;
+        FolderMan::instance()->scheduleFolderForLocalChanges(this);
+    } else {
+        FolderMan::instance()->scheduleFolder(this);
+    }
 }
 
 void Folder::slotNextSyncFullLocalDiscovery()
@@ -477,6 +477,9 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    /// Whether _scheduleSelfTimer was started for locally changed files
+    bool _scheduleForLocalChanges = false;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
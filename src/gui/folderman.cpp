@@ -63,6 +63,12 @@ FolderMan::FolderMan(QObject *parent)
     QObject::connect(&_etagPollTimer, &QTimer::timeout, this, &FolderMan::slotEtagPollTimerTimeout);
     _etagPollTimer.start();
 
+    _maxParallelSyncs = cfg.maxParallelSyncs();
+    const auto maxParallelSyncsEnv = qgetenv("OWNCLOUD_MAX_PARALLEL_SYNCS").toInt();
+    if (maxParallelSyncsEnv > 0)
+        _maxParallelSyncs = maxParallelSyncsEnv;
+    _maxParallelSyncs = qMax(1, _maxParallelSyncs);
+
     _startScheduledSyncTimer.setSingleShot(true);
     connect(&_startScheduledSyncTimer, &QTimer::timeout,
         this, &FolderMan::slotStartScheduledFolderSync);
@@ -123,6 +129,12 @@ void FolderMan::unloadFolder(Folder *f)
         _socketApi.data(), &SocketApi::broadcastStatusPushMessage);
     disconnect(f, &Folder::watchedFileChangedExternally,
         &f->syncEngine().syncFileStatusTracker(), &SyncFileStatusTracker::slotPathTouched);
+
+    _currentSyncFolders.removeAll(f);
+    _resourceBudget.release(_resourceShares.take(f));
+    _priorityFolders.remove(f);
+    _queuedSince.remove(f);
+    _lastQueueWait.remove(f);
 }
 
 int FolderMan::unloadAndDeleteAllFolders()
@@ -141,7 +153,7 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = nullptr;
-    _currentSyncFolder = nullptr;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
@@ -630,7 +642,8 @@ void FolderMan::scheduleFolder(Folder *f)
         }
         f->prepareToSync();
         emit folderSyncStateChange(f);
-        _scheduledFolders.enqueue(f);
+        _priorityFolders.remove(f);
+        enqueueFolder(f, _scheduledFolders.size());
         emit scheduleQueueChanged();
     } else {
         qCInfo(lcFolderMan) << "Sync for folder " << alias << " already scheduled, do not enqueue!";
@@ -649,16 +662,55 @@ void FolderMan::scheduleFolderNext(Folder *f)
         return;
     }
 
-    _scheduledFolders.removeAll(f);
-
     f->prepareToSync();
     emit folderSyncStateChange(f);
-    _scheduledFolders.prepend(f);
+    enqueueFolder(f, 0);
     emit scheduleQueueChanged();
 
     startScheduledSyncSoon();
 }
 
+void FolderMan::scheduleFolderForLocalChanges(Folder *f)
+{
+    qCInfo(lcFolderMan) << "Schedule folder " << f->alias() << " to sync for local changes!";
+
+    if (!f->canSync()) {
+        qCInfo(lcFolderMan) << "Folder is not ready to sync, not scheduled!";
+        _socketApi->slotUpdateFolderView(f);
+        return;
+    }
+
+    // Behind the other folders with local changes, ahead of everything else
+    int index = 0;
+    while (index < _scheduledFolders.size()
+        && _scheduledFolders.at(index) != f
+        && _priorityFolders.contains(_scheduledFolders.at(index))) {
+        ++index;
+    }
+    if (!_scheduledFolders.contains(f)) {
+        f->prepareToSync();
+        emit folderSyncStateChange(f);
+    }
+    _priorityFolders.insert(f);
+    enqueueFolder(f, index);
+    emit scheduleQueueChanged();
+
+    startScheduledSyncSoon();
+}
+
+void FolderMan::enqueueFolder(Folder *f, int index)
+{
+    const auto oldIndex = _scheduledFolders.indexOf(f);
+    if (oldIndex < 0) {
+        _queuedSince[f].start();
+    } else {
+        _scheduledFolders.removeAt(oldIndex);
+        if (oldIndex < index)
+            --index;
+    }
+    _scheduledFolders.insert(qMin(index, _scheduledFolders.size()), f);
+}
+
 void FolderMan::slotScheduleETagJob(const QString & /*alias*/, RequestEtagJob *job)
 {
     QObject::connect(job, &QObject::destroyed, this, &FolderMan::slotEtagJobDestroyed);
@@ -761,7 +813,7 @@ void FolderMan::startScheduledSyncSoon()
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (isAnySyncRunning()) {
+    if (runningSyncCount() >= _maxParallelSyncs) {
         return;
     }
 
@@ -769,7 +821,9 @@ void FolderMan::startScheduledSyncSoon()
     qint64 msSinceLastSync = 0;
 
     // Require a pause based on the duration of the last sync run.
-    if (Folder *lastFolder = _lastSyncFolder) {
+    // Local changes don't wait for it, the user is likely waiting for them.
+    Folder *lastFolder = _lastSyncFolder;
+    if (lastFolder && !_priorityFolders.contains(_scheduledFolders.head())) {
         msSinceLastSync = lastFolder->msecSinceLastSync().count();
 
         //  1s   -> 1.5s pause
@@ -799,7 +853,7 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (isAnySyncRunning()) {
+    if (runningSyncCount() >= _maxParallelSyncs) {
         for (auto f : _folderMap) {
             if (f->isSyncRunning())
                 qCInfo(lcFolderMan) << "Currently folder " << f->remoteUrl().toString() << " is running, wait for finish!";
@@ -817,28 +871,40 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = nullptr;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
-        }
-    }
+    // Start the first folders in the queue that can be synced, as many as
+    // there are free slots. Folders that are still syncing stay queued.
+    bool queueChanged = false;
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext() && runningSyncCount() < _maxParallelSyncs) {
+        Folder *folder = it.next();
+        if (folder->isSyncRunning() || _currentSyncFolders.contains(folder))
+            continue;
 
-    emit scheduleQueueChanged();
+        it.remove();
+        queueChanged = true;
+        const bool priority = _priorityFolders.remove(folder);
+        const auto queuedSince = _queuedSince.take(folder);
+        const auto waited = std::chrono::milliseconds(queuedSince.isValid() ? queuedSince.elapsed() : 0);
+        if (!folder->canSync())
+            continue;
+
+        _lastQueueWait[folder] = waited;
+        qCInfo(lcFolderMan) << "Folder" << folder->alias() << "waited" << waited.count() << "ms in the queue,"
+                            << _currentSyncFolders.size() << "other syncs running";
 
-    // Start syncing this folder!
-    if (folder) {
         // Safe to call several times, and necessary to try again if
         // the folder path didn't exist previously.
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
+        // Start syncing this folder!
+        _currentSyncFolders.append(folder);
+        _resourceShares.insert(folder, _resourceBudget.acquire(priority));
         folder->startSync(QStringList());
     }
+
+    if (queueChanged)
+        emit scheduleQueueChanged();
 }
 
 bool FolderMan::pushNotificationsFilesReady(Account *account)
@@ -1030,7 +1096,7 @@ void FolderMan::slotScheduleFolderByTime()
 
 bool FolderMan::isAnySyncRunning() const
 {
-    if (_currentSyncFolder)
+    if (!_currentSyncFolders.isEmpty())
         return true;
 
     for (auto f : _folderMap) {
@@ -1071,12 +1137,21 @@ void FolderMan::slotFolderSyncFinished(const SyncResult &)
         qPrintable(f->accountState()->account()->displayName()),
         qPrintable(f->remoteUrl().toString()));
 
-    if (f == _currentSyncFolder) {
-        _lastSyncFolder = _currentSyncFolder;
-        _currentSyncFolder = nullptr;
+    if (_currentSyncFolders.removeAll(f) > 0) {
+        _lastSyncFolder = f;
+        _resourceBudget.release(_resourceShares.take(f));
     }
-    if (!isAnySyncRunning())
-        startScheduledSyncSoon();
+    startScheduledSyncSoon();
+}
+
+int FolderMan::runningSyncCount() const
+{
+    int count = 0;
+    for (auto f : _folderMap) {
+        if (f->isSyncRunning() || _currentSyncFolders.contains(f))
+            ++count;
+    }
+    return count;
 }
 
 Folder *FolderMan::addFolder(AccountState *accountState, const FolderDefinition &folderDefinition)
@@ -1332,10 +1407,10 @@ void FolderMan::slotWipeFolderForAccount(AccountState *accountState)
 
         qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-        const bool currentlyRunning = (_currentSyncFolder == f);
+        const bool currentlyRunning = _currentSyncFolders.contains(f);
         if (currentlyRunning) {
             // abort the sync now
-            _currentSyncFolder->slotTerminateSync();
+            f->slotTerminateSync();
         }
 
         if (_scheduledFolders.removeAll(f) > 0) {
@@ -1696,9 +1771,26 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
+QVector<Folder *> FolderMan::currentSyncFolders() const
+{
+    return _currentSyncFolders;
+}
+
 Folder *FolderMan::currentSyncFolder() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders.isEmpty() ? nullptr : _currentSyncFolders.last();
+}
+
+std::chrono::milliseconds FolderMan::queueWaitTime(Folder *f) const
+{
+    if (_scheduledFolders.contains(f) && _queuedSince.value(f).isValid())
+        return std::chrono::milliseconds(_queuedSince.value(f).elapsed());
+    return _lastQueueWait.value(f, std::chrono::milliseconds(0));
+}
+
+QSharedPointer<SyncResourceBudget::Share> FolderMan::resourceShare(Folder *f) const
+{
+    return _resourceShares.value(f);
 }
 
 void FolderMan::restartApplication()
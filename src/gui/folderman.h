@@ -19,11 +19,15 @@
 #include <QObject>
 #include <QQueue>
 #include <QList>
+#include <QElapsedTimer>
+
+#include <chrono>
 
 #include "folder.h"
 #include "folderwatcher.h"
 #include "navigationpanehelper.h"
 #include "syncfileitem.h"
+#include "syncresourcebudget.h"
 
 class TestFolderMan;
 
@@ -163,15 +167,32 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      *
-     * Note: This is only the folder that's currently syncing *as-scheduled*. There
+     * Note: These are only the folders that are currently syncing *as-scheduled*. There
      * may be externally-managed syncs such as from placeholder hydrations.
      *
      * See also isAnySyncRunning()
      */
+    QVector<Folder *> currentSyncFolders() const;
+
+    /** The most recently started of the currentSyncFolders(), or null */
     Folder *currentSyncFolder() const;
 
+    /** How many folders may sync at the same time */
+    int maxParallelSyncs() const { return _maxParallelSyncs; }
+
+    /**
+     * How long the folder waits or waited in the queue.
+     *
+     * While the folder is scheduled this is the time since it was queued,
+     * afterwards the time its last scheduled sync had to wait.
+     */
+    std::chrono::milliseconds queueWaitTime(Folder *f) const;
+
+    /** The part of the resource budget of the folder's running sync, or null */
+    QSharedPointer<SyncResourceBudget::Share> resourceShare(Folder *f) const;
+
     /**
      * Returns true if any folder is currently syncing.
      *
@@ -195,6 +216,15 @@ public:
     /** Puts a folder in the very front of the queue. */
     void scheduleFolderNext(Folder *);
 
+    /**
+     * Queues a folder in which files were changed locally.
+     *
+     * It goes ahead of the folders queued for other reasons, doesn't wait
+     * for the pause after the previous sync and gets a larger part of the
+     * resource budget while it syncs.
+     */
+    void scheduleFolderForLocalChanges(Folder *);
+
     /** Queues all folders for syncing. */
     void scheduleAllFolders();
 
@@ -307,6 +337,12 @@ private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon();
 
+    /** The number of syncs running, scheduled or not */
+    int runningSyncCount() const;
+
+    /** Adds the folder to the queue, or moves it to \a index if it is already queued */
+    void enqueueFolder(Folder *f, int index);
+
     // finds all folder configuration files
     // and create the folders
     QString getBackupName(QString fullPathName) const;
@@ -329,8 +365,9 @@ private:
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder = nullptr;
+    QVector<Folder *> _currentSyncFolders;
     QPointer<Folder> _lastSyncFolder;
+    int _maxParallelSyncs = 1;
     bool _syncEnabled = true;
 
     /// Folder aliases from the settings that weren't read
@@ -350,6 +387,19 @@ private:
     /// Scheduled folders that should be synced as soon as possible
     QQueue<Folder *> _scheduledFolders;
 
+    /// Scheduled folders with local changes, they are at the front of the queue
+    QSet<Folder *> _priorityFolders;
+
+    /// When the scheduled folders were queued
+    QHash<Folder *, QElapsedTimer> _queuedSince;
+
+    /// How long the last scheduled sync of a folder waited in the queue
+    QHash<Folder *, std::chrono::milliseconds> _lastQueueWait;
+
+    /// Shared by the running syncs
+    SyncResourceBudget _resourceBudget;
+    QHash<Folder *, QSharedPointer<SyncResourceBudget::Share>> _resourceShares;
+
     /// Picks the next scheduled folder and starts the sync
     QTimer _startScheduledSyncTimer;
 
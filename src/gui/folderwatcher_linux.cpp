@@ -15,6 +15,12 @@
 #include "config.h"
 
 #include <sys/inotify.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/fanotify.h>
+#include <fcntl.h>
+#include <climits>
+#endif
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
@@ -26,11 +32,39 @@
 
 namespace OCC {
 
+namespace {
+    // Changes are reported once no event arrived for this long...
+    const int flushDelayMs = 100;
+    // ...but a constant stream of events doesn't delay them more than this
+    const int maxFlushDelayMs = 1000;
+    // Number of watches handed from the worker to the main thread at once
+    const int watchBatchSize = 1000;
+    // Reads of fanotify events handed to the main thread at once
+    const int fanotifyReadsPerBatch = 64;
+
+    bool isJournalFile(const QByteArray &fileName)
+    {
+        // Filter out journal changes - redundant with filtering in
+        // FolderWatcher::pathIsIgnored.
+        return fileName.startsWith("._sync_")
+            || fileName.startsWith(".csync_journal.db")
+            || fileName.startsWith(".sync_");
+    }
+}
+
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
     : QObject()
     , _parent(p)
     , _folder(path)
 {
+    _registrationPool.setMaxThreadCount(1);
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(flushDelayMs);
+    connect(&_flushTimer, &QTimer::timeout, this, &FolderWatcherPrivate::slotFlushChanges);
+
+    if (initFanotify())
+        return;
+
     _fd = inotify_init();
     if (_fd != -1) {
         _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
@@ -39,10 +73,19 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path
         qCWarning(lcFolderWatcher) << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
+    slotAddFolderRecursive(path);
 }
 
-FolderWatcherPrivate::~FolderWatcherPrivate() = default;
+FolderWatcherPrivate::~FolderWatcherPrivate()
+{
+    _abortRegistration = true;
+    _registrationPool.waitForDone();
+    _socket.reset();
+    if (_fd != -1)
+        close(_fd);
+    if (_mountFd != -1)
+        close(_mountFd);
+}
 
 // attention: result list passed by reference!
 bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullList)
@@ -69,66 +112,123 @@ bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullLi
     return ok;
 }
 
-void FolderWatcherPrivate::inotifyRegisterPath(const QString &path)
+void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
 {
-    if (path.isEmpty())
+    if (_fd == -1 || _pathToWatch.contains(path) || _pendingRegistrations.contains(path))
         return;
 
-    int wd = inotify_add_watch(_fd, path.toUtf8().constData(),
-        IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
-    if (wd > -1) {
-        _watchToPath.insert(wd, path);
-        _pathToWatch.insert(path, wd);
-    } else {
-        // If we're running out of memory or inotify watches, become
-        // unreliable.
-        if (_parent->_isReliable && (errno == ENOMEM || errno == ENOSPC)) {
-            _parent->_isReliable = false;
-            emit _parent->becameUnreliable(
-                tr("This problem usually happens when the inotify watches are exhausted. "
-                   "Check the FAQ for details."));
+    qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
+    _pendingRegistrations.insert(path);
+    _ready = false;
+
+    // Only the inotify calls and the directory listing happen on the worker,
+    // the maps are updated and the ignore list is consulted on this thread.
+    const int fd = _fd;
+    _registrationPool.start([this, fd, path] {
+        const auto root = QDir(path).absolutePath();
+        QStringList folders(root);
+        if (!findFoldersBelow(QDir(path), folders)) {
+            qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
         }
-    }
+
+        QVector<Watch> watches;
+        bool exhausted = false;
+        for (const auto &folder : qAsConst(folders)) {
+            if (_abortRegistration)
+                return;
+            const int wd = inotify_add_watch(fd, folder.toUtf8().constData(),
+                IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_ONLYDIR);
+            if (wd > -1) {
+                watches.append({ wd, folder });
+            } else if (errno == ENOMEM || errno == ENOSPC) {
+                // If we're running out of memory or inotify watches, become
+                // unreliable.
+                exhausted = true;
+                break;
+            }
+            if (watches.size() >= watchBatchSize) {
+                QMetaObject::invokeMethod(this, [this, path, watches] { addWatches(path, watches, false, false); }, Qt::QueuedConnection);
+                watches.clear();
+            }
+        }
+        QMetaObject::invokeMethod(this, [this, path, watches, exhausted] { addWatches(path, watches, true, exhausted); }, Qt::QueuedConnection);
+    });
 }
 
-void FolderWatcherPrivate::slotAddFolderRecursive(const QString &path)
+void FolderWatcherPrivate::addWatches(const QString &root, const QVector<Watch> &watches, bool done, bool exhausted)
 {
-    if (_pathToWatch.contains(path))
-        return;
-
+    const auto rootPath = QDir(root).absolutePath();
     int subdirs = 0;
-    qCDebug(lcFolderWatcher) << "(+) Watcher:" << path;
-
-    QDir inPath(path);
-    inotifyRegisterPath(inPath.absolutePath());
-
-    QStringList allSubfolders;
-    if (!findFoldersBelow(QDir(path), allSubfolders)) {
-        qCWarning(lcFolderWatcher) << "Could not traverse all sub folders";
-    }
-    QStringListIterator subfoldersIt(allSubfolders);
-    while (subfoldersIt.hasNext()) {
-        QString subfolder = subfoldersIt.next();
-        QDir folder(subfolder);
-        if (folder.exists() && !_pathToWatch.contains(folder.absolutePath())) {
+    for (const auto &watch : watches) {
+        if (watch.path != rootPath) {
             subdirs++;
-            if (_parent->pathIsIgnored(subfolder)) {
-                qCDebug(lcFolderWatcher) << "* Not adding" << folder.path();
+            if (_parent->pathIsIgnored(watch.path)) {
+                qCDebug(lcFolderWatcher) << "* Not adding" << watch.path;
+                // Another path may share the watch if it was registered before
+                if (!_watchToPath.contains(watch.wd))
+                    inotify_rm_watch(_fd, watch.wd);
                 continue;
             }
-            inotifyRegisterPath(folder.absolutePath());
-        } else {
-            qCDebug(lcFolderWatcher) << "    `-> discarded:" << folder.path();
         }
-    }
+        _watchToPath.insert(watch.wd, watch.path);
+        _pathToWatch.insert(watch.path, watch.wd);
 
+        const auto events = _unresolvedEvents.values(watch.wd);
+        _unresolvedEvents.remove(watch.wd);
+        for (const auto &fileName : events)
+            pathChanged(watch.path + '/' + fileName);
+    }
     if (subdirs > 0) {
         qCDebug(lcFolderWatcher) << "    `-> and" << subdirs << "subdirectories";
     }
+
+    if (exhausted && _parent->_isReliable) {
+        _parent->_isReliable = false;
+        emit _parent->becameUnreliable(
+            tr("This problem usually happens when the inotify watches are exhausted. "
+               "Check the FAQ for details."));
+    }
+
+    if (done) {
+        _pendingRegistrations.remove(root);
+        if (_pendingRegistrations.isEmpty()) {
+            _unresolvedEvents.clear();
+            _ready = true;
+        }
+    }
+}
+
+void FolderWatcherPrivate::pathChanged(const QString &path)
+{
+    if (_pendingChanges.isEmpty())
+        _pendingSince.start();
+    _pendingChanges.insert(path);
+
+    // Wait for the events to calm down, but not forever
+    if (!_flushTimer.isActive() || _pendingSince.elapsed() < maxFlushDelayMs)
+        _flushTimer.start();
+}
+
+void FolderWatcherPrivate::slotFlushChanges()
+{
+    QStringList paths;
+    paths.reserve(_pendingChanges.size());
+    for (const auto &path : qAsConst(_pendingChanges)) {
+        paths.append(path);
+        if (QFileInfo(path).isDir())
+            _parent->appendSubPaths(QDir(path), paths);
+    }
+    _pendingChanges.clear();
+    _parent->changeDetected(paths);
 }
 
 void FolderWatcherPrivate::slotReceivedNotification(int fd)
 {
+    if (_usesFanotify) {
+        readFanotifyEvents();
+        return;
+    }
+
     int len = 0;
     struct inotify_event *event = nullptr;
     size_t i = 0;
@@ -165,19 +265,27 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
             continue;
         }
 
+        if (event->mask & IN_Q_OVERFLOW) {
+            emit _parent->lostChanges();
+            continue;
+        }
+
         // Fire event for the path that was changed.
         if (event->len == 0 || event->wd <= -1)
             continue;
         QByteArray fileName(event->name);
-        // Filter out journal changes - redundant with filtering in
-        // FolderWatcher::pathIsIgnored.
-        if (fileName.startsWith("._sync_")
-            || fileName.startsWith(".csync_journal.db")
-            || fileName.startsWith(".sync_")) {
+        if (isJournalFile(fileName)) {
             continue;
         }
-        const QString p = _watchToPath[event->wd] + '/' + fileName;
-        _parent->changeDetected(p);
+        const auto watchPath = _watchToPath.constFind(event->wd);
+        if (watchPath == _watchToPath.constEnd()) {
+            // The worker registered the watch but we didn't get it yet
+            if (!_pendingRegistrations.isEmpty())
+                _unresolvedEvents.insert(event->wd, fileName);
+            continue;
+        }
+        const QString p = *watchPath + '/' + fileName;
+        pathChanged(p);
 
         if ((event->mask & (IN_MOVED_TO | IN_CREATE))
             && QFileInfo(p).isDir()
@@ -217,4 +325,146 @@ void FolderWatcherPrivate::removeFoldersBelow(const QString &path)
     }
 }
 
+#if defined(Q_OS_LINUX) && defined(FAN_REPORT_DFID_NAME)
+
+bool FolderWatcherPrivate::initFanotify()
+{
+    if (!qEnvironmentVariableIsSet("OWNCLOUD_FOLDERWATCHER_FANOTIFY"))
+        return false;
+
+    // Marking a whole filesystem needs CAP_SYS_ADMIN, resolving the directory
+    // handles needs CAP_DAC_READ_SEARCH. Without them, inotify is used.
+    const int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_init() failed, using inotify:" << strerror(errno);
+        return false;
+    }
+    const auto folder = _folder.toUtf8();
+    const uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_ONDIR;
+    // Mount marks can't report directory entry events, so the mark covers the
+    // filesystem and the events outside of the folder are dropped on the worker
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, folder.constData()) == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_mark() failed, using inotify:" << strerror(errno);
+        close(fd);
+        return false;
+    }
+    _mountFd = open(folder.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_mountFd == -1) {
+        close(fd);
+        return false;
+    }
+
+    // Folder::path() ends with a slash, the resolved paths are canonical
+    _fanotifyRoot = QFileInfo(_folder).canonicalFilePath();
+    if (_fanotifyRoot.isEmpty()) {
+        close(_mountFd);
+        _mountFd = -1;
+        close(fd);
+        return false;
+    }
+
+    qCInfo(lcFolderWatcher) << "Using fanotify for" << _folder;
+    _fd = fd;
+    _usesFanotify = true;
+    _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
+    connect(_socket.data(), &QSocketNotifier::activated, this, &FolderWatcherPrivate::slotReceivedNotification);
+    return true;
+}
+
+namespace {
+    struct FanotifyBatch
+    {
+        QStringList paths; // relative to the watched folder, empty for the folder itself
+        bool lostChanges = false;
+    };
+
+    // Reads the pending events, resolving the directory handles is too slow for the main thread
+    FanotifyBatch readFanotifyBatch(int fd, int mountFd, const QString &root)
+    {
+        FanotifyBatch batch;
+        alignas(fanotify_event_metadata) char buffer[8192];
+        const QString rootSlash = root + QLatin1Char('/');
+
+        for (int reads = 0; reads < fanotifyReadsPerBatch; ++reads) {
+            auto len = read(fd, buffer, sizeof(buffer));
+            if (len <= 0)
+                return batch;
+
+            for (auto metadata = reinterpret_cast<fanotify_event_metadata *>(buffer);
+                 FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len)) {
+                if (metadata->vers != FANOTIFY_METADATA_VERSION)
+                    return batch;
+                if (metadata->mask & FAN_Q_OVERFLOW) {
+                    batch.lostChanges = true;
+                    continue;
+                }
+
+                const auto info = reinterpret_cast<fanotify_event_info_fid *>(metadata + 1);
+                if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+                    continue;
+                const auto handle = reinterpret_cast<file_handle *>(info->handle);
+                const QByteArray fileName(reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes));
+                if (isJournalFile(fileName))
+                    continue;
+
+                // The event only identifies the directory by its handle
+                const int dirFd = open_by_handle_at(mountFd, handle, O_PATH | O_CLOEXEC);
+                if (dirFd == -1)
+                    continue; // gone already, its parent got an event as well
+                char dirPath[PATH_MAX];
+                const auto dirPathLen = readlink(QByteArray("/proc/self/fd/" + QByteArray::number(dirFd)).constData(), dirPath, sizeof(dirPath));
+                close(dirFd);
+                if (dirPathLen <= 0)
+                    continue;
+
+                auto path = QString::fromUtf8(dirPath, static_cast<int>(dirPathLen));
+                if (fileName != ".")
+                    path += QLatin1Char('/') + QString::fromUtf8(fileName);
+                // The mark covers the whole filesystem
+                if (path == root)
+                    batch.paths.append(QString());
+                else if (path.startsWith(rootSlash))
+                    batch.paths.append(path.mid(root.size()));
+            }
+        }
+        return batch;
+    }
+}
+
+void FolderWatcherPrivate::readFanotifyEvents()
+{
+    // The notifier is back on once the worker handed over what it read
+    _socket->setEnabled(false);
+    const int fd = _fd;
+    const int mountFd = _mountFd;
+    const auto root = _fanotifyRoot;
+    _registrationPool.start([this, fd, mountFd, root] {
+        if (_abortRegistration)
+            return;
+        const auto batch = readFanotifyBatch(fd, mountFd, root);
+        QMetaObject::invokeMethod(this, [this, batch] {
+            if (batch.lostChanges)
+                emit _parent->lostChanges();
+            // Report the paths below the folder as it was given to us
+            const auto folder = QDir::cleanPath(_folder);
+            for (const auto &relativePath : batch.paths)
+                pathChanged(folder + relativePath);
+            _socket->setEnabled(true);
+        }, Qt::QueuedConnection);
+    });
+}
+
+#else
+
+bool FolderWatcherPrivate::initFanotify()
+{
+    return false;
+}
+
+void FolderWatcherPrivate::readFanotifyEvents()
+{
+}
+
+#endif
+
 } // ns mirall
@@ -20,15 +20,32 @@
 #include <QSocketNotifier>
 #include <QHash>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QMultiHash>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
 
-#include "folderwatcher.h"
+#include <atomic>
 
-class QTimer;
+#include "folderwatcher.h"
 
 namespace OCC {
 
 /**
  * @brief Linux (inotify) API implementation of FolderWatcher
+ *
+ * Watches are registered on a worker thread, a tree with many directories
+ * would block the GUI otherwise. Changes are collected and reported in
+ * batches once the events calm down, so bursts of events for the same
+ * paths don't turn into a flood of signals.
+ *
+ * If OWNCLOUD_FOLDERWATCHER_FANOTIFY is set and the process has the
+ * privileges, fanotify is used instead: a single mark on the filesystem
+ * replaces the per-directory watches. The events are read and resolved to
+ * paths on the worker thread.
+ *
  * @ingroup gui
  */
 class FolderWatcherPrivate : public QObject
@@ -41,26 +58,54 @@ public:
 
     int testWatchCount() const { return _pathToWatch.size(); }
 
-    /// On linux the watcher is ready when the ctor finished.
+    /// On linux the watcher is ready when the initial watches are registered.
     bool _ready = true;
 
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotFlushChanges();
 
 protected:
-    bool findFoldersBelow(const QDir &dir, QStringList &fullList);
-    void inotifyRegisterPath(const QString &path);
+    static bool findFoldersBelow(const QDir &dir, QStringList &fullList);
     void removeFoldersBelow(const QString &path);
 
 private:
-    FolderWatcher *_parent;
+    struct Watch
+    {
+        int wd;
+        QString path;
+    };
+
+    // Called on the main thread with the watches the worker registered
+    void addWatches(const QString &root, const QVector<Watch> &watches, bool done, bool exhausted);
+    void pathChanged(const QString &path);
+    bool initFanotify();
+    void readFanotifyEvents();
+
+    FolderWatcher *_parent = nullptr;
 
     QString _folder;
     QHash<int, QString> _watchToPath;
     QMap<QString, int> _pathToWatch;
     QScopedPointer<QSocketNotifier> _socket;
-    int _fd;
+    int _fd = -1;
+
+    // Registration of watches, or reading the fanotify events, on a single
+    // worker thread in request order
+    QThreadPool _registrationPool;
+    std::atomic<bool> _abortRegistration { false };
+    QSet<QString> _pendingRegistrations;
+    // Events for watches the worker registered but whose path isn't known here yet
+    QMultiHash<int, QByteArray> _unresolvedEvents;
+
+    QSet<QString> _pendingChanges;
+    QTimer _flushTimer;
+    QElapsedTimer _pendingSince;
+
+    bool _usesFanotify = false;
+    int _mountFd = -1;
+    QString _fanotifyRoot; /// canonical path of the folder, without the trailing slash
 };
 }
 
@@ -31,6 +31,7 @@
 
 #include "configfile.h"
 #include "logger.h"
+#include "common/tracing.h"
 
 namespace OCC {
 
@@ -73,6 +74,13 @@ LogBrowser::LogBrowser(QWidget *parent)
     label->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::MinimumExpanding);
     mainLayout->addWidget(label);
 
+    auto traceButton = new QCheckBox;
+    traceButton->setText(tr("Record a performance trace of the syncs"));
+    traceButton->setToolTip(tr("Written to the same folder until the client quits, it can be opened with ui.perfetto.dev"));
+    traceButton->setChecked(Tracing::isEnabled());
+    connect(traceButton, &QCheckBox::toggled, this, &LogBrowser::toggleTracing);
+    mainLayout->addWidget(traceButton);
+
     auto openFolderButton = new QPushButton;
     openFolderButton->setText(tr("Open folder"));
     connect(openFolderButton, &QPushButton::clicked, this, []() {
@@ -125,4 +133,10 @@ void LogBrowser::togglePermanentLogging(bool enabled)
     }
 }
 
+void LogBrowser::toggleTracing(bool enabled)
+{
+    // Not persisted, the trace file has no size limit
+    Logger::instance()->setTracingEnabled(enabled);
+}
+
 } // namespace
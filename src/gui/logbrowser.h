@@ -45,6 +45,7 @@ protected:
 
 protected slots:
     void togglePermanentLogging(bool enabled);
+    void toggleTracing(bool enabled);
 };
 
 } // namespace
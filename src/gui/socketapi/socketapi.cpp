@@ -218,8 +218,37 @@ void SocketListener::sendMessage(const QString &message, bool doWait) const
     }
 }
 
+void SocketListener::sendLines(const QByteArray &lines, int count) const
+{
+    if (!socket) {
+        qCWarning(lcSocketApi) << "Not sending" << count << "messages to dead socket";
+        return;
+    }
+
+    qCDebug(lcSocketApi) << "Sending" << count << "SocketAPI messages to" << socket;
+    if (socket->write(lines) != lines.size()) {
+        qCWarning(lcSocketApi) << "Could not send all data on socket for" << count << "messages";
+    }
+}
+
+bool SocketListener::isInterestedIn(const QString &systemPath, uint systemDirectoryHash) const
+{
+    if (_monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash))
+        return true;
+
+    const auto cs = Utility::fsCasePreserving() ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    for (const auto &directory : _subscribedDirectories) {
+        if (systemPath.startsWith(directory, cs)
+            && (systemPath.size() == directory.size() || systemPath.at(directory.size()) == QLatin1Char('/'))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 SocketApi::SocketApi(QObject *parent)
     : QObject(parent)
+    , _statusBroadcaster(_listeners)
 {
     QString socketPath;
 
@@ -289,6 +318,14 @@ SocketApi::SocketApi(QObject *parent)
 
     connect(&_localServer, &QLocalServer::newConnection, this, &SocketApi::slotNewConnection);
 
+    // Should the status pushes fall too far behind, let the extensions refresh everything
+    connect(&_statusBroadcaster, &SocketStatusBroadcaster::overflowed, this, [this] {
+        for (Folder *f : FolderMan::instance()->map()) {
+            if (f->canSync())
+                broadcastMessage(buildMessage(QLatin1String("UPDATE_VIEW"), removeTrailingSlash(f->path())));
+        }
+    });
+
     // folder watcher
     connect(FolderMan::instance(), &FolderMan::folderSyncStateChange, this, &SocketApi::slotUpdateFolderView);
 }
@@ -489,6 +526,8 @@ void SocketApi::slotUpdateFolderView(Folder *f)
 
 void SocketApi::broadcastMessage(const QString &msg, bool doWait)
 {
+    // Keep the queued status pushes ahead of e.g. UPDATE_VIEW
+    _statusBroadcaster.flushAll();
     for (const auto &listener : qAsConst(_listeners)) {
         listener->sendMessage(msg, doWait);
     }
@@ -543,12 +582,10 @@ void SocketApi::processShareRequest(const QString &localFile, SocketListener *li
 
 void SocketApi::broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus)
 {
-    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, fileStatus.toSocketAPIString());
     Q_ASSERT(!systemPath.endsWith('/'));
-    uint directoryHash = qHash(systemPath.left(systemPath.lastIndexOf('/')));
-    for (const auto &listener : qAsConst(_listeners)) {
-        listener->sendMessageIfDirectoryMonitored(msg, directoryHash);
-    }
+    if (_listeners.isEmpty())
+        return;
+    _statusBroadcaster.push(systemPath, fileStatus);
 }
 
 void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener)
@@ -579,6 +616,22 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketList
     listener->sendMessage(message);
 }
 
+void SocketApi::command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    auto directory = QDir::fromNativeSeparators(argument);
+    while (directory.endsWith(QLatin1Char('/')))
+        directory.chop(1);
+    listener->subscribeToDirectory(directory);
+}
+
+void SocketApi::command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener)
+{
+    auto directory = QDir::fromNativeSeparators(argument);
+    while (directory.endsWith(QLatin1Char('/')))
+        directory.chop(1);
+    listener->unsubscribeFromDirectory(directory);
+}
+
 void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener)
 {
     processShareRequest(localFile, listener, ShareDialogStartPage::UsersAndGroups);
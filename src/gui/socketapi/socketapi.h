@@ -21,6 +21,7 @@
 #include "common/syncjournalfilerecord.h"
 
 #include "config.h"
+#include "socketapi/socketstatusbroadcaster.h"
 
 #include <QLocalServer>
 
@@ -108,6 +109,12 @@ private:
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener);
 
+    /** Status pushes are sent for everything below the given directory,
+     * not only for the directories the listener retrieved a status in.
+     */
+    Q_INVOKABLE void command_SUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
+    Q_INVOKABLE void command_UNSUBSCRIBE_STATUS(const QString &argument, SocketListener *listener);
+
     Q_INVOKABLE void command_VERSION(const QString &argument, SocketListener *listener);
 
     Q_INVOKABLE void command_SHARE_MENU_TITLE(const QString &argument, SocketListener *listener);
@@ -188,6 +195,7 @@ private:
 
     QSet<QString> _registeredAliases;
     QMap<QIODevice *, QSharedPointer<SocketListener>> _listeners;
+    SocketStatusBroadcaster _statusBroadcaster;
     QLocalServer _localServer;
 };
 }
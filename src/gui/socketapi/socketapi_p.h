@@ -20,6 +20,7 @@
 #include <functional>
 #include <QBitArray>
 #include <QPointer>
+#include <QStringList>
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -77,19 +78,32 @@ public:
         sendMessage(QStringLiteral("ERROR:") + message, doWait);
     }
 
-    void sendMessageIfDirectoryMonitored(const QString &message, uint systemDirectoryHash) const
-    {
-        if (_monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash))
-            sendMessage(message, false);
-    }
+    /// Writes \a count messages at once, encoded and terminated by newlines
+    void sendLines(const QByteArray &lines, int count) const;
+
+    /// Whether status pushes for \a systemPath should be sent to this listener
+    bool isInterestedIn(const QString &systemPath, uint systemDirectoryHash) const;
 
     void registerMonitoredDirectory(uint systemDirectoryHash)
     {
         _monitoredDirectoriesBloomFilter.storeHash(systemDirectoryHash);
     }
 
+    /// Status pushes for \a systemPath and everything below are sent, see SUBSCRIBE_STATUS
+    void subscribeToDirectory(const QString &systemPath)
+    {
+        if (!_subscribedDirectories.contains(systemPath))
+            _subscribedDirectories.append(systemPath);
+    }
+
+    void unsubscribeFromDirectory(const QString &systemPath)
+    {
+        _subscribedDirectories.removeAll(systemPath);
+    }
+
 private:
     BloomFilter _monitoredDirectoriesBloomFilter;
+    QStringList _subscribedDirectories;
 };
 
 class ListenerClosure : public QObject
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "socketstatusbroadcaster.h"
+#include "socketapi.h"
+#include "socketapi_p.h"
+
+#include <QDir>
+
+#include <vector>
+
+namespace OCC {
+
+constexpr int SocketStatusBroadcaster::defaultDelay;
+constexpr int SocketStatusBroadcaster::defaultMaxBatchSize;
+constexpr int SocketStatusBroadcaster::defaultMaxQueueSize;
+
+namespace {
+    const qint64 statsLogInterval = 60 * 1000;
+}
+
+SocketStatusBroadcaster::SocketStatusBroadcaster(const QMap<QIODevice *, QSharedPointer<SocketListener>> &listeners, QObject *parent)
+    : QObject(parent)
+    , _listeners(listeners)
+{
+    _timer.setSingleShot(true);
+    _timer.setInterval(defaultDelay);
+    connect(&_timer, &QTimer::timeout, this, &SocketStatusBroadcaster::flush);
+    _sinceStatsLogged.start();
+}
+
+void SocketStatusBroadcaster::push(const QString &systemPath, SyncFileStatus fileStatus)
+{
+    ++_stats.queued;
+    auto it = _statuses.find(systemPath);
+    if (it != _statuses.end()) {
+        *it = fileStatus;
+        ++_stats.merged;
+        return;
+    }
+
+    if (_order.size() >= _maxQueueSize) {
+        qCWarning(lcSocketApi) << "Too many status changes to push, dropping" << _order.size() + 1 << "of them";
+        _stats.dropped += _order.size() + 1;
+        _order.clear();
+        _statuses.clear();
+        _timer.stop();
+        logStats(true);
+        emit overflowed();
+        return;
+    }
+
+    _order.enqueue(systemPath);
+    _statuses.insert(systemPath, fileStatus);
+    // Not restarted by further pushes, so that nothing waits longer than the delay
+    if (!_timer.isActive())
+        _timer.start();
+}
+
+void SocketStatusBroadcaster::flush()
+{
+    _timer.stop();
+    if (_order.isEmpty())
+        return;
+
+    struct Message
+    {
+        QString systemPath;
+        uint directoryHash;
+        QByteArray line;
+    };
+    std::vector<Message> messages;
+    messages.reserve(static_cast<size_t>(qMin(_order.size(), _maxBatchSize)));
+    while (!_order.isEmpty() && static_cast<int>(messages.size()) < _maxBatchSize) {
+        auto systemPath = _order.dequeue();
+        const auto fileStatus = _statuses.take(systemPath);
+        Q_ASSERT(!systemPath.endsWith(QLatin1Char('/')));
+        const auto directoryHash = qHash(systemPath.left(systemPath.lastIndexOf(QLatin1Char('/'))));
+        auto line = (QStringLiteral("STATUS:") + fileStatus.toSocketAPIString() + QLatin1Char(':')
+            + QDir::toNativeSeparators(systemPath) + QLatin1Char('\n')).toUtf8();
+        messages.push_back({ std::move(systemPath), directoryHash, std::move(line) });
+    }
+
+    for (const auto &listener : _listeners) {
+        QByteArray lines;
+        int count = 0;
+        for (const auto &message : messages) {
+            if (listener->isInterestedIn(message.systemPath, message.directoryHash)) {
+                lines += message.line;
+                ++count;
+            }
+        }
+        if (count > 0) {
+            listener->sendLines(lines, count);
+            _stats.sent += static_cast<quint64>(count);
+        }
+    }
+
+    if (!_order.isEmpty())
+        _timer.start();
+    logStats(false);
+}
+
+void SocketStatusBroadcaster::flushAll()
+{
+    while (!_order.isEmpty())
+        flush();
+    _timer.stop();
+}
+
+SocketStatusBroadcaster::Stats SocketStatusBroadcaster::stats() const
+{
+    auto stats = _stats;
+    stats.queueDepth = _order.size();
+    return stats;
+}
+
+void SocketStatusBroadcaster::logStats(bool force)
+{
+    if (!force && _sinceStatsLogged.elapsed() < statsLogInterval)
+        return;
+    const auto current = stats();
+    qCInfo(lcSocketApi) << "Status pushes: queue depth" << current.queueDepth << "queued" << current.queued
+                        << "merged" << current.merged << "dropped" << current.dropped << "sent" << current.sent;
+    _sinceStatsLogged.restart();
+}
+
+}
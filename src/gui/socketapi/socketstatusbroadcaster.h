@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "common/syncfilestatus.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QTimer>
+
+class QIODevice;
+
+namespace OCC {
+
+class SocketListener;
+
+/**
+ * @brief Coalesces the STATUS pushes sent to the shell extensions
+ *
+ * SyncFileStatusTracker reports every change of a file together with all
+ * its parent directories, so a sync of many files produces many times more
+ * status changes, mostly for the same few directories.
+ *
+ * The statuses are queued for a short delay, during which a new status of a
+ * path replaces the queued one. The queue is then sent to each listener that
+ * is interested in the paths in a single write, as lines of the usual
+ * STATUS:<status>:<path> form. At most maxBatchSize statuses are sent per
+ * delay, the rest waits for the next one.
+ *
+ * Should the queue grow beyond maxQueueSize anyway, it is dropped and
+ * overflowed() is emitted, so the listeners can be asked to refresh
+ * everything at once instead.
+ *
+ * @ingroup gui
+ */
+class SocketStatusBroadcaster : public QObject
+{
+    Q_OBJECT
+public:
+    struct Stats
+    {
+        int queueDepth = 0;
+        quint64 queued = 0; /// statuses pushed
+        quint64 merged = 0; /// statuses that replaced a queued one of the same path
+        quint64 dropped = 0; /// statuses discarded because the queue overflowed
+        quint64 sent = 0; /// messages written, once per listener
+    };
+
+    static constexpr int defaultDelay = 100; // ms
+    static constexpr int defaultMaxBatchSize = 1000;
+    static constexpr int defaultMaxQueueSize = 50000;
+
+    explicit SocketStatusBroadcaster(const QMap<QIODevice *, QSharedPointer<SocketListener>> &listeners, QObject *parent = nullptr);
+
+    void setDelay(int msec) { _timer.setInterval(msec); }
+    void setMaxBatchSize(int size) { _maxBatchSize = size; }
+    void setMaxQueueSize(int size) { _maxQueueSize = size; }
+
+    void push(const QString &systemPath, SyncFileStatus fileStatus);
+
+    /// Sends the next batch right away
+    void flush();
+
+    /// Sends everything queued right away, e.g. to keep it ahead of another message
+    void flushAll();
+
+    Stats stats() const;
+
+signals:
+    /// The queued statuses were dropped, the listeners are out of date
+    void overflowed();
+
+private:
+    void logStats(bool force);
+
+    const QMap<QIODevice *, QSharedPointer<SocketListener>> &_listeners;
+    QQueue<QString> _order; /// the queued paths, each once
+    QHash<QString, SyncFileStatus> _statuses; /// the latest status of each queued path
+    QTimer _timer;
+    int _maxBatchSize = defaultMaxBatchSize;
+    int _maxQueueSize = defaultMaxQueueSize;
+
+    Stats _stats;
+    QElapsedTimer _sinceStatsLogged;
+};
+
+}
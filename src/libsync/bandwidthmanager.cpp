@@ -16,6 +16,7 @@
 #include "propagatedownload.h"
 #include "propagateupload.h"
 #include "propagatorjobs.h"
+#include "common/tracing.h"
 #include "common/utility.h"
 
 #ifdef Q_OS_WIN
@@ -147,6 +148,7 @@ void BandwidthManager::unregisterDownloadJob(QObject *o)
 
 void BandwidthManager::relativeUploadMeasuringTimerExpired()
 {
+    _uploadThrottleSlice.end();
     if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.empty()) {
         // Not in this limiting mode, just wait 1 sec to continue the cycle
         _relativeUploadDelayTimer.setInterval(1000);
@@ -199,6 +201,8 @@ void BandwidthManager::relativeUploadMeasuringTimerExpired()
         ud->giveBandwidthQuota(quotaPerDevice);
         qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
     }
+    _uploadThrottleSlice.begin("bandwidth", "upload limited",
+        QStringLiteral("%1 bytes for each of %2 uploads").arg(quotaPerDevice).arg(deviceCount));
     _relativeLimitCurrentMeasuredDevice = nullptr;
 }
 
@@ -206,6 +210,7 @@ void BandwidthManager::relativeUploadDelayTimerExpired()
 {
     // Switch to measuring state
     _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
+    _uploadThrottleSlice.end();
 
     if (!usingRelativeUploadLimit()) {
         return; // oh, not actually needed
@@ -235,6 +240,8 @@ void BandwidthManager::relativeUploadDelayTimerExpired()
             ud->setChoked(true);
         }
     }
+    _uploadThrottleSlice.begin("bandwidth", "upload measuring",
+        QStringLiteral("%1 uploads choked").arg(_relativeUploadDeviceList.size() - 1));
 
     // now we're in measuring state
 }
@@ -242,6 +249,7 @@ void BandwidthManager::relativeUploadDelayTimerExpired()
 // for downloads:
 void BandwidthManager::relativeDownloadMeasuringTimerExpired()
 {
+    _downloadThrottleSlice.end();
     if (!usingRelativeDownloadLimit() || _downloadJobList.empty()) {
         // Not in this limiting mode, just wait 1 sec to continue the cycle
         _relativeDownloadDelayTimer.setInterval(1000);
@@ -294,6 +302,8 @@ void BandwidthManager::relativeDownloadMeasuringTimerExpired()
         gfj->giveBandwidthQuota(quotaPerJob);
         qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
     }
+    _downloadThrottleSlice.begin("bandwidth", "download limited",
+        QStringLiteral("%1 bytes for each of %2 downloads").arg(quotaPerJob).arg(jobCount));
     _relativeLimitCurrentMeasuredDevice = nullptr;
 }
 
@@ -301,6 +311,7 @@ void BandwidthManager::relativeDownloadDelayTimerExpired()
 {
     // Switch to measuring state
     _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
+    _downloadThrottleSlice.end();
 
     if (!usingRelativeDownloadLimit()) {
         return; // oh, not actually needed
@@ -329,6 +340,8 @@ void BandwidthManager::relativeDownloadDelayTimerExpired()
             gfj->setChoked(true);
         }
     }
+    _downloadThrottleSlice.begin("bandwidth", "download measuring",
+        QStringLiteral("%1 downloads choked").arg(_downloadJobList.size() - 1));
 
     // now we're in measuring state
 }
@@ -378,6 +391,10 @@ void BandwidthManager::absoluteLimitTimerExpired()
     if (usingAbsoluteUploadLimit() && !_absoluteUploadDeviceList.empty()) {
         qint64 quotaPerDevice = _currentUploadLimit / qMax((std::list<UploadDevice *>::size_type)1, _absoluteUploadDeviceList.size());
         qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.size() << _currentUploadLimit;
+        if (Tracing::isEnabled()) {
+            Tracing::instant("bandwidth", "upload quota",
+                QStringLiteral("%1 bytes for each of %2 uploads").arg(quotaPerDevice).arg(_absoluteUploadDeviceList.size()));
+        }
         Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
             device->giveBandwidthQuota(quotaPerDevice);
             qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
@@ -386,6 +403,10 @@ void BandwidthManager::absoluteLimitTimerExpired()
     if (usingAbsoluteDownloadLimit() && !_downloadJobList.empty()) {
         qint64 quotaPerJob = _currentDownloadLimit / qMax((std::list<GETFileJob *>::size_type)1, _downloadJobList.size());
         qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.size() << _currentDownloadLimit;
+        if (Tracing::isEnabled()) {
+            Tracing::instant("bandwidth", "download quota",
+                QStringLiteral("%1 bytes for each of %2 downloads").arg(quotaPerJob).arg(_downloadJobList.size()));
+        }
         Q_FOREACH (GETFileJob *j, _downloadJobList) {
             j->giveBandwidthQuota(quotaPerJob);
             qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
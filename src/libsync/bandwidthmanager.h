@@ -20,6 +20,8 @@
 #include <QIODevice>
 #include <list>
 
+#include "common/tracing.h"
+
 namespace OCC {
 
 class UploadDevice;
@@ -99,6 +101,10 @@ private:
     qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
 
     qint64 _currentDownloadLimit;
+
+    // The phases of the relative limits, for the trace
+    Tracing::AsyncSlice _uploadThrottleSlice;
+    Tracing::AsyncSlice _downloadThrottleSlice;
 };
 
 } // namespace OCC
@@ -64,9 +64,17 @@ QByteArray getHeaderFromJsonReply(const QJsonObject &reply, const QByteArray &he
     return reply.value(headerName).toString().toLatin1();
 }
 
-constexpr auto batchSize = 100;
+constexpr auto maxBatchFileCount = 1000;
 
-constexpr auto parallelJobsMaximumCount = 1;
+// Besides its data every file costs some work on the server, counted as this many bytes
+constexpr qint64 perFileCost = 64 * 1024;
+
+// Batches are sized so that their request takes about this long
+constexpr std::chrono::milliseconds targetBatchDuration(3000);
+
+constexpr qint64 initialBatchSize = 100 * perFileCost;
+constexpr qint64 minBatchSize = 10 * perFileCost;
+constexpr qint64 maxBatchSize = 100 * 1000 * 1000;
 }
 
 namespace OCC {
@@ -75,9 +83,8 @@ BulkPropagatorJob::BulkPropagatorJob(OwncloudPropagator *propagator,
                                      const std::deque<SyncFileItemPtr> &items)
     : PropagatorJob(propagator)
     , _items(items)
+    , _batchSize(initialBatchSize)
 {
-    _filesToUpload.reserve(batchSize);
-    _pendingChecksumFiles.reserve(batchSize);
 }
 
 bool BulkPropagatorJob::scheduleSelfOrChild()
@@ -85,13 +92,20 @@ bool BulkPropagatorJob::scheduleSelfOrChild()
     if (_items.empty()) {
         return false;
     }
-    if (!_pendingChecksumFiles.empty()) {
+    // One batch is hashed at a time, while the previous ones are uploaded
+    if (!_pendingChecksumFiles.empty() || _jobs.size() >= propagator()->maximumActiveTransferJob()) {
         return false;
     }
 
     _state = Running;
-    for(int i = 0; i < batchSize && !_items.empty(); ++i) {
+    qint64 batchCost = 0;
+    for(int i = 0; i < maxBatchFileCount && !_items.empty(); ++i) {
         auto currentItem = _items.front();
+        const auto cost = currentItem->_size + perFileCost;
+        if (i > 0 && batchCost + cost > _batchSize) {
+            break;
+        }
+        batchCost += cost;
         _items.pop_front();
         _pendingChecksumFiles.insert(currentItem->_file);
         QMetaObject::invokeMethod(this, [this, currentItem] () {
@@ -184,23 +198,24 @@ void BulkPropagatorJob::doStartUpload(SyncFileItemPtr item,
     _filesToUpload.push_back(std::move(newUploadFile));
     _pendingChecksumFiles.remove(item->_file);
 
-    if (_pendingChecksumFiles.empty()) {
-        triggerUpload();
-    }
+    checkPropagationIsDone();
 }
 
 void BulkPropagatorJob::triggerUpload()
 {
+    qCInfo(lcBulkPropagatorJob) << "Uploading a batch of" << _filesToUpload.size() << "files, batches running:" << _jobs.size();
+
     auto uploadParametersData = std::vector<SingleUploadFileData>{};
     uploadParametersData.reserve(_filesToUpload.size());
 
     int timeout = 0;
     for(auto &singleFile : _filesToUpload) {
-        // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
-        auto device = std::make_unique<UploadDevice>(
-                singleFile._localPath, 0, singleFile._fileSize, &propagator()->_bandwidthManager);
-        if (!device->open(QIODevice::ReadOnly)) {
-            qCWarning(lcBulkPropagatorJob) << "Could not prepare upload device: " << device->errorString();
+        // The files are only read while the request is sent, one at a time,
+        // but find out now whether they can be opened
+        QFile file(singleFile._localPath);
+        QString openError;
+        if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, 0)) {
+            qCWarning(lcBulkPropagatorJob) << "Could not prepare upload device: " << openError;
 
             // If the file is currently locked, we want to retry the sync
             // when it becomes available again.
@@ -208,18 +223,19 @@ void BulkPropagatorJob::triggerUpload()
                 emit propagator()->seenLockedFile(singleFile._localPath);
             }
 
-            abortWithError(singleFile._item, SyncFileItem::NormalError, device->errorString());
+            abortWithError(singleFile._item, SyncFileItem::NormalError, openError);
             emit finished(SyncFileItem::NormalError);
 
             return;
         }
         singleFile._headers["X-File-Path"] = singleFile._remotePath.toUtf8();
-        uploadParametersData.push_back({std::move(device), singleFile._headers});
+        uploadParametersData.push_back({singleFile._localPath, singleFile._fileSize, singleFile._headers});
         timeout += singleFile._fileSize;
     }
 
     const auto bulkUploadUrl = Utility::concatUrlPath(propagator()->account()->url(), QStringLiteral("/remote.php/dav/bulk"));
-    auto job = std::make_unique<PutMultiFileJob>(propagator()->account(), bulkUploadUrl, std::move(uploadParametersData), this);
+    auto job = std::make_unique<PutMultiFileJob>(propagator()->account(), bulkUploadUrl, std::move(uploadParametersData),
+        &propagator()->_bandwidthManager, this);
     connect(job.get(), &PutMultiFileJob::finishedSignal, this, &BulkPropagatorJob::slotPutFinished);
 
     for(auto &singleFile : _filesToUpload) {
@@ -231,14 +247,17 @@ void BulkPropagatorJob::triggerUpload()
 
     adjustLastJobTimeout(job.get(), timeout);
     _jobs.append(job.get());
+    _filesInTransit[job.get()].swap(_filesToUpload);
     job.release()->start();
-    if (parallelism() == PropagatorJob::JobParallelism::FullParallelism && _jobs.size() < parallelJobsMaximumCount) {
-        scheduleSelfOrChild();
-    }
 }
 
 void BulkPropagatorJob::checkPropagationIsDone()
 {
+    // The batch is complete once all its checksums are there, files that failed are left out
+    if (_pendingChecksumFiles.empty() && !_filesToUpload.empty()) {
+        triggerUpload();
+    }
+
     if (_items.empty()) {
         if (!_jobs.empty() || !_pendingChecksumFiles.empty()) {
             // just wait for the other job to finish.
@@ -406,14 +425,24 @@ void BulkPropagatorJob::slotPutFinished()
     Q_ASSERT(job);
 
     slotJobDestroyed(job); // remove it from the _jobs list
+    const auto filesToUpload = _filesInTransit.take(job);
 
     const auto jobError = job->reply()->error();
 
+    qint64 batchBytes = 0;
+    for (const auto &singleFile : filesToUpload) {
+        batchBytes += singleFile._fileSize;
+    }
+    propagator()->reportTransferFinished(job, batchBytes, job->msSinceStart());
+    if (jobError == QNetworkReply::NoError) {
+        adjustBatchSize(filesToUpload.size() * perFileCost + batchBytes, job->msSinceStart());
+    }
+
     const auto replyData = job->reply()->readAll();
     const auto replyJson = QJsonDocument::fromJson(replyData);
     const auto fullReplyObject = replyJson.object();
 
-    for (const auto &singleFile : _filesToUpload) {
+    for (const auto &singleFile : filesToUpload) {
         if (!fullReplyObject.contains(singleFile._remotePath)) {
             if (jobError != QNetworkReply::NoError) {
                 singleFile._item->_status = SyncFileItem::NormalError;
@@ -425,7 +454,16 @@ void BulkPropagatorJob::slotPutFinished()
         slotPutFinishedOneFile(singleFile, job, singleReplyObject);
     }
 
-    finalize(fullReplyObject);
+    finalize(fullReplyObject, filesToUpload);
+}
+
+void BulkPropagatorJob::adjustBatchSize(qint64 batchCost, std::chrono::milliseconds duration)
+{
+    // Same smoothing as the dynamic chunk size of uploads: small batches are
+    // dominated by the round trip and grow, slow ones shrink
+    const auto predictedGoodSize = batchCost * targetBatchDuration / (duration + std::chrono::milliseconds(1));
+    _batchSize = qBound(minBatchSize, _batchSize / 2 + predictedGoodSize / 2, maxBatchSize);
+    qCDebug(lcBulkPropagatorJob) << "Batch of" << batchCost << "took" << duration.count() << "ms, next batch size" << _batchSize;
 }
 
 void BulkPropagatorJob::slotUploadProgress(SyncFileItemPtr item, qint64 sent, qint64 total)
@@ -485,13 +523,13 @@ void BulkPropagatorJob::finalizeOneFile(const BulkUploadItem &oneFile)
     propagator()->_journal->commit("upload file start");
 }
 
-void BulkPropagatorJob::finalize(const QJsonObject &fullReply)
+void BulkPropagatorJob::finalize(const QJsonObject &fullReply, const std::vector<BulkUploadItem> &files)
 {
-    for(auto singleFileIt = std::begin(_filesToUpload); singleFileIt != std::end(_filesToUpload); ) {
-        const auto &singleFile = *singleFileIt;
-
+    for (const auto &singleFile : files) {
         if (!fullReply.contains(singleFile._remotePath)) {
-            ++singleFileIt;
+            if (!singleFile._item->hasErrorStatus()) {
+                done(singleFile._item, SyncFileItem::NormalError, tr("The server did not report the upload of this file"));
+            }
             continue;
         }
         if (!singleFile._item->hasErrorStatus()) {
@@ -499,8 +537,6 @@ void BulkPropagatorJob::finalize(const QJsonObject &fullReply)
         }
 
         done(singleFile._item, singleFile._item->_status, {});
-
-        singleFileIt = _filesToUpload.erase(singleFileIt);
     }
 
     checkPropagationIsDone();
@@ -21,6 +21,9 @@
 #include <QVector>
 #include <QMap>
 #include <QByteArray>
+#include <QHash>
+
+#include <chrono>
 #include <deque>
 
 namespace OCC {
@@ -98,7 +101,10 @@ private:
     void adjustLastJobTimeout(AbstractNetworkJob *job,
                               qint64 fileSize) const;
 
-    void finalize(const QJsonObject &fullReply);
+    void finalize(const QJsonObject &fullReply, const std::vector<BulkUploadItem> &files);
+
+    /// Sizes the next batches from the time the last one took
+    void adjustBatchSize(qint64 batchCost, std::chrono::milliseconds duration);
 
     void finalizeOneFile(const BulkUploadItem &oneFile);
 
@@ -159,7 +165,11 @@ private:
 
     QSet<QString> _pendingChecksumFiles;
 
-    std::vector<BulkUploadItem> _filesToUpload;
+    std::vector<BulkUploadItem> _filesToUpload; /// the batch whose checksums are being computed
+
+    QHash<PutMultiFileJob *, std::vector<BulkUploadItem>> _filesInTransit; /// the batches being uploaded
+
+    qint64 _batchSize; /// the file sizes plus a cost per file the next batch may have
 
     SyncFileItem::Status _finalStatus = SyncFileItem::Status::NoStatus;
 };
@@ -64,6 +64,13 @@ public:
     bool shareResharing() const;
     int shareDefaultPermissions() const;
     bool chunkingNg() const;
+    /**
+     * Whether chunked uploads may reference unchanged ranges of the file they replace
+     *
+     * An experimental extension of chunking v2 that no released server implements,
+     * only used with SyncOptions::_experimentalDeltaUpload.
+     */
+    bool chunkingDelta() const;
     bool bulkUpload() const;
     bool filesLockAvailable() const;
     bool userStatus() const;
@@ -11,6 +11,7 @@
 #include "capabilities.h"
 #include "networkjobs.h"
 #include "clientsideencryptionjobs.h"
+#include "filesystem.h"
 #include "theme.h"
 #include "creds/abstractcredentials.h"
 
@@ -19,6 +20,7 @@
 #include <algorithm>
 
 #include <cstdio>
+#include <cstring>
 
 #include <QDebug>
 #include <QLoggingCategory>
@@ -1780,9 +1782,12 @@ bool EncryptionHelper::fileDecryption(const QByteArray &key, const QByteArray& i
     return true;
 }
 
-EncryptionHelper::StreamingDecryptor::StreamingDecryptor(const QByteArray &key, const QByteArray &iv, quint64 totalSize) : _totalSize(totalSize)
+EncryptionHelper::StreamingDecryptor::StreamingDecryptor(const QByteArray &key, const QByteArray &iv, quint64 totalSize)
+    : _key(key)
+    , _iv(iv)
+    , _totalSize(totalSize)
 {
-    if (_ctx && !key.isEmpty() && !iv.isEmpty() && totalSize > 0) {
+    if (_ctx && !key.isEmpty() && !iv.isEmpty()) {
         _isInitialized = true;
 
         /* Initialize the decryption operation. */
@@ -1841,19 +1846,22 @@ QByteArray EncryptionHelper::StreamingDecryptor::chunkDecryption(const char *inp
         qCDebug(lcCse()) << "Decryption started";
     }
 
-    Q_ASSERT(_decryptedSoFar + chunkSize <= _totalSize);
-    if (_decryptedSoFar + chunkSize > _totalSize) {
-        qCritical(lcCse()) << "Decryption failed. Chunk is out of range!";
-        return QByteArray();
-    }
+    // Without a total size all chunks are data, finish() checks the tag
+    if (_totalSize > 0) {
+        Q_ASSERT(_decryptedSoFar + chunkSize <= _totalSize);
+        if (_decryptedSoFar + chunkSize > _totalSize) {
+            qCritical(lcCse()) << "Decryption failed. Chunk is out of range!";
+            return QByteArray();
+        }
 
-    Q_ASSERT(_decryptedSoFar + chunkSize < OCC::Constants::e2EeTagSize || _totalSize - OCC::Constants::e2EeTagSize >= _decryptedSoFar + chunkSize - OCC::Constants::e2EeTagSize);
-    if (_decryptedSoFar + chunkSize > OCC::Constants::e2EeTagSize && _totalSize - OCC::Constants::e2EeTagSize < _decryptedSoFar + chunkSize - OCC::Constants::e2EeTagSize) {
-        qCritical(lcCse()) << "Decryption failed. Incorrect chunk!";
-        return QByteArray();
+        Q_ASSERT(_decryptedSoFar + chunkSize < OCC::Constants::e2EeTagSize || _totalSize - OCC::Constants::e2EeTagSize >= _decryptedSoFar + chunkSize - OCC::Constants::e2EeTagSize);
+        if (_decryptedSoFar + chunkSize > OCC::Constants::e2EeTagSize && _totalSize - OCC::Constants::e2EeTagSize < _decryptedSoFar + chunkSize - OCC::Constants::e2EeTagSize) {
+            qCritical(lcCse()) << "Decryption failed. Incorrect chunk!";
+            return QByteArray();
+        }
     }
 
-    const bool isLastChunk = _decryptedSoFar + chunkSize == _totalSize;
+    const bool isLastChunk = _totalSize > 0 && _decryptedSoFar + chunkSize == _totalSize;
 
     // last OCC::Constants::e2EeTagSize bytes is ALWAYS a e2EeTag!!!
     const qint64 size = isLastChunk ? chunkSize - OCC::Constants::e2EeTagSize : chunkSize;
@@ -1911,41 +1919,91 @@ QByteArray EncryptionHelper::StreamingDecryptor::chunkDecryption(const char *inp
             return QByteArray();
         }
 
-        int outLen = 0;
-
-        QByteArray e2EeTag = QByteArray(input + inputPos, OCC::Constants::e2EeTagSize);
-
-        /* Set expected e2EeTag value. Works in OpenSSL 1.0.1d and later */
-        if(!EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_TAG, e2EeTag.size(), reinterpret_cast<unsigned char*>(e2EeTag.data()))) {
-            qCritical(lcCse()) << "Could not set expected e2EeTag";
+        if (!finish(input + inputPos)) {
             return QByteArray();
         }
+    }
 
-        if(1 != EVP_DecryptFinal_ex(_ctx, unsignedData(decryptedBlock), &outLen)) {
-            qCritical(lcCse()) << "Could finalize decryption";
-            return QByteArray();
-        }
+    if (isFinished()) {
+        qCDebug(lcCse()) << "Decryption complete";
+    }
 
-        const auto writtenToOutput = buffer.write(decryptedBlock, outLen);
+    return byteArray;
+}
 
-        Q_ASSERT(writtenToOutput == outLen);
-        if (writtenToOutput != outLen) {
-            qCritical(lcCse()) << "Failed to write decrypted data to device.";
-            return QByteArray();
-        }
+bool EncryptionHelper::StreamingDecryptor::finish(const char *e2EeTag)
+{
+    Q_ASSERT(isInitialized() && !isFinished());
+    if (!isInitialized() || isFinished()) {
+        qCritical(lcCse()) << "Decryption can't be finished. Decryptor is not initialized or already finished!";
+        return false;
+    }
 
-        bytesWritten += writtenToOutput;
+    QByteArray tag(e2EeTag, OCC::Constants::e2EeTagSize);
 
-        _decryptedSoFar += OCC::Constants::e2EeTagSize;
+    /* Set expected e2EeTag value. Works in OpenSSL 1.0.1d and later */
+    if(!EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_TAG, tag.size(), reinterpret_cast<unsigned char*>(tag.data()))) {
+        qCritical(lcCse()) << "Could not set expected e2EeTag";
+        return false;
+    }
 
-        _isFinished = true;
+    // GCM doesn't hold data back, nothing is left to be decrypted
+    QByteArray lastBlock(blockSize, '\0');
+    int outLen = 0;
+    if(1 != EVP_DecryptFinal_ex(_ctx, unsignedData(lastBlock), &outLen)) {
+        qCritical(lcCse()) << "Could finalize decryption";
+        return false;
     }
+    Q_ASSERT(outLen == 0);
 
-    if (isFinished()) {
-        qCDebug(lcCse()) << "Decryption complete";
+    _decryptedSoFar += OCC::Constants::e2EeTagSize;
+    _isFinished = true;
+    return true;
+}
+
+bool EncryptionHelper::StreamingDecryptor::resume(QIODevice *plainText, quint64 size)
+{
+    Q_ASSERT(isInitialized() && _decryptedSoFar == 0);
+    if (!isInitialized() || _decryptedSoFar != 0) {
+        qCritical(lcCse()) << "Decryption can't be resumed. Decryptor is not initialized or already started!";
+        return false;
+    }
+    if (_totalSize > 0 && size + OCC::Constants::e2EeTagSize > _totalSize) {
+        qCritical(lcCse()) << "Decryption can't be resumed. More was decrypted than there is:" << size << _totalSize;
+        return false;
     }
 
-    return byteArray;
+    CipherCtx encryptCtx;
+    if (!encryptCtx || !EVP_EncryptInit_ex(encryptCtx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
+        qCritical(lcCse()) << "Could not init cipher";
+        return false;
+    }
+    EVP_CIPHER_CTX_set_padding(encryptCtx, 0);
+    if (!EVP_CIPHER_CTX_ctrl(encryptCtx, EVP_CTRL_GCM_SET_IVLEN, _iv.size(), nullptr)
+        || !EVP_EncryptInit_ex(encryptCtx, nullptr, nullptr, reinterpret_cast<const unsigned char *>(_key.constData()), reinterpret_cast<const unsigned char *>(_iv.constData()))) {
+        qCritical(lcCse()) << "Could not set key and iv";
+        return false;
+    }
+
+    // GCM works in place and without holding data back: the buffer holds the
+    // plain text, then the encrypted data, then the plain text again
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    auto data = unsignedData(buffer);
+    while (_decryptedSoFar < size) {
+        const auto readBytes = plainText->read(buffer.data(), qMin<quint64>(buffer.size(), size - _decryptedSoFar));
+        if (readBytes <= 0) {
+            qCritical(lcCse()) << "Could not read the decrypted data" << plainText->errorString();
+            return false;
+        }
+        int len = 0;
+        if (!EVP_EncryptUpdate(encryptCtx, data, &len, data, static_cast<int>(readBytes))
+            || !EVP_DecryptUpdate(_ctx, data, &len, data, static_cast<int>(readBytes))) {
+            qCritical(lcCse()) << "Could not resume decryption";
+            return false;
+        }
+        _decryptedSoFar += readBytes;
+    }
+    return true;
 }
 
 bool EncryptionHelper::StreamingDecryptor::isInitialized() const
@@ -1957,4 +2015,161 @@ bool EncryptionHelper::StreamingDecryptor::isFinished() const
 {
     return _isFinished;
 }
+
+EncryptionHelper::StreamingEncryptor::StreamingEncryptor(const QByteArray &key, const QByteArray &iv, const QString &fileName, QObject *parent)
+    : QIODevice(parent)
+    , _key(key)
+    , _iv(iv)
+    , _file(fileName)
+{
+}
+
+bool EncryptionHelper::StreamingEncryptor::open(QIODevice::OpenMode mode)
+{
+    if (mode & QIODevice::WriteOnly)
+        return false;
+
+    // Get the file size now: _file.fileName() is no longer reliable
+    // on all platforms after openAndSeekFileSharedRead().
+    _plainSize = FileSystem::getSize(_file.fileName());
+
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, 0)) {
+        setErrorString(openError);
+        return false;
+    }
+    _checkpoint = -1;
+    if (!startEncryption()) {
+        _file.close();
+        setErrorString(tr("Could not start encrypting the file"));
+        return false;
+    }
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void EncryptionHelper::StreamingEncryptor::close()
+{
+    _file.close();
+    QIODevice::close();
+}
+
+qint64 EncryptionHelper::StreamingEncryptor::size() const
+{
+    return _plainSize + OCC::Constants::e2EeTagSize;
+}
+
+bool EncryptionHelper::StreamingEncryptor::seek(qint64 pos)
+{
+    if (pos < 0 || pos > size() || !encryptUpTo(qMin(pos, _plainSize))) {
+        return false;
+    }
+    // A finished encryption can't be continued, there is nothing to go back to after it
+    if (_encrypted < _plainSize && EVP_CIPHER_CTX_copy(_checkpointCtx, _ctx)) {
+        _checkpoint = _encrypted;
+    }
+    return QIODevice::seek(pos);
+}
+
+qint64 EncryptionHelper::StreamingEncryptor::readData(char *data, qint64 maxlen)
+{
+    const auto position = pos();
+    if (position < _plainSize) {
+        Q_ASSERT(position == _encrypted);
+        // EVP_EncryptUpdate() takes an int
+        const auto read = _file.read(data, qMin(qMin(maxlen, _plainSize - position), qint64(1024 * 1024)));
+        if (read <= 0) {
+            setErrorString(read < 0 ? _file.errorString() : tr("The file got shorter while it was uploaded"));
+            return -1;
+        }
+        if (!encrypt(data, read)) {
+            setErrorString(tr("Could not encrypt the file"));
+            return -1;
+        }
+        return read;
+    }
+
+    const auto tagPosition = position - _plainSize;
+    const auto count = qMin(maxlen, _tag.size() - tagPosition);
+    if (count <= 0) {
+        return 0;
+    }
+    std::memcpy(data, _tag.constData() + tagPosition, count);
+    return count;
+}
+
+bool EncryptionHelper::StreamingEncryptor::startEncryption()
+{
+    _encrypted = 0;
+    _tag.clear();
+    if (!_ctx
+        || !EVP_CIPHER_CTX_reset(_ctx)
+        || !EVP_EncryptInit_ex(_ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
+        qCInfo(lcCse()) << "Could not init cipher";
+        return false;
+    }
+    EVP_CIPHER_CTX_set_padding(_ctx, 0);
+    if (!EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_IVLEN, _iv.size(), nullptr)
+        || !EVP_EncryptInit_ex(_ctx, nullptr, nullptr, reinterpret_cast<const unsigned char *>(_key.constData()), reinterpret_cast<const unsigned char *>(_iv.constData()))) {
+        qCInfo(lcCse()) << "Could not set key and iv";
+        return false;
+    }
+    return _plainSize > 0 || encrypt(nullptr, 0);
+}
+
+bool EncryptionHelper::StreamingEncryptor::encrypt(char *data, qint64 size)
+{
+    if (size > 0) {
+        int len = 0;
+        // GCM encrypts in place and without holding data back
+        if (!EVP_EncryptUpdate(_ctx, reinterpret_cast<unsigned char *>(data), &len, reinterpret_cast<unsigned char *>(data), static_cast<int>(size)) || len != size) {
+            qCInfo(lcCse()) << "Could not encrypt";
+            return false;
+        }
+        _encrypted += size;
+    }
+    if (_encrypted < _plainSize) {
+        return true;
+    }
+
+    QByteArray rest(OCC::Constants::e2EeTagSize, '\0');
+    QByteArray e2EeTag(OCC::Constants::e2EeTagSize, '\0');
+    int len = 0;
+    if (1 != EVP_EncryptFinal_ex(_ctx, unsignedData(rest), &len)
+        || 1 != EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_GET_TAG, OCC::Constants::e2EeTagSize, unsignedData(e2EeTag))) {
+        qCInfo(lcCse()) << "Could not finalize encryption";
+        return false;
+    }
+    _tag = e2EeTag;
+    return true;
+}
+
+bool EncryptionHelper::StreamingEncryptor::encryptUpTo(qint64 pos)
+{
+    if (pos < _encrypted) {
+        if (_checkpoint >= 0 && _checkpoint <= pos) {
+            if (!EVP_CIPHER_CTX_copy(_ctx, _checkpointCtx)) {
+                return false;
+            }
+            _encrypted = _checkpoint;
+            _tag.clear();
+        } else if (!startEncryption()) {
+            return false;
+        }
+    }
+
+    if (_encrypted < pos) {
+        // The state of the cipher at pos depends on all the data before it
+        if (!_file.seek(_encrypted)) {
+            return false;
+        }
+        QByteArray buffer(static_cast<int>(qMin(pos - _encrypted, qint64(64 * 1024))), Qt::Uninitialized);
+        while (_encrypted < pos) {
+            const auto read = _file.read(buffer.data(), qMin(pos - _encrypted, qint64(buffer.size())));
+            if (read <= 0 || !encrypt(buffer.data(), read)) {
+                return false;
+            }
+        }
+    }
+    return _file.seek(_encrypted);
+}
 }
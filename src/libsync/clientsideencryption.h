@@ -94,23 +94,97 @@ private:
 class OWNCLOUDSYNC_EXPORT StreamingDecryptor
 {
 public:
+    /** totalSize includes the tag, 0 if it isn't known. The tag is then not
+     * part of the chunks and given to finish() instead.
+     */
     StreamingDecryptor(const QByteArray &key, const QByteArray &iv, quint64 totalSize);
     ~StreamingDecryptor() = default;
 
     QByteArray chunkDecryption(const char *input, quint64 chunkSize);
 
+    /// Checks the e2EeTagSize bytes of the tag, which followed the decrypted data
+    bool finish(const char *e2EeTag);
+
+    /**
+     * Continues a decryption of which the first size bytes were decrypted
+     * into plainText before, like a download that is resumed.
+     *
+     * The tag authenticates all of the encrypted data, so those bytes are
+     * encrypted again to bring the decryption to where it stopped.
+     * Must be called before the first chunkDecryption().
+     */
+    bool resume(QIODevice *plainText, quint64 size);
+
     bool isInitialized() const;
     bool isFinished() const;
 
 private:
     Q_DISABLE_COPY(StreamingDecryptor)
 
+    QByteArray _key;
+    QByteArray _iv;
     CipherCtx _ctx;
     bool _isInitialized = false;
     bool _isFinished = false;
     quint64 _decryptedSoFar = 0;
     quint64 _totalSize = 0;
 };
+
+/**
+ * @brief Reads a file encrypted, the way fileEncryption() writes it
+ *
+ * The data is encrypted as it's read instead of into a temporary copy of the
+ * file, and followed by the tag, which tag() also returns once the end of the
+ * file was read.
+ *
+ * GCM can only go forward. Seeking back returns to the position of the
+ * previous seek if it's not after the target, which is where the chunk that
+ * is sent again starts. Otherwise the file is encrypted again from its start
+ * up to the target, without returning that data.
+ */
+class OWNCLOUDSYNC_EXPORT StreamingEncryptor : public QIODevice
+{
+    Q_OBJECT
+public:
+    StreamingEncryptor(const QByteArray &key, const QByteArray &iv, const QString &fileName, QObject *parent = nullptr);
+    ~StreamingEncryptor() override = default;
+
+    bool open(QIODevice::OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return false; }
+    qint64 size() const override;
+    bool seek(qint64 pos) override;
+
+    /// The size of the file, fixed when it is opened
+    qint64 plainSize() const { return _plainSize; }
+    /// Empty until the end of the file was encrypted
+    QByteArray tag() const { return _tag; }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    Q_DISABLE_COPY(StreamingEncryptor)
+
+    bool startEncryption();
+    bool encrypt(char *data, qint64 size);
+    bool encryptUpTo(qint64 pos);
+
+    QByteArray _key;
+    QByteArray _iv;
+    QFile _file;
+    qint64 _plainSize = 0;
+
+    CipherCtx _ctx;
+    /// How much of the file _ctx has encrypted
+    qint64 _encrypted = 0;
+    QByteArray _tag;
+
+    /// The state at the previous seek, -1 if there is none
+    CipherCtx _checkpointCtx;
+    qint64 _checkpoint = -1;
+};
 }
 
 class OWNCLOUDSYNC_EXPORT ClientSideEncryption : public QObject {
@@ -159,6 +159,8 @@ public:
     void setShowInExplorerNavigationPane(bool show);
 
     int timeout() const;
+    /// How many folders may sync at the same time
+    int maxParallelSyncs() const;
     qint64 chunkSize() const;
     qint64 maxChunkSize() const;
     qint64 minChunkSize() const;
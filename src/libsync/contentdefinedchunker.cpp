@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "contentdefinedchunker.h"
+
+#include <QCryptographicHash>
+#include <QIODevice>
+
+#include <array>
+
+namespace OCC {
+
+namespace {
+
+    const qint64 readBufferSize = 1024 * 1024;
+
+    // Random values for every byte. They must never change: the chunk
+    // boundaries, and with them every stored chunk index, depend on them.
+    const std::array<quint64, 256> &gearTable()
+    {
+        static const auto table = [] {
+            std::array<quint64, 256> table {};
+            quint64 state = 0x6e657874636c6f75; // splitmix64
+            for (auto &value : table) {
+                quint64 z = (state += 0x9e3779b97f4a7c15);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+                value = z ^ (z >> 31);
+            }
+            return table;
+        }();
+        return table;
+    }
+}
+
+constexpr qint64 ContentDefinedChunker::defaultAverageChunkSize;
+
+ContentDefinedChunker::ContentDefinedChunker(qint64 averageChunkSize)
+{
+    int bits = 6;
+    while ((qint64(1) << (bits + 1)) <= averageChunkSize)
+        ++bits;
+    _averageSize = qint64(1) << bits;
+    _minSize = _averageSize / 4;
+    _maxSize = _averageSize * 4;
+    // Use the high bits of the hash, they depend on more of the preceding bytes
+    _mask = ~quint64(0) << (64 - bits);
+}
+
+void ContentDefinedChunker::finishChunk()
+{
+    _current.hash = _hash.result();
+    _chunks.append(_current);
+    _hash.reset();
+    _fingerprint = 0;
+    _current.offset += _current.size;
+    _current.size = 0;
+}
+
+void ContentDefinedChunker::addData(const char *data, qint64 size)
+{
+    const auto &gear = gearTable();
+    const auto bytes = reinterpret_cast<const uchar *>(data);
+    qint64 chunkStart = 0;
+    for (qint64 i = 0; i < size; ++i) {
+        _fingerprint = (_fingerprint << 1) + gear[bytes[i]];
+        const qint64 chunkSize = _current.size + i - chunkStart + 1;
+        if (chunkSize >= _maxSize || (chunkSize >= _minSize && (_fingerprint & _mask) == 0)) {
+            _hash.addData(data + chunkStart, static_cast<int>(i - chunkStart + 1));
+            _current.size = chunkSize;
+            finishChunk();
+            chunkStart = i + 1;
+        }
+    }
+    _hash.addData(data + chunkStart, static_cast<int>(size - chunkStart));
+    _current.size += size - chunkStart;
+}
+
+QVector<SyncJournalDb::ChunkIndex::Chunk> ContentDefinedChunker::finish()
+{
+    if (_current.size > 0)
+        finishChunk();
+    return _chunks;
+}
+
+QVector<SyncJournalDb::ChunkIndex::Chunk> ContentDefinedChunker::chunks(QIODevice *device, bool *ok)
+{
+    if (ok)
+        *ok = false;
+
+    QByteArray buffer(readBufferSize, Qt::Uninitialized);
+    while (true) {
+        const auto read = device->read(buffer.data(), buffer.size());
+        if (read < 0)
+            return {};
+        if (read == 0)
+            break;
+        addData(buffer.constData(), read);
+    }
+
+    if (ok)
+        *ok = true;
+    return finish();
+}
+
+}
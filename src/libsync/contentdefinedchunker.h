@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+#include "common/syncjournaldb.h"
+
+#include <QCryptographicHash>
+#include <QVector>
+
+class QIODevice;
+
+namespace OCC {
+
+/**
+ * Splits data into chunks whose boundaries depend on the content only.
+ *
+ * A cut is made where a rolling gear hash over the last bytes matches a
+ * mask, so inserting or removing data only changes the chunks around the
+ * edit and the following boundaries resynchronize. Chunks are between a
+ * quarter and four times the average size.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ContentDefinedChunker
+{
+public:
+    static constexpr qint64 defaultAverageChunkSize = 1024 * 1024;
+
+    /// \a averageChunkSize is rounded down to a power of two
+    explicit ContentDefinedChunker(qint64 averageChunkSize = defaultAverageChunkSize);
+
+    qint64 averageChunkSize() const { return _averageSize; }
+
+    /// Splits the next \a size bytes of the data
+    void addData(const char *data, qint64 size);
+
+    /// Ends the last chunk and returns the chunks of all data with their SHA256
+    QVector<SyncJournalDb::ChunkIndex::Chunk> finish();
+
+    /**
+     * Reads \a device to the end and returns its chunks with their SHA256.
+     *
+     * Sets \a ok to false if the device could not be read.
+     */
+    QVector<SyncJournalDb::ChunkIndex::Chunk> chunks(QIODevice *device, bool *ok = nullptr);
+
+private:
+    void finishChunk();
+
+    qint64 _averageSize;
+    qint64 _minSize;
+    qint64 _maxSize;
+    quint64 _mask;
+
+    QVector<SyncJournalDb::ChunkIndex::Chunk> _chunks;
+    SyncJournalDb::ChunkIndex::Chunk _current;
+    QCryptographicHash _hash { QCryptographicHash::Sha256 };
+    quint64 _fingerprint = 0;
+};
+
+}
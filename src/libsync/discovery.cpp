@@ -16,6 +16,7 @@
 #include "common/filesystembase.h"
 #include "common/syncjournaldb.h"
 #include "filesystem.h"
+#include "localdiscoveryexecutor.h"
 #include "syncfileitem.h"
 #include <QDebug>
 #include <algorithm>
@@ -26,7 +27,6 @@
 #include "vio/csync_vio_local.h"
 #include <QFileInfo>
 #include <QFile>
-#include <QThreadPool>
 #include <common/checksums.h>
 #include <common/constants.h>
 #include "csync_exclude.h"
@@ -40,6 +40,7 @@ Q_LOGGING_CATEGORY(lcDisco, "sync.discovery", QtInfoMsg)
 void ProcessDirectoryJob::start()
 {
     qCInfo(lcDisco) << "STARTING" << _currentFolder._server << _queryServer << _currentFolder._local << _queryLocal;
+    _traceSlice.begin("discovery", "directory", _currentFolder._original);
 
     if (_queryServer == NormalQuery) {
         _serverJob = startAsyncServerQuery();
@@ -52,6 +53,7 @@ void ProcessDirectoryJob::start()
         if (!_discoveryData->_shouldDiscoverLocaly(_currentFolder._local)
             && (_currentFolder._local == _currentFolder._original || !_discoveryData->_shouldDiscoverLocaly(_currentFolder._original))) {
             _queryLocal = ParentNotChanged;
+            _discoveryData->localDiscoveryExecutor()->discard(_discoveryData->_localDir + _currentFolder._local);
         }
     }
 
@@ -68,6 +70,7 @@ void ProcessDirectoryJob::start()
 
 void ProcessDirectoryJob::process()
 {
+    Tracing::Scope trace("discovery", "process directory", _currentFolder._original);
     ASSERT(_localQueryDone && _serverQueryDone);
 
     // Build lookup tables for local, remote and db entries.
@@ -96,8 +99,11 @@ void ProcessDirectoryJob::process()
         return;
     }
 
+    QStringList localSubdirectories;
     for (auto &e : _localNormalQueryEntries) {
         entries[e.name].localEntry = e;
+        if (e.isDirectory && !e.isSymLink)
+            localSubdirectories.append(e.name);
     }
     if (isVfsWithSuffix()) {
         // For vfs-suffix the local data for suffixed files should usually be associated
@@ -183,6 +189,23 @@ void ProcessDirectoryJob::process()
         }
         processFile(std::move(path), e.localEntry, e.serverEntry, e.dbEntry);
     }
+
+    // Local directories that discovery won't look into don't need to be listed
+    // ahead of time. This is only an optimization: a directory that is requested
+    // later on anyway is just listed again.
+    if (!localSubdirectories.isEmpty()) {
+        QSet<QString> recursedInto;
+        for (const auto *job : _queuedJobs) {
+            if (job->_queryLocal == NormalQuery)
+                recursedInto.insert(job->_currentFolder._local);
+        }
+        for (const auto &name : qAsConst(localSubdirectories)) {
+            const auto localPath = PathTuple::pathAppend(_currentFolder._local, name);
+            if (!recursedInto.contains(localPath))
+                _discoveryData->localDiscoveryExecutor()->discard(_discoveryData->_localDir + localPath);
+        }
+    }
+
     QTimer::singleShot(0, _discoveryData, &DiscoveryPhase::scheduleMoreJobs);
 }
 
@@ -457,29 +480,32 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
     item->_remotePerm = serverEntry.remotePerm;
     item->_type = serverEntry.isDirectory ? ItemTypeDirectory : ItemTypeFile;
     item->_etag = serverEntry.etag;
-    item->_directDownloadUrl = serverEntry.directDownloadUrl;
-    item->_directDownloadCookies = serverEntry.directDownloadCookies;
+    // The server's values replace the ones of the db record
+    item->clearExtra();
+    if (!serverEntry.directDownloadUrl.isEmpty()) {
+        item->mutableExtra()._directDownloadUrl = serverEntry.directDownloadUrl;
+        item->mutableExtra()._directDownloadCookies = serverEntry.directDownloadCookies;
+    }
     item->_isEncrypted = serverEntry.isE2eEncrypted;
-    item->_encryptedFileName = [=] {
-        if (serverEntry.e2eMangledName.isEmpty()) {
-            return QString();
-        }
-
+    if (!serverEntry.e2eMangledName.isEmpty()) {
         Q_ASSERT(_discoveryData->_remoteFolder.startsWith('/'));
         Q_ASSERT(_discoveryData->_remoteFolder.endsWith('/'));
 
         const auto rootPath = _discoveryData->_remoteFolder.mid(1);
         Q_ASSERT(serverEntry.e2eMangledName.startsWith(rootPath));
-        return serverEntry.e2eMangledName.mid(rootPath.length());
-    }();
+        item->mutableExtra()._encryptedFileName = serverEntry.e2eMangledName.mid(rootPath.length());
+    }
     item->_locked = serverEntry.locked;
-    item->_lockOwnerDisplayName = serverEntry.lockOwnerDisplayName;
-    item->_lockOwnerId = serverEntry.lockOwnerId;
-    item->_lockOwnerType = serverEntry.lockOwnerType;
-    item->_lockEditorApp = serverEntry.lockEditorApp;
-    item->_lockTime = serverEntry.lockTime;
-    item->_lockTimeout = serverEntry.lockTimeout;
-    qCInfo(lcDisco()) << item->_locked << item->_lockOwnerDisplayName << item->_lockOwnerId << item->_lockOwnerType << item->_lockEditorApp << item->_lockTime << item->_lockTimeout;
+    if (serverEntry.locked == SyncFileItem::LockStatus::LockedItem) {
+        auto &extra = item->mutableExtra();
+        extra._lockOwnerDisplayName = serverEntry.lockOwnerDisplayName;
+        extra._lockOwnerId = serverEntry.lockOwnerId;
+        extra._lockOwnerType = serverEntry.lockOwnerType;
+        extra._lockEditorApp = serverEntry.lockEditorApp;
+        extra._lockTime = serverEntry.lockTime;
+        extra._lockTimeout = serverEntry.lockTimeout;
+        qCInfo(lcDisco()) << item->_locked << extra._lockOwnerDisplayName << extra._lockOwnerId << extra._lockOwnerType << extra._lockEditorApp << extra._lockTime << extra._lockTimeout;
+    }
 
     // Check for missing server data
     {
@@ -634,7 +660,7 @@ void ProcessDirectoryJob::processFileAnalyzeRemoteInfo(
                 addVirtualFileSuffix(path._original);
         }
 
-        if (opts._vfs->mode() != Vfs::Off && !item->_encryptedFileName.isEmpty()) {
+        if (opts._vfs->mode() != Vfs::Off && !item->extra()._encryptedFileName.isEmpty()) {
             // We are syncing a file for the first time (local entry is invalid) and it is encrypted file that will be virtual once synced
             // to avoid having error of "file has changed during sync" when trying to hydrate it excplicitly - we must remove Constants::e2EeTagSize bytes from the end
             // as explicit hydration does not care if these bytes are present in the placeholder or not, but, the size must not change in the middle of the sync
@@ -1380,7 +1406,7 @@ void ProcessDirectoryJob::processFileConflict(const SyncFileItemPtr &item, Proce
             rec._fileSize = serverEntry.size;
             rec._remotePerm = serverEntry.remotePerm;
             rec._checksumHeader = serverEntry.checksumHeader;
-            _discoveryData->_statedb->setFileRecord(rec);
+            _discoveryData->_statedb->queueFileRecord(rec);
         }
         return;
     }
@@ -1642,8 +1668,11 @@ void ProcessDirectoryJob::subJobFinished()
     _childIgnored |= job->_childIgnored;
     _childModified |= job->_childModified;
 
-    if (job->_dirItem)
+    if (job->_dirItem) {
         emit _discoveryData->itemDiscovered(job->_dirItem);
+        if (isUnchangedWithParents())
+            emit _discoveryData->subtreeDiscovered(job->_dirItem->_file);
+    }
 
     int count = _runningJobs.removeAll(job);
     ASSERT(count == 1);
@@ -1651,6 +1680,15 @@ void ProcessDirectoryJob::subJobFinished()
     QTimer::singleShot(0, _discoveryData, &DiscoveryPhase::scheduleMoreJobs);
 }
 
+bool ProcessDirectoryJob::isUnchangedWithParents() const
+{
+    for (auto job = this; job; job = qobject_cast<const ProcessDirectoryJob *>(job->parent())) {
+        if (job->_dirItem && job->_dirItem->_instruction != CSYNC_INSTRUCTION_NONE)
+            return false;
+    }
+    return true;
+}
+
 int ProcessDirectoryJob::processSubJobs(int nbJobs)
 {
     if (_queuedJobs.empty() && _runningJobs.empty() && _pendingAsyncJobs == 0) {
@@ -1674,6 +1712,7 @@ int ProcessDirectoryJob::processSubJobs(int nbJobs)
                 _dirItem->_instruction = CSYNC_INSTRUCTION_NONE;
             }
         }
+        _traceSlice.end();
         emit finished();
     }
 
@@ -1771,53 +1810,46 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
 void ProcessDirectoryJob::startAsyncLocalQuery()
 {
     QString localPath = _discoveryData->_localDir + _currentFolder._local;
-    auto localJob = new DiscoverySingleLocalDirectoryJob(_discoveryData->_account, localPath, _discoveryData->_syncOptions._vfs.data());
 
-    _discoveryData->_currentlyActiveJobs++;
+    _discoveryData->_currentlyActiveLocalJobs++;
     _pendingAsyncJobs++;
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::itemDiscovered, _discoveryData, &DiscoveryPhase::itemDiscovered);
-
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::childIgnored, this, [this](bool b) {
-        _childIgnored = b;
-    });
-
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
+    _discoveryData->localDiscoveryExecutor()->request(localPath, this, [this](const LocalDirectoryListing &listing) {
+        _discoveryData->_currentlyActiveLocalJobs--;
         _pendingAsyncJobs--;
-        if (_serverJob)
-            _serverJob->abort();
 
-        emit _discoveryData->fatalError(msg);
-    });
+        for (const auto &item : listing.ignoredItems) {
+            _childIgnored = true;
+            emit _discoveryData->itemDiscovered(item);
+        }
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedNonFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
+        switch (listing.error) {
+        case LocalDirectoryListing::FatalError:
+            if (_serverJob)
+                _serverJob->abort();
 
-        if (_dirItem) {
-            _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
-            _dirItem->_errorString = msg;
-            emit this->finished();
-        } else {
-            // Fatal for the root job since it has no SyncFileItem
-            emit _discoveryData->fatalError(msg);
+            emit _discoveryData->fatalError(listing.errorString);
+            return;
+        case LocalDirectoryListing::NonFatalError:
+            if (_dirItem) {
+                _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
+                _dirItem->_errorString = listing.errorString;
+                emit this->finished();
+            } else {
+                // Fatal for the root job since it has no SyncFileItem
+                emit _discoveryData->fatalError(listing.errorString);
+            }
+            return;
+        case LocalDirectoryListing::NoError:
+            break;
         }
-    });
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finished, this, [this](const auto &results) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
-
-        _localNormalQueryEntries = results;
+        _localNormalQueryEntries = listing.entries;
         _localQueryDone = true;
 
         if (_serverQueryDone)
             this->process();
     });
-
-    QThreadPool *pool = QThreadPool::globalInstance();
-    pool->start(localJob); // QThreadPool takes ownership
 }
 
 
@@ -19,6 +19,7 @@
 #include "syncfileitem.h"
 #include "common/asserts.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 
 class ExcludedFiles;
 
@@ -213,6 +214,12 @@ private:
     void processBlacklisted(const PathTuple &, const LocalInfo &, const SyncJournalFileRecord &dbEntry);
     void subJobFinished();
 
+    /** Whether neither this directory nor any of its parents has to be propagated
+     *
+     * Then what is discovered below doesn't depend on anything outside of it.
+     */
+    bool isUnchangedWithParents() const;
+
     /** An DB operation failed */
     void dbError();
 
@@ -299,6 +306,7 @@ private:
     bool _childIgnored = false; // The directory contains ignored item that would prevent deletion
     PinState _pinState = PinState::Unspecified; // The directory's pin-state, see computePinState()
     bool _isInsideEncryptedTree = false; // this directory is encrypted or is within the tree of directories with root directory encrypted
+    Tracing::AsyncSlice _traceSlice; // from start() to finished()
 
 signals:
     void finished();
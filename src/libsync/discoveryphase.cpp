@@ -14,6 +14,7 @@
 
 #include "discoveryphase.h"
 #include "discovery.h"
+#include "localdiscoveryexecutor.h"
 
 #include "account.h"
 #include "clientsideencryptionjobs.h"
@@ -87,7 +88,7 @@ void DiscoveryPhase::checkSelectiveSyncNewFolder(const QString &path, RemotePerm
         && remotePerm.hasPermission(RemotePermissions::IsMounted)) {
         // external storage.
 
-        /* Note: DiscoverySingleDirectoryJob::directoryListingIteratedSlot make sure that only the
+        /* Note: DiscoverySingleDirectoryJob::processEntry make sure that only the
          * root of a mounted storage has 'M', all sub entries have 'm' */
 
         // Only allow it if the white list contains exactly this path (not parents)
@@ -249,96 +250,34 @@ void DiscoveryPhase::setSelectiveSyncWhiteList(const QStringList &list)
     std::sort(_selectiveSyncWhiteList.begin(), _selectiveSyncWhiteList.end());
 }
 
-void DiscoveryPhase::scheduleMoreJobs()
+DiscoveryPhase::DiscoveryPhase() = default;
+
+DiscoveryPhase::~DiscoveryPhase() = default;
+
+LocalDiscoveryExecutor *DiscoveryPhase::localDiscoveryExecutor()
 {
-    auto limit = qMax(1, _syncOptions._parallelNetworkJobs);
-    if (_currentRootJob && _currentlyActiveJobs < limit) {
-        _currentRootJob->processSubJobs(limit - _currentlyActiveJobs);
+    if (!_localDiscoveryExecutor) {
+        _localDiscoveryExecutor = std::make_unique<LocalDiscoveryExecutor>(
+            _syncOptions._vfs.data(), _syncOptions._parallelLocalDiscoveryJobs);
     }
+    return _localDiscoveryExecutor.get();
 }
 
-DiscoverySingleLocalDirectoryJob::DiscoverySingleLocalDirectoryJob(const AccountPtr &account, const QString &localPath, OCC::Vfs *vfs, QObject *parent)
- : QObject(parent), QRunnable(), _localPath(localPath), _account(account), _vfs(vfs)
+void DiscoveryPhase::scheduleMoreJobs()
 {
-    qRegisterMetaType<QVector<LocalInfo> >("QVector<LocalInfo>");
-}
-
-// Use as QRunnable
-void DiscoverySingleLocalDirectoryJob::run() {
-    QString localPath = _localPath;
-    if (localPath.endsWith('/')) // Happens if _currentFolder._local.isEmpty()
-        localPath.chop(1);
-
-    auto dh = csync_vio_local_opendir(localPath);
-    if (!dh) {
-        qCInfo(lcDiscovery) << "Error while opening directory" << (localPath) << errno;
-        QString errorString = tr("Error while opening directory %1").arg(localPath);
-        if (errno == EACCES) {
-            errorString = tr("Directory not accessible on client, permission denied");
-            emit finishedNonFatalError(errorString);
-            return;
-        } else if (errno == ENOENT) {
-            errorString = tr("Directory not found: %1").arg(localPath);
-        } else if (errno == ENOTDIR) {
-            // Not a directory..
-            // Just consider it is empty
-            return;
-        }
-        emit finishedFatalError(errorString);
-        return;
-    }
-
-    QVector<LocalInfo> results;
-    while (true) {
-        errno = 0;
-        auto dirent = csync_vio_local_readdir(dh, _vfs);
-        if (!dirent)
-            break;
-        if (dirent->type == ItemTypeSkip)
-            continue;
-        LocalInfo i;
-        static QTextCodec *codec = QTextCodec::codecForName("UTF-8");
-        ASSERT(codec);
-        QTextCodec::ConverterState state;
-        i.name = codec->toUnicode(dirent->path, dirent->path.size(), &state);
-        if (state.invalidChars > 0 || state.remainingChars > 0) {
-            emit childIgnored(true);
-            auto item = SyncFileItemPtr::create();
-            //item->_file = _currentFolder._target + i.name;
-            // FIXME ^^ do we really need to use _target or is local fine?
-            item->_file = _localPath + i.name;
-            item->_instruction = CSYNC_INSTRUCTION_IGNORE;
-            item->_status = SyncFileItem::NormalError;
-            item->_errorString = tr("Filename encoding is not valid");
-            emit itemDiscovered(item);
-            continue;
-        }
-        i.modtime = dirent->modtime;
-        i.size = dirent->size;
-        i.inode = dirent->inode;
-        i.isDirectory = dirent->type == ItemTypeDirectory;
-        i.isHidden = dirent->is_hidden;
-        i.isSymLink = dirent->type == ItemTypeSoftLink;
-        i.isVirtualFile = dirent->type == ItemTypeVirtualFile || dirent->type == ItemTypeVirtualFileDownload;
-        i.type = dirent->type;
-        results.push_back(i);
-    }
-    if (errno != 0) {
-        csync_vio_local_closedir(dh);
-
-        // Note: Windows vio converts any error into EACCES
-        qCWarning(lcDiscovery) << "readdir failed for file in " << localPath << " - errno: " << errno;
-        emit finishedFatalError(tr("Error while reading directory %1").arg(localPath));
-        return;
+    // Network and local queries have separate limits. A new directory job may
+    // need both, so only start as many as both allow.
+    auto networkLimit = qMax(1, _syncOptions._parallelNetworkJobs);
+    auto localThreads = localDiscoveryExecutor()->threadCount();
+    if (_syncOptions._resourceShare) {
+        networkLimit = _syncOptions._resourceShare->networkJobs(networkLimit);
+        localThreads = _syncOptions._resourceShare->localDiscoveryThreads(localThreads);
     }
-
-    errno = 0;
-    csync_vio_local_closedir(dh);
-    if (errno != 0) {
-        qCWarning(lcDiscovery) << "closedir failed for file in " << localPath << " - errno: " << errno;
+    auto localLimit = localThreads * 2;
+    auto available = qMin(networkLimit - _currentlyActiveJobs, localLimit - _currentlyActiveLocalJobs);
+    if (_currentRootJob && available > 0) {
+        _currentRootJob->processSubJobs(available);
     }
-
-    emit finished(results);
 }
 
 DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent)
@@ -390,8 +329,8 @@ void DiscoverySingleDirectoryJob::start()
 
     lsColJob->setProperties(props);
 
-    QObject::connect(lsColJob, &LsColJob::directoryListingIterated,
-        this, &DiscoverySingleDirectoryJob::directoryListingIteratedSlot);
+    QObject::connect(lsColJob, &LsColJob::directoryListingEntries,
+        this, &DiscoverySingleDirectoryJob::directoryListingEntriesSlot);
     QObject::connect(lsColJob, &LsColJob::finishedWithError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot);
     QObject::connect(lsColJob, &LsColJob::finishedWithoutError, this, &DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot);
     lsColJob->start();
@@ -406,138 +345,151 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static void propertyMapToRemoteInfo(const QMap<QString, QString> &map, RemoteInfo &result)
+static void lsColEntryToRemoteInfo(const LsColEntry &entry, RemoteInfo &result)
 {
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        QString property = it.key();
-        QString value = it.value();
-        if (property == QLatin1String("resourcetype")) {
-            result.isDirectory = value.contains(QLatin1String("collection"));
-        } else if (property == QLatin1String("getlastmodified")) {
-            const auto date = QDateTime::fromString(value, Qt::RFC2822Date);
-            Q_ASSERT(date.isValid());
-            result.modtime = 0;
-            if (date.toSecsSinceEpoch() > 0) {
-                result.modtime = date.toSecsSinceEpoch();
-            }
-        } else if (property == QLatin1String("getcontentlength")) {
-            // See #4573, sometimes negative size values are returned
-            bool ok = false;
-            qlonglong ll = value.toLongLong(&ok);
-            if (ok && ll >= 0) {
-                result.size = ll;
-            } else {
-                result.size = 0;
-            }
-        } else if (property == "getetag") {
-            result.etag = Utility::normalizeEtag(value.toUtf8());
-        } else if (property == "id") {
-            result.fileId = value.toUtf8();
-        } else if (property == "downloadURL") {
-            result.directDownloadUrl = value;
-        } else if (property == "dDC") {
-            result.directDownloadCookies = value;
-        } else if (property == "permissions") {
-            result.remotePerm = RemotePermissions::fromServerString(value);
-        } else if (property == "checksums") {
-            result.checksumHeader = findBestChecksum(value.toUtf8());
-        } else if (property == "share-types" && !value.isEmpty()) {
-            // Since QMap is sorted, "share-types" is always after "permissions".
-            if (result.remotePerm.isNull()) {
-                qWarning() << "Server returned a share type, but no permissions?";
-            } else {
-                // S means shared with me.
-                // But for our purpose, we want to know if the file is shared. It does not matter
-                // if we are the owner or not.
-                // Piggy back on the persmission field
-                result.remotePerm.setPermission(RemotePermissions::IsShared);
-            }
-        } else if (property == "is-encrypted" && value == QStringLiteral("1")) {
-            result.isE2eEncrypted = true;
-        } else if (property == "lock") {
-            result.locked = (value == QStringLiteral("1") ? SyncFileItem::LockStatus::LockedItem : SyncFileItem::LockStatus::UnlockedItem);
-        }
-        if (property == "lock-owner-displayname") {
-            result.lockOwnerDisplayName = value;
+    if (entry.contains(LsColEntry::ResourceType)) {
+        result.isDirectory = entry.value(LsColEntry::ResourceType).contains(QLatin1String("collection"));
+    }
+    if (entry.contains(LsColEntry::GetLastModified)) {
+        const auto date = QDateTime::fromString(entry.value(LsColEntry::GetLastModified), Qt::RFC2822Date);
+        Q_ASSERT(date.isValid());
+        result.modtime = 0;
+        if (date.toSecsSinceEpoch() > 0) {
+            result.modtime = date.toSecsSinceEpoch();
         }
-        if (property == "lock-owner") {
-            result.lockOwnerId = value;
+    }
+    if (entry.contains(LsColEntry::GetContentLength)) {
+        // See #4573, sometimes negative size values are returned
+        bool ok = false;
+        qlonglong ll = entry.value(LsColEntry::GetContentLength).toLongLong(&ok);
+        if (ok && ll >= 0) {
+            result.size = ll;
+        } else {
+            result.size = 0;
         }
-        if (property == "lock-owner-type") {
-            auto ok = false;
-            const auto intConvertedValue = value.toULongLong(&ok);
-            if (ok) {
-                result.lockOwnerType = static_cast<SyncFileItem::LockOwnerType>(intConvertedValue);
-            } else {
-                result.lockOwnerType = SyncFileItem::LockOwnerType::UserLock;
-            }
+    }
+    if (entry.contains(LsColEntry::GetEtag)) {
+        result.etag = Utility::normalizeEtag(entry.value(LsColEntry::GetEtag).toUtf8());
+    }
+    if (entry.contains(LsColEntry::Id)) {
+        result.fileId = entry.value(LsColEntry::Id).toUtf8();
+    }
+    if (entry.contains(LsColEntry::DownloadUrl)) {
+        result.directDownloadUrl = entry.value(LsColEntry::DownloadUrl);
+    }
+    if (entry.contains(LsColEntry::DirectDownloadCookies)) {
+        result.directDownloadCookies = entry.value(LsColEntry::DirectDownloadCookies);
+    }
+    if (entry.contains(LsColEntry::Permissions)) {
+        result.remotePerm = RemotePermissions::fromServerString(entry.value(LsColEntry::Permissions));
+    }
+    if (entry.contains(LsColEntry::Checksums)) {
+        result.checksumHeader = findBestChecksum(entry.value(LsColEntry::Checksums).toUtf8());
+    }
+    // Must come after the permissions
+    if (!entry.value(LsColEntry::ShareTypes).isEmpty()) {
+        if (result.remotePerm.isNull()) {
+            qWarning() << "Server returned a share type, but no permissions?";
+        } else {
+            // S means shared with me.
+            // But for our purpose, we want to know if the file is shared. It does not matter
+            // if we are the owner or not.
+            // Piggy back on the persmission field
+            result.remotePerm.setPermission(RemotePermissions::IsShared);
         }
-        if (property == "lock-owner-editor") {
-            result.lockEditorApp = value;
+    }
+    if (entry.value(LsColEntry::IsEncrypted) == QStringLiteral("1")) {
+        result.isE2eEncrypted = true;
+    }
+    if (entry.contains(LsColEntry::Lock)) {
+        result.locked = (entry.value(LsColEntry::Lock) == QStringLiteral("1") ? SyncFileItem::LockStatus::LockedItem : SyncFileItem::LockStatus::UnlockedItem);
+    }
+    if (entry.contains(LsColEntry::LockOwnerDisplayName)) {
+        result.lockOwnerDisplayName = entry.value(LsColEntry::LockOwnerDisplayName);
+    }
+    if (entry.contains(LsColEntry::LockOwner)) {
+        result.lockOwnerId = entry.value(LsColEntry::LockOwner);
+    }
+    if (entry.contains(LsColEntry::LockOwnerType)) {
+        auto ok = false;
+        const auto intConvertedValue = entry.value(LsColEntry::LockOwnerType).toULongLong(&ok);
+        if (ok) {
+            result.lockOwnerType = static_cast<SyncFileItem::LockOwnerType>(intConvertedValue);
+        } else {
+            result.lockOwnerType = SyncFileItem::LockOwnerType::UserLock;
         }
-        if (property == "lock-time") {
-            auto ok = false;
-            const auto intConvertedValue = value.toULongLong(&ok);
-            if (ok) {
-                result.lockTime = intConvertedValue;
-            } else {
-                result.lockTime = 0;
-            }
+    }
+    if (entry.contains(LsColEntry::LockOwnerEditor)) {
+        result.lockEditorApp = entry.value(LsColEntry::LockOwnerEditor);
+    }
+    if (entry.contains(LsColEntry::LockTime)) {
+        auto ok = false;
+        const auto intConvertedValue = entry.value(LsColEntry::LockTime).toULongLong(&ok);
+        if (ok) {
+            result.lockTime = intConvertedValue;
+        } else {
+            result.lockTime = 0;
         }
-        if (property == "lock-timeout") {
-            auto ok = false;
-            const auto intConvertedValue = value.toULongLong(&ok);
-            if (ok) {
-                result.lockTimeout = intConvertedValue;
-            } else {
-                result.lockTimeout = 0;
-            }
+    }
+    if (entry.contains(LsColEntry::LockTimeout)) {
+        auto ok = false;
+        const auto intConvertedValue = entry.value(LsColEntry::LockTimeout).toULongLong(&ok);
+        if (ok) {
+            result.lockTimeout = intConvertedValue;
+        } else {
+            result.lockTimeout = 0;
         }
+    }
 
+    if (result.isDirectory && entry.contains(LsColEntry::Size)) {
+        result.sizeOfFolder = entry.value(LsColEntry::Size).toInt();
     }
+}
 
-    if (result.isDirectory && map.contains("size")) {
-        result.sizeOfFolder = map.value("size").toInt();
+void DiscoverySingleDirectoryJob::directoryListingEntriesSlot(const QVector<LsColEntry> &entries)
+{
+    for (const auto &entry : entries) {
+        processEntry(entry);
     }
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &file, const QMap<QString, QString> &map)
+void DiscoverySingleDirectoryJob::processEntry(const LsColEntry &entry)
 {
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
-        if (map.contains("permissions")) {
-            auto perm = RemotePermissions::fromServerString(map.value("permissions"));
+        if (entry.contains(LsColEntry::Permissions)) {
+            auto perm = RemotePermissions::fromServerString(entry.value(LsColEntry::Permissions));
             emit firstDirectoryPermissions(perm);
             _isExternalStorage = perm.hasPermission(RemotePermissions::IsMounted);
         }
-        if (map.contains("data-fingerprint")) {
-            _dataFingerprint = map.value("data-fingerprint").toUtf8();
+        if (entry.contains(LsColEntry::DataFingerprint)) {
+            _dataFingerprint = entry.value(LsColEntry::DataFingerprint).toUtf8();
             if (_dataFingerprint.isEmpty()) {
                 // Placeholder that means that the server supports the feature even if it did not set one.
                 _dataFingerprint = "[empty]";
             }
         }
-        if (map.contains(QStringLiteral("fileid"))) {
-            _localFileId = map.value(QStringLiteral("fileid")).toUtf8();
+        if (entry.contains(LsColEntry::FileId)) {
+            _localFileId = entry.value(LsColEntry::FileId).toUtf8();
         }
-        if (map.contains("id")) {
-            _fileId = map.value("id").toUtf8();
+        if (entry.contains(LsColEntry::Id)) {
+            _fileId = entry.value(LsColEntry::Id).toUtf8();
         }
-        if (map.contains("is-encrypted") && map.value("is-encrypted") == QStringLiteral("1")) {
+        if (entry.value(LsColEntry::IsEncrypted) == QStringLiteral("1")) {
             _isE2eEncrypted = true;
             Q_ASSERT(!_fileId.isEmpty());
         }
-        if (map.contains("size")) {
-            _size = map.value("size").toInt();
+        if (entry.contains(LsColEntry::Size)) {
+            _size = entry.value(LsColEntry::Size).toInt();
         }
     } else {
 
         RemoteInfo result;
-        int slash = file.lastIndexOf('/');
-        result.name = file.mid(slash + 1);
+        int slash = entry.href.lastIndexOf('/');
+        result.name = entry.href.mid(slash + 1);
         result.size = -1;
-        propertyMapToRemoteInfo(map, result);
+        lsColEntryToRemoteInfo(entry, result);
         if (result.isDirectory)
             result.size = 0;
 
@@ -552,9 +504,9 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &fi
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
+    if (entry.contains(LsColEntry::GetEtag)) {
         if (_firstEtag.isEmpty()) {
-            _firstEtag = parseEtag(map.value(QStringLiteral("getetag")).toUtf8()); // for directory itself
+            _firstEtag = parseEtag(entry.value(LsColEntry::GetEtag).toUtf8()); // for directory itself
         }
     }
 }
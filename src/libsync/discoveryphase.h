@@ -25,6 +25,7 @@
 #include <QWaitCondition>
 #include <QRunnable>
 #include <deque>
+#include <memory>
 #include "syncoptions.h"
 #include "syncfileitem.h"
 
@@ -41,6 +42,7 @@ enum class LocalDiscoveryStyle {
 class Account;
 class SyncJournalDb;
 class ProcessDirectoryJob;
+class LocalDiscoveryExecutor;
 
 /**
  * Represent all the meta-data about a file in the server
@@ -91,34 +93,6 @@ struct LocalInfo
     bool isValid() const { return !name.isNull(); }
 };
 
-/**
- * @brief Run list on a local directory and process the results for Discovery
- *
- * @ingroup libsync
- */
-class DiscoverySingleLocalDirectoryJob : public QObject, public QRunnable
-{
-    Q_OBJECT
-public:
-    explicit DiscoverySingleLocalDirectoryJob(const AccountPtr &account, const QString &localPath, OCC::Vfs *vfs, QObject *parent = nullptr);
-
-    void run() override;
-signals:
-    void finished(QVector<LocalInfo> result);
-    void finishedFatalError(QString errorString);
-    void finishedNonFatalError(QString errorString);
-
-    void itemDiscovered(SyncFileItemPtr item);
-    void childIgnored(bool b);
-private slots:
-private:
-    QString _localPath;
-    AccountPtr _account;
-    OCC::Vfs* _vfs;
-public:
-};
-
-
 /**
  * @brief Run a PROPFIND on a directory and process the results for Discovery
  *
@@ -141,7 +115,7 @@ signals:
     void finished(const HttpResult<QVector<RemoteInfo>> &result);
 
 private slots:
-    void directoryListingIteratedSlot(const QString &, const QMap<QString, QString> &);
+    void directoryListingEntriesSlot(const QVector<LsColEntry> &entries);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply *);
     void fetchE2eMetadata();
@@ -149,6 +123,8 @@ private slots:
     void metadataError(const QByteArray& fileId, int httpReturnCode);
 
 private:
+    void processEntry(const LsColEntry &entry);
+
     QVector<RemoteInfo> _results;
     QString _subPath;
     QByteArray _firstEtag;
@@ -225,6 +201,11 @@ class DiscoveryPhase : public QObject
     bool isRenamed(const QString &p) const { return _renamedItemsLocal.contains(p) || _renamedItemsRemote.contains(p); }
 
     int _currentlyActiveJobs = 0;
+    int _currentlyActiveLocalJobs = 0;
+
+    /// Lists local directories ahead of the ProcessDirectoryJobs, created on first use
+    std::unique_ptr<LocalDiscoveryExecutor> _localDiscoveryExecutor;
+    LocalDiscoveryExecutor *localDiscoveryExecutor();
 
     // both must contain a sorted list
     QStringList _selectiveSyncBlackList;
@@ -262,6 +243,9 @@ class DiscoveryPhase : public QObject
     void enqueueDirectoryToDelete(const QString &path, ProcessDirectoryJob* const directoryJob);
 
 public:
+    DiscoveryPhase();
+    ~DiscoveryPhase() override;
+
     // input
     QString _localDir; // absolute path to the local directory. ends with '/'
     QString _remoteFolder; // remote folder, ends with '/'
@@ -289,6 +273,14 @@ signals:
     void itemDiscovered(const SyncFileItemPtr &item);
     void finished();
 
+    /** All items in and below the directory at path have been discovered
+     *
+     * Only emitted if no parent directory needs to be propagated. Removals
+     * and renames discovered later might still change those items, see
+     * findAndCancelDeletedJob().
+     */
+    void subtreeDiscovered(const QString &path);
+
     // A new folder was discovered and was not synced because of the confirmation feature
     void newBigFolder(const QString &folder, bool isExternal);
 
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "localdiscoveryexecutor.h"
+
+#include "common/asserts.h"
+#include "common/vfs.h"
+#include "vio/csync_vio_local.h"
+
+#include <QLoggingCategory>
+#include <QTextCodec>
+#include <QThread>
+
+#include <climits>
+#include <vector>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcLocalDiscoveryExecutor, "nextcloud.sync.discovery.local", QtInfoMsg)
+
+LocalDiscoveryExecutor::LocalDiscoveryExecutor(Vfs *vfs, int threadCount)
+    : _vfs(vfs)
+{
+    if (threadCount <= 0)
+        threadCount = qMax(1, QThread::idealThreadCount());
+
+    _queues.resize(threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+        auto thread = QThread::create([this, i] { workerLoop(i); });
+        thread->setObjectName(QStringLiteral("LocalDiscovery%1").arg(i));
+        _threads.push_back(thread);
+        thread->start();
+    }
+    qCDebug(lcLocalDiscoveryExecutor) << "Started" << threadCount << "local discovery threads";
+}
+
+LocalDiscoveryExecutor::~LocalDiscoveryExecutor()
+{
+    {
+        QMutexLocker lock(&_mutex);
+        _stop = true;
+        _workAvailable.wakeAll();
+    }
+    for (auto thread : _threads) {
+        thread->wait();
+        delete thread;
+    }
+}
+
+QString LocalDiscoveryExecutor::keyForPath(const QString &path)
+{
+    // The root of the sync folder is requested with a trailing slash
+    if (path.endsWith(QLatin1Char('/')))
+        return path.left(path.size() - 1);
+    return path;
+}
+
+void LocalDiscoveryExecutor::request(const QString &localPath, QObject *receiver, const Callback &callback)
+{
+    const auto key = keyForPath(localPath);
+    LocalDirectoryListing listing;
+    {
+        QMutexLocker lock(&_mutex);
+        auto it = _prefetched.find(key);
+        if (it == _prefetched.end()) {
+            _waiters[key].append(Waiter{ receiver, callback });
+            auto state = _states.find(key);
+            if (state == _states.end()) {
+                _states.insert(key, TaskState::Queued);
+                _requested.push_back(Task{ localPath, _prefetchDepth });
+            } else if (state.value() == TaskState::Queued) {
+                // Already in a worker queue, move it ahead
+                _requested.push_back(Task{ localPath, _prefetchDepth });
+            }
+            // Otherwise it is being listed and the waiters get the result when done
+            _workAvailable.wakeOne();
+            return;
+        }
+
+        listing = std::move(it.value());
+        _prefetched.erase(it);
+        _cachedEntries -= listing.entries.size();
+        // Now that discovery reached this directory, look further ahead
+        if (_prefetchDepth > 0)
+            enqueueSubdirectories(0, key, listing, _prefetchDepth - 1);
+        _workAvailable.wakeAll();
+    }
+
+    QMetaObject::invokeMethod(receiver, [callback, listing = std::move(listing)] { callback(listing); }, Qt::QueuedConnection);
+}
+
+void LocalDiscoveryExecutor::discard(const QString &localPath)
+{
+    const auto key = keyForPath(localPath);
+    const auto prefix = key + QLatin1Char('/');
+
+    QMutexLocker lock(&_mutex);
+
+    // Names like "dir-x" sort between "dir" and "dir/...", so look at the directory
+    // itself and at the range of its children separately
+    auto discardPrefetched = [this](QMap<QString, LocalDirectoryListing>::iterator it) {
+        _cachedEntries -= it.value().entries.size();
+        return _prefetched.erase(it);
+    };
+    auto exact = _prefetched.find(key);
+    if (exact != _prefetched.end())
+        discardPrefetched(exact);
+    for (auto it = _prefetched.lowerBound(prefix); it != _prefetched.end() && it.key().startsWith(prefix);)
+        it = discardPrefetched(it);
+
+    auto discardState = [this](QMap<QString, TaskState>::iterator it) {
+        if (_waiters.contains(it.key()))
+            return ++it;
+        if (it.value() == TaskState::Running) {
+            // The result is dropped in finishTask()
+            it.value() = TaskState::Discarded;
+            return ++it;
+        }
+        if (it.value() == TaskState::Queued) {
+            // The task stays in its queue but takeTask() will skip it
+            return _states.erase(it);
+        }
+        return ++it;
+    };
+    auto exactState = _states.find(key);
+    if (exactState != _states.end())
+        discardState(exactState);
+    for (auto it = _states.lowerBound(prefix); it != _states.end() && it.key().startsWith(prefix);)
+        it = discardState(it);
+}
+
+qint64 LocalDiscoveryExecutor::scanTree(const QString &localPath)
+{
+    QMutexLocker lock(&_mutex);
+    ASSERT(!_scanningTree && _states.isEmpty());
+    _scanningTree = true;
+    _scannedEntries = 0;
+    _states.insert(keyForPath(localPath), TaskState::Queued);
+    _requested.push_back(Task{ localPath, INT_MAX });
+    _workAvailable.wakeAll();
+    while (_runningTasks > 0 || hasQueuedWork()) {
+        _idle.wait(&_mutex);
+    }
+    _scanningTree = false;
+    return _scannedEntries;
+}
+
+bool LocalDiscoveryExecutor::hasQueuedWork() const
+{
+    if (!_requested.empty())
+        return true;
+    for (const auto &queue : _queues) {
+        if (!queue.empty())
+            return true;
+    }
+    return false;
+}
+
+void LocalDiscoveryExecutor::workerLoop(int workerIndex)
+{
+    forever {
+        Task task;
+        {
+            QMutexLocker lock(&_mutex);
+            while (!takeTask(workerIndex, &task)) {
+                if (_stop)
+                    return;
+                if (_runningTasks == 0 && !hasQueuedWork())
+                    _idle.wakeAll();
+                _workAvailable.wait(&_mutex);
+            }
+            ++_runningTasks;
+        }
+
+        auto listing = listDirectory(task.path, _vfs);
+        finishTask(workerIndex, task, std::move(listing));
+    }
+}
+
+// Must be called with _mutex locked
+bool LocalDiscoveryExecutor::takeTask(int workerIndex, Task *task)
+{
+    if (_stop)
+        return false;
+
+    auto claim = [this, task](std::deque<Task> &queue, bool fromFront) {
+        while (!queue.empty()) {
+            *task = fromFront ? std::move(queue.front()) : std::move(queue.back());
+            if (fromFront)
+                queue.pop_front();
+            else
+                queue.pop_back();
+
+            // The same directory may be queued more than once, or be discarded meanwhile
+            auto state = _states.find(keyForPath(task->path));
+            if (state != _states.end() && state.value() == TaskState::Queued) {
+                state.value() = TaskState::Running;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (claim(_requested, true))
+        return true;
+
+    // Don't prefetch more if discovery doesn't keep up
+    if (_cachedEntries >= _maximumCachedEntries && !_scanningTree)
+        return false;
+
+    if (claim(_queues[workerIndex], false))
+        return true;
+
+    const auto queueCount = static_cast<int>(_queues.size());
+    for (int i = 1; i < queueCount; ++i) {
+        if (claim(_queues[(workerIndex + i) % queueCount], true))
+            return true;
+    }
+    return false;
+}
+
+void LocalDiscoveryExecutor::finishTask(int workerIndex, const Task &task, LocalDirectoryListing &&listing)
+{
+    const auto key = keyForPath(task.path);
+    QVector<Waiter> waiters;
+    {
+        QMutexLocker lock(&_mutex);
+        --_runningTasks;
+        const auto state = _states.take(key);
+        waiters = _waiters.take(key);
+
+        if (_scanningTree) {
+            _scannedEntries += listing.entries.size();
+            enqueueSubdirectories(workerIndex, key, listing, INT_MAX);
+        } else if (!waiters.isEmpty()) {
+            if (_prefetchDepth > 0)
+                enqueueSubdirectories(workerIndex, key, listing, _prefetchDepth - 1);
+        } else if (state == TaskState::Running) {
+            if (task.remainingDepth > 0)
+                enqueueSubdirectories(workerIndex, key, listing, task.remainingDepth - 1);
+            _cachedEntries += listing.entries.size();
+            _prefetched.insert(key, std::move(listing));
+        }
+
+        if (_runningTasks == 0 && !hasQueuedWork())
+            _idle.wakeAll();
+    }
+
+    if (waiters.isEmpty())
+        return;
+
+    // Whether a receiver still exists can only be known in its thread, which is
+    // the executor's. The executor outlives the worker threads, so this is safe.
+    QMetaObject::invokeMethod(this, [waiters = std::move(waiters), listing = std::move(listing)] {
+        for (const auto &waiter : waiters) {
+            if (waiter.receiver)
+                waiter.callback(listing);
+        }
+    }, Qt::QueuedConnection);
+}
+
+// Must be called with _mutex locked
+void LocalDiscoveryExecutor::enqueueSubdirectories(int workerIndex, const QString &key, const LocalDirectoryListing &listing, int remainingDepth)
+{
+    if (listing.error != LocalDirectoryListing::NoError)
+        return;
+
+    auto &queue = _queues[workerIndex];
+    bool added = false;
+    for (const auto &entry : listing.entries) {
+        if (!entry.isDirectory || entry.isSymLink)
+            continue;
+        auto path = key + QLatin1Char('/') + entry.name;
+        if (_states.contains(path) || _prefetched.contains(path))
+            continue;
+        _states.insert(path, TaskState::Queued);
+        queue.push_back(Task{ std::move(path), remainingDepth });
+        added = true;
+    }
+    if (added)
+        _workAvailable.wakeAll();
+}
+
+LocalDirectoryListing LocalDiscoveryExecutor::listDirectory(const QString &path, Vfs *vfs)
+{
+    LocalDirectoryListing result;
+
+    QString localPath = path;
+    if (localPath.endsWith('/')) // Happens if _currentFolder._local.isEmpty()
+        localPath.chop(1);
+
+    auto dh = csync_vio_local_opendir(localPath);
+    if (!dh) {
+        qCInfo(lcLocalDiscoveryExecutor) << "Error while opening directory" << (localPath) << errno;
+        result.errorString = tr("Error while opening directory %1").arg(localPath);
+        result.error = LocalDirectoryListing::FatalError;
+        if (errno == EACCES) {
+            result.errorString = tr("Directory not accessible on client, permission denied");
+            result.error = LocalDirectoryListing::NonFatalError;
+        } else if (errno == ENOENT) {
+            result.errorString = tr("Directory not found: %1").arg(localPath);
+        } else if (errno == ENOTDIR) {
+            // Not a directory..
+            // Just consider it is empty
+            result.errorString.clear();
+            result.error = LocalDirectoryListing::NoError;
+        }
+        return result;
+    }
+
+    // Reused for all directories listed by this thread
+    thread_local std::vector<csync_file_stat_t> dirents;
+    if (csync_vio_local_readdir_batch(dh, &dirents, vfs) < 0) {
+        const auto readError = errno;
+        csync_vio_local_closedir(dh);
+
+        // Note: Windows vio converts any error into EACCES
+        qCWarning(lcLocalDiscoveryExecutor) << "readdir failed for file in " << localPath << " - errno: " << readError;
+        result.error = LocalDirectoryListing::FatalError;
+        result.errorString = tr("Error while reading directory %1").arg(localPath);
+        return result;
+    }
+
+    static QTextCodec *codec = QTextCodec::codecForName("UTF-8");
+    ASSERT(codec);
+    result.entries.reserve(static_cast<int>(dirents.size()));
+    for (const auto &dirent : dirents) {
+        if (dirent.type == ItemTypeSkip)
+            continue;
+        LocalInfo i;
+        QTextCodec::ConverterState state;
+        i.name = codec->toUnicode(dirent.path, dirent.path.size(), &state);
+        if (state.invalidChars > 0 || state.remainingChars > 0) {
+            auto item = SyncFileItemPtr::create();
+            //item->_file = _currentFolder._target + i.name;
+            // FIXME ^^ do we really need to use _target or is local fine?
+            item->_file = path + i.name;
+            item->_instruction = CSYNC_INSTRUCTION_IGNORE;
+            item->_status = SyncFileItem::NormalError;
+            item->_errorString = tr("Filename encoding is not valid");
+            result.ignoredItems.push_back(item);
+            continue;
+        }
+        i.modtime = dirent.modtime;
+        i.size = dirent.size;
+        i.inode = dirent.inode;
+        i.isDirectory = dirent.type == ItemTypeDirectory;
+        i.isHidden = dirent.is_hidden;
+        i.isSymLink = dirent.type == ItemTypeSoftLink;
+        i.isVirtualFile = dirent.type == ItemTypeVirtualFile || dirent.type == ItemTypeVirtualFileDownload;
+        i.type = dirent.type;
+        result.entries.push_back(i);
+    }
+    dirents.clear();
+
+    errno = 0;
+    csync_vio_local_closedir(dh);
+    if (errno != 0) {
+        qCWarning(lcLocalDiscoveryExecutor) << "closedir failed for file in " << localPath << " - errno: " << errno;
+    }
+
+    return result;
+}
+
+}
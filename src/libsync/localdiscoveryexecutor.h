@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+#include "discoveryphase.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+class QThread;
+
+namespace OCC {
+
+class Vfs;
+
+/**
+ * The result of listing one local directory
+ */
+struct LocalDirectoryListing
+{
+    enum Error {
+        NoError,
+        FatalError, //< discovery must be aborted
+        NonFatalError //< the directory should be ignored
+    };
+
+    QVector<LocalInfo> entries;
+    /// Entries that can't be synced, like file names with an invalid encoding
+    QVector<SyncFileItemPtr> ignoredItems;
+    Error error = NoError;
+    QString errorString;
+};
+
+/**
+ * @brief Lists local directories on a set of worker threads
+ *
+ * Local discovery is limited by the speed of readdir/stat. Instead of listing one
+ * directory at a time when ProcessDirectoryJob asks for it, this executor keeps
+ * listing the subdirectories of what was asked for so that the results are
+ * usually ready when discovery reaches them.
+ *
+ * Each worker has its own queue: it takes new work from the back of its queue
+ * (depth first, the directories it just found) and steals from the front of the
+ * other workers' queues when it runs out. Directories that were requested by
+ * discovery are always served first.
+ *
+ * The number of threads is independent from the network job limit of the
+ * discovery.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT LocalDiscoveryExecutor : public QObject
+{
+    Q_OBJECT
+public:
+    using Callback = std::function<void(const LocalDirectoryListing &)>;
+
+    /** threadCount <= 0 means QThread::idealThreadCount() */
+    explicit LocalDiscoveryExecutor(Vfs *vfs, int threadCount = 0);
+    ~LocalDiscoveryExecutor() override;
+
+    int threadCount() const { return static_cast<int>(_threads.size()); }
+
+    /** How many levels below a requested directory are listed ahead of time. 0 disables prefetching. */
+    void setPrefetchDepth(int depth) { _prefetchDepth = depth; }
+
+    /** Maximum number of entries kept for directories that were listed ahead of time but not requested yet */
+    void setMaximumCachedEntries(int count) { _maximumCachedEntries = count; }
+
+    /** Calls callback with the listing of localPath in the thread of the executor.
+     *
+     * The receiver must live in that thread too. The callback isn't called if
+     * receiver is destroyed before the listing is done.
+     */
+    void request(const QString &localPath, QObject *receiver, const Callback &callback);
+
+    /** Forget everything that was or is being listed ahead of time in localPath and below.
+     *
+     * To be called for directories discovery won't look into, for example excluded ones.
+     */
+    void discard(const QString &localPath);
+
+    /** Lists localPath and all subdirectories, blocks until done.
+     *
+     * Returns the number of entries seen. Used for benchmarks.
+     */
+    qint64 scanTree(const QString &localPath);
+
+    /** Lists a single directory in the calling thread */
+    static LocalDirectoryListing listDirectory(const QString &localPath, Vfs *vfs);
+
+private:
+    struct Task
+    {
+        QString path; // as given to listDirectory()
+        int remainingDepth;
+    };
+
+    enum class TaskState {
+        Queued,
+        Running,
+        Discarded
+    };
+
+    struct Waiter
+    {
+        QPointer<QObject> receiver; // only to be used in the executor's thread
+        Callback callback;
+    };
+
+    void workerLoop(int workerIndex);
+    bool takeTask(int workerIndex, Task *task);
+    void finishTask(int workerIndex, const Task &task, LocalDirectoryListing &&listing);
+    void enqueueSubdirectories(int workerIndex, const QString &key, const LocalDirectoryListing &listing, int remainingDepth);
+    bool hasQueuedWork() const;
+    static QString keyForPath(const QString &path);
+
+    Vfs *_vfs;
+    int _prefetchDepth = 2;
+    int _maximumCachedEntries = 200000;
+
+    std::vector<QThread *> _threads;
+
+    // Everything below is protected by _mutex
+    mutable QMutex _mutex;
+    QWaitCondition _workAvailable;
+    QWaitCondition _idle;
+    bool _stop = false;
+    int _runningTasks = 0;
+    std::vector<std::deque<Task>> _queues; // one per worker
+    std::deque<Task> _requested; // asked for by discovery, served before the queues
+    QMap<QString, TaskState> _states; // keyed by keyForPath(), sorted to discard subtrees
+    QMap<QString, LocalDirectoryListing> _prefetched;
+    QMap<QString, QVector<Waiter>> _waiters;
+    int _cachedEntries = 0;
+
+    // Only used by scanTree()
+    bool _scanningTree = false;
+    qint64 _scannedEntries = 0;
+};
+
+}
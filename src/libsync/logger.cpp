@@ -15,15 +15,19 @@
 #include "logger.h"
 
 #include "config.h"
+#include "common/tracing.h"
 
+#include <QDeadlineTimer>
 #include <QDir>
 #include <QRegularExpression>
 #include <QStringList>
+#include <QThread>
 #include <QtGlobal>
-#include <QTextCodec>
 #include <qmetaobject.h>
+#include <qtconcurrentrun.h>
 
 #include <iostream>
+#include <utility>
 
 #ifdef ZLIB_FOUND
 #include <zlib.h>
@@ -35,9 +39,94 @@
 
 namespace {
 constexpr int CrashLogSize = 20;
+// Messages waiting for the writer, must be a power of two
+constexpr size_t LogQueueSize = 64 * 1024;
+// The writer waits that long after the first message, for larger batches
+constexpr int BatchDelayMsec = 20;
+// Written in one go, more than that is written in several writes
+constexpr int MaxBatchBytes = 1024 * 1024;
 }
 namespace OCC {
 
+/**
+ * Bounded lock-free queue of formatted messages for any number of producers
+ * and one consumer at a time, the one holding Logger::_mutex.
+ *
+ * Each slot has a sequence number: it equals the queue position when the slot
+ * is free for the producer of that position and the position plus one once
+ * the message is there for the consumer.
+ */
+class LogQueue
+{
+public:
+    explicit LogQueue(size_t capacity)
+        : _slots(new Slot[capacity])
+        , _mask(capacity - 1)
+    {
+        Q_ASSERT((capacity & _mask) == 0);
+        for (size_t i = 0; i < capacity; ++i) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// Returns false if the queue is full
+    bool tryPush(QString &message)
+    {
+        auto position = _pushPosition.load(std::memory_order_relaxed);
+        forever {
+            auto &slot = _slots[position & _mask];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+                if (_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.message.swap(message);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = _pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Returns false if the queue is empty, or the next message is not there yet
+    bool tryPop(QString &message)
+    {
+        const auto position = _popPosition.load(std::memory_order_relaxed);
+        auto &slot = _slots[position & _mask];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+            return false;
+        }
+        message.swap(slot.message);
+        slot.message = QString();
+        slot.sequence.store(position + _mask + 1, std::memory_order_release);
+        _popPosition.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Can be asked without being the consumer, the answer may be outdated then
+    bool isEmpty() const
+    {
+        const auto position = _popPosition.load(std::memory_order_relaxed);
+        return _slots[position & _mask].sequence.load(std::memory_order_acquire) != position + 1;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        QString message;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    const size_t _mask;
+    // Keep the producers' and the consumer's position on different cache lines
+    alignas(64) std::atomic<size_t> _pushPosition{0};
+    alignas(64) std::atomic<size_t> _popPosition{0};
+};
+
 Logger *Logger::instance()
 {
     static Logger log;
@@ -46,6 +135,7 @@ Logger *Logger::instance()
 
 Logger::Logger(QObject *parent)
     : QObject(parent)
+    , _queue(std::make_unique<LogQueue>(LogQueueSize))
 {
     qSetMessagePattern(QStringLiteral("%{time yyyy-MM-dd hh:mm:ss:zzz} [ %{type} %{category} %{file}:%{line} "
                                       "]%{if-debug}\t[ %{function} ]%{endif}:\t%{message}"));
@@ -62,6 +152,10 @@ Logger::~Logger()
 #ifndef NO_MSG_HANDLER
     qInstallMessageHandler(nullptr);
 #endif
+    stopWriter();
+    QMutexLocker lock(&_mutex);
+    writeQueuedMessages();
+    _logFile.flush();
 }
 
 
@@ -83,7 +177,7 @@ void Logger::postGuiMessage(const QString &title, const QString &message)
 bool Logger::isLoggingToFile() const
 {
     QMutexLocker lock(&_mutex);
-    return _logstream;
+    return _logFile.isOpen();
 }
 
 void Logger::doLog(QtMsgType type, const QMessageLogContext &ctx, const QString &message)
@@ -113,15 +207,14 @@ void Logger::doLog(QtMsgType type, const QMessageLogContext &ctx, const QString
         OutputDebugString(msgW.c_str());
     }
 #endif
-    {
+    if (type != QtFatalMsg && _asynchronous.load(std::memory_order_relaxed)) {
+        queueMessage(msg);
+    } else {
         QMutexLocker lock(&_mutex);
-        _crashLogIndex = (_crashLogIndex + 1) % CrashLogSize;
-        _crashLog[_crashLogIndex] = msg;
-        if (_logstream) {
-            (*_logstream) << msg << Qt::endl;
-            if (_doFileFlush)
-                _logstream->flush();
-        }
+        writeQueuedMessages();
+        QByteArray line;
+        appendMessage(line, msg);
+        writeBatch(line);
         if (type == QtFatalMsg) {
             close();
 #if defined(Q_OS_WIN)
@@ -133,14 +226,132 @@ void Logger::doLog(QtMsgType type, const QMessageLogContext &ctx, const QString
     emit logWindowLog(msg);
 }
 
+void Logger::queueMessage(QString message)
+{
+    if (!_queue->tryPush(message)) {
+        _droppedMessages.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (!_writerStarted.load(std::memory_order_acquire)) {
+        QMutexLocker writerLocker(&_writerMutex);
+        if (!_writerThread && !_stopWriter) {
+            _writerThread = QThread::create([this] { writerLoop(); });
+            _writerThread->setObjectName(QStringLiteral("LogWriter"));
+            _writerThread->start();
+            _writerStarted.store(true, std::memory_order_release);
+        }
+    }
+
+    // Pairs with the fence in writerLoop(): either the writer sees the
+    // message or we see that it sleeps. Only then it needs waking up.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_writerSleeping.load(std::memory_order_relaxed)) {
+        QMutexLocker writerLocker(&_writerMutex);
+        _writerCondition.wakeOne();
+    }
+}
+
+void Logger::writerLoop()
+{
+    while (true) {
+        {
+            QMutexLocker writerLocker(&_writerMutex);
+            while (!_stopWriter && _queue->isEmpty()) {
+                _writerSleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (_queue->isEmpty()) {
+                    _writerCondition.wait(&_writerMutex);
+                }
+                _writerSleeping.store(false, std::memory_order_relaxed);
+            }
+            // Nobody wakes us up during the delay, except for stopping
+            QDeadlineTimer deadline(BatchDelayMsec);
+            while (!_stopWriter && _writerCondition.wait(&_writerMutex, deadline)) {
+            }
+            if (_stopWriter) {
+                return;
+            }
+        }
+
+        QMutexLocker locker(&_mutex);
+        writeQueuedMessages();
+    }
+}
+
+void Logger::stopWriter()
+{
+    QThread *thread = nullptr;
+    {
+        QMutexLocker writerLocker(&_writerMutex);
+        _stopWriter = true;
+        _writerCondition.wakeAll();
+        thread = std::exchange(_writerThread, nullptr);
+    }
+    if (thread) {
+        thread->wait();
+        delete thread;
+    }
+}
+
+void Logger::writeQueuedMessages()
+{
+    QByteArray batch;
+    QString message;
+    // Bounded, so that fast producers can't keep us here forever
+    for (size_t i = 0; i < LogQueueSize && _queue->tryPop(message); ++i) {
+        appendMessage(batch, message);
+        if (batch.size() >= MaxBatchBytes) {
+            writeBatch(batch);
+        }
+    }
+
+    const auto dropped = _droppedMessages.load(std::memory_order_relaxed);
+    if (dropped != _droppedMessagesReported) {
+        appendMessage(batch, QStringLiteral("%1 [ warning nextcloud.sync.logger ]:\t%2 log messages were dropped, the log writer could not keep up")
+                                 .arg(QDateTime::currentDateTime().toString(QStringLiteral("yyyy-MM-dd hh:mm:ss:zzz")))
+                                 .arg(dropped - _droppedMessagesReported));
+        _droppedMessagesReported = dropped;
+    }
+    writeBatch(batch);
+}
+
+void Logger::appendMessage(QByteArray &batch, const QString &message)
+{
+    _crashLogIndex = (_crashLogIndex + 1) % CrashLogSize;
+    _crashLog[_crashLogIndex] = message;
+    if (_logFile.isOpen()) {
+        batch += message.toUtf8();
+        batch += '\n';
+    }
+}
+
+void Logger::writeBatch(QByteArray &batch)
+{
+    if (batch.isEmpty()) {
+        return;
+    }
+    if (_logFile.isOpen()) {
+        _logFile.write(batch);
+        if (_doFileFlush)
+            _logFile.flush();
+    }
+    batch.clear();
+}
+
+void Logger::flush()
+{
+    QMutexLocker lock(&_mutex);
+    writeQueuedMessages();
+    _logFile.flush();
+}
+
 void Logger::close()
 {
     dumpCrashLog();
-    if (_logstream)
-    {
-        _logstream->flush();
+    if (_logFile.isOpen()) {
+        _logFile.flush();
         _logFile.close();
-        _logstream.reset();
     }
 }
 
@@ -152,8 +363,9 @@ QString Logger::logFile() const
 void Logger::setLogFile(const QString &name)
 {
     QMutexLocker locker(&_mutex);
-    if (_logstream) {
-        _logstream.reset(nullptr);
+    if (_logFile.isOpen()) {
+        // What was logged so far still goes to the old file
+        writeQueuedMessages();
         _logFile.close();
     }
 
@@ -177,9 +389,6 @@ void Logger::setLogFile(const QString &name)
                 .arg(name));
         return;
     }
-
-    _logstream.reset(new QTextStream(&_logFile));
-    _logstream->setCodec(QTextCodec::codecForName("UTF-8"));
 }
 
 void Logger::setLogExpire(int expire)
@@ -202,6 +411,14 @@ void Logger::setLogFlush(bool flush)
     _doFileFlush = flush;
 }
 
+void Logger::setLogAsynchronous(bool asynchronous)
+{
+    if (!asynchronous) {
+        flush();
+    }
+    _asynchronous = asynchronous;
+}
+
 void Logger::setLogDebug(bool debug)
 {
     const QSet<QString> rules = {debug ? QStringLiteral("nextcloud.*.debug=true") : QString()};
@@ -241,6 +458,22 @@ void Logger::disableTemporaryFolderLogDir()
     _temporaryFolderLogDir = false;
 }
 
+void Logger::setTracingEnabled(bool enabled)
+{
+    if (!enabled) {
+        Tracing::stop();
+        return;
+    }
+    if (!Tracing::fileName().isEmpty())
+        return;
+
+    QDir dir(temporaryFolderLogDirPath());
+    if (!dir.mkpath(QStringLiteral(".")))
+        return;
+    const auto name = QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd_HHmmss")) + QStringLiteral("_sync.perfetto-trace");
+    Tracing::start(dir.filePath(name));
+}
+
 void Logger::setLogRules(const QSet<QString> &rules)
 {
     _logRules = rules;
@@ -326,17 +559,19 @@ void Logger::enterNextLogFile()
         setLogFile(dir.filePath(newLogName));
 
         // Compress the previous log file. On a restart this can be the most recent
-        // log file.
+        // log file. That can take a while for a large log, so not on this thread.
         auto logToCompress = previousLog;
         if (logToCompress.isEmpty() && files.size() > 0 && !files.last().endsWith(".gz"))
             logToCompress = dir.absoluteFilePath(files.last());
         if (!logToCompress.isEmpty()) {
-            QString compressedName = logToCompress + ".gz";
-            if (compressLog(logToCompress, compressedName)) {
-                QFile::remove(logToCompress);
-            } else {
-                QFile::remove(compressedName);
-            }
+            QtConcurrent::run([logToCompress] {
+                QString compressedName = logToCompress + ".gz";
+                if (compressLog(logToCompress, compressedName)) {
+                    QFile::remove(logToCompress);
+                } else {
+                    QFile::remove(compressedName);
+                }
+            });
         }
     }
 }
@@ -20,15 +20,30 @@
 #include <QDateTime>
 #include <QFile>
 #include <QTextStream>
+#include <QWaitCondition>
 #include <qmutex.h>
 
+#include <atomic>
+#include <memory>
+
 #include "common/utility.h"
 #include "owncloudlib.h"
 
+class QThread;
+
 namespace OCC {
 
+class LogQueue;
+
 /**
  * @brief The Logger class
+ *
+ * Messages are formatted by the thread logging them and put into a bounded
+ * lock-free queue. A writer thread takes them from there and writes them to
+ * the log file in batches. Should the queue be full, the message is dropped
+ * and the number of dropped messages is written to the log once there is
+ * room again.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT Logger : public QObject
@@ -55,6 +70,19 @@ public:
 
     void setLogFlush(bool flush);
 
+    /** Whether messages are written by the writer thread, the default.
+     *
+     * Otherwise they are written before doLog() returns, which is slower
+     * but keeps every message in order with anything else on stdout.
+     */
+    void setLogAsynchronous(bool asynchronous);
+
+    /// Writes the queued messages and flushes the log file
+    void flush();
+
+    /// The number of messages dropped because the queue was full
+    quint64 droppedMessages() const { return _droppedMessages.load(std::memory_order_relaxed); }
+
     bool logDebug() const { return _logDebug; }
     void setLogDebug(bool debug);
 
@@ -74,6 +102,9 @@ public:
     /** For switching off via logwindow */
     void disableTemporaryFolderLogDir();
 
+    /** Records a performance trace into the temporary log folder, see Tracing */
+    void setTracingEnabled(bool enabled);
+
     void addLogRule(const QSet<QString> &rules) {
         setLogRules(_logRules + rules);
     }
@@ -99,12 +130,34 @@ private:
     void close();
     void dumpCrashLog();
 
+    void queueMessage(QString message);
+    void writerLoop();
+    void stopWriter();
+    // These need _mutex
+    void writeQueuedMessages();
+    void appendMessage(QByteArray &batch, const QString &message);
+    void writeBatch(QByteArray &batch);
+
     QFile _logFile;
     bool _doFileFlush = false;
     int _logExpire = 0;
     bool _logDebug = false;
-    QScopedPointer<QTextStream> _logstream;
+    // Taken by whoever writes to _logFile, the producers only touch _queue
     mutable QMutex _mutex;
+
+    std::unique_ptr<LogQueue> _queue;
+    std::atomic<bool> _asynchronous{true};
+    std::atomic<quint64> _droppedMessages{0};
+    quint64 _droppedMessagesReported = 0;
+
+    // The writer thread sleeps on _writerCondition while the queue is empty
+    QMutex _writerMutex;
+    QWaitCondition _writerCondition;
+    std::atomic<bool> _writerSleeping{false};
+    std::atomic<bool> _writerStarted{false};
+    bool _stopWriter = false;
+    QThread *_writerThread = nullptr;
+
     QString _logDirectory;
     bool _temporaryFolderLogDir = false;
     QSet<QString> _logRules;
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "multipartuploaddevice.h"
+
+#include "bandwidthmanager.h"
+#include "propagateupload.h"
+#include "common/asserts.h"
+#include "common/checksums.h"
+
+#include <QDir>
+#include <QLoggingCategory>
+#include <QUuid>
+
+#include <cstring>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcMultipartUploadDevice, "nextcloud.sync.multipartuploaddevice", QtInfoMsg)
+
+constexpr qint64 MultipartUploadDevice::defaultBufferSize;
+
+namespace {
+    const QByteArray checksumHeader = QByteArrayLiteral("X-File-MD5");
+}
+
+MultipartUploadDevice::MultipartUploadDevice(std::vector<SingleUploadFileData> files, BandwidthManager *bandwidthManager,
+    qint64 bufferSize, QObject *parent)
+    : QIODevice(parent)
+    , _files(std::move(files))
+    , _bandwidthManager(bandwidthManager)
+    , _boundary(QByteArrayLiteral("boundary_.oOo._") + QUuid::createUuid().toByteArray(QUuid::WithoutBraces))
+    , _buffer(static_cast<int>(qMax<qint64>(1, bufferSize)), Qt::Uninitialized)
+    , _hash(QCryptographicHash::Md5)
+{
+    for (const auto &file : _files)
+        _size += partHeader(file).size() + file._fileSize + 2;
+    _size += _boundary.size() + 6;
+}
+
+MultipartUploadDevice::~MultipartUploadDevice() = default;
+
+QByteArray MultipartUploadDevice::contentType() const
+{
+    return QByteArrayLiteral("multipart/related; boundary=\"") + _boundary + '"';
+}
+
+QByteArray MultipartUploadDevice::partHeader(const SingleUploadFileData &file) const
+{
+    QByteArray header = "--" + _boundary + "\r\n";
+    for (auto it = file._headers.cbegin(); it != file._headers.cend(); ++it)
+        header += it.key() + ": " + it.value() + "\r\n";
+    header += "\r\n";
+    return header;
+}
+
+bool MultipartUploadDevice::open(QIODevice::OpenMode mode)
+{
+    if (mode & QIODevice::WriteOnly)
+        return false;
+
+    _bufferStart = _bufferEnd = 0;
+    _pendingText.clear();
+    _produced = 0;
+    _nextFile = 0;
+    _partDevice.reset();
+    _closed = false;
+    _failed = false;
+    return QIODevice::open(mode);
+}
+
+void MultipartUploadDevice::close()
+{
+    _partDevice.reset();
+    QIODevice::close();
+}
+
+qint64 MultipartUploadDevice::bytesAvailable() const
+{
+    return _size - _produced + QIODevice::bytesAvailable();
+}
+
+bool MultipartUploadDevice::atEnd() const
+{
+    return _produced >= _size && QIODevice::bytesAvailable() == 0;
+}
+
+qint64 MultipartUploadDevice::writeData(const char *, qint64)
+{
+    ASSERT(false, "write to read only device");
+    return -1;
+}
+
+qint64 MultipartUploadDevice::readData(char *data, qint64 maxlen)
+{
+    qint64 copied = 0;
+    while (copied < maxlen) {
+        if (_bufferStart == _bufferEnd) {
+            const auto filled = fillBuffer(copied);
+            if (filled < 0)
+                return -1;
+            if (_bufferStart == _bufferEnd)
+                break;
+        }
+        const auto count = qMin(maxlen - copied, _bufferEnd - _bufferStart);
+        std::memcpy(data + copied, _buffer.constData() + _bufferStart, static_cast<size_t>(count));
+        _bufferStart += count;
+        copied += count;
+    }
+    _produced += copied;
+    if (copied == 0 && _closed && _pendingText.isEmpty())
+        return -1;
+    return copied;
+}
+
+int MultipartUploadDevice::fillBuffer(qint64 copied)
+{
+    _bufferStart = 0;
+    _bufferEnd = 0;
+    while (_bufferEnd < _buffer.size()) {
+        if (!_pendingText.isEmpty()) {
+            const auto count = qMin<qint64>(_pendingText.size(), _buffer.size() - _bufferEnd);
+            std::memcpy(_buffer.data() + _bufferEnd, _pendingText.constData(), static_cast<size_t>(count));
+            _bufferEnd += count;
+            _pendingText.remove(0, static_cast<int>(count));
+        } else if (_partDevice) {
+            const auto result = readPartData();
+            if (result < 0)
+                return -1;
+            if (result == 0)
+                break; // waiting for bandwidth quota
+        } else if (_nextFile < _files.size()) {
+            if (!startPart(copied))
+                return -1;
+        } else if (!_closed) {
+            _pendingText = "--" + _boundary + "--\r\n";
+            _closed = true;
+        } else {
+            break;
+        }
+    }
+    _peakBufferedSize = qMax(_peakBufferedSize, _bufferEnd + _pendingText.size());
+    return _bufferEnd > 0 ? 1 : 0;
+}
+
+bool MultipartUploadDevice::startPart(qint64 copied)
+{
+    const auto &file = _files.at(_nextFile);
+    _pendingText = partHeader(file);
+    _partDevice = std::make_unique<UploadDevice>(file._localPath, 0, file._fileSize, _bandwidthManager.data());
+    if (!_partDevice->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        qCWarning(lcMultipartUploadDevice) << "Could not open" << file._localPath << _partDevice->errorString();
+        fail(_partDevice->errorString());
+        _partDevice.reset();
+        return false;
+    }
+    // The bandwidth manager wakes the part up when it gets quota
+    connect(_partDevice.get(), &QIODevice::readyRead, this, &QIODevice::readyRead);
+
+    _partStart = _produced + copied + (_bufferEnd - _bufferStart) + _pendingText.size();
+    _partRead = 0;
+    // The header holds a checksum header like "MD5:<hex>", other types can't be verified here
+    QByteArray checksumType;
+    _expectedChecksum.clear();
+    if (!parseChecksumHeader(file._headers.value(checksumHeader), &checksumType, &_expectedChecksum)
+        || checksumType != checkSumMD5C) {
+        _expectedChecksum.clear();
+    }
+    _hash.reset();
+    return true;
+}
+
+int MultipartUploadDevice::readPartData()
+{
+    const auto &file = _files.at(_nextFile);
+    const auto wanted = qMin(_buffer.size() - _bufferEnd, file._fileSize - _partRead);
+    if (wanted > 0) {
+        const auto read = _partDevice->read(_buffer.data() + _bufferEnd, wanted);
+        const bool waiting = _partDevice->isChoked() || _partDevice->isBandwidthLimited();
+        if (read < 0 || (read == 0 && !waiting)) {
+            // Nothing to read without a limit means the file got shorter
+            fail(tr("The file %1 changed during the upload").arg(QDir::toNativeSeparators(file._localPath)));
+            return -1;
+        }
+        if (read == 0)
+            return 0;
+        if (!_expectedChecksum.isEmpty())
+            _hash.addData(_buffer.constData() + _bufferEnd, static_cast<int>(read));
+        _bufferEnd += read;
+        _partRead += read;
+        return 1;
+    }
+
+    if (!_expectedChecksum.isEmpty() && _hash.result().toHex() != _expectedChecksum.toLower()) {
+        qCWarning(lcMultipartUploadDevice) << "Checksum of" << file._localPath << "changed while uploading";
+        fail(tr("The file %1 changed during the upload").arg(QDir::toNativeSeparators(file._localPath)));
+        return -1;
+    }
+    _partDevice.reset();
+    _pendingText = "\r\n";
+    ++_nextFile;
+    return 1;
+}
+
+void MultipartUploadDevice::fail(const QString &errorString)
+{
+    setErrorString(errorString);
+    _failed = true;
+}
+
+void MultipartUploadDevice::slotJobUploadProgress(qint64 sent, qint64 total)
+{
+    // The bandwidth manager looks at the progress of the part being read
+    if (_partDevice && sent > _partStart)
+        _partDevice->slotJobUploadProgress(sent - _partStart, total);
+}
+
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QMap>
+#include <QPointer>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+namespace OCC {
+
+class BandwidthManager;
+class UploadDevice;
+
+struct SingleUploadFileData
+{
+    QString _localPath;
+    qint64 _fileSize = 0;
+    QMap<QByteArray, QByteArray> _headers;
+};
+
+/**
+ * @brief Produces a multipart/related body out of a list of local files
+ *
+ * The body is generated while it is read: only one file is open at a time
+ * and its data goes through a single buffer of fixed size that is reused for
+ * every read, so the memory used doesn't depend on the number or the size of
+ * the files.
+ *
+ * If a part has an X-File-MD5 header, the data is hashed while it is read and
+ * the device fails when it doesn't match, as the file changed since the
+ * checksum was computed.
+ *
+ * The device is sequential, its size is known upfront to be sent as the
+ * Content-Length.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT MultipartUploadDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    static constexpr qint64 defaultBufferSize = 1024 * 1024;
+
+    /// \a bandwidthManager may be null for unlimited uploads
+    explicit MultipartUploadDevice(std::vector<SingleUploadFileData> files, BandwidthManager *bandwidthManager,
+        qint64 bufferSize = defaultBufferSize, QObject *parent = nullptr);
+    ~MultipartUploadDevice() override;
+
+    /// The value of the Content-Type header, with the boundary
+    QByteArray contentType() const;
+
+    bool open(QIODevice::OpenMode mode) override;
+    void close() override;
+
+    bool isSequential() const override { return true; }
+    qint64 size() const override { return _size; }
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override;
+
+    /// Whether reading stopped because of an error, see errorString()
+    bool failed() const { return _failed; }
+
+    /// The most data that was held in memory at once, for tests
+    qint64 peakBufferedSize() const { return _peakBufferedSize; }
+
+    /// Where the data of the last file that was started begins in the body, for tests
+    qint64 partStart() const { return _partStart; }
+
+public slots:
+    void slotJobUploadProgress(qint64 sent, qint64 total);
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *, qint64) override;
+
+private:
+    /** Returns -1 on error, 0 if no data is available at the moment, 1 otherwise
+     *
+     * \a copied is what the running readData() copied already, it's not in _produced yet.
+     */
+    int fillBuffer(qint64 copied);
+    int readPartData();
+    bool startPart(qint64 copied);
+    void fail(const QString &errorString);
+    QByteArray partHeader(const SingleUploadFileData &file) const;
+
+    std::vector<SingleUploadFileData> _files;
+    QPointer<BandwidthManager> _bandwidthManager;
+    QByteArray _boundary;
+    qint64 _size = 0;
+
+    QByteArray _buffer;
+    qint64 _bufferStart = 0;
+    qint64 _bufferEnd = 0;
+    QByteArray _pendingText; /// delimiters and headers not yet in the buffer
+    qint64 _produced = 0; /// bytes returned by readData()
+    qint64 _peakBufferedSize = 0;
+
+    size_t _nextFile = 0;
+    std::unique_ptr<UploadDevice> _partDevice; /// the file being read
+    qint64 _partStart = 0; /// position of the data of the current file in the body
+    qint64 _partRead = 0;
+    QByteArray _expectedChecksum; /// hex MD5 of the current file, empty if not verified
+    QCryptographicHash _hash;
+    bool _closed = false; /// the closing delimiter was produced
+    bool _failed = false;
+};
+
+}
@@ -23,6 +23,7 @@
 #include <QSslCipher>
 #include <QBuffer>
 #include <QXmlStreamReader>
+#include <QMetaMethod>
 #include <QStringList>
 #include <QStack>
 #include <QTimer>
@@ -36,6 +37,8 @@
 #include <QPainterPath>
 #endif
 
+#include <utility>
+
 #include "networkjobs.h"
 #include "account.h"
 #include "owncloudpropagator.h"
@@ -192,136 +195,279 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader)
-{
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
+
+namespace {
+    // Same order as LsColEntry::Property
+    const QLatin1String lsColPropertyNames[] = {
+        QLatin1String("resourcetype"),
+        QLatin1String("getlastmodified"),
+        QLatin1String("getcontentlength"),
+        QLatin1String("getetag"),
+        QLatin1String("size"),
+        QLatin1String("id"),
+        QLatin1String("fileid"),
+        QLatin1String("downloadURL"),
+        QLatin1String("dDC"),
+        QLatin1String("permissions"),
+        QLatin1String("checksums"),
+        QLatin1String("data-fingerprint"),
+        QLatin1String("share-types"),
+        QLatin1String("is-encrypted"),
+        QLatin1String("lock"),
+        QLatin1String("lock-owner-displayname"),
+        QLatin1String("lock-owner"),
+        QLatin1String("lock-owner-type"),
+        QLatin1String("lock-owner-editor"),
+        QLatin1String("lock-time"),
+        QLatin1String("lock-timeout"),
+    };
+    static_assert(sizeof(lsColPropertyNames) / sizeof(lsColPropertyNames[0]) == LsColEntry::PropertyCount, "a name for every property");
+}
+
+LsColEntry::Property LsColEntry::propertyForName(const QStringRef &name)
+{
+    for (int i = 0; i < PropertyCount; ++i) {
+        if (name == lsColPropertyNames[i]) {
+            return static_cast<Property>(i);
         }
+    }
+    return PropertyCount;
+}
 
-    } while (!reader.atEnd());
-    return result;
+QString LsColEntry::propertyName(Property property)
+{
+    Q_ASSERT(property < PropertyCount);
+    return lsColPropertyNames[property];
 }
 
+void LsColEntry::setValue(const QStringRef &name, const QString &value)
+{
+    const auto property = propertyForName(name);
+    if (property == PropertyCount) {
+        _otherProperties.append({ name.toString(), value });
+        return;
+    }
+    _values[property] = value;
+    _present |= 1u << property;
+}
+
+QMap<QString, QString> LsColEntry::toPropertyMap() const
+{
+    QMap<QString, QString> map;
+    for (int i = 0; i < PropertyCount; ++i) {
+        if (contains(static_cast<Property>(i))) {
+            map.insert(lsColPropertyNames[i], _values[i]);
+        }
+    }
+    for (const auto &property : _otherProperties) {
+        map.insert(property.first, property.second);
+    }
+    return map;
+}
 
 LsColXMLParser::LsColXMLParser() = default;
 
 bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
+    startParsing(fileInfo, expectedPath);
+    return addData(xml) && finish();
+}
+
+void LsColXMLParser::startParsing(QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _fileInfo = fileInfo;
+    _expectedPath = expectedPath;
+    _folders.clear();
+    _entry = LsColEntry();
+    _propstat = LsColEntry();
+    _batch.clear();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    _failed = false;
+    _capture = Capture::None;
+    _captureDepth = 0;
+    _text.clear();
+}
+
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed) {
+        return false;
+    }
+
+    _reader.addData(data);
+    while (!_failed && !_reader.atEnd()) {
+        handleToken(_reader.readNext());
+    }
+    // Running out of data just means that we have to wait for more
+    if (!_failed && _reader.hasError() && _reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "in line" << _reader.lineNumber();
+        _failed = true;
+    }
+
+    if (!_batch.isEmpty()) {
+        emit directoryListingEntries(_batch);
+        _batch.clear();
+    }
+    return !_failed;
+}
+
+bool LsColXMLParser::finish()
+{
+    if (_failed) {
+        return false;
+    }
+    if (_reader.hasError()) {
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "in line" << _reader.lineNumber();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qCWarning(lcLsColJob) << "ERROR no WebDAV response?";
+        return false;
+    }
+    emit directoryListingSubfolders(_folders);
+    emit finishedWithoutError();
+    return true;
+}
+
+void LsColXMLParser::handleToken(QXmlStreamReader::TokenType type)
+{
+    if (_capture != Capture::None) {
+        // supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
+        if (type == QXmlStreamReader::Characters) {
+            _text += _reader.text();
+        } else if (type == QXmlStreamReader::StartElement) {
+            ++_captureDepth;
+            _text += QLatin1Char('<');
+            _text += _reader.name();
+            _text += QLatin1Char('>');
+        } else if (type == QXmlStreamReader::EndElement) {
+            if (_captureDepth == 0) {
+                finishCapture();
+                return;
+            }
+            --_captureDepth;
+            _text += QLatin1String("</");
+            _text += _reader.name();
+            _text += QLatin1Char('>');
+        }
+        return;
+    }
+
+    const auto name = _reader.name();
+    const bool isDav = _reader.namespaceUri() == QLatin1String("DAV:");
+    if (type == QXmlStreamReader::StartElement) {
         // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
+        if (isDav) {
             if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QUrl::fromLocalFile(QUrl::fromPercentEncoding(reader.readElementText().toUtf8()))
-                        .adjusted(QUrl::NormalizePathSegments)
-                        .path();
-                if (!hrefString.startsWith(expectedPath)) {
-                    qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
+                startCapture(Capture::Href);
+                return;
             } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
-                } else {
-                    currentPropsHaveHttp200 = false;
-                }
+                _insidePropstat = true;
+            } else if (name == QLatin1String("status") && _insidePropstat) {
+                startCapture(Capture::Status);
+                return;
             } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
+                _insideProp = true;
+                return;
             } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
+                _insideMultiStatus = true;
+                return;
             }
         }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
+        if (_insidePropstat && _insideProp) {
             // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && fileInfo) {
-                    (*fileInfo)[currentHref].size = s;
-                }
-            } else if (name == QLatin1String("fileid")) {
-                (*fileInfo)[currentHref].fileId = propertyContent.toUtf8();
+            _propertyName = name.toString();
+            startCapture(Capture::Property);
+        }
+    } else if (type == QXmlStreamReader::EndElement && isDav) {
+        // End elements with DAV:
+        if (name == QLatin1String("response")) {
+            finishEntry();
+        } else if (name == QLatin1String("propstat")) {
+            _insidePropstat = false;
+            if (_currentPropsHaveHttp200) {
+                auto href = std::move(_entry.href);
+                _entry = std::move(_propstat);
+                _entry.href = std::move(href);
             }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+            _propstat = LsColEntry();
+            _currentPropsHaveHttp200 = false;
+        } else if (name == QLatin1String("prop")) {
+            _insideProp = false;
         }
+    }
+}
 
-        // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
-                    }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString, QString>(currentTmpProperties);
-                    }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
-                }
+void LsColXMLParser::startCapture(Capture capture)
+{
+    _capture = capture;
+    _captureDepth = 0;
+    _text.clear();
+}
+
+void LsColXMLParser::finishCapture()
+{
+    const auto capture = std::exchange(_capture, Capture::None);
+    const auto text = std::exchange(_text, QString());
+
+    switch (capture) {
+    case Capture::Href: {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QUrl::fromLocalFile(QUrl::fromPercentEncoding(text.toUtf8()))
+                .adjusted(QUrl::NormalizePathSegments)
+                .path();
+        if (!hrefString.startsWith(_expectedPath)) {
+            qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            _failed = true;
+            return;
+        }
+        _entry.href = hrefString;
+        break;
+    }
+    case Capture::Status:
+        _currentPropsHaveHttp200 = text.startsWith(QLatin1String("HTTP/1.1 200"));
+        break;
+    case Capture::Property: {
+        const QStringRef name(&_propertyName);
+        if (name == QLatin1String("resourcetype") && text.contains(QLatin1String("collection"))) {
+            _folders.append(_entry.href);
+        } else if (name == QLatin1String("size")) {
+            bool ok = false;
+            auto s = text.toLongLong(&ok);
+            if (ok && _fileInfo) {
+                (*_fileInfo)[_entry.href].size = s;
             }
+        } else if (name == QLatin1String("fileid") && _fileInfo) {
+            (*_fileInfo)[_entry.href].fileId = text.toUtf8();
         }
+        _propstat.setValue(name, text);
+        break;
+    }
+    case Capture::None:
+        break;
     }
+}
 
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qCWarning(lcLsColJob) << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qCWarning(lcLsColJob) << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+void LsColXMLParser::finishEntry()
+{
+    if (_entry.href.endsWith('/')) {
+        _entry.href.chop(1);
     }
-    return true;
+    // Building the maps is expensive, only do it for those who still want them
+    if (isSignalConnected(QMetaMethod::fromSignal(&LsColXMLParser::directoryListingIterated))) {
+        emit directoryListingIterated(_entry.href, _entry.toPropertyMap());
+    }
+    if (isSignalConnected(QMetaMethod::fromSignal(&LsColXMLParser::directoryListingEntries))) {
+        _batch.append(std::move(_entry));
+    }
+    _entry = LsColEntry();
 }
 
 /*********************************************************************************************/
@@ -384,32 +530,77 @@ void LsColJob::start()
     } else {
         sendRequest("PROPFIND", makeDavUrl(path()), req, buf);
     }
+    _traceSlice.begin("network", "PROPFIND", _url.isValid() ? _url.path() : path());
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+LsColJob::~LsColJob() = default;
+
+void LsColJob::newReplyHook(QNetworkReply *reply)
 {
-    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
-                       << replyStatusString();
+    // A redirect starts over with a new reply
+    _parser.reset();
+    connect(reply, &QNetworkReply::readyRead, this, &LsColJob::slotReadyRead);
+}
 
+bool LsColJob::isMultiStatusReply() const
+{
     QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
-            this, &LsColJob::directoryListingSubfolders);
-        connect(&parser, &LsColXMLParser::directoryListingIterated,
+    return httpCode == 207 && contentType.contains("application/xml; charset=utf-8");
+}
+
+void LsColJob::createParser()
+{
+    _parser = std::make_unique<LsColXMLParser>();
+    connect(_parser.get(), &LsColXMLParser::directoryListingSubfolders,
+        this, &LsColJob::directoryListingSubfolders);
+    // Only connected when needed, the parser skips building the property maps otherwise
+    if (isSignalConnected(QMetaMethod::fromSignal(&LsColJob::directoryListingIterated))) {
+        connect(_parser.get(), &LsColXMLParser::directoryListingIterated,
             this, &LsColJob::directoryListingIterated);
-        connect(&parser, &LsColXMLParser::finishedWithError,
-            this, &LsColJob::finishedWithError);
-        connect(&parser, &LsColXMLParser::finishedWithoutError,
-            this, &LsColJob::finishedWithoutError);
+    }
+    if (isSignalConnected(QMetaMethod::fromSignal(&LsColJob::directoryListingEntries))) {
+        connect(_parser.get(), &LsColXMLParser::directoryListingEntries,
+            this, &LsColJob::directoryListingEntries);
+    }
+    connect(_parser.get(), &LsColXMLParser::finishedWithError,
+        this, &LsColJob::finishedWithError);
+    connect(_parser.get(), &LsColXMLParser::finishedWithoutError,
+        this, &LsColJob::finishedWithoutError);
+
+    QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/dav/folder"
+    _parser->startParsing(&_folderInfos, expectedPath);
+}
 
-        QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/dav/folder"
-        if (!parser.parse(reply()->readAll(), &_folderInfos, expectedPath)) {
+void LsColJob::slotReadyRead()
+{
+    if (sender() != reply()) {
+        return;
+    }
+    if (!_parser) {
+        if (!isMultiStatusReply()) {
+            // finished() reports the error
+            return;
+        }
+        createParser();
+    }
+    // Parse what we have so far, the entries are emitted while the rest is still downloading.
+    // After an error the data is still read to keep it from piling up, finished() reports the error.
+    _parser->addData(reply()->readAll());
+}
+
+bool LsColJob::finished()
+{
+    _traceSlice.end();
+    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
+                       << replyStatusString();
+
+    if (isMultiStatusReply()) {
+        if (!_parser) {
+            createParser();
+        }
+        if (!_parser->addData(reply()->readAll()) || !_parser->finish()) {
             // XML parse error
             emit finishedWithError(reply());
         }
@@ -600,6 +791,7 @@ void PropfindJob::start()
     buf->open(QIODevice::ReadOnly);
     sendRequest("PROPFIND", makeDavUrl(path()), req, buf);
 
+    _traceSlice.begin("network", "PROPFIND", path());
     AbstractNetworkJob::start();
 }
 
@@ -615,6 +807,7 @@ QList<QByteArray> PropfindJob::properties() const
 
 bool PropfindJob::finished()
 {
+    _traceSlice.end();
     qCInfo(lcPropfindJob) << "PROPFIND of" << reply()->request().url() << "FINISHED WITH STATUS"
                           << replyStatusString();
 
@@ -19,11 +19,16 @@
 #include "abstractnetworkjob.h"
 
 #include "common/result.h"
+#include "common/tracing.h"
 
 #include <QBuffer>
 #include <QUrlQuery>
 #include <QJsonDocument>
+#include <QXmlStreamReader>
+
+#include <array>
 #include <functional>
+#include <memory>
 
 class QUrl;
 class QJsonObject;
@@ -112,7 +117,65 @@ struct ExtraFolderInfo {
 };
 
 /**
- * @brief The LsColJob class
+ * @brief One entry of a PROPFIND reply
+ *
+ * The properties requested by the sync engine are interned: they are stored in
+ * fixed slots indexed by Property instead of a map keyed by their names.
+ */
+class OWNCLOUDSYNC_EXPORT LsColEntry
+{
+public:
+    enum Property {
+        ResourceType,
+        GetLastModified,
+        GetContentLength,
+        GetEtag,
+        Size,
+        Id,
+        FileId,
+        DownloadUrl,
+        DirectDownloadCookies,
+        Permissions,
+        Checksums,
+        DataFingerprint,
+        ShareTypes,
+        IsEncrypted,
+        Lock,
+        LockOwnerDisplayName,
+        LockOwner,
+        LockOwnerType,
+        LockOwnerEditor,
+        LockTime,
+        LockTimeout,
+        PropertyCount //< not one of the above
+    };
+
+    /// The property with the given local name, PropertyCount for unknown ones
+    static Property propertyForName(const QStringRef &name);
+    static QString propertyName(Property property);
+
+    bool contains(Property property) const { return _present & (1u << property); }
+    const QString &value(Property property) const { return _values[property]; }
+    void setValue(const QStringRef &name, const QString &value);
+
+    /// All properties keyed by their name, as delivered by directoryListingIterated()
+    QMap<QString, QString> toPropertyMap() const;
+
+    QString href; //< the path of the entry, without trailing slash
+
+private:
+    std::array<QString, PropertyCount> _values;
+    quint32 _present = 0;
+    QVector<QPair<QString, QString>> _otherProperties;
+};
+
+/**
+ * @brief Parses the reply of a PROPFIND with depth 1
+ *
+ * The reply can be parsed at once with parse() or in pieces while it is
+ * downloaded: startParsing(), then addData() for every piece, then finish().
+ * Entries are emitted as soon as they are complete.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject
@@ -125,19 +188,68 @@ public:
                QHash<QString, ExtraFolderInfo> *sizes,
                const QString &expectedPath);
 
+    void startParsing(QHash<QString, ExtraFolderInfo> *sizes, const QString &expectedPath);
+    /// Returns false if the data is invalid, further data is ignored then
+    bool addData(const QByteArray &data);
+    /// Returns false if the reply was incomplete or not a WebDAV reply
+    bool finish();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    /// The entries completed by one call to addData(), cheaper than directoryListingIterated()
+    void directoryListingEntries(const QVector<LsColEntry> &entries);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
+
+private:
+    enum class Capture {
+        None,
+        Href,
+        Status,
+        Property
+    };
+
+    void handleToken(QXmlStreamReader::TokenType type);
+    void startCapture(Capture capture);
+    void finishCapture();
+    void finishEntry();
+
+    QXmlStreamReader _reader;
+    QHash<QString, ExtraFolderInfo> *_fileInfo = nullptr;
+    QString _expectedPath;
+    QStringList _folders;
+
+    LsColEntry _entry; // the properties of the last successful propstat
+    LsColEntry _propstat;
+    QVector<LsColEntry> _batch;
+    bool _currentPropsHaveHttp200 = false;
+    bool _insidePropstat = false;
+    bool _insideProp = false;
+    bool _insideMultiStatus = false;
+    bool _failed = false;
+
+    // The text of the element being read, it can arrive in several pieces
+    Capture _capture = Capture::None;
+    int _captureDepth = 0;
+    QString _propertyName;
+    QString _text;
 };
 
+/**
+ * @brief The LsColJob class
+ *
+ * The reply is parsed while it is downloaded.
+ *
+ * @ingroup libsync
+ */
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob
 {
     Q_OBJECT
 public:
     explicit LsColJob(AccountPtr account, const QString &path, QObject *parent = nullptr);
     explicit LsColJob(AccountPtr account, const QUrl &url, QObject *parent = nullptr);
+    ~LsColJob() override;
     void start() override;
     QHash<QString, ExtraFolderInfo> _folderInfos;
 
@@ -155,15 +267,23 @@ public:
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
+    void directoryListingEntries(const QVector<LsColEntry> &entries);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
 private slots:
     bool finished() override;
+    void slotReadyRead();
 
 private:
+    void newReplyHook(QNetworkReply *reply) override;
+    bool isMultiStatusReply() const;
+    void createParser();
+
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
+    std::unique_ptr<LsColXMLParser> _parser; // exists once data of a multistatus reply arrived
+    Tracing::AsyncSlice _traceSlice;
 };
 
 /**
@@ -203,6 +323,7 @@ private slots:
 
 private:
     QList<QByteArray> _properties;
+    Tracing::AsyncSlice _traceSlice;
 };
 
 #ifndef TOKEN_AUTH_ONLY
@@ -83,21 +83,28 @@ OwncloudPropagator::~OwncloudPropagator() = default;
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit != 0
-        || _uploadLimit != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
-        return 1;
-    }
-    return qMin(3, qCeil(_syncOptions._parallelNetworkJobs / 2.));
+    // With a bandwidth limit the BandwidthManager splits the budget across the
+    // running transfers, so there is no need to fall back to a single one.
+    return qMin(_transferConcurrency.window(), hardMaximumActiveJob());
+}
+
+void OwncloudPropagator::reportTransferFinished(const AbstractNetworkJob *job, qint64 bytes, std::chrono::milliseconds duration)
+{
+    const auto reply = job->reply();
+    if (!reply)
+        return;
+    const auto outcome = TransferConcurrencyController::outcome(
+        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), reply->error(), job->timedOut());
+    _transferConcurrency.addSample(bytes, duration, outcome, _activeJobList.count());
 }
 
 /* The maximum number of active jobs in parallel  */
 int OwncloudPropagator::hardMaximumActiveJob()
 {
-    if (!_syncOptions._parallelNetworkJobs)
-        return 1;
-    return _syncOptions._parallelNetworkJobs;
+    const auto jobs = qMax(1, _syncOptions._parallelNetworkJobs);
+    if (_syncOptions._resourceShare)
+        return _syncOptions._resourceShare->networkJobs(jobs);
+    return jobs;
 }
 
 PropagateItemJob::~PropagateItemJob()
@@ -225,6 +232,7 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     // Duplicate calls to done() are a logic error
     ENFORCE(_state != Finished);
     _state = Finished;
+    _traceSlice.end();
 
     _item->_status = statusArg;
 
@@ -388,7 +396,18 @@ std::unique_ptr<PropagateUploadFileCommon> OwncloudPropagator::createUploadJob(S
 {
     auto job = std::unique_ptr<PropagateUploadFileCommon>{};
 
-    if (item->_size > syncOptions()._initialChunkSize && account()->capabilities().chunkingNg()) {
+    // An encrypted file is chunked whatever its size: its MOVE can wait until the
+    // tag of the new content is in the folder's metadata, a PUT can't
+    const auto isEncryptedUpload = [&] {
+        if (!account()->capabilities().clientSideEncryptionAvailable())
+            return false;
+        const auto slashPosition = item->_file.lastIndexOf('/');
+        SyncJournalFileRecord parentRec;
+        return _journal->getFileRecord(slashPosition >= 0 ? item->_file.left(slashPosition) : QString(), &parentRec)
+            && parentRec.isValid() && parentRec._isE2eEncrypted;
+    };
+
+    if (account()->capabilities().chunkingNg() && (item->_size > syncOptions()._initialChunkSize || isEncryptedUpload())) {
         // Item is above _initialChunkSize, thus will be classified as to be chunked
         job = std::make_unique<PropagateUploadFileNG>(this, item);
     } else {
@@ -474,14 +493,55 @@ void OwncloudPropagator::adjustDeletedFoldersWithNewChildren(SyncFileItemVector
 
 qint64 OwncloudPropagator::smallFileSize()
 {
-    const qint64 smallFileSize = 100 * 1024; //default to 1 MB. Not dynamic right now.
-    return smallFileSize;
+    return _transferConcurrency.smallFileSize();
 }
 
 void OwncloudPropagator::start(SyncFileItemVector &&items)
 {
     Q_ASSERT(std::is_sorted(items.begin(), items.end()));
 
+    if (_waitForDiscoveryJob) {
+        // Streaming: the root job is running already, these are the remaining items
+        appendItems(items);
+        _waitForDiscoveryJob->release();
+        return;
+    }
+
+    resetDelayedUploadTasks();
+    _rootJob.reset(new PropagateRootDirectory(this));
+    appendItems(items);
+
+    connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
+
+    _jobScheduled = false;
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::startStreaming()
+{
+    resetDelayedUploadTasks();
+    _rootJob.reset(new PropagateRootDirectory(this));
+    _waitForDiscoveryJob = new PropagateWaitForDiscoveryJob(this);
+    _waitForDiscoveryJob->setParent(_rootJob.data());
+    _rootJob->appendJob(_waitForDiscoveryJob);
+
+    connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
+
+    _jobScheduled = false;
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::appendSubtree(SyncFileItemVector &&items)
+{
+    Q_ASSERT(std::is_sorted(items.begin(), items.end()));
+    ENFORCE(_waitForDiscoveryJob);
+
+    appendItems(items);
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::appendItems(SyncFileItemVector &items)
+{
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
      * In order to do that we loop over the items. (which are sorted by destination)
@@ -516,8 +576,6 @@ void OwncloudPropagator::start(SyncFileItemVector &&items)
     // process each item that is new and is a directory and make sure every parent in its tree has the instruction NEW instead of REMOVE
     adjustDeletedFoldersWithNewChildren(items);
 
-    resetDelayedUploadTasks();
-    _rootJob.reset(new PropagateRootDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory * /* job */>> directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob *> directoriesToRemove;
@@ -589,11 +647,6 @@ void OwncloudPropagator::start(SyncFileItemVector &&items)
     foreach (PropagatorJob *it, directoriesToRemove) {
         _rootJob->_dirDeletionJobs.appendJob(it);
     }
-
-    connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
-
-    _jobScheduled = false;
-    scheduleNextJob();
 }
 
 void OwncloudPropagator::startDirectoryPropagation(const SyncFileItemPtr &item,
@@ -674,6 +727,8 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+    // Other syncs may finish meanwhile, so don't cap the window by the current share
+    _transferConcurrency.reset(qMax(1, syncOptions._parallelNetworkJobs));
 }
 
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
@@ -888,7 +943,7 @@ bool OwncloudPropagator::createConflict(const SyncFileItemPtr &item,
     // Create a new upload job if the new conflict file should be uploaded
     if (account()->capabilities().uploadConflictFiles()) {
         if (composite && !QFileInfo(conflictFilePath).isDir()) {
-            SyncFileItemPtr conflictItem = SyncFileItemPtr(new SyncFileItem);
+            auto conflictItem = SyncFileItemPtr::create();
             conflictItem->_file = conflictFileName;
             conflictItem->_type = ItemTypeFile;
             conflictItem->_direction = SyncFileItem::Up;
@@ -927,10 +982,8 @@ Result<Vfs::ConvertToPlaceholderResult, QString> OwncloudPropagator::staticUpdat
         return Vfs::ConvertToPlaceholderResult::Locked;
     }
     auto record = item.toSyncJournalFileRecordWithInode(fsPath);
-    const auto dBresult = journal->setFileRecord(record);
-    if (!dBresult) {
-        return dBresult.error();
-    }
+    // Written by the journal's writer thread, errors are reported when the sync finishes
+    journal->queueFileRecord(record);
     return Vfs::ConvertToPlaceholderResult::Ok;
 }
 
@@ -1231,7 +1284,7 @@ void PropagateDirectory::slotSubJobsFinished(SyncFileItem::Status status)
 }
 
 PropagateRootDirectory::PropagateRootDirectory(OwncloudPropagator *propagator)
-    : PropagateDirectory(propagator, SyncFileItemPtr(new SyncFileItem))
+    : PropagateDirectory(propagator, SyncFileItemPtr::create())
     , _dirDeletionJobs(propagator)
 {
     connect(&_dirDeletionJobs, &PropagatorJob::finished, this, &PropagateRootDirectory::slotDirDeletionJobsFinished);
@@ -1358,7 +1411,7 @@ void CleanupPollsJob::start()
 
     auto info = _pollInfos.first();
     _pollInfos.pop_front();
-    SyncFileItemPtr item(new SyncFileItem);
+    auto item = SyncFileItemPtr::create();
     item->_file = info._file;
     item->_modtime = info._modtime;
     item->_size = info._fileSize;
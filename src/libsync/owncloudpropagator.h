@@ -27,9 +27,11 @@
 #include "csync.h"
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 #include "bandwidthmanager.h"
 #include "accountfwd.h"
 #include "syncoptions.h"
+#include "transferconcurrencycontroller.h"
 
 #include <deque>
 
@@ -53,6 +55,7 @@ void blacklistUpdate(SyncJournalDb *journal, SyncFileItem &item);
 class SyncJournalDb;
 class OwncloudPropagator;
 class PropagatorCompositeJob;
+class AbstractNetworkJob;
 
 /**
  * @brief the base class of propagator jobs
@@ -189,6 +192,7 @@ protected slots:
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
     JobParallelism _parallelism;
+    Tracing::AsyncSlice _traceSlice; // from scheduleSelfOrChild() to done()
 
 public:
     PropagateItemJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
@@ -212,6 +216,7 @@ public:
         qCInfo(lcPropagator) << "Starting" << _item->_instruction << "propagation of" << _item->destination() << "by" << this;
 
         _state = Running;
+        _traceSlice.begin("propagator", metaObject()->className(), _item->destination());
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
@@ -411,6 +416,36 @@ public:
     }
 };
 
+/**
+ * @brief Keeps the root directory job running while discovery still hands over items
+ * @ingroup libsync
+ *
+ * Sits among the root's sub jobs without doing anything until release() is
+ * called, see OwncloudPropagator::startStreaming().
+ */
+class PropagateWaitForDiscoveryJob : public PropagatorJob
+{
+    Q_OBJECT
+public:
+    using PropagatorJob::PropagatorJob;
+
+    bool scheduleSelfOrChild() override
+    {
+        if (_state != NotYetStarted)
+            return false;
+        _state = Running;
+        return true;
+    }
+
+    void release()
+    {
+        if (_state == Finished)
+            return;
+        _state = Finished;
+        emit finished(SyncFileItem::Success);
+    }
+};
+
 class PropagateUploadFileCommon;
 
 class OWNCLOUDSYNC_EXPORT OwncloudPropagator : public QObject
@@ -441,6 +476,21 @@ public:
 
     void start(SyncFileItemVector &&_syncedItems);
 
+    /** Starts the propagation before discovery has finished
+     *
+     * Discovered subtrees are then added with appendSubtree() and the
+     * remaining items with start(), which lets the propagation finish.
+     */
+    void startStreaming();
+
+    /** Adds the sorted items of a completely discovered subtree
+     *
+     * They must not depend on anything outside of the subtree: no removals,
+     * renames or type changes, and no parent directory that needs to be
+     * propagated.
+     */
+    void appendSubtree(SyncFileItemVector &&items);
+
     void startDirectoryPropagation(const SyncFileItemPtr &item,
                                    QStack<QPair<QString, PropagateDirectory*>> &directories,
                                    QVector<PropagatorJob *> &directoriesToRemove,
@@ -486,9 +536,17 @@ public:
      */
     QHash<QString, qint64> _folderQuota;
 
-    /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
+    /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel)
+     *
+     * Adjusted during the sync by the TransferConcurrencyController.
+     */
     int maximumActiveTransferJob();
 
+    /** To be called by the upload and download jobs when a transfer request finished,
+     * before they remove themselves from _activeJobList.
+     */
+    void reportTransferFinished(const AbstractNetworkJob *job, qint64 bytes, std::chrono::milliseconds duration);
+
     /** The size to use for upload chunks.
      *
      * Will be dynamically adjusted after each chunk upload finishes
@@ -586,7 +644,7 @@ public:
     /** Update the database for an item.
      *
      * Typically after a sync operation succeeded. Updates the inode from
-     * the filesystem.
+     * the filesystem. The record is written with SyncJournalDb::queueFileRecord().
      *
      * Will also trigger a Vfs::convertToPlaceholder.
      */
@@ -595,7 +653,7 @@ public:
     /** Update the database for an item.
      *
      * Typically after a sync operation succeeded. Updates the inode from
-     * the filesystem.
+     * the filesystem. The record is written with SyncJournalDb::queueFileRecord().
      *
      * Will also trigger a Vfs::convertToPlaceholder.
      */
@@ -667,9 +725,14 @@ private:
 
     static void adjustDeletedFoldersWithNewChildren(SyncFileItemVector &items);
 
+    /// Creates the jobs for the sorted items below the root job
+    void appendItems(SyncFileItemVector &items);
+
     AccountPtr _account;
     QScopedPointer<PropagateRootDirectory> _rootJob;
+    QPointer<PropagateWaitForDiscoveryJob> _waitForDiscoveryJob; // while streaming, see startStreaming()
     SyncOptions _syncOptions;
+    TransferConcurrencyController _transferConcurrency;
     bool _jobScheduled = false;
 
     const QString _localDir; // absolute path to the local directory. ends with '/'
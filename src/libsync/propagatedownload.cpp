@@ -113,8 +113,9 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
-        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
+    if (_resumeStart > 0 || _rangeEnd >= 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-'
+            + (_rangeEnd >= 0 ? QByteArray::number(_rangeEnd) : QByteArray());
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
     }
@@ -140,6 +141,7 @@ void GETFileJob::start()
 
     connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
 
+    _requestTimer.start();
     AbstractNetworkJob::start();
 }
 
@@ -205,8 +207,19 @@ void GETFileJob::slotMetaDataChanged()
         return;
     }
 
+    QByteArray ranges = reply()->rawHeader("Content-Range");
+    if (_rangeEnd >= 0 && ranges.isEmpty()) {
+        qCWarning(lcGetJob) << "Server ignored the range request" << _headers["Range"];
+        _errorString = tr("The server does not support range requests");
+        _errorStatus = SyncFileItem::NormalError;
+        _rangeNotSupported = true;
+        reply()->abort();
+        return;
+    }
+
     bool ok = false;
-    _contentLength = reply()->header(QNetworkRequest::ContentLengthHeader).toLongLong(&ok);
+    const auto contentLength = reply()->header(QNetworkRequest::ContentLengthHeader).toLongLong(&ok);
+    _contentLength = ok ? contentLength : -1;
     if (ok && _expectedContentLength != -1 && _contentLength != _expectedContentLength) {
         qCWarning(lcGetJob) << "We received a different content length than expected!"
                             << _expectedContentLength << "vs" << _contentLength;
@@ -217,7 +230,6 @@ void GETFileJob::slotMetaDataChanged()
     }
 
     qint64 start = 0;
-    QByteArray ranges = reply()->rawHeader("Content-Range");
     if (!ranges.isEmpty()) {
         const QRegularExpression rx("bytes (\\d+)-");
         const auto rxMatch = rx.match(ranges);
@@ -393,59 +405,120 @@ GETEncryptedFileJob::GETEncryptedFileJob(AccountPtr account, const QUrl &url, QI
 {
 }
 
+bool GETEncryptedFileJob::startDecryption()
+{
+    // The resume start is final once data arrives, it's reset if the server ignored the range
+    const auto start = resumeStart();
+    // Without a Content-Length the tag is found at the end by finishDecryption()
+    const auto totalSize = _contentLength >= 0 ? start + _contentLength : 0;
+    _decryptor.reset(new EncryptionHelper::StreamingDecryptor(_encryptedFileInfo.encryptionKey, _encryptedFileInfo.initializationVector, totalSize));
+    if (!_decryptor->isInitialized()) {
+        return false;
+    }
+    if (start == 0) {
+        return true;
+    }
+
+    // The encrypted data up to the start was not downloaded again
+    const auto file = qobject_cast<QFileDevice *>(device());
+    if (!file) {
+        qCCritical(lcPropagateDownload) << "Can't resume decryption, the download doesn't go into a file";
+        return false;
+    }
+    QFile decrypted(file->fileName());
+    if (!decrypted.open(QIODevice::ReadOnly)) {
+        qCCritical(lcPropagateDownload) << "Can't resume decryption" << decrypted.errorString();
+        return false;
+    }
+    return _decryptor->resume(&decrypted, start);
+}
+
 qint64 GETEncryptedFileJob::writeToDevice(const QByteArray &data)
 {
     if (!_decryptor) {
         // only initialize the decryptor once, because, according to Qt documentation, metadata might get changed during the processing of the data sometimes
         // https://doc.qt.io/qt-5/qnetworkreply.html#metaDataChanged
-        _decryptor.reset(new EncryptionHelper::StreamingDecryptor(_encryptedFileInfo.encryptionKey, _encryptedFileInfo.initializationVector, _contentLength));
+        if (!startDecryption()) {
+            _decryptionFailed = true;
+            return -1;
+        }
     }
 
-    if (!_decryptor->isInitialized()) {
+    if (_decryptionFailed) {
         return -1;
     }
 
-    const auto bytesRemaining = _contentLength - _processedSoFar - data.length();
-
-    if (bytesRemaining != 0 && bytesRemaining < OCC::Constants::e2EeTagSize) {
-        // decryption is going to fail if last chunk does not include or does not equal to OCC::Constants::e2EeTagSize bytes tag
-        // we may end up receiving packets beyond OCC::Constants::e2EeTagSize bytes tag at the end
-        // in that case, we don't want to try and decrypt less than OCC::Constants::e2EeTagSize ending bytes of tag, we will accumulate all the incoming data till the end
-        // and then, we are going to decrypt the entire chunk containing OCC::Constants::e2EeTagSize bytes at the end
-        _pendingBytes += QByteArray(data.constData(), data.length());
-        _processedSoFar += data.length();
-        if (_processedSoFar != _contentLength) {
+    if (_contentLength < 0) {
+        // Any data could be the end, so the last bytes are held back as the tag
+        _pendingBytes += data;
+        const auto size = _pendingBytes.size() - OCC::Constants::e2EeTagSize;
+        if (size <= 0) {
             return data.length();
         }
-    }
-
-    if (!_pendingBytes.isEmpty()) {
-        const auto decryptedChunk = _decryptor->chunkDecryption(_pendingBytes.constData(), _pendingBytes.size());
-
+        const auto decryptedChunk = _decryptor->chunkDecryption(_pendingBytes.constData(), size);
+        _pendingBytes.remove(0, size);
         if (decryptedChunk.isEmpty()) {
             qCCritical(lcPropagateDownload) << "Decryption failed!";
+            _decryptionFailed = true;
+            return -1;
+        }
+        if (GETFileJob::writeToDevice(decryptedChunk) != decryptedChunk.size()) {
             return -1;
         }
-
-        GETFileJob::writeToDevice(decryptedChunk);
-
         return data.length();
     }
 
-    const auto decryptedChunk = _decryptor->chunkDecryption(data.constData(), data.length());
+    const auto bytesRemaining = _contentLength - _processedSoFar - data.length();
+    _processedSoFar += data.length();
+
+    QByteArray decryptedChunk;
+    if (!_pendingBytes.isEmpty() || (bytesRemaining > 0 && bytesRemaining < OCC::Constants::e2EeTagSize)) {
+        // decryption is going to fail if last chunk does not include or does not equal to OCC::Constants::e2EeTagSize bytes tag
+        // we may end up receiving packets beyond OCC::Constants::e2EeTagSize bytes tag at the end
+        // in that case, we don't want to try and decrypt less than OCC::Constants::e2EeTagSize ending bytes of tag, we will accumulate all the incoming data till the end
+        // and then, we are going to decrypt the entire chunk containing OCC::Constants::e2EeTagSize bytes at the end
+        _pendingBytes += data;
+        if (bytesRemaining > 0) {
+            return data.length();
+        }
+        decryptedChunk = _decryptor->chunkDecryption(_pendingBytes.constData(), _pendingBytes.size());
+        _pendingBytes.clear();
+    } else {
+        decryptedChunk = _decryptor->chunkDecryption(data.constData(), data.length());
+    }
 
-    if (decryptedChunk.isEmpty()) {
+    // The last chunk may be the tag only, it decrypts to nothing
+    if (decryptedChunk.isEmpty() && !_decryptor->isFinished()) {
         qCCritical(lcPropagateDownload) << "Decryption failed!";
+        _decryptionFailed = true;
         return -1;
     }
 
-    GETFileJob::writeToDevice(decryptedChunk);
-
-    _processedSoFar += data.length();
+    if (!decryptedChunk.isEmpty() && GETFileJob::writeToDevice(decryptedChunk) != decryptedChunk.size()) {
+        return -1;
+    }
 
     return data.length();
 }
 
+bool GETEncryptedFileJob::finishDecryption()
+{
+    if (_decryptionFailed) {
+        return false;
+    }
+    if (_decryptor && _decryptor->isFinished()) {
+        return true;
+    }
+    // Only the tag is left when the data didn't have a known length
+    if (!_decryptor || _pendingBytes.size() != OCC::Constants::e2EeTagSize || !_decryptor->finish(_pendingBytes.constData())) {
+        qCCritical(lcPropagateDownload) << "Decryption failed, the download is incomplete or its tag is wrong";
+        _decryptionFailed = true;
+        return false;
+    }
+    _pendingBytes.clear();
+    return true;
+}
+
 void PropagateDownloadFile::start()
 {
     if (propagator()->_abortRequested)
@@ -631,6 +704,7 @@ void PropagateDownloadFile::startDownload()
 
     QString tmpFileName;
     QByteArray expectedEtagForResume;
+    QVector<SyncJournalDb::DownloadInfo::Segment> segments;
     const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
@@ -640,16 +714,31 @@ void PropagateDownloadFile::startDownload()
         } else {
             tmpFileName = progressInfo._tmpfile;
             expectedEtagForResume = progressInfo._etag;
+            segments = progressInfo._segments;
         }
     }
 
     if (tmpFileName.isEmpty()) {
         tmpFileName = createDownloadTmpFileName(_item->_file);
+        segments = planSegments();
     }
     _tmpFile.setFileName(propagator()->fullLocalPath(tmpFileName));
 
-    _resumeStart = _tmpFile.size();
-    if (_resumeStart > 0 && _resumeStart == _item->_size) {
+    if (!segments.isEmpty()) {
+        // The temporary is allocated at full size, its size says nothing about the progress
+        if (_tmpFile.size() != _item->_size || segments.last().end != _item->_size) {
+            for (auto &segment : segments)
+                segment.downloaded = 0;
+        }
+        _resumeStart = 0;
+        for (const auto &segment : qAsConst(segments))
+            _resumeStart += segment.downloaded;
+    } else {
+        _resumeStart = _tmpFile.size();
+    }
+    // An encrypted temporary holds the decrypted data, which doesn't include the
+    // tag. That still needs to be downloaded to check the data.
+    if (!_isEncrypted && _resumeStart > 0 && _resumeStart == _item->_size) {
         qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
         downloadFinished();
         return;
@@ -659,11 +748,21 @@ void PropagateDownloadFile::startDownload()
     // file writable if it exists.
     if (_tmpFile.exists())
         FileSystem::setFileReadOnly(_tmpFile.fileName(), false);
-    if (!_tmpFile.open(QIODevice::Append | QIODevice::Unbuffered)) {
+    QIODevice::OpenMode openMode = QIODevice::Append | QIODevice::Unbuffered;
+    if (!segments.isEmpty())
+        openMode = QIODevice::ReadWrite | QIODevice::Unbuffered;
+    if (!_tmpFile.open(openMode)) {
         qCWarning(lcPropagateDownload) << "could not open temporary file" << _tmpFile.fileName();
         done(SyncFileItem::NormalError, _tmpFile.errorString());
         return;
     }
+    // The segments write anywhere in the file, so allocate all of it now.
+    // Where the file system supports it, this makes a sparse file.
+    if (!segments.isEmpty() && _tmpFile.size() != _item->_size && !_tmpFile.resize(_item->_size)) {
+        qCWarning(lcPropagateDownload) << "could not resize temporary file" << _tmpFile.fileName();
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
     // Hide temporary after creation
     FileSystem::setFileHidden(_tmpFile.fileName(), true);
 
@@ -695,29 +794,49 @@ void PropagateDownloadFile::startDownload()
         pi._etag = _item->_etag;
         pi._tmpfile = tmpFileName;
         pi._valid = true;
+        pi._segments = segments;
         propagator()->_journal->setDownloadInfo(_item->_file, pi);
         propagator()->_journal->commit("download file start");
+
+        if (!segments.isEmpty()) {
+            _tmpFile.close();
+            _segmentedDownloadInfo = pi;
+            startSegmentedDownload();
+            return;
+        }
     }
 
     QMap<QByteArray, QByteArray> headers;
 
-    if (_item->_directDownloadUrl.isEmpty()) {
+    if (_item->extra()._directDownloadUrl.isEmpty()) {
         // Normal job, download from oC instance
-        _job = new GETFileJob(propagator()->account(),
-            propagator()->fullRemotePath(_isEncrypted ? _item->_encryptedFileName : _item->_file),
-            &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+        if (_isEncrypted) {
+            _job = new GETEncryptedFileJob(propagator()->account(),
+                propagator()->fullRemotePath(_item->extra()._encryptedFileName),
+                &_tmpFile, headers, expectedEtagForResume, _resumeStart, _downloadEncryptedHelper->encryptedInfo(), this);
+        } else {
+            _job = new GETFileJob(propagator()->account(),
+                propagator()->fullRemotePath(_item->_file),
+                &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+        }
     } else {
         // We were provided a direct URL, use that one
-        qCInfo(lcPropagateDownload) << "directDownloadUrl given for " << _item->_file << _item->_directDownloadUrl;
+        qCInfo(lcPropagateDownload) << "directDownloadUrl given for " << _item->_file << _item->extra()._directDownloadUrl;
 
-        if (!_item->_directDownloadCookies.isEmpty()) {
-            headers["Cookie"] = _item->_directDownloadCookies.toUtf8();
+        if (!_item->extra()._directDownloadCookies.isEmpty()) {
+            headers["Cookie"] = _item->extra()._directDownloadCookies.toUtf8();
         }
 
-        QUrl url = QUrl::fromUserInput(_item->_directDownloadUrl);
-        _job = new GETFileJob(propagator()->account(),
-            url,
-            &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+        QUrl url = QUrl::fromUserInput(_item->extra()._directDownloadUrl);
+        if (_isEncrypted) {
+            _job = new GETEncryptedFileJob(propagator()->account(),
+                url,
+                &_tmpFile, headers, expectedEtagForResume, _resumeStart, _downloadEncryptedHelper->encryptedInfo(), this);
+        } else {
+            _job = new GETFileJob(propagator()->account(),
+                url,
+                &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+        }
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
@@ -726,99 +845,202 @@ void PropagateDownloadFile::startDownload()
     _job->start();
 }
 
-qint64 PropagateDownloadFile::committedDiskSpace() const
+QVector<SyncJournalDb::DownloadInfo::Segment> PropagateDownloadFile::planSegments() const
 {
-    if (_state == Running) {
-        return qBound(0LL, _item->_size - _resumeStart - _downloadProgress, _item->_size);
+    const auto &options = propagator()->syncOptions();
+    // Encrypted files are larger on the server than _item->_size says
+    if (_isEncrypted || !_item->extra()._directDownloadUrl.isEmpty() || _rangeRequestsUnsupported
+        || options._parallelDownloadSegments < 2 || _item->_size < qMax<qint64>(options._minSegmentedDownloadSize, options._parallelDownloadSegments)) {
+        return {};
+    }
+
+    QVector<SyncJournalDb::DownloadInfo::Segment> segments;
+    const auto count = options._parallelDownloadSegments;
+    for (int i = 0; i < count; ++i) {
+        SyncJournalDb::DownloadInfo::Segment segment;
+        segment.start = _item->_size * i / count;
+        segment.end = _item->_size * (i + 1) / count;
+        segments.append(segment);
+    }
+    return segments;
+}
+
+void PropagateDownloadFile::startSegmentedDownload()
+{
+    const auto &segments = _segmentedDownloadInfo._segments;
+    qCInfo(lcPropagateDownload) << "Downloading" << _item->_file << "in" << segments.size() << "segments,"
+                                << _resumeStart << "bytes are already there";
+
+    _runningSegments.clear();
+    _runningSegments.resize(segments.size());
+    _segmentProgressSaved.start();
+    for (int i = 0; i < segments.size(); ++i) {
+        if (segments.at(i).downloaded == segments.at(i).end - segments.at(i).start)
+            continue;
+        QString error;
+        if (!startSegment(i, &error)) {
+            abortSegments();
+            done(SyncFileItem::NormalError, error);
+            return;
+        }
     }
-    return 0;
 }
 
-void PropagateDownloadFile::setDeleteExistingFolder(bool enabled)
+bool PropagateDownloadFile::startSegment(int index, QString *error)
 {
-    _deleteExisting = enabled;
+    const auto &segment = _segmentedDownloadInfo._segments.at(index);
+    auto &running = _runningSegments[index];
+
+    // Every segment writes through its own file handle at its own position
+    const auto position = segment.start + segment.downloaded;
+    running.file.reset(new QFile(_tmpFile.fileName()));
+    if (!running.file->open(QIODevice::ReadWrite | QIODevice::Unbuffered) || !running.file->seek(position)) {
+        qCWarning(lcPropagateDownload) << "could not open temporary file" << _tmpFile.fileName();
+        *error = running.file->errorString();
+        return false;
+    }
+
+    running.job = new GETFileJob(propagator()->account(), propagator()->fullRemotePath(_item->_file),
+        running.file.data(), QMap<QByteArray, QByteArray>(), _segmentedDownloadInfo._etag, position, this);
+    running.job->setRangeEnd(segment.end - 1);
+    running.job->setExpectedContentLength(segment.end - position);
+    running.job->setBandwidthManager(&propagator()->_bandwidthManager);
+    connect(running.job.data(), &GETFileJob::finishedSignal, this, [this, index] { segmentFinished(index); });
+    connect(running.job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::segmentProgress);
+    // Every segment uses a connection, so it takes a slot of its own
+    propagator()->_activeJobList.append(this);
+    running.job->start();
+    return true;
 }
 
-const char owncloudCustomSoftErrorStringC[] = "owncloud-custom-soft-error-string";
-void PropagateDownloadFile::slotGetFinished()
+void PropagateDownloadFile::segmentFinished(int index)
 {
+    auto &running = _runningSegments[index];
+    GETFileJob *job = running.job;
+    ASSERT(job);
+
+    propagator()->reportTransferFinished(job, job->currentDownloadPosition() - job->resumeStart(), job->msSinceStart());
     propagator()->_activeJobList.removeOne(this);
 
-    GETFileJob *job = _job;
-    ASSERT(job);
+    auto &segment = _segmentedDownloadInfo._segments[index];
+    segment.downloaded = job->currentDownloadPosition() - segment.start;
+    running.job.clear();
+    running.file->close();
 
     _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
     _item->_requestId = job->requestId();
 
-    QNetworkReply::NetworkError err = job->reply()->error();
-    if (err != QNetworkReply::NoError) {
-        // If we sent a 'Range' header and get 416 back, we want to retry
-        // without the header.
-        const bool badRangeHeader = job->resumeStart() > 0 && _item->_httpErrorCode == 416;
-        if (badRangeHeader) {
-            qCWarning(lcPropagateDownload) << "server replied 416 to our range request, trying again without";
-            propagator()->_anotherSyncNeeded = true;
-        }
-
-        // Getting a 404 probably means that the file was deleted on the server.
-        const bool fileNotFound = _item->_httpErrorCode == 404;
-        if (fileNotFound) {
-            qCWarning(lcPropagateDownload) << "server replied 404, assuming file was deleted";
-        }
-
-        // Getting a 423 means that the file is locked
-        const bool fileLocked = _item->_httpErrorCode == 423;
-        if (fileLocked) {
-            qCWarning(lcPropagateDownload) << "server replied 423, file is Locked";
-        }
+    const auto err = job->reply()->error();
+    if (err != QNetworkReply::NoError || segment.downloaded != segment.end - segment.start) {
+        saveSegmentProgress();
+        abortSegments();
 
-        // Don't keep the temporary file if it is empty or we
-        // used a bad range header or the file's not on the server anymore.
-        if (_tmpFile.exists() && (_tmpFile.size() == 0 || badRangeHeader || fileNotFound)) {
-            _tmpFile.close();
+        if (job->rangeNotSupported()) {
+            qCWarning(lcPropagateDownload) << "Server does not support range requests, downloading" << _item->_file << "in one piece";
+            _rangeRequestsUnsupported = true;
             FileSystem::remove(_tmpFile.fileName());
             propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+            startDownload();
+            return;
         }
-
-        if (!_item->_directDownloadUrl.isEmpty() && err != QNetworkReply::OperationCanceledError) {
-            // If this was with a direct download, retry without direct download
-            qCWarning(lcPropagateDownload) << "Direct download of" << _item->_directDownloadUrl << "failed. Retrying through owncloud.";
-            _item->_directDownloadUrl.clear();
-            start();
+        if (err == QNetworkReply::NoError) {
+            qCDebug(lcPropagateDownload) << "Segment" << segment.start << segment.end << "ended after" << segment.downloaded << "bytes";
+            propagator()->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
             return;
         }
+        getFailed(job);
+        return;
+    }
 
-        // This gives a custom QNAM (by the user of libowncloudsync) to abort() a QNetworkReply in its metaDataChanged() slot and
-        // set a custom error string to make this a soft error. In contrast to the default hard error this won't bring down
-        // the whole sync and allows for a custom error message.
-        QNetworkReply *reply = job->reply();
-        if (err == QNetworkReply::OperationCanceledError && reply->property(owncloudCustomSoftErrorStringC).isValid()) {
-            job->setErrorString(reply->property(owncloudCustomSoftErrorStringC).toString());
-            job->setErrorStatus(SyncFileItem::SoftError);
-        } else if (badRangeHeader) {
-            // Can't do this in classifyError() because 416 without a
-            // Range header should result in NormalError.
-            job->setErrorStatus(SyncFileItem::SoftError);
-        } else if (fileNotFound) {
-            job->setErrorString(tr("File was deleted from server"));
-            job->setErrorStatus(SyncFileItem::SoftError);
-
-            // As a precaution against bugs that cause our database and the
-            // reality on the server to diverge, rediscover this folder on the
-            // next sync run.
-            propagator()->_journal->schedulePathForRemoteDiscovery(_item->_file);
+    for (const auto &other : qAsConst(_runningSegments)) {
+        if (other.job) {
+            saveSegmentProgress();
+            return;
         }
+    }
 
-        QByteArray errorBody;
-        QString errorString = _item->_httpErrorCode >= 400 ? job->errorStringParsingBody(&errorBody)
-                                                           : job->errorString();
-        SyncFileItem::Status status = job->errorStatus();
-        if (status == SyncFileItem::NoStatus) {
-            status = classifyError(err, _item->_httpErrorCode,
-                &propagator()->_anotherSyncNeeded, errorBody);
+    // All segments are there, the checksum is validated over the whole file
+    propagator()->_journal->setDownloadInfo(_item->_file, _segmentedDownloadInfo);
+    _item->_responseTimeStamp = job->responseTimestamp();
+    if (!job->etag().isEmpty()) {
+        _item->_etag = parseEtag(job->etag());
+    }
+    if (job->lastModified()) {
+        _item->_modtime = job->lastModified();
+    }
+    validateDownload(job);
+}
+
+void PropagateDownloadFile::segmentProgress()
+{
+    qint64 downloaded = 0;
+    for (int i = 0; i < _runningSegments.size(); ++i) {
+        const auto &segment = _segmentedDownloadInfo._segments.at(i);
+        const auto &job = _runningSegments.at(i).job;
+        downloaded += job ? job->currentDownloadPosition() - segment.start : segment.downloaded;
+    }
+    _downloadProgress = downloaded - _resumeStart;
+    propagator()->reportProgress(*_item, downloaded);
+
+    // Keep the journal roughly up to date in case the client gets killed
+    if (_segmentProgressSaved.hasExpired(10 * 1000))
+        saveSegmentProgress();
+}
+
+void PropagateDownloadFile::abortSegments()
+{
+    for (auto &running : _runningSegments) {
+        if (!running.job)
+            continue;
+        disconnect(running.job.data(), nullptr, this, nullptr);
+        if (running.job->reply())
+            running.job->reply()->abort();
+        running.job.clear();
+        running.file->close();
+        propagator()->_activeJobList.removeOne(this);
+    }
+}
+
+void PropagateDownloadFile::saveSegmentProgress()
+{
+    for (int i = 0; i < _runningSegments.size(); ++i) {
+        if (const auto &job = _runningSegments.at(i).job) {
+            auto &segment = _segmentedDownloadInfo._segments[i];
+            segment.downloaded = job->currentDownloadPosition() - segment.start;
         }
+    }
+    propagator()->_journal->setDownloadInfo(_item->_file, _segmentedDownloadInfo);
+    _segmentProgressSaved.start();
+}
+
+qint64 PropagateDownloadFile::committedDiskSpace() const
+{
+    if (_state == Running) {
+        return qBound(0LL, _item->_size - _resumeStart - _downloadProgress, _item->_size);
+    }
+    return 0;
+}
+
+void PropagateDownloadFile::setDeleteExistingFolder(bool enabled)
+{
+    _deleteExisting = enabled;
+}
+
+const char owncloudCustomSoftErrorStringC[] = "owncloud-custom-soft-error-string";
+void PropagateDownloadFile::slotGetFinished()
+{
+    GETFileJob *job = _job;
+    ASSERT(job);
+
+    propagator()->reportTransferFinished(job, job->currentDownloadPosition() - job->resumeStart(), job->msSinceStart());
+    propagator()->_activeJobList.removeOne(this);
+
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item->_requestId = job->requestId();
 
-        done(status, errorString);
+    if (job->reply()->error() != QNetworkReply::NoError) {
+        getFailed(job);
         return;
     }
 
@@ -870,14 +1092,16 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
-    if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
+    // The tag at the end of encrypted data is not written
+    const qint64 tagSize = _isEncrypted ? Constants::e2EeTagSize : 0;
+    if (bodySize > 0 && bodySize - tagSize != _tmpFile.size() - job->resumeStart()) {
         qCDebug(lcPropagateDownload) << bodySize << _tmpFile.size() << job->resumeStart();
         propagator()->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
         return;
     }
 
-    if (_tmpFile.size() == 0 && _item->_size > 0) {
+    if (_tmpFile.size() == 0 && _item->_size > tagSize) {
         FileSystem::remove(_tmpFile.fileName());
         done(SyncFileItem::NormalError,
             tr("The downloaded file is empty, but the server said it should have been %1.")
@@ -885,6 +1109,102 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    // Without a Content-Length the tag is only checked now
+    const auto encryptedJob = qobject_cast<GETEncryptedFileJob *>(job);
+    if (encryptedJob && !encryptedJob->finishDecryption()) {
+        qCWarning(lcPropagateDownload) << "decryption of" << _item->_file << "failed, discarding the temporary";
+        FileSystem::remove(_tmpFile.fileName());
+        propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+        done(SyncFileItem::NormalError, tr("The downloaded file could not be decrypted."));
+        return;
+    }
+
+    validateDownload(job);
+}
+
+void PropagateDownloadFile::getFailed(GETFileJob *job)
+{
+    const QNetworkReply::NetworkError err = job->reply()->error();
+    // If we sent a 'Range' header and get 416 back, we want to retry
+    // without the header.
+    const bool badRangeHeader = job->resumeStart() > 0 && _item->_httpErrorCode == 416;
+    if (badRangeHeader) {
+        qCWarning(lcPropagateDownload) << "server replied 416 to our range request, trying again without";
+        propagator()->_anotherSyncNeeded = true;
+    }
+
+    // Getting a 404 probably means that the file was deleted on the server.
+    const bool fileNotFound = _item->_httpErrorCode == 404;
+    if (fileNotFound) {
+        qCWarning(lcPropagateDownload) << "server replied 404, assuming file was deleted";
+    }
+
+    // Getting a 423 means that the file is locked
+    const bool fileLocked = _item->_httpErrorCode == 423;
+    if (fileLocked) {
+        qCWarning(lcPropagateDownload) << "server replied 423, file is Locked";
+    }
+
+    // What was decrypted before can't be trusted if the tag didn't match
+    const auto encryptedJob = qobject_cast<GETEncryptedFileJob *>(job);
+    const bool decryptionFailed = encryptedJob && encryptedJob->decryptionFailed();
+    if (decryptionFailed) {
+        qCWarning(lcPropagateDownload) << "decryption of" << _item->_file << "failed, discarding the temporary";
+    }
+
+    // Don't keep the temporary file if it is empty or we
+    // used a bad range header or the file's not on the server anymore.
+    if (_tmpFile.exists() && (_tmpFile.size() == 0 || badRangeHeader || fileNotFound || decryptionFailed)) {
+        _tmpFile.close();
+        FileSystem::remove(_tmpFile.fileName());
+        propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+    }
+
+    if (!_item->extra()._directDownloadUrl.isEmpty() && err != QNetworkReply::OperationCanceledError) {
+        // If this was with a direct download, retry without direct download
+        qCWarning(lcPropagateDownload) << "Direct download of" << _item->extra()._directDownloadUrl << "failed. Retrying through owncloud.";
+        _item->mutableExtra()._directDownloadUrl.clear();
+        start();
+        return;
+    }
+
+    // This gives a custom QNAM (by the user of libowncloudsync) to abort() a QNetworkReply in its metaDataChanged() slot and
+    // set a custom error string to make this a soft error. In contrast to the default hard error this won't bring down
+    // the whole sync and allows for a custom error message.
+    QNetworkReply *reply = job->reply();
+    if (err == QNetworkReply::OperationCanceledError && reply->property(owncloudCustomSoftErrorStringC).isValid()) {
+        job->setErrorString(reply->property(owncloudCustomSoftErrorStringC).toString());
+        job->setErrorStatus(SyncFileItem::SoftError);
+    } else if (badRangeHeader) {
+        // Can't do this in classifyError() because 416 without a
+        // Range header should result in NormalError.
+        job->setErrorStatus(SyncFileItem::SoftError);
+    } else if (fileNotFound) {
+        job->setErrorString(tr("File was deleted from server"));
+        job->setErrorStatus(SyncFileItem::SoftError);
+
+        // As a precaution against bugs that cause our database and the
+        // reality on the server to diverge, rediscover this folder on the
+        // next sync run.
+        propagator()->_journal->schedulePathForRemoteDiscovery(_item->_file);
+    } else if (decryptionFailed) {
+        job->setErrorString(tr("The downloaded file could not be decrypted."));
+    }
+
+    QByteArray errorBody;
+    QString errorString = _item->_httpErrorCode >= 400 ? job->errorStringParsingBody(&errorBody)
+                                                       : job->errorString();
+    SyncFileItem::Status status = job->errorStatus();
+    if (status == SyncFileItem::NoStatus) {
+        status = classifyError(err, _item->_httpErrorCode,
+            &propagator()->_anotherSyncNeeded, errorBody);
+    }
+
+    done(status, errorString);
+}
+
+void PropagateDownloadFile::validateDownload(GETFileJob *job)
+{
     // Did the file come with conflict headers? If so, store them now!
     // If we download conflict files but the server doesn't send conflict
     // headers, the record will be established by SyncEngine::conflictRecordMaintenance.
@@ -918,6 +1238,10 @@ void PropagateDownloadFile::slotGetFinished()
     auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
     if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
         checksumHeader = "MD5:" + contentMd5Header;
+    // The server's checksum is of the encrypted data, which was decrypted while it
+    // was downloaded. The tag already proved it arrived unchanged.
+    if (_isEncrypted)
+        checksumHeader.clear();
     validator->start(_tmpFile.fileName(), checksumHeader);
 }
 
@@ -926,7 +1250,7 @@ void PropagateDownloadFile::slotChecksumFail(const QString &errMsg,
 {
     if (reason == ValidateChecksumHeader::FailureReason::ChecksumMismatch && propagator()->account()->isChecksumRecalculateRequestSupported()) {
             const QByteArray calculatedChecksumHeader(calculatedChecksumType + ':' + calculatedChecksum);
-            const QString fullRemotePathForFile(propagator()->fullRemotePath(_isEncrypted ? _item->_encryptedFileName : _item->_file));
+            const QString fullRemotePathForFile(propagator()->fullRemotePath(_isEncrypted ? _item->extra()._encryptedFileName : _item->_file));
             auto *job = new SimpleFileJob(propagator()->account(), fullRemotePathForFile);
             QObject::connect(job, &SimpleFileJob::finishedSignal, this,
                 [this, calculatedChecksumHeader, errMsg](const QNetworkReply *reply) { processChecksumRecalculate(reply, calculatedChecksumHeader, errMsg);
@@ -1096,16 +1420,7 @@ void PropagateDownloadFile::contentChecksumComputed(const QByteArray &checksumTy
 {
     _item->_checksumHeader = makeChecksumHeader(checksumType, checksum);
 
-    if (_isEncrypted) {
-        if (_downloadEncryptedHelper->decryptFile(_tmpFile)) {
-          downloadFinished();
-        } else {
-          done(SyncFileItem::NormalError, _downloadEncryptedHelper->errorString());
-        }
-
-    } else {
-        downloadFinished();
-    }
+    downloadFinished();
 }
 
 void PropagateDownloadFile::downloadFinished()
@@ -1212,7 +1527,7 @@ void PropagateDownloadFile::downloadFinished()
     }
 
     qCInfo(lcPropagateDownload()) << propagator()->account()->davUser() << propagator()->account()->davDisplayName() << propagator()->account()->displayName();
-    if (_item->_locked == SyncFileItem::LockStatus::LockedItem && (_item->_lockOwnerType != SyncFileItem::LockOwnerType::UserLock || _item->_lockOwnerId != propagator()->account()->davUser())) {
+    if (_item->_locked == SyncFileItem::LockStatus::LockedItem && (_item->extra()._lockOwnerType != SyncFileItem::LockOwnerType::UserLock || _item->extra()._lockOwnerId != propagator()->account()->davUser())) {
         qCInfo(lcPropagateDownload()) << "file is locked: making it read only";
         FileSystem::setFileReadOnly(fn, true);
     }
@@ -1276,7 +1591,7 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
     if (_isEncrypted) {
         propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
     } else {
-        propagator()->_journal->setDownloadInfo(_item->_encryptedFileName, SyncJournalDb::DownloadInfo());
+        propagator()->_journal->setDownloadInfo(_item->extra()._encryptedFileName, SyncJournalDb::DownloadInfo());
     }
 
     propagator()->_journal->commit("download file start2");
@@ -1309,6 +1624,10 @@ void PropagateDownloadFile::abort(PropagatorJob::AbortType abortType)
 {
     if (_job && _job->reply())
         _job->reply()->abort();
+    for (const auto &running : qAsConst(_runningSegments)) {
+        if (running.job && running.job->reply())
+            running.job->reply()->abort();
+    }
 
     if (abortType == AbortType::Asynchronous) {
         emit abortFinished();
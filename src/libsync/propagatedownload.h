@@ -20,6 +20,7 @@
 #include <common/checksums.h>
 
 #include <QBuffer>
+#include <QElapsedTimer>
 #include <QFile>
 
 namespace OCC {
@@ -38,6 +39,8 @@ class OWNCLOUDSYNC_EXPORT GETFileJob : public AbstractNetworkJob
     QByteArray _expectedEtagForResume;
     qint64 _expectedContentLength;
     qint64 _resumeStart;
+    qint64 _rangeEnd = -1;
+    bool _rangeNotSupported = false;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -51,6 +54,8 @@ class OWNCLOUDSYNC_EXPORT GETFileJob : public AbstractNetworkJob
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    QElapsedTimer _requestTimer;
+
 protected:
     qint64 _contentLength;
 
@@ -107,13 +112,28 @@ public:
 
     QByteArray &etag() { return _etag; }
     qint64 resumeStart() { return _resumeStart; }
+
+    /** Only request the bytes from resumeStart up to and including \a end.
+     *
+     * The server must reply with a matching Content-Range, otherwise the job
+     * fails and rangeNotSupported() is set.
+     */
+    void setRangeEnd(qint64 end) { _rangeEnd = end; }
+    bool rangeNotSupported() const { return _rangeNotSupported; }
+
+    std::chrono::milliseconds msSinceStart() const
+    {
+        return std::chrono::milliseconds(_requestTimer.elapsed());
+    }
     time_t lastModified() { return _lastModified; }
 
+    /// -1 if the reply has no Content-Length, like with chunked transfer encoding
     qint64 contentLength() const { return _contentLength; }
     qint64 expectedContentLength() const { return _expectedContentLength; }
     void setExpectedContentLength(qint64 size) { _expectedContentLength = size; }
 
 protected:
+    QIODevice *device() const { return _device; }
     virtual qint64 writeToDevice(const QByteArray &data);
 
 signals:
@@ -126,6 +146,10 @@ private slots:
 
 /**
  * @brief The GETEncryptedFileJob class that provides file decryption on the fly while the download is running
+ *
+ * When resuming, the device must be a file that holds the resumeStart bytes
+ * that were decrypted before; they're needed to check the tag at the end.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT GETEncryptedFileJob : public GETFileJob
@@ -142,11 +166,25 @@ public:
         qint64 resumeStart, EncryptedFile encryptedInfo, QObject *parent = nullptr);
     ~GETEncryptedFileJob() override = default;
 
+    /// Whether the data didn't decrypt, then what was written is unusable
+    bool decryptionFailed() const { return _decryptionFailed; }
+
+    /**
+     * Checks the tag once the download finished without a Content-Length,
+     * the tag is only known to be the last bytes then.
+     *
+     * Returns whether the whole file was decrypted.
+     */
+    bool finishDecryption();
+
 protected:
     qint64 writeToDevice(const QByteArray &data) override;
 
 private:
+    bool startDecryption();
+
     QSharedPointer<EncryptionHelper::StreamingDecryptor> _decryptor;
+    bool _decryptionFailed = false;
     EncryptedFile _encryptedFileInfo = {};
     QByteArray _pendingBytes;
     qint64 _processedSoFar = 0;
@@ -189,6 +227,10 @@ private:
     +-> updateMetadata() <-------------------------+
 
 \endcode
+
+ * Large files are downloaded in segments: startDownload() runs one GETFileJob
+ * per byte range, and once all are done segmentFinished() continues with the
+ * checksum validation of the whole file.
  */
 class PropagateDownloadFile : public PropagateItemJob
 {
@@ -245,17 +287,42 @@ private:
     void startAfterIsEncryptedIsChecked();
     void deleteExistingFolder();
 
+    /// Handles a GETFileJob that finished with a network error
+    void getFailed(GETFileJob *job);
+    /// Grabs the conflict headers of the reply and validates the transmission checksum
+    void validateDownload(GETFileJob *job);
+
+    /// Splits the file into byte ranges to download in parallel, empty for one piece
+    QVector<SyncJournalDb::DownloadInfo::Segment> planSegments() const;
+    void startSegmentedDownload();
+    bool startSegment(int index, QString *error);
+    void segmentFinished(int index);
+    void segmentProgress();
+    /// Stops the running segments without notifying this job
+    void abortSegments();
+    void saveSegmentProgress();
+
     qint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
     bool _deleteExisting;
     bool _isEncrypted = false;
-    EncryptedFile _encryptedInfo;
     ConflictRecord _conflictRecord;
 
     QElapsedTimer _stopwatch;
 
+    /// The journal entry of a segmented download, its segments record the progress
+    SyncJournalDb::DownloadInfo _segmentedDownloadInfo;
+    struct RunningSegment
+    {
+        QPointer<GETFileJob> job;
+        QSharedPointer<QFile> file; // the temporary, positioned at the segment
+    };
+    QVector<RunningSegment> _runningSegments;
+    QElapsedTimer _segmentProgressSaved;
+    bool _rangeRequestsUnsupported = false;
+
     PropagateDownloadEncrypted *_downloadEncryptedHelper = nullptr;
 };
 }
@@ -25,7 +25,7 @@ void PropagateDownloadEncrypted::start()
             return result;
         }
     }();
-    const auto remoteFilename = _item->_encryptedFileName.isEmpty() ? _item->_file : _item->_encryptedFileName;
+    const auto remoteFilename = _item->extra()._encryptedFileName.isEmpty() ? _item->_file : _item->extra()._encryptedFileName;
     const auto remotePath = QString(rootPath + remoteFilename);
     const auto remoteParentPath = remotePath.left(remotePath.lastIndexOf('/'));
 
@@ -71,12 +71,12 @@ void PropagateDownloadEncrypted::folderEncryptedMetadataError(const QByteArray &
 void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocument &json)
 {
   qCDebug(lcPropagateDownloadEncrypted) << "Metadata Received reading"
-                                        << _item->_instruction << _item->_file << _item->_encryptedFileName;
+                                        << _item->_instruction << _item->_file << _item->extra()._encryptedFileName;
   const QString filename = _info.fileName();
   auto meta = new FolderMetadata(_propagator->account(), json.toJson(QJsonDocument::Compact));
   const QVector<EncryptedFile> files = meta->files();
 
-  const QString encryptedFilename = _item->_encryptedFileName.section(QLatin1Char('/'), -1);
+  const QString encryptedFilename = _item->extra()._encryptedFileName.section(QLatin1Char('/'), -1);
   for (const EncryptedFile &file : files) {
     if (encryptedFilename == file.encryptedFilename) {
       _encryptedInfo = file;
@@ -91,42 +91,4 @@ void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocumen
   qCCritical(lcPropagateDownloadEncrypted) << "Failed to find encrypted metadata information of remote file" << filename;
 }
 
-// TODO: Fix this. Exported in the wrong place.
-QString createDownloadTmpFileName(const QString &previous);
-
-bool PropagateDownloadEncrypted::decryptFile(QFile& tmpFile)
-{
-    const QString tmpFileName = createDownloadTmpFileName(_item->_file + QLatin1String("_dec"));
-    qCDebug(lcPropagateDownloadEncrypted) << "Content Checksum Computed starting decryption" << tmpFileName;
-
-    tmpFile.close();
-    QFile _tmpOutput(_propagator->fullLocalPath(tmpFileName), this);
-    EncryptionHelper::fileDecryption(_encryptedInfo.encryptionKey,
-                                     _encryptedInfo.initializationVector,
-                                     &tmpFile,
-                                     &_tmpOutput);
-
-    qCDebug(lcPropagateDownloadEncrypted) << "Decryption finished" << tmpFile.fileName() << _tmpOutput.fileName();
-
-    tmpFile.close();
-    _tmpOutput.close();
-
-    // we decripted the temporary into another temporary, so good bye old one
-    if (!tmpFile.remove()) {
-        qCDebug(lcPropagateDownloadEncrypted) << "Failed to remove temporary file" << tmpFile.errorString();
-        _errorString = tmpFile.errorString();
-        return false;
-    }
-
-    // Let's fool the rest of the logic into thinking this was the actual download
-    tmpFile.setFileName(_tmpOutput.fileName());
-
-    return true;
-}
-
-QString PropagateDownloadEncrypted::errorString() const
-{
-  return _errorString;
-}
-
 }
@@ -17,8 +17,8 @@ class PropagateDownloadEncrypted : public QObject {
 public:
   PropagateDownloadEncrypted(OwncloudPropagator *propagator, const QString &localParentPath, SyncFileItemPtr item, QObject *parent = nullptr);
   void start();
-  bool decryptFile(QFile& tmpFile);
-  QString errorString() const;
+  /// The key and iv of the file, valid once fileMetadataFound() was emitted
+  const EncryptedFile &encryptedInfo() const { return _encryptedInfo; }
 
 public slots:
   void checkFolderId(const QStringList &list);
@@ -30,15 +30,12 @@ signals:
   void fileMetadataFound();
   void failed();
 
-  void decryptionFinished();
-
 private:
   OwncloudPropagator *_propagator;
   QString _localParentPath;
   SyncFileItemPtr _item;
   QFileInfo _info;
   EncryptedFile _encryptedInfo;
-  QString _errorString;
 };
 
 }
@@ -33,8 +33,8 @@ void PropagateRemoteDelete::start()
     if (propagator()->_abortRequested)
         return;
 
-    if (!_item->_encryptedFileName.isEmpty() || _item->_isEncrypted) {
-        if (!_item->_encryptedFileName.isEmpty()) {
+    if (!_item->extra()._encryptedFileName.isEmpty() || _item->_isEncrypted) {
+        if (!_item->extra()._encryptedFileName.isEmpty()) {
             _deleteEncryptedHelper = new PropagateRemoteDeleteEncrypted(propagator(), _item, this);
         } else {
             _deleteEncryptedHelper = new PropagateRemoteDeleteEncryptedRootFolder(propagator(), _item, this);
@@ -31,9 +31,9 @@ PropagateRemoteDeleteEncrypted::PropagateRemoteDeleteEncrypted(OwncloudPropagato
 
 void PropagateRemoteDeleteEncrypted::start()
 {
-    Q_ASSERT(!_item->_encryptedFileName.isEmpty());
+    Q_ASSERT(!_item->extra()._encryptedFileName.isEmpty());
 
-    const QFileInfo info(_item->_encryptedFileName);
+    const QFileInfo info(_item->extra()._encryptedFileName);
     startLsColJob(info.path());
 }
 
@@ -47,7 +47,7 @@ void PropagateRemoteDeleteEncrypted::slotFolderEncryptedMetadataReceived(const Q
 {
     if (statusCode == 404) {
         qCDebug(PROPAGATE_REMOVE_ENCRYPTED) << "Metadata not found, but let's proceed with removing the file anyway.";
-        deleteRemoteItem(_item->_encryptedFileName);
+        deleteRemoteItem(_item->extra()._encryptedFileName);
         return;
     }
 
@@ -71,7 +71,7 @@ void PropagateRemoteDeleteEncrypted::slotFolderEncryptedMetadataReceived(const Q
 
     if (!found) {
         // file is not found in the metadata, but we still need to remove it
-        deleteRemoteItem(_item->_encryptedFileName);
+        deleteRemoteItem(_item->extra()._encryptedFileName);
         return;
     }
 
@@ -80,7 +80,7 @@ void PropagateRemoteDeleteEncrypted::slotFolderEncryptedMetadataReceived(const Q
     auto job = new UpdateMetadataApiJob(_propagator->account(), _folderId, metadata.encryptedMetadata(), _folderToken);
     connect(job, &UpdateMetadataApiJob::success, this, [this](const QByteArray& fileId) {
         Q_UNUSED(fileId);
-        deleteRemoteItem(_item->_encryptedFileName);
+        deleteRemoteItem(_item->extra()._encryptedFileName);
     });
     connect(job, &UpdateMetadataApiJob::error, this, &PropagateRemoteDeleteEncrypted::taskFailed);
     job->start();
@@ -30,6 +30,7 @@
 #include "networkjobs.h"
 #include "clientsideencryption.h"
 #include "clientsideencryptionjobs.h"
+#include "contentdefinedchunker.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
@@ -331,18 +332,55 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    splitWhileComputing(computeChecksum);
+
+    // If the content checksum can't be reused as the transmission checksum,
+    // compute both while the file is read anyway.
+    const auto &capabilities = propagator()->account()->capabilities();
+    if (uploadChecksumEnabled() && !capabilities.supportedChecksumTypes().contains(checksumType)
+        && !capabilities.uploadChecksumType().isEmpty()) {
+        computeChecksum->setAdditionalChecksumTypes({ capabilities.uploadChecksumType() });
+    }
 
     connect(computeChecksum, &ComputeChecksum::done,
-        this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
+        this, [this, computeChecksum](const QByteArray &contentChecksumType, const QByteArray &contentChecksum) {
+            const auto transmissionChecksumType = propagator()->account()->capabilities().uploadChecksumType();
+            _precomputedTransmissionChecksum = computeChecksum->checksum(transmissionChecksumType);
+            if (!_precomputedTransmissionChecksum.isEmpty())
+                _precomputedTransmissionChecksumType = transmissionChecksumType;
+            slotComputeTransmissionChecksum(contentChecksumType, contentChecksum);
+        });
     connect(computeChecksum, &ComputeChecksum::done,
         computeChecksum, &QObject::deleteLater);
     computeChecksum->start(_fileToUpload._path);
 }
 
+void PropagateUploadFileCommon::splitWhileComputing(ComputeChecksum *computeChecksum)
+{
+    if (!_contentDefinedChunks.isEmpty() || !wantsContentDefinedChunks())
+        return;
+
+    // The calculation may outlive the job, it shares the chunker
+    auto chunker = std::make_shared<ContentDefinedChunker>();
+    computeChecksum->setDataObserver([chunker](const char *data, qint64 size) {
+        chunker->addData(data, size);
+    });
+    connect(computeChecksum, &ComputeChecksum::done, this, [this, chunker] {
+        _contentDefinedChunks = chunker->finish();
+    });
+}
+
 void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray &contentChecksumType, const QByteArray &contentChecksum)
 {
     _item->_checksumHeader = makeChecksumHeader(contentChecksumType, contentChecksum);
 
+    // Encrypted files are encrypted while they are sent, nothing knows the sent
+    // data in advance
+    if (_uploadingEncrypted) {
+        slotStartUpload(QByteArray(), QByteArray());
+        return;
+    }
+
     // Reuse the content checksum as the transmission checksum if possible
     const auto supportedTransmissionChecksums =
         propagator()->account()->capabilities().supportedChecksumTypes();
@@ -351,6 +389,12 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
         return;
     }
 
+    // Already computed together with the content checksum?
+    if (uploadChecksumEnabled() && !_precomputedTransmissionChecksumType.isEmpty()) {
+        slotStartUpload(_precomputedTransmissionChecksumType, _precomputedTransmissionChecksum);
+        return;
+    }
+
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
     if (uploadChecksumEnabled()) {
@@ -358,6 +402,7 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     } else {
         computeChecksum->setChecksumType(QByteArray());
     }
+    splitWhileComputing(computeChecksum);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotStartUpload);
@@ -415,6 +460,16 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     _fileToUpload._size = FileSystem::getSize(fullFilePath);
     _item->_size = FileSystem::getSize(originalFilePath);
 
+    if (_uploadingEncrypted) {
+        const auto &encryptedFile = _uploadEncryptedHelper->encryptedFile();
+        delete _encryptor;
+        _encryptor = new EncryptionHelper::StreamingEncryptor(encryptedFile.encryptionKey, encryptedFile.initializationVector, fullFilePath, this);
+        if (!_encryptor->open(QIODevice::ReadOnly)) {
+            return slotOnErrorStartFolderUnlock(SyncFileItem::SoftError, _encryptor->errorString());
+        }
+        _fileToUpload._size = _encryptor->size();
+    }
+
     // But skip the file if the mtime is too close to 'now'!
     // That usually indicates a file that is still being changed
     // or not yet fully copied to the destination.
@@ -453,10 +508,23 @@ UploadDevice::UploadDevice(const QString &fileName, qint64 start, qint64 size, B
     , _size(size)
     , _bandwidthManager(bwm)
 {
-    _bandwidthManager->registerUploadDevice(this);
+    if (_bandwidthManager) {
+        _bandwidthManager->registerUploadDevice(this);
+    }
 }
 
 
+UploadDevice::UploadDevice(QIODevice *source, qint64 start, qint64 size, BandwidthManager *bwm)
+    : _source(source)
+    , _start(start)
+    , _size(size)
+    , _bandwidthManager(bwm)
+{
+    if (_bandwidthManager) {
+        _bandwidthManager->registerUploadDevice(this);
+    }
+}
+
 UploadDevice::~UploadDevice()
 {
     if (_bandwidthManager) {
@@ -469,14 +537,23 @@ bool UploadDevice::open(QIODevice::OpenMode mode)
     if (mode & QIODevice::WriteOnly)
         return false;
 
-    // Get the file size now: _file.fileName() is no longer reliable
-    // on all platforms after openAndSeekFileSharedRead().
-    auto fileDiskSize = FileSystem::getSize(_file.fileName());
-
-    QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, _start)) {
-        setErrorString(openError);
-        return false;
+    qint64 fileDiskSize = 0;
+    if (_source) {
+        if (!_source->seek(_start)) {
+            setErrorString(_source->errorString());
+            return false;
+        }
+        fileDiskSize = _source->size();
+    } else {
+        // Get the file size now: _file.fileName() is no longer reliable
+        // on all platforms after openAndSeekFileSharedRead().
+        fileDiskSize = FileSystem::getSize(_file.fileName());
+
+        QString openError;
+        if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, _start)) {
+            setErrorString(openError);
+            return false;
+        }
     }
 
     _size = qBound(0ll, _size, fileDiskSize - _start);
@@ -521,9 +598,10 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
         _bandwidthQuota -= maxlen;
     }
 
-    auto c = _file.read(data, maxlen);
+    QIODevice *input = _source ? _source.data() : &_file;
+    auto c = input->read(data, maxlen);
     if (c < 0) {
-        setErrorString(_file.errorString());
+        setErrorString(input->errorString());
         return -1;
     }
     _read += c;
@@ -568,6 +646,9 @@ bool UploadDevice::seek(qint64 pos)
         return false;
     }
     _read = pos;
+    if (_source) {
+        return _source->seek(_start + pos);
+    }
     _file.seek(_start + pos);
     return true;
 }
@@ -632,6 +713,9 @@ void PropagateUploadFileCommon::slotPollFinished()
 void PropagateUploadFileCommon::done(SyncFileItem::Status status, const QString &errorString)
 {
     _finished = true;
+    if (_encryptor) {
+        _encryptor->close();
+    }
     PropagateItemJob::done(status, errorString);
 }
 
@@ -778,8 +862,37 @@ QMap<QByteArray, QByteArray> PropagateUploadFileCommon::headers()
     return headers;
 }
 
+std::unique_ptr<UploadDevice> PropagateUploadFileCommon::createUploadDevice(qint64 start, qint64 size)
+{
+    if (_encryptor) {
+        return std::make_unique<UploadDevice>(_encryptor, start, size, &propagator()->_bandwidthManager);
+    }
+    return std::make_unique<UploadDevice>(_fileToUpload._path, start, size, &propagator()->_bandwidthManager);
+}
+
+void PropagateUploadFileCommon::storeAuthenticationTag()
+{
+    // The tag is only known once all of the file was encrypted, which a
+    // resumed upload that had sent everything before did not do
+    if (!_encryptor->seek(_encryptor->size()) || _encryptor->tag().isEmpty()) {
+        slotOnErrorStartFolderUnlock(SyncFileItem::NormalError, tr("Could not encrypt the file"));
+        return;
+    }
+    _encryptor->close();
+    _uploadEncryptedHelper->storeAuthenticationTag(_encryptor->tag());
+}
+
 void PropagateUploadFileCommon::finalize()
 {
+    if (_encryptor && _encryptor->isOpen()) {
+        // Only a chunked upload can wait for the tag before the file becomes
+        // visible, see PropagateUploadFileNG::startNextChunk(). A plain PUT is
+        // visible at once, so the tag can only follow it.
+        connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::tagStored, this, &PropagateUploadFileCommon::finalize);
+        storeAuthenticationTag();
+        return;
+    }
+
     // Update the quota, if known
     auto quotaIt = propagator()->_folderQuota.find(QFileInfo(_item->_file).path());
     if (quotaIt != propagator()->_folderQuota.end())
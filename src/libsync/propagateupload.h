@@ -38,7 +38,10 @@ class UploadDevice : public QIODevice
 {
     Q_OBJECT
 public:
+    /// \a bwm may be null for unlimited uploads
     UploadDevice(const QString &fileName, qint64 start, qint64 size, BandwidthManager *bwm);
+    /// Reads from \a source instead of a file, which must be open and outlive the device
+    UploadDevice(QIODevice *source, qint64 start, qint64 size, BandwidthManager *bwm);
     ~UploadDevice() override;
 
     bool open(QIODevice::OpenMode mode) override;
@@ -63,6 +66,8 @@ signals:
 private:
     /// The local file to read data from
     QFile _file;
+    /// Read instead of _file if set
+    QPointer<QIODevice> _source;
 
     /// Start of the file data to use
     qint64 _start = 0;
@@ -180,6 +185,10 @@ signals:
 };
 
 class PropagateUploadEncrypted;
+class ComputeChecksum;
+namespace EncryptionHelper {
+class StreamingEncryptor;
+}
 
 /**
  * @brief The PropagateUploadFileCommon class is the code common between all chunking algorithms
@@ -237,6 +246,13 @@ protected:
     UploadFileInfo _fileToUpload;
     QByteArray _transmissionChecksumHeader;
 
+    /// Transmission checksum computed in the same pass as the content checksum, if any
+    QByteArray _precomputedTransmissionChecksumType;
+    QByteArray _precomputedTransmissionChecksum;
+
+    /// Content defined chunks of the file, split while it was read for its checksums
+    QVector<SyncJournalDb::ChunkIndex::Chunk> _contentDefinedChunks;
+
 public:
     PropagateUploadFileCommon(OwncloudPropagator *propagator, const SyncFileItemPtr &item);
 
@@ -267,6 +283,10 @@ private slots:
     // invoked on internal error to unlock a folder and faile
     void slotOnErrorStartFolderUnlock(SyncFileItem::Status status, const QString &errorString);
 
+private:
+    // Fills _contentDefinedChunks in the same pass over the file as the checksums, if wanted
+    void splitWhileComputing(ComputeChecksum *computeChecksum);
+
 public:
     virtual void doStartUpload() = 0;
 
@@ -316,8 +336,26 @@ protected:
 
     /** Bases headers that need to be sent on the PUT, or in the MOVE for chunking-ng */
     QMap<QByteArray, QByteArray> headers();
+
+    /// Reads size bytes at start of the data to upload, encrypted if needed
+    std::unique_ptr<UploadDevice> createUploadDevice(qint64 start, qint64 size);
+
+    /// Whether the file is split into _contentDefinedChunks while it is checksummed
+    virtual bool wantsContentDefinedChunks() { return false; }
+
+    /**
+     * Closes the encryptor and adds the tag of the encrypted file to the
+     * folder's metadata. PropagateUploadEncrypted::tagStored() follows.
+     *
+     * Fails the upload if there is no tag.
+     */
+    void storeAuthenticationTag();
+
+    /// Set while an end to end encrypted file is uploaded, which is encrypted as it is read
+    EncryptionHelper::StreamingEncryptor *_encryptor = nullptr;
+    PropagateUploadEncrypted *_uploadEncryptedHelper;
+
 private:
-  PropagateUploadEncrypted *_uploadEncryptedHelper;
   bool _uploadingEncrypted;
   UploadStatus _uploadStatus;
 };
@@ -379,7 +417,7 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    qint64 _sent = 0; /// amount of data (bytes) that was already sent
+    qint64 _sent = 0; /// amount of data (bytes) that was already sent or is being sent
     uint _transferId = 0; /// transfer id (part of the url)
     int _currentChunk = 0; /// Id of the next chunk that will be sent
     qint64 _currentChunkSize = 0; /// current chunk size
@@ -394,6 +432,23 @@ private:
     };
     QMap<qint64, ServerChunkInfo> _serverChunks;
 
+    // Experimental delta upload: the content defined chunks of the file in upload order.
+    // Chunks the server already has point to their offset in the version
+    // that is replaced, the others have a sourceOffset of -1 and are sent.
+    struct DeltaChunk
+    {
+        qint64 offset;
+        qint64 size;
+        qint64 sourceOffset;
+    };
+    QVector<DeltaChunk> _deltaChunks;
+    int _nextDeltaChunk = 0;
+    SyncJournalDb::ChunkIndex _chunkIndex; /// stored in the journal once the upload succeeded
+
+    // Bytes of the running chunk uploads that did not reach the server yet, by chunk id.
+    // _sent counts them already, as it is the offset of the next chunk.
+    QHash<int, qint64> _unsentChunkBytes;
+
     /**
      * Return the URL of a chunk.
      * If chunk == -1, returns the URL of the parent folder containing the chunks
@@ -411,6 +466,15 @@ public:
 private:
     void startNewUpload();
     void startNextChunk();
+    /// Starts the upload of the next chunk, returns false if it failed and the job is done
+    bool startChunk();
+    /// How many chunks of this file may be uploaded at the same time
+    int maxParallelChunks();
+    bool deltaUploadEnabled();
+    bool wantsContentDefinedChunks() override { return deltaUploadEnabled(); }
+    void computeDeltaChunks();
+    /// Returns false if \a chunks don't cover the file
+    bool planDeltaUpload(const QVector<SyncJournalDb::ChunkIndex::Chunk> &chunks);
 public slots:
     void abort(AbortType abortType) override;
 private slots:
@@ -3,6 +3,7 @@
 #include "networkjobs.h"
 #include "clientsideencryption.h"
 #include "account.h"
+#include "common/constants.h"
 
 #include <QFileInfo>
 #include <QDir>
@@ -160,7 +161,7 @@ void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDo
       }
   }
 
-  _item->_encryptedFileName = _remoteParentPath + QLatin1Char('/') + encryptedFile.encryptedFilename;
+  _item->mutableExtra()._encryptedFileName = _remoteParentPath + QLatin1Char('/') + encryptedFile.encryptedFilename;
   _item->_isEncrypted = true;
 
   qCDebug(lcPropagateUploadEncrypted) << "Creating the encrypted file.";
@@ -168,24 +169,9 @@ void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDo
   if (info.isDir()) {
       _completeFileName = encryptedFile.encryptedFilename;
   } else {
-      QFile input(info.absoluteFilePath());
-      QFile output(QDir::tempPath() + QDir::separator() + encryptedFile.encryptedFilename);
-
-      QByteArray tag;
-      bool encryptionResult = EncryptionHelper::fileEncryption(
-        encryptedFile.encryptionKey,
-        encryptedFile.initializationVector,
-        &input, &output, tag);
-
-      if (!encryptionResult) {
-        qCDebug(lcPropagateUploadEncrypted()) << "There was an error encrypting the file, aborting upload.";
-        connect(this, &PropagateUploadEncrypted::folderUnlocked, this, &PropagateUploadEncrypted::error);
-        unlockFolder();
-        return;
-      }
-
-      encryptedFile.authenticationTag = tag;
-      _completeFileName = output.fileName();
+      // The uploader encrypts the file while sending it, see storeAuthenticationTag().
+      // The key goes to the server first, a resumed upload has to use it again.
+      _completeFileName = info.absoluteFilePath();
   }
 
   qCDebug(lcPropagateUploadEncrypted) << "Creating the metadata for the encrypted file.";
@@ -219,12 +205,29 @@ void PropagateUploadEncrypted::slotUpdateMetadataSuccess(const QByteArray& fileI
     Q_UNUSED(fileId);
     qCDebug(lcPropagateUploadEncrypted) << "Uploading of the metadata success, Encrypting the file";
     QFileInfo outputInfo(_completeFileName);
+    // The encrypted data is followed by the tag
+    const auto size = outputInfo.isFile() ? outputInfo.size() + Constants::e2EeTagSize : outputInfo.size();
 
-    qCDebug(lcPropagateUploadEncrypted) << "Encrypted Info:" << outputInfo.path() << outputInfo.fileName() << outputInfo.size();
+    qCDebug(lcPropagateUploadEncrypted) << "Encrypted Info:" << outputInfo.path() << _encryptedFile.encryptedFilename << size;
     qCDebug(lcPropagateUploadEncrypted) << "Finalizing the upload part, now the actuall uploader will take over";
     emit finalized(outputInfo.path() + QLatin1Char('/') + outputInfo.fileName(),
-                   _remoteParentPath + QLatin1Char('/') + outputInfo.fileName(),
-                   outputInfo.size());
+                   _remoteParentPath + QLatin1Char('/') + _encryptedFile.encryptedFilename,
+                   size);
+}
+
+void PropagateUploadEncrypted::storeAuthenticationTag(const QByteArray &tag)
+{
+    qCDebug(lcPropagateUploadEncrypted) << "Uploading the metadata with the tag of" << _encryptedFile.encryptedFilename;
+    _encryptedFile.authenticationTag = tag;
+    _metadata->addEncryptedFile(_encryptedFile);
+
+    auto job = new UpdateMetadataApiJob(_propagator->account(),
+                                        _folderId,
+                                        _metadata->encryptedMetadata(),
+                                        _folderToken);
+    connect(job, &UpdateMetadataApiJob::success, this, &PropagateUploadEncrypted::tagStored);
+    connect(job, &UpdateMetadataApiJob::error, this, &PropagateUploadEncrypted::slotUpdateMetadataError);
+    job->start();
 }
 
 void PropagateUploadEncrypted::slotUpdateMetadataError(const QByteArray& fileId, int httpErrorResponse)
@@ -43,6 +43,17 @@ public:
     bool isFolderLocked() const { return _isFolderLocked; }
     const QByteArray folderToken() const { return _folderToken; }
 
+    /// The key and iv to encrypt the file with, once finalized() was emitted
+    const EncryptedFile &encryptedFile() const { return _encryptedFile; }
+
+    /** Adds the tag of the uploaded file to the folder's metadata
+     *
+     * The file is encrypted while it is uploaded, so its tag is only known
+     * afterwards. A chunked upload stores it before the MOVE that makes the
+     * file visible. Emits tagStored() or error().
+     */
+    void storeAuthenticationTag(const QByteArray &tag);
+
 private slots:
     void slotFolderEncryptedIdReceived(const QStringList &list);
     void slotFolderEncryptedIdError(QNetworkReply *r);
@@ -58,6 +69,7 @@ signals:
     // Emmited after the file is encrypted and everythign is setup.
     void finalized(const QString& path, const QString& filename, quint64 size);
     void error();
+    void tagStored();
     void folderUnlocked(const QByteArray &folderId, int httpStatus);
 
 private:
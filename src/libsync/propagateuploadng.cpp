@@ -25,13 +25,19 @@
 #include "syncengine.h"
 #include "propagateremotemove.h"
 #include "deletejob.h"
+#include "contentdefinedchunker.h"
+#include "propagateuploadencrypted.h"
+#include "clientsideencryption.h"
 #include "common/asserts.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
 #include <cmath>
 #include <cstring>
+#include <numeric>
 
 namespace OCC {
 
@@ -65,14 +71,18 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
           |                                                       |                      |
           |                                                       |                  DeleteJob
           |                                                       |                      |
+          +--> computeDeltaChunks()  (experimental delta upload)  |                      |
+          |                                                       |                      |
     +-----+<------------------------------------------------------+<---  slotDeleteJobFinished()
     |
     +---->  startNextChunk()  ---finished?  --+
                   ^               |          |
                   +---------------+          |
-                                             |
+                  (several chunks in flight) |
     +----------------------------------------+
     |
+    +-> storeAuthenticationTag()  (encrypted only)
+    |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
 
@@ -136,18 +146,27 @@ void PropagateUploadFileNG::slotPropfindFinished()
 
     _currentChunk = 0;
     _sent = 0;
+    bool hasReusedRanges = false;
     while (_serverChunks.contains(_currentChunk)) {
+        // The chunks of a delta upload that reuse data of the replaced file are empty
+        hasReusedRanges |= _serverChunks[_currentChunk].size == 0;
         _sent += _serverChunks[_currentChunk].size;
         _serverChunks.remove(_currentChunk);
         ++_currentChunk;
     }
 
-    if (_sent > _fileToUpload._size) {
-        // Normally this can't happen because the size is xor'ed with the transfer id, and it is
-        // therefore impossible that there is more data on the server than on the file.
-        qCCritical(lcPropagateUploadNG) << "Inconsistency while resuming " << _item->_file
-                                      << ": the size on the server (" << _sent << ") is bigger than the size of the file ("
-                                      << _fileToUpload._size << ")";
+    if (_sent > _fileToUpload._size || hasReusedRanges) {
+        if (hasReusedRanges) {
+            // The sizes on the server don't add up to the offset the upload stopped at,
+            // so a delta upload starts over instead of resuming.
+            qCInfo(lcPropagateUploadNG) << "Restarting the delta upload of" << _item->_file;
+        } else {
+            // Normally this can't happen because the size is xor'ed with the transfer id, and it is
+            // therefore impossible that there is more data on the server than on the file.
+            qCCritical(lcPropagateUploadNG) << "Inconsistency while resuming " << _item->_file
+                                          << ": the size on the server (" << _sent << ") is bigger than the size of the file ("
+                                          << _fileToUpload._size << ")";
+        }
 
         // Wipe the old chunking data.
         // Fire and forget. Any error will be ignored.
@@ -284,9 +303,96 @@ void PropagateUploadFileNG::slotMkColFinished()
         abortWithError(status, job->errorStringParsingBody());
         return;
     }
+    // The file was usually split while its checksum was computed, read it
+    // again only if that didn't happen
+    if (deltaUploadEnabled() && !planDeltaUpload(_contentDefinedChunks)) {
+        computeDeltaChunks();
+        return;
+    }
     startNextChunk();
 }
 
+bool PropagateUploadFileNG::deltaUploadEnabled()
+{
+    // Experimental, the server side of the protocol doesn't exist yet.
+    // Encrypted files are different after every change, nothing could be reused.
+    return propagator()->syncOptions()._experimentalDeltaUpload
+        && propagator()->account()->capabilities().chunkingDelta()
+        && !_item->_isEncrypted && _item->extra()._encryptedFileName.isEmpty()
+        && _fileToUpload._size >= ContentDefinedChunker::defaultAverageChunkSize;
+}
+
+void PropagateUploadFileNG::computeDeltaChunks()
+{
+    propagator()->_activeJobList.append(this);
+
+    using Chunks = QVector<SyncJournalDb::ChunkIndex::Chunk>;
+    auto watcher = new QFutureWatcher<Chunks>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher] {
+        watcher->deleteLater();
+        propagator()->_activeJobList.removeOne(this);
+        if (propagator()->_abortRequested)
+            return;
+        if (!planDeltaUpload(watcher->result())) {
+            // Unreadable or changed since discovery, the regular upload deals with that
+            qCInfo(lcPropagateUploadNG) << "Could not split" << _item->_file << "into chunks, uploading all of it";
+        }
+        startNextChunk();
+    });
+
+    const QString fileName = _fileToUpload._path;
+    watcher->setFuture(QtConcurrent::run([fileName]() {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+            return Chunks();
+        return ContentDefinedChunker().chunks(&file);
+    }));
+}
+
+bool PropagateUploadFileNG::planDeltaUpload(const QVector<SyncJournalDb::ChunkIndex::Chunk> &chunks)
+{
+    const auto size = std::accumulate(chunks.cbegin(), chunks.cend(), qint64(0),
+        [](qint64 sum, const SyncJournalDb::ChunkIndex::Chunk &chunk) { return sum + chunk.size; });
+    if (chunks.isEmpty() || size != _fileToUpload._size)
+        return false;
+
+    _chunkIndex._valid = true;
+    _chunkIndex._averageChunkSize = ContentDefinedChunker::defaultAverageChunkSize;
+    _chunkIndex._chunks = chunks;
+
+    // The server copies reused ranges from the version the MOVE replaces, so the
+    // stored index must describe exactly that version.
+    QHash<QByteArray, qint64> serverChunks;
+    const auto previous = propagator()->_journal->getChunkIndex(_item->_file);
+    if (previous._valid && previous._etag == _item->_etag
+        && previous._averageChunkSize == _chunkIndex._averageChunkSize
+        && headers().contains(QByteArrayLiteral("If-Match"))) {
+        for (const auto &chunk : previous._chunks)
+            serverChunks.insert(chunk.hash, chunk.offset);
+    }
+
+    qint64 reused = 0;
+    _deltaChunks.clear();
+    _deltaChunks.reserve(chunks.size());
+    for (const auto &chunk : chunks) {
+        const auto sourceOffset = serverChunks.value(chunk.hash, -1);
+        if (sourceOffset >= 0)
+            reused += chunk.size;
+        _deltaChunks.append({ chunk.offset, chunk.size, sourceOffset });
+    }
+    _nextDeltaChunk = 0;
+    qCInfo(lcPropagateUploadNG) << "Delta upload of" << _item->_file << "reuses" << reused << "of" << size << "bytes";
+    return true;
+}
+
+int PropagateUploadFileNG::maxParallelChunks()
+{
+    // The encryption goes through the file once, in order
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled() || _encryptor)
+        return 1;
+    return qMax(1, propagator()->syncOptions()._maxParallelChunkUploads);
+}
+
 void PropagateUploadFileNG::startNextChunk()
 {
     if (propagator()->_abortRequested)
@@ -295,44 +401,110 @@ void PropagateUploadFileNG::startNextChunk()
     qint64 fileSize = _fileToUpload._size;
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
-    // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    if (_sent < fileSize) {
+        // Keep several chunks in flight to fill links with a high latency. How many
+        // is bounded by the transfer window of the propagator, which follows the
+        // measured throughput.
+        do {
+            if (!startChunk())
+                return;
+        } while (_sent < fileSize && _jobs.size() < maxParallelChunks()
+            && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob());
+        return;
+    }
 
-    if (_currentChunkSize == 0) {
-        Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
-        _finished = true;
+    // The server assembles the chunks in the order of their names, so they may
+    // arrive in any order, but all of them must be there before the MOVE
+    if (!_jobs.isEmpty())
+        return;
 
-        // Finish with a MOVE
-        // If we changed the file name, we must store the changed filename in the remote folder, not the original one.
-        QString destination = QDir::cleanPath(propagator()->account()->davUrl().path()
-            + propagator()->fullRemotePath(_fileToUpload._file));
-        auto headers = PropagateUploadFileCommon::headers();
+    if (_encryptor && _encryptor->isOpen()) {
+        // Other clients verify the content with the tag in the folder's metadata.
+        // The MOVE makes the new content visible, so it waits until the tag is
+        // stored. If that fails the chunks stay, the next sync resumes them and
+        // stores the tag again.
+        connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::tagStored, this, &PropagateUploadFileNG::startNextChunk);
+        storeAuthenticationTag();
+        return;
+    }
 
-        // "If-Match applies to the source, but we are interested in comparing the etag of the destination
-        auto ifMatch = headers.take(QByteArrayLiteral("If-Match"));
-        if (!ifMatch.isEmpty()) {
-            headers[QByteArrayLiteral("If")] = "<" + QUrl::toPercentEncoding(destination, "/") + "> ([" + ifMatch + "])";
-        }
-        if (!_transmissionChecksumHeader.isEmpty()) {
-            qCInfo(lcPropagateUpload) << destination << _transmissionChecksumHeader;
-            headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    _finished = true;
+
+    // Finish with a MOVE
+    // If we changed the file name, we must store the changed filename in the remote folder, not the original one.
+    QString destination = QDir::cleanPath(propagator()->account()->davUrl().path()
+        + propagator()->fullRemotePath(_fileToUpload._file));
+    auto headers = PropagateUploadFileCommon::headers();
+
+    // "If-Match applies to the source, but we are interested in comparing the etag of the destination
+    auto ifMatch = headers.take(QByteArrayLiteral("If-Match"));
+    if (!ifMatch.isEmpty()) {
+        headers[QByteArrayLiteral("If")] = "<" + QUrl::toPercentEncoding(destination, "/") + "> ([" + ifMatch + "])";
+    }
+    if (!_transmissionChecksumHeader.isEmpty()) {
+        qCInfo(lcPropagateUpload) << destination << _transmissionChecksumHeader;
+        headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    }
+    headers[QByteArrayLiteral("OC-Total-Length")] = QByteArray::number(fileSize);
+
+    auto job = new MoveJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), "/.file"),
+        destination, headers, this);
+    _jobs.append(job);
+    connect(job, &MoveJob::finishedSignal, this, &PropagateUploadFileNG::slotMoveJobFinished);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+    propagator()->_activeJobList.append(this);
+    adjustLastJobTimeout(job, fileSize);
+    job->start();
+}
+
+bool PropagateUploadFileNG::startChunk()
+{
+    const qint64 fileSize = _fileToUpload._size;
+    qint64 sourceOffset = -1;
+    if (_nextDeltaChunk < _deltaChunks.size()) {
+        // Changed data is sent in requests of up to the chunk size, unchanged
+        // data as one reference per contiguous range of the old version
+        const auto &first = _deltaChunks.at(_nextDeltaChunk++);
+        ENFORCE(first.offset == _sent, "Delta chunks out of order");
+        sourceOffset = first.sourceOffset;
+        _currentChunkSize = first.size;
+        while (_nextDeltaChunk < _deltaChunks.size()) {
+            const auto &next = _deltaChunks.at(_nextDeltaChunk);
+            const bool fits = sourceOffset >= 0
+                ? next.sourceOffset == sourceOffset + _currentChunkSize
+                : next.sourceOffset < 0 && _currentChunkSize + next.size <= propagator()->_chunkSize;
+            if (!fits)
+                break;
+            _currentChunkSize += next.size;
+            ++_nextDeltaChunk;
         }
-        headers[QByteArrayLiteral("OC-Total-Length")] = QByteArray::number(fileSize);
+    } else {
+        // prevent situation that chunk size is bigger then required one to send
+        _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    }
+
+    QMap<QByteArray, QByteArray> headers;
+    headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
 
-        auto job = new MoveJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), "/.file"),
-            destination, headers, this);
+    if (sourceOffset >= 0) {
+        // The server takes this chunk's data from the file that is replaced. This
+        // is the experimental dav/chunkingDelta extension, see Capabilities::chunkingDelta()
+        headers["OC-Chunk-Source-Range"] = QByteArray::number(sourceOffset) + '-' + QByteArray::number(sourceOffset + _currentChunkSize - 1);
+        auto device = std::make_unique<QBuffer>();
+        device->open(QIODevice::ReadOnly);
+        _sent += _currentChunkSize;
+        auto *job = new PUTFileJob(propagator()->account(), chunkUrl(_currentChunk), std::move(device), headers, _currentChunk, this);
         _jobs.append(job);
-        connect(job, &MoveJob::finishedSignal, this, &PropagateUploadFileNG::slotMoveJobFinished);
+        connect(job, &PUTFileJob::finishedSignal, this, &PropagateUploadFileNG::slotPutFinished);
         connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
-        propagator()->_activeJobList.append(this);
-        adjustLastJobTimeout(job, fileSize);
         job->start();
-        return;
+        propagator()->_activeJobList.append(this);
+        _currentChunk++;
+        return true;
     }
 
     const QString fileName = _fileToUpload._path;
-    auto device = std::make_unique<UploadDevice>(
-            fileName, _sent, _currentChunkSize, &propagator()->_bandwidthManager);
+    auto device = createUploadDevice(_sent, _currentChunkSize);
     if (!device->open(QIODevice::ReadOnly)) {
         qCWarning(lcPropagateUploadNG) << "Could not prepare upload device: " << device->errorString();
 
@@ -343,12 +515,9 @@ void PropagateUploadFileNG::startNextChunk()
         }
         // Soft error because this is likely caused by the user modifying his files while syncing
         abortWithError(SyncFileItem::SoftError, device->errorString());
-        return;
+        return false;
     }
 
-    QMap<QByteArray, QByteArray> headers;
-    headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
-
     _sent += _currentChunkSize;
     QUrl url = chunkUrl(_currentChunk);
 
@@ -364,7 +533,9 @@ void PropagateUploadFileNG::startNextChunk()
     connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
     job->start();
     propagator()->_activeJobList.append(this);
+    _unsentChunkBytes.insert(_currentChunk, _currentChunkSize);
     _currentChunk++;
+    return true;
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -374,7 +545,9 @@ void PropagateUploadFileNG::slotPutFinished()
 
     slotJobDestroyed(job); // remove it from the _jobs list
 
+    propagator()->reportTransferFinished(job, job->device()->size(), job->msSinceStart());
     propagator()->_activeJobList.removeOne(this);
+    _unsentChunkBytes.remove(job->_chunk);
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
@@ -396,10 +569,12 @@ void PropagateUploadFileNG::slotPutFinished()
     //
     // Dynamic chunk sizing is enabled if the server configured a
     // target duration for each chunk upload.
+    // Reused ranges are not transferred and say nothing about the bandwidth.
     auto targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
-    if (targetDuration.count() > 0) {
+    const auto chunkSize = job->device()->size();
+    if (targetDuration.count() > 0 && chunkSize > 0) {
         auto uploadTime = ++job->msSinceStart(); // add one to avoid div-by-zero
-        qint64 predictedGoodSize = (_currentChunkSize * targetDuration) / uploadTime;
+        qint64 predictedGoodSize = (chunkSize * targetDuration) / uploadTime;
 
         // The whole targeting is heuristic. The predictedGoodSize will fluctuate
         // quite a bit because of external factors (like available bandwidth)
@@ -415,18 +590,19 @@ void PropagateUploadFileNG::slotPutFinished()
             targetSize,
             propagator()->syncOptions()._maxChunkSize);
 
-        qCInfo(lcPropagateUploadNG) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime.count()
+        qCInfo(lcPropagateUploadNG) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime.count()
                                   << "ms, desired is" << targetDuration.count() << "ms, expected good chunk size is"
                                   << predictedGoodSize << "bytes and nudged next chunk size to "
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    _finished = _sent == _item->_size;
+    // Chunks finish in any order, the data is complete once the last running one is done
+    const bool allChunksSent = _sent == _item->_size && _jobs.isEmpty();
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->fullLocalPath(_item->_file));
     if (!FileSystem::fileExists(fullFilePath)) {
-        if (!_finished) {
+        if (!allChunksSent) {
             abortWithError(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         } else {
@@ -441,13 +617,13 @@ void PropagateUploadFileNG::slotPutFinished()
     }
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
         propagator()->_anotherSyncNeeded = true;
-        if (!_finished) {
+        if (!allChunksSent) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             return;
         }
     }
 
-    if (!_finished) {
+    if (!allChunksSent) {
         // Deletes an existing blacklist entry on successful chunk upload
         if (_item->_hasBlacklistEntry) {
             propagator()->_journal->wipeErrorBlacklistEntry(_item->_file);
@@ -514,6 +690,13 @@ void PropagateUploadFileNG::slotMoveJobFinished()
         abortWithError(SyncFileItem::NormalError, tr("Missing ETag from server"));
         return;
     }
+
+    // Remember the chunks of the new version for the next delta upload, or
+    // drop the index of the replaced version
+    if (propagator()->syncOptions()._experimentalDeltaUpload) {
+        _chunkIndex._etag = _item->_etag;
+        propagator()->_journal->setChunkIndex(_item->_file, _chunkIndex);
+    }
     finalize();
 }
 
@@ -526,7 +709,11 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+    auto job = qobject_cast<PUTFileJob *>(sender());
+    ASSERT(job);
+    _unsentChunkBytes[job->_chunk] = total - sent;
+    const auto unsent = std::accumulate(_unsentChunkBytes.cbegin(), _unsentChunkBytes.cend(), qint64(0));
+    propagator()->reportProgress(*_item, _sent - unsent);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
@@ -135,8 +135,7 @@ void PropagateUploadFileV1::startNextChunk()
     }
 
     const QString fileName = _fileToUpload._path;
-    auto device = std::make_unique<UploadDevice>(
-            fileName, chunkStart, currentChunkSize, &propagator()->_bandwidthManager);
+    auto device = createUploadDevice(chunkStart, currentChunkSize);
     if (!device->open(QIODevice::ReadOnly)) {
         qCWarning(lcPropagateUploadV1) << "Could not prepare upload device: " << device->errorString();
 
@@ -169,6 +168,9 @@ void PropagateUploadFileV1::startNextChunk()
     if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
         // Server may also disable parallel chunked upload for any higher version
         parallelChunkUpload = false;
+    } else if (_encryptor) {
+        // The encryption goes through the file once, in order
+        parallelChunkUpload = false;
     } else {
         QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
         if (!env.isEmpty()) {
@@ -205,6 +207,7 @@ void PropagateUploadFileV1::slotPutFinished()
 
     slotJobDestroyed(job); // remove it from the _jobs list
 
+    propagator()->reportTransferFinished(job, job->device()->size(), job->msSinceStart());
     propagator()->_activeJobList.removeOne(this);
 
     if (_finished) {
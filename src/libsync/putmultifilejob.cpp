@@ -14,8 +14,6 @@
 
 #include "putmultifilejob.h"
 
-#include <QHttpPart>
-
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcPutMultiFileJob, "nextcloud.sync.networkjob.put.multi", QtInfoMsg)
@@ -25,22 +23,17 @@ PutMultiFileJob::~PutMultiFileJob() = default;
 void PutMultiFileJob::start()
 {
     QNetworkRequest req;
-
-    for(auto &oneDevice : _devices) {
-        auto onePart = QHttpPart{};
-
-        onePart.setBodyDevice(oneDevice._device.get());
-
-        for (QMap<QByteArray, QByteArray>::const_iterator it = oneDevice._headers.begin(); it != oneDevice._headers.end(); ++it) {
-            onePart.setRawHeader(it.key(), it.value());
-        }
-
-        req.setPriority(QNetworkRequest::LowPriority); // Long uploads must not block non-propagation jobs.
-
-        _body.append(onePart);
+    req.setPriority(QNetworkRequest::LowPriority); // Long uploads must not block non-propagation jobs.
+    req.setHeader(QNetworkRequest::ContentTypeHeader, _body->contentType());
+    // With a known length the body is read while it is sent instead of being buffered
+    req.setHeader(QNetworkRequest::ContentLengthHeader, _body->size());
+    req.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
+
+    if (!_body->open(QIODevice::ReadOnly)) {
+        qCWarning(lcPutMultiFileJob) << "Could not open the upload body" << _body->errorString();
     }
 
-    sendRequest("POST", _url, req, &_body);
+    sendRequest("POST", _url, req, _body);
 
     if (reply()->error() != QNetworkReply::NoError) {
         qCWarning(lcPutMultiFileJob) << " Network error: " << reply()->errorString();
@@ -54,8 +47,9 @@ void PutMultiFileJob::start()
 
 bool PutMultiFileJob::finished()
 {
-    for(const auto &oneDevice : _devices) {
-        oneDevice._device->close();
+    _body->close();
+    if (_body->failed() && reply()->error() != QNetworkReply::NoError) {
+        _errorString = _body->errorString();
     }
 
     qCInfo(lcPutMultiFileJob) << "POST of" << reply()->request().url().toString() << path() << "FINISHED WITH STATUS"
@@ -16,7 +16,7 @@
 
 #include "abstractnetworkjob.h"
 
-#include "propagateupload.h"
+#include "multipartuploaddevice.h"
 #include "account.h"
 
 #include <QLoggingCategory>
@@ -25,23 +25,20 @@
 #include <QUrl>
 #include <QString>
 #include <QElapsedTimer>
-#include <QHttpMultiPart>
 #include <memory>
 
-class QIODevice;
-
 namespace OCC {
 
 Q_DECLARE_LOGGING_CATEGORY(lcPutMultiFileJob)
 
-struct SingleUploadFileData
-{
-    std::unique_ptr<UploadDevice> _device;
-    QMap<QByteArray, QByteArray> _headers;
-};
+class BandwidthManager;
 
 /**
  * @brief The PutMultiFileJob class
+ *
+ * Uploads several files in one multipart/related POST. The body is streamed
+ * from the files by a MultipartUploadDevice.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT PutMultiFileJob : public AbstractNetworkJob
@@ -50,17 +47,14 @@ class OWNCLOUDSYNC_EXPORT PutMultiFileJob : public AbstractNetworkJob
 
 public:
     explicit PutMultiFileJob(AccountPtr account, const QUrl &url,
-                             std::vector<SingleUploadFileData> devices, QObject *parent = nullptr)
+                             std::vector<SingleUploadFileData> files, BandwidthManager *bandwidthManager,
+                             QObject *parent = nullptr)
         : AbstractNetworkJob(account, {}, parent)
-        , _devices(std::move(devices))
+        , _body(new MultipartUploadDevice(std::move(files), bandwidthManager, MultipartUploadDevice::defaultBufferSize, this))
         , _url(url)
     {
-        _body.setContentType(QHttpMultiPart::RelatedType);
-        for(auto &singleDevice : _devices) {
-            singleDevice._device->setParent(this);
-            connect(this, &PutMultiFileJob::uploadProgress,
-                    singleDevice._device.get(), &UploadDevice::slotJobUploadProgress);
-        }
+        connect(this, &PutMultiFileJob::uploadProgress,
+                _body, &MultipartUploadDevice::slotJobUploadProgress);
     }
 
     ~PutMultiFileJob() override;
@@ -84,8 +78,7 @@ signals:
     void uploadProgress(qint64, qint64);
 
 private:
-    QHttpMultiPart _body;
-    std::vector<SingleUploadFileData> _devices;
+    MultipartUploadDevice *_body;
     QString _errorString;
     QUrl _url;
     QElapsedTimer _requestTimer;
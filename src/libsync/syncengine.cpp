@@ -40,6 +40,8 @@
 #include <climits>
 #include <cassert>
 #include <chrono>
+#include <functional>
+#include <numeric>
 
 #include <QCoreApplication>
 #include <QSslSocket>
@@ -61,7 +63,6 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcEngine, "nextcloud.sync.engine", QtInfoMsg)
 
-bool SyncEngine::s_anySyncRunning = false;
 
 /** When the client touches a file, block change notifications for this duration (ms)
  *
@@ -206,6 +207,39 @@ static bool isFileTransferInstruction(SyncInstructions instruction)
         || instruction == CSYNC_INSTRUCTION_TYPE_CHANGE;
 }
 
+// Whether the rest of the discovery leaves the item alone. Not so for removals and
+// renames, and for what DiscoveryPhase::findAndCancelDeletedJob() may still cancel.
+static bool isFinalBeforeDiscoveryFinished(const SyncFileItem &item)
+{
+    if (item._isRestoration || item._type == ItemTypeVirtualFile)
+        return false;
+    switch (item._instruction) {
+    case CSYNC_INSTRUCTION_NEW:
+    case CSYNC_INSTRUCTION_SYNC:
+    case CSYNC_INSTRUCTION_CONFLICT:
+    case CSYNC_INSTRUCTION_UPDATE_METADATA:
+    case CSYNC_INSTRUCTION_IGNORE:
+    case CSYNC_INSTRUCTION_ERROR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Sorts items the way OwncloudPropagator::start() expects them. The indexes into
+// allItems are those of the discovery order; of equal items the later discovered
+// comes first, like with the sorted insertion that was used before.
+static SyncFileItemVector sortedItems(const SyncFileItemVector &allItems, QVector<int> indexes)
+{
+    std::sort(indexes.begin(), indexes.end(), std::greater<int>());
+    SyncFileItemVector items;
+    items.reserve(indexes.size());
+    for (const auto index : qAsConst(indexes))
+        items.append(allItems.at(index));
+    std::stable_sort(items.begin(), items.end());
+    return items;
+}
+
 void SyncEngine::deleteStaleDownloadInfos(const SyncFileItemVector &syncItems)
 {
     // Find all downloadinfo paths that we want to preserve.
@@ -373,8 +407,8 @@ void OCC::SyncEngine::slotItemDiscovered(const OCC::SyncFileItemPtr &item)
                 }
             }
 
-            // Updating the db happens on success
-            _journal->setFileRecord(rec);
+            // Updating the db happens on success, written in batches in the background
+            _journal->queueFileRecord(rec);
 
             // This might have changed the shared flag, so we must notify SyncFileStatusTracker for example
             emit itemCompleted(item);
@@ -408,14 +442,20 @@ void OCC::SyncEngine::slotItemDiscovered(const OCC::SyncFileItemPtr &item)
         }
     }
 
+    if (_syncOptions._streamPropagation && !isFinalBeforeDiscoveryFinished(*item)) {
+        markUnstreamable(item->_file);
+        markUnstreamable(item->destination());
+    }
+
     // check for blacklisting of this item.
     // if the item is on blacklist, the instruction was set to ERROR
     checkErrorBlacklisting(*item);
     _needsUpdate = true;
 
-    // Insert sorted
-    auto it = std::lower_bound( _syncItems.begin(), _syncItems.end(), item ); // the _syncItems is sorted
-    _syncItems.insert( it, item );
+    // Sorted once discovery finished, sorted insertion is quadratic
+    _syncItems.append(item);
+    if (_syncOptions._streamPropagation)
+        _unstreamedItems.insert(item->_file, _syncItems.size() - 1);
 
     slotNewItem(item);
 
@@ -439,12 +479,11 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false)
         return;
     }
 
-    s_anySyncRunning = true;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -486,6 +525,8 @@ void SyncEngine::startSync()
     }
 
     _syncItems.clear();
+    _unstreamedItems.clear();
+    _unstreamableDirectories.clear();
     _needsUpdate = false;
 
     if (!_journal->exists()) {
@@ -597,9 +638,15 @@ void SyncEngine::startSync()
         finalize(false);
     });
     connect(_discoveryPhase.data(), &DiscoveryPhase::finished, this, &SyncEngine::slotDiscoveryFinished);
+    if (_syncOptions._streamPropagation)
+        connect(_discoveryPhase.data(), &DiscoveryPhase::subtreeDiscovered, this, &SyncEngine::slotSubtreeDiscovered);
     connect(_discoveryPhase.data(), &DiscoveryPhase::silentlyExcluded,
         _syncFileStatusTracker.data(), &SyncFileStatusTracker::slotAddSilentlyExcluded);
 
+    if (_syncOptions._useJournalSnapshot && !_journal->loadFileRecordSnapshot()) {
+        qCWarning(lcEngine) << "Could not load the journal snapshot, discovery reads from the database";
+    }
+
     auto discoveryJob = new ProcessDirectoryJob(
         _discoveryPhase.data(), PinState::AlwaysLocal, _journal->keyValueStoreGetInt("last_sync", 0), _discoveryPhase.data());
     _discoveryPhase->startJob(discoveryJob);
@@ -640,6 +687,82 @@ void SyncEngine::slotNewItem(const SyncFileItemPtr &item)
     _progressInfo->adjustTotalsForFile(*item);
 }
 
+void SyncEngine::slotSubtreeDiscovered(const QString &path)
+{
+    if (!_discoveryPhase || _unstreamableDirectories.contains(path)) {
+        return;
+    }
+    if (dataFingerprintChanged()) {
+        // restoreOldFiles() needs to see all items first
+        return;
+    }
+
+    // The directory itself and everything below it
+    QVector<int> indexes;
+    const auto prefix = path + QLatin1Char('/');
+    auto takeWhile = [this, &indexes](QMultiMap<QString, int>::iterator it, const std::function<bool(const QString &)> &inSubtree) {
+        while (it != _unstreamedItems.end() && inSubtree(it.key())) {
+            indexes.append(it.value());
+            it = _unstreamedItems.erase(it);
+        }
+    };
+    takeWhile(_unstreamedItems.find(path), [&path](const QString &file) { return file == path; });
+    takeWhile(_unstreamedItems.lowerBound(prefix), [&prefix](const QString &file) { return file.startsWith(prefix); });
+    if (indexes.isEmpty()) {
+        return;
+    }
+
+    auto items = sortedItems(_syncItems, indexes);
+    qCInfo(lcEngine) << "Propagating" << items.size() << "items in" << path << "while the discovery continues";
+
+    if (!_propagator) {
+        emit aboutToPropagate(items);
+        createPropagator();
+        Q_EMIT started();
+        _propagator->startStreaming();
+    } else {
+        emit aboutToPropagateMore(items);
+    }
+    _propagator->appendSubtree(std::move(items));
+}
+
+void SyncEngine::markUnstreamable(const QString &path)
+{
+    // Parents of a marked directory are marked already
+    for (auto dir = path; !dir.isEmpty() && !_unstreamableDirectories.contains(dir); dir = dir.left(qMax(0, dir.lastIndexOf(QLatin1Char('/'))))) {
+        _unstreamableDirectories.insert(dir);
+    }
+}
+
+bool SyncEngine::dataFingerprintChanged() const
+{
+    const auto databaseFingerprint = _journal->dataFingerprint();
+    // If databaseFingerprint is empty, this means that there was no information in the database
+    // (for example, upgrading from a previous version, or first sync, or server not supporting fingerprint)
+    return !databaseFingerprint.isEmpty() && _discoveryPhase
+        && _discoveryPhase->_dataFingerprint != databaseFingerprint;
+}
+
+void SyncEngine::createPropagator()
+{
+    _propagator = QSharedPointer<OwncloudPropagator>(
+        new OwncloudPropagator(_account, _localPath, _remotePath, _journal, _bulkUploadBlackList));
+    _propagator->setSyncOptions(_syncOptions);
+    connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
+        this, &SyncEngine::slotItemCompleted);
+    connect(_propagator.data(), &OwncloudPropagator::progress,
+        this, &SyncEngine::slotProgress);
+    connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotPropagationFinished, Qt::QueuedConnection);
+    connect(_propagator.data(), &OwncloudPropagator::seenLockedFile, this, &SyncEngine::seenLockedFile);
+    connect(_propagator.data(), &OwncloudPropagator::touchedFile, this, &SyncEngine::slotAddTouchedFile);
+    connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
+    connect(_propagator.data(), &OwncloudPropagator::insufficientRemoteStorage, this, &SyncEngine::slotInsufficientRemoteStorage);
+    connect(_propagator.data(), &OwncloudPropagator::newItem, this, &SyncEngine::slotNewItem);
+
+    // apply the network limits to the propagator
+    setNetworkLimits(_uploadLimit, _downloadLimit);
+}
+
 void SyncEngine::slotDiscoveryFinished()
 {
     if (!_discoveryPhase) {
@@ -667,12 +790,8 @@ void SyncEngine::slotDiscoveryFinished()
 
     //    qCInfo(lcEngine) << "Permissions of the root folder: " << _csync_ctx->remote.root_perms.toString();
     auto finish = [this]{
-        auto databaseFingerprint = _journal->dataFingerprint();
-        // If databaseFingerprint is empty, this means that there was no information in the database
-        // (for example, upgrading from a previous version, or first sync, or server not supporting fingerprint)
-        if (!databaseFingerprint.isEmpty() && _discoveryPhase
-            && _discoveryPhase->_dataFingerprint != databaseFingerprint) {
-            qCInfo(lcEngine) << "data fingerprint changed, assume restore from backup" << databaseFingerprint << _discoveryPhase->_dataFingerprint;
+        if (dataFingerprintChanged()) {
+            qCInfo(lcEngine) << "data fingerprint changed, assume restore from backup" << _journal->dataFingerprint() << _discoveryPhase->_dataFingerprint;
             restoreOldFiles(_syncItems);
         }
 
@@ -680,6 +799,17 @@ void SyncEngine::slotDiscoveryFinished()
             _anotherSyncNeeded = ImmediateFollowUp;
         }
 
+        // With a propagator started early only what it doesn't have yet remains
+        SyncFileItemVector remainingItems;
+        if (_propagator) {
+            remainingItems = sortedItems(_syncItems, _unstreamedItems.values().toVector());
+            _unstreamedItems.clear();
+            _unstreamableDirectories.clear();
+        }
+
+        QVector<int> indexes(_syncItems.size());
+        std::iota(indexes.begin(), indexes.end(), 0);
+        _syncItems = sortedItems(_syncItems, indexes);
         Q_ASSERT(std::is_sorted(_syncItems.begin(), _syncItems.end()));
 
         qCInfo(lcEngine) << "#### Reconcile (aboutToPropagate) #################################################### " << _stopWatch.addLapTime(QStringLiteral("Reconcile (aboutToPropagate)")) << "ms";
@@ -687,7 +817,11 @@ void SyncEngine::slotDiscoveryFinished()
         _localDiscoveryPaths.clear();
 
         // To announce the beginning of the sync
-        emit aboutToPropagate(_syncItems);
+        if (_propagator) {
+            emit aboutToPropagateMore(remainingItems);
+        } else {
+            emit aboutToPropagate(_syncItems);
+        }
 
         qCInfo(lcEngine) << "#### Reconcile (aboutToPropagate OK) #################################################### "<< _stopWatch.addLapTime(QStringLiteral("Reconcile (aboutToPropagate OK)")) << "ms";
 
@@ -712,36 +846,35 @@ void SyncEngine::slotDiscoveryFinished()
     #endif
         }
 
-        // do a database commit
+        // Reconcile is done, propagation reads the database
+        _journal->discardFileRecordSnapshot();
+
+        // write the metadata updates queued during discovery and do a database commit
+        const auto queuedRecordsResult = _journal->flushQueuedFileRecords();
+        if (!queuedRecordsResult) {
+            qCWarning(lcEngine) << "Could not write file records queued during discovery:" << queuedRecordsResult.error();
+        }
         _journal->commit(QStringLiteral("post treewalk"));
 
-        _propagator = QSharedPointer<OwncloudPropagator>(
-            new OwncloudPropagator(_account, _localPath, _remotePath, _journal, _bulkUploadBlackList));
-        _propagator->setSyncOptions(_syncOptions);
-        connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
-            this, &SyncEngine::slotItemCompleted);
-        connect(_propagator.data(), &OwncloudPropagator::progress,
-            this, &SyncEngine::slotProgress);
-        connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotPropagationFinished, Qt::QueuedConnection);
-        connect(_propagator.data(), &OwncloudPropagator::seenLockedFile, this, &SyncEngine::seenLockedFile);
-        connect(_propagator.data(), &OwncloudPropagator::touchedFile, this, &SyncEngine::slotAddTouchedFile);
-        connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
-        connect(_propagator.data(), &OwncloudPropagator::insufficientRemoteStorage, this, &SyncEngine::slotInsufficientRemoteStorage);
-        connect(_propagator.data(), &OwncloudPropagator::newItem, this, &SyncEngine::slotNewItem);
-
-        // apply the network limits to the propagator
-        setNetworkLimits(_uploadLimit, _downloadLimit);
+        const bool propagationStarted = !_propagator.isNull();
+        if (!propagationStarted)
+            createPropagator();
 
         deleteStaleDownloadInfos(_syncItems);
         deleteStaleUploadInfos(_syncItems);
         deleteStaleErrorBlacklistEntries(_syncItems);
         _journal->commit(QStringLiteral("post stale entry removal"));
 
-        // Emit the started signal only after the propagator has been set up.
-        if (_needsUpdate)
-            Q_EMIT started();
+        if (propagationStarted) {
+            _syncItems.clear();
+            _propagator->start(std::move(remainingItems));
+        } else {
+            // Emit the started signal only after the propagator has been set up.
+            if (_needsUpdate)
+                Q_EMIT started();
 
-        _propagator->start(std::move(_syncItems));
+            _propagator->start(std::move(_syncItems));
+        }
 
         qCInfo(lcEngine) << "#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QStringLiteral("Post-Reconcile Finished")) << "ms";
     };
@@ -766,6 +899,11 @@ void SyncEngine::slotDiscoveryFinished()
             guard->deleteLater();
             if (cancel) {
                 qCInfo(lcEngine) << "User aborted sync";
+                if (_propagator) {
+                    // Already propagating subtrees, finalizes once aborted
+                    _propagator->abort();
+                    return;
+                }
                 finalize(false);
                 return;
             } else {
@@ -818,9 +956,18 @@ void SyncEngine::slotPropagationFinished(bool success)
         _journal->setDataFingerprint(_discoveryPhase->_dataFingerprint);
     }
 
+    // The propagator queued the file records of the items it finished
+    const auto queuedRecordsResult = _journal->flushQueuedFileRecords();
+    if (!queuedRecordsResult) {
+        qCWarning(lcEngine) << "Could not write file records queued during propagation:" << queuedRecordsResult.error();
+        Q_EMIT syncError(tr("Error writing metadata to the database"));
+        success = false;
+    }
+
     conflictRecordMaintenance();
 
     _journal->deleteStaleFlagsEntries();
+    _journal->deleteStaleChunkIndexes();
     _journal->commit("All Finished.", false);
 
     // Send final progress information even if no
@@ -839,9 +986,11 @@ void SyncEngine::finalize(bool success)
     _stopWatch.stop();
 
     if (_discoveryPhase) {
+        // Propagation may finish while discovery still runs, see SyncOptions::_streamPropagation
+        disconnect(_discoveryPhase.data(), nullptr, this, nullptr);
         _discoveryPhase.take()->deleteLater();
     }
-    s_anySyncRunning = false;
+    _journal->discardFileRecordSnapshot();
     _syncRunning = false;
     emit finished(success);
 
@@ -1056,7 +1205,8 @@ void SyncEngine::abort()
         qCInfo(lcEngine) << "Aborting sync";
 
     if (_propagator) {
-        // If we're already in the propagation phase, aborting that is sufficient
+        // If we're already in the propagation phase, aborting that is sufficient.
+        // A discovery that is still running is stopped once that finalizes.
         _propagator->abort();
     } else if (_discoveryPhase) {
         // Delete the discovery and all child jobs after ensuring
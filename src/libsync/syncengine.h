@@ -147,6 +147,10 @@ signals:
     // after the above signals. with the items that actually need propagating
     void aboutToPropagate(SyncFileItemVector &);
 
+    // after aboutToPropagate() when SyncOptions::_streamPropagation handed over a
+    // subtree before discovery finished, with the items of later subtrees and the rest
+    void aboutToPropagateMore(SyncFileItemVector &);
+
     // after each item completed by a job (successful or not)
     void itemCompleted(const SyncFileItemPtr &);
 
@@ -193,6 +197,9 @@ private slots:
 
     void slotItemCompleted(const SyncFileItemPtr &item);
     void slotDiscoveryFinished();
+
+    /** Propagates a discovered subtree right away, see SyncOptions::_streamPropagation */
+    void slotSubtreeDiscovered(const QString &path);
     void slotPropagationFinished(bool success);
     void slotProgress(const SyncFileItem &item, qint64 curent);
     void slotCleanPollsJobAborted(const QString &error);
@@ -228,11 +235,25 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
+    // creates _propagator and connects to it
+    void createPropagator();
+
+    // true if the server data fingerprint doesn't match the one of the last sync
+    bool dataFingerprintChanged() const;
+
+    // Marks the path and its parent directories as not to be propagated before discovery finished
+    void markUnstreamable(const QString &path);
 
     // Must only be acessed during update and reconcile
+    // Appended in discovery order, sorted once discovery finished
     QVector<SyncFileItemPtr> _syncItems;
 
+    // With SyncOptions::_streamPropagation: the _syncItems indexes by file of
+    // the items not handed to the propagator yet
+    QMultiMap<QString, int> _unstreamedItems;
+    // ...and the directories that must wait for the end of the discovery
+    QSet<QString> _unstreamableDirectories;
+
     AccountPtr _account;
     bool _needsUpdate;
     bool _syncRunning;
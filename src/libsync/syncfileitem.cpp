@@ -43,15 +43,15 @@ SyncJournalFileRecord SyncFileItem::toSyncJournalFileRecordWithInode(const QStri
     rec._remotePerm = _remotePerm;
     rec._serverHasIgnoredFiles = _serverHasIgnoredFiles;
     rec._checksumHeader = _checksumHeader;
-    rec._e2eMangledName = _encryptedFileName.toUtf8();
+    rec._e2eMangledName = extra()._encryptedFileName.toUtf8();
     rec._isE2eEncrypted = _isEncrypted;
     rec._lockstate._locked = _locked == LockStatus::LockedItem;
-    rec._lockstate._lockOwnerDisplayName = _lockOwnerDisplayName;
-    rec._lockstate._lockOwnerId = _lockOwnerId;
-    rec._lockstate._lockOwnerType = static_cast<qint64>(_lockOwnerType);
-    rec._lockstate._lockEditorApp = _lockEditorApp;
-    rec._lockstate._lockTime = _lockTime;
-    rec._lockstate._lockTimeout = _lockTimeout;
+    rec._lockstate._lockOwnerDisplayName = extra()._lockOwnerDisplayName;
+    rec._lockstate._lockOwnerId = extra()._lockOwnerId;
+    rec._lockstate._lockOwnerType = static_cast<qint64>(extra()._lockOwnerType);
+    rec._lockstate._lockEditorApp = extra()._lockEditorApp;
+    rec._lockstate._lockTime = extra()._lockTime;
+    rec._lockstate._lockTimeout = extra()._lockTimeout;
 
     // Update the inode if possible
     rec._inode = _inode;
@@ -80,16 +80,36 @@ SyncFileItemPtr SyncFileItem::fromSyncJournalFileRecord(const SyncJournalFileRec
     item->_remotePerm = rec._remotePerm;
     item->_serverHasIgnoredFiles = rec._serverHasIgnoredFiles;
     item->_checksumHeader = rec._checksumHeader;
-    item->_encryptedFileName = rec.e2eMangledName();
+    if (!rec._e2eMangledName.isEmpty())
+        item->mutableExtra()._encryptedFileName = rec.e2eMangledName();
     item->_isEncrypted = rec._isE2eEncrypted;
     item->_locked = rec._lockstate._locked ? LockStatus::LockedItem : LockStatus::UnlockedItem;
-    item->_lockOwnerDisplayName = rec._lockstate._lockOwnerDisplayName;
-    item->_lockOwnerId = rec._lockstate._lockOwnerId;
-    item->_lockOwnerType = static_cast<LockOwnerType>(rec._lockstate._lockOwnerType);
-    item->_lockEditorApp = rec._lockstate._lockEditorApp;
-    item->_lockTime = rec._lockstate._lockTime;
-    item->_lockTimeout = rec._lockstate._lockTimeout;
+    if (rec._lockstate._locked) {
+        auto &extra = item->mutableExtra();
+        extra._lockOwnerDisplayName = rec._lockstate._lockOwnerDisplayName;
+        extra._lockOwnerId = rec._lockstate._lockOwnerId;
+        extra._lockOwnerType = static_cast<LockOwnerType>(rec._lockstate._lockOwnerType);
+        extra._lockEditorApp = rec._lockstate._lockEditorApp;
+        extra._lockTime = rec._lockstate._lockTime;
+        extra._lockTimeout = rec._lockstate._lockTimeout;
+    }
     return item;
 }
 
+const SyncFileItem::Extra &SyncFileItem::extra() const
+{
+    static const Extra empty;
+    if (const auto extra = _extra.constData())
+        return *extra;
+    return empty;
+}
+
+SyncFileItem::Extra &SyncFileItem::mutableExtra()
+{
+    if (!_extra)
+        _extra = new Extra;
+    // Detaches from copies of this item
+    return *_extra;
+}
+
 }
@@ -19,6 +19,7 @@
 #include <QString>
 #include <QDateTime>
 #include <QMetaType>
+#include <QSharedData>
 #include <QSharedPointer>
 
 #include <csync.h>
@@ -131,6 +132,34 @@ public:
     {
     }
 
+    /** The fields only few items need
+     *
+     * Only files with a direct download url, a lock or end to end encryption
+     * carry them, a sync of many files would spend most of the memory of its
+     * items on empty strings otherwise.
+     */
+    struct Extra : public QSharedData
+    {
+        QString _directDownloadUrl;
+        QString _directDownloadCookies;
+
+        /// If the file is end to end encrypted, the encrypted name on the server
+        QString _encryptedFileName;
+
+        QString _lockOwnerId;
+        QString _lockOwnerDisplayName;
+        QString _lockEditorApp;
+        LockOwnerType _lockOwnerType = LockOwnerType::UserLock;
+        qint64 _lockTime = 0;
+        qint64 _lockTimeout = 0;
+    };
+
+    /// The extra fields, default ones if none were set
+    const Extra &extra() const;
+    /// For setting extra fields, allocates them on first use
+    Extra &mutableExtra();
+    void clearExtra() { _extra = nullptr; }
+
     friend bool operator==(const SyncFileItem &item1, const SyncFileItem &item2)
     {
         return item1._originalFile == item2._originalFile;
@@ -237,11 +266,6 @@ public:
      */
     QString _originalFile;
 
-    /// Whether there's end to end encryption on this file.
-    /// If the file is encrypted, the _encryptedFilename is
-    /// the encrypted name on the server.
-    QString _encryptedFileName;
-
     ItemType _type BITFIELD(3);
     Direction _direction BITFIELD(3);
     bool _serverHasIgnoredFiles BITFIELD(1);
@@ -291,16 +315,10 @@ public:
     qint64 _previousSize = 0;
     time_t _previousModtime = 0;
 
-    QString _directDownloadUrl;
-    QString _directDownloadCookies;
-
     LockStatus _locked = LockStatus::UnlockedItem;
-    QString _lockOwnerId;
-    QString _lockOwnerDisplayName;
-    LockOwnerType _lockOwnerType = LockOwnerType::UserLock;
-    QString _lockEditorApp;
-    qint64 _lockTime = 0;
-    qint64 _lockTimeout = 0;
+
+private:
+    QSharedDataPointer<Extra> _extra;
 };
 
 inline bool operator<(const SyncFileItemPtr &item1, const SyncFileItemPtr &item2)
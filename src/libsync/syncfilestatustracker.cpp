@@ -49,6 +49,18 @@ static bool pathStartsWith( const QString& lhs, const QString& rhs )
         );
 }
 
+// Splits a path into its directory and its name, "" being the root's own name
+static std::pair<QString, QString> splitPath(const QString &relativePath)
+{
+    const int lastSlashIndex = relativePath.lastIndexOf(QLatin1Char('/'));
+    if (lastSlashIndex == -1)
+        return { QString(), relativePath };
+    return { relativePath.left(lastSlashIndex), relativePath.mid(lastSlashIndex + 1) };
+}
+
+// The statuses are stored in the journal as the tag, with the shared flag above it
+static const int sharedStatusFlag = 0x100;
+
 bool SyncFileStatusTracker::PathComparator::operator()( const QString& lhs, const QString& rhs ) const
 {
     // This will make sure that the std::map is ordered and queried case-insensitively on macOS and Windows.
@@ -115,6 +127,8 @@ SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
 {
     connect(syncEngine, &SyncEngine::aboutToPropagate,
         this, &SyncFileStatusTracker::slotAboutToPropagate);
+    connect(syncEngine, &SyncEngine::aboutToPropagateMore,
+        this, &SyncFileStatusTracker::slotAboutToPropagateMore);
     connect(syncEngine, &SyncEngine::itemCompleted,
         this, &SyncFileStatusTracker::slotItemCompleted);
     connect(syncEngine, &SyncEngine::finished, this, &SyncFileStatusTracker::slotSyncFinished);
@@ -123,12 +137,22 @@ SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
 }
 
 SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
+{
+    return fileStatus(relativePath, UseCache);
+}
+
+SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath, CacheFlag cacheFlag)
 {
     ASSERT(!relativePath.endsWith(QLatin1Char('/')));
 
+    SyncFileStatus status;
     if (relativePath.isEmpty()) {
+        if (cacheFlag == UseCache && cachedStatus(relativePath, &status))
+            return status;
         // This is the root sync folder, it doesn't have an entry in the database and won't be walked by csync, so resolve manually.
-        return resolveSyncAndErrorStatus(QString(), NotShared);
+        status = resolveSyncAndErrorStatus(QString(), NotShared);
+        cacheStatus(relativePath, status, cacheFlag == RefreshCache);
+        return status;
     }
 
     // The SyncEngine won't notify us at all for CSYNC_FILE_SILENTLY_EXCLUDED
@@ -148,14 +172,27 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
     if (_dirtyPaths.contains(relativePath))
         return SyncFileStatus::StatusSync;
 
+    // Everything else changes through fileStatusChanged, which updates the cache
+    if (cacheFlag == UseCache && cachedStatus(relativePath, &status))
+        return status;
+
     // First look it up in the database to know if it's shared
     SyncJournalFileRecord rec;
     if (_syncEngine->journal()->getFileRecord(relativePath, &rec) && rec.isValid()) {
-        return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
+        status = resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
+    } else {
+        // Must be a new file not yet in the database, check if it's syncing or has an error.
+        status = resolveSyncAndErrorStatus(relativePath, NotShared, PathUnknown);
     }
+    cacheStatus(relativePath, status, cacheFlag == RefreshCache);
+    return status;
+}
 
-    // Must be a new file not yet in the database, check if it's syncing or has an error.
-    return resolveSyncAndErrorStatus(relativePath, NotShared, PathUnknown);
+SyncFileStatus SyncFileStatusTracker::resolveAndCacheStatus(const QString &relativePath, SharedFlag sharedFlag)
+{
+    const auto status = resolveSyncAndErrorStatus(relativePath, sharedFlag);
+    cacheStatus(relativePath, status, true);
+    return status;
 }
 
 void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
@@ -172,7 +209,7 @@ void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
 void SyncFileStatusTracker::slotAddSilentlyExcluded(const QString &folderPath)
 {
     _syncProblems[folderPath] = SyncFileStatus::StatusExcluded;
-    emit fileStatusChanged(getSystemDestination(folderPath), resolveSyncAndErrorStatus(folderPath, NotShared));
+    emit fileStatusChanged(getSystemDestination(folderPath), resolveAndCacheStatus(folderPath, NotShared));
 }
 
 void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
@@ -181,8 +218,8 @@ void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &rela
     int count = _syncCount[relativePath]++;
     if (!count) {
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
+            ? fileStatus(relativePath, RefreshCache)
+            : resolveAndCacheStatus(relativePath, sharedFlag);
         emit fileStatusChanged(getSystemDestination(relativePath), status);
 
         // We passed from OK to SYNC, increment the parent to keep it marked as
@@ -204,8 +241,8 @@ void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &rela
         _syncCount.remove(relativePath);
 
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
-            : resolveSyncAndErrorStatus(relativePath, sharedFlag);
+            ? fileStatus(relativePath, RefreshCache)
+            : resolveAndCacheStatus(relativePath, sharedFlag);
         emit fileStatusChanged(getSystemDestination(relativePath), status);
 
         // We passed from SYNC to OK, decrement our parent.
@@ -222,9 +259,44 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
 {
     ASSERT(_syncCount.isEmpty());
 
+    // The problems of the last sync before a restart come from the cache
+    loadStatusCache();
+
     ProblemsMap oldProblems;
     std::swap(_syncProblems, oldProblems);
 
+    announceItems(items);
+
+    // Some metadata status won't trigger files to be synced, make sure that we
+    // push the OK status for dirty files that don't need to be propagated.
+    // Swap into a copy since fileStatus() reads _dirtyPaths to determine the status
+    QSet<QString> oldDirtyPaths;
+    std::swap(_dirtyPaths, oldDirtyPaths);
+    for (const auto &oldDirtyPath : qAsConst(oldDirtyPaths))
+        emit fileStatusChanged(getSystemDestination(oldDirtyPath), fileStatus(oldDirtyPath, RefreshCache));
+
+    // Make sure to push any status that might have been resolved indirectly since the last sync
+    // (like an error file being deleted from disk)
+    for (const auto &syncProblem : _syncProblems)
+        oldProblems.erase(syncProblem.first);
+    for (const auto &oldProblem : oldProblems) {
+        const QString &path = oldProblem.first;
+        SyncFileStatus::SyncFileStatusTag severity = oldProblem.second;
+        if (severity == SyncFileStatus::StatusError)
+            invalidateParentPaths(path);
+        emit fileStatusChanged(getSystemDestination(path), fileStatus(path, RefreshCache));
+    }
+}
+
+void SyncFileStatusTracker::slotAboutToPropagateMore(SyncFileItemVector &items)
+{
+    // Items of a sync that started propagating before its discovery finished.
+    // Problems of the last sync that weren't discovered yet are gone until then.
+    announceItems(items);
+}
+
+void SyncFileStatusTracker::announceItems(const SyncFileItemVector &items)
+{
     foreach (const SyncFileItemPtr &item, items) {
         qCDebug(lcStatusTracker) << "Investigating" << item->destination() << item->_status << item->_instruction;
         _dirtyPaths.remove(item->destination());
@@ -244,29 +316,9 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
             // Mark this path as syncing for instructions that will result in propagation.
             incSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
         } else {
-            emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+            emit fileStatusChanged(getSystemDestination(item->destination()), resolveAndCacheStatus(item->destination(), sharedFlag));
         }
     }
-
-    // Some metadata status won't trigger files to be synced, make sure that we
-    // push the OK status for dirty files that don't need to be propagated.
-    // Swap into a copy since fileStatus() reads _dirtyPaths to determine the status
-    QSet<QString> oldDirtyPaths;
-    std::swap(_dirtyPaths, oldDirtyPaths);
-    for (const auto &oldDirtyPath : qAsConst(oldDirtyPaths))
-        emit fileStatusChanged(getSystemDestination(oldDirtyPath), fileStatus(oldDirtyPath));
-
-    // Make sure to push any status that might have been resolved indirectly since the last sync
-    // (like an error file being deleted from disk)
-    for (const auto &syncProblem : _syncProblems)
-        oldProblems.erase(syncProblem.first);
-    for (const auto &oldProblem : oldProblems) {
-        const QString &path = oldProblem.first;
-        SyncFileStatus::SyncFileStatusTag severity = oldProblem.second;
-        if (severity == SyncFileStatus::StatusError)
-            invalidateParentPaths(path);
-        emit fileStatusChanged(getSystemDestination(path), fileStatus(path));
-    }
 }
 
 void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
@@ -279,7 +331,14 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
     } else if (hasExcludedStatus(*item)) {
         _syncProblems[item->destination()] = SyncFileStatus::StatusExcluded;
     } else {
-        _syncProblems.erase(item->destination());
+        const auto problem = _syncProblems.find(item->destination());
+        if (problem != _syncProblems.end()) {
+            const bool wasError = problem->second == SyncFileStatus::StatusError;
+            _syncProblems.erase(problem);
+            // The parents might not show a warning anymore, and have it cached
+            if (wasError)
+                invalidateParentPaths(item->destination());
+        }
     }
 
     SharedFlag sharedFlag = item->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared;
@@ -290,7 +349,14 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
         // decSyncCount calls *must* be symetric with incSyncCount calls in slotAboutToPropagate
         decSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
     } else {
-        emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+        emit fileStatusChanged(getSystemDestination(item->destination()), resolveAndCacheStatus(item->destination(), sharedFlag));
+    }
+
+    // Forget what is gone from the disk, along with its contents
+    if (item->_instruction == CSYNC_INSTRUCTION_REMOVE && !hasErrorStatus(*item)) {
+        removeCachedStatuses(item->destination());
+    } else if (item->_instruction == CSYNC_INSTRUCTION_RENAME && !hasErrorStatus(*item) && item->_file != item->destination()) {
+        removeCachedStatuses(item->_file);
     }
 }
 
@@ -305,17 +371,23 @@ void SyncFileStatusTracker::slotSyncFinished()
             continue;
         }
 
-        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key()));
+        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key(), RefreshCache));
     }
 }
 
 void SyncFileStatusTracker::slotSyncEngineRunningChanged()
 {
-    emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(QString(), NotShared));
+    emit fileStatusChanged(getSystemDestination(QString()), resolveAndCacheStatus(QString(), NotShared));
+
+    // Everything of the sync that finished is in, including the root
+    if (!_syncEngine->isSyncRunning())
+        saveStatusCache();
 }
 
 SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
 {
+    loadStatusCache();
+
     // If it's a new file and that we're not syncing it yet,
     // don't show any icon and wait for the filesystem watcher to trigger a sync.
     SyncFileStatus status(isPathKnown ? SyncFileStatus::StatusUpToDate : SyncFileStatus::StatusNone);
@@ -342,8 +414,120 @@ void SyncFileStatusTracker::invalidateParentPaths(const QString &path)
     QStringList splitPath = path.split('/', Qt::SkipEmptyParts);
     for (int i = 0; i < splitPath.size(); ++i) {
         QString parentPath = QStringList(splitPath.mid(0, i)).join(QLatin1String("/"));
-        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath));
+        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath, RefreshCache));
+    }
+}
+
+bool SyncFileStatusTracker::cachedStatus(const QString &relativePath, SyncFileStatus *status)
+{
+    loadStatusCache();
+    const auto path = splitPath(relativePath);
+    const auto directory = _statusCache.constFind(path.first);
+    if (directory == _statusCache.constEnd())
+        return false;
+    const auto entry = directory->constFind(path.second);
+    if (entry == directory->constEnd())
+        return false;
+    *status = *entry;
+    return true;
+}
+
+void SyncFileStatusTracker::cacheStatus(const QString &relativePath, SyncFileStatus status, bool changed)
+{
+    loadStatusCache();
+    const auto path = splitPath(relativePath);
+    auto &entries = _statusCache[path.first];
+    auto entry = entries.find(path.second);
+    if (entry == entries.end()) {
+        entries.insert(path.second, status);
+    } else if (*entry != status) {
+        *entry = status;
+    } else {
+        return;
+    }
+    // Statuses resolved from the journal for a request will be the same after a restart
+    if (changed)
+        _unsavedStatuses.insert(relativePath);
+}
+
+void SyncFileStatusTracker::removeCachedStatuses(const QString &relativePath)
+{
+    ASSERT(!relativePath.isEmpty());
+    loadStatusCache();
+    const auto path = splitPath(relativePath);
+    auto directory = _statusCache.find(path.first);
+    if (directory != _statusCache.end()) {
+        directory->remove(path.second);
+        if (directory->isEmpty())
+            _statusCache.erase(directory);
+    }
+
+    QStringList directories = { relativePath };
+    while (!directories.isEmpty()) {
+        const auto directoryPath = directories.takeLast();
+        const auto entries = _statusCache.take(directoryPath);
+        for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+            const auto childPath = directoryPath + QLatin1Char('/') + it.key();
+            if (_statusCache.contains(childPath))
+                directories.append(childPath);
+        }
+    }
+    _removedStatusPaths.append(relativePath);
+}
+
+void SyncFileStatusTracker::loadStatusCache()
+{
+    if (_statusCacheLoaded)
+        return;
+    _statusCacheLoaded = true;
+
+    int count = 0;
+    _syncEngine->journal()->getFileStatusCache([this, &count](const QString &relativePath, int value) {
+        const auto tag = value & ~sharedStatusFlag;
+        if (tag <= SyncFileStatus::StatusSync || tag > SyncFileStatus::StatusExcluded)
+            return;
+        SyncFileStatus status(static_cast<SyncFileStatus::SyncFileStatusTag>(tag));
+        status.setShared(value & sharedStatusFlag);
+
+        const auto path = splitPath(relativePath);
+        auto &entries = _statusCache[path.first];
+        if (entries.contains(path.second))
+            return;
+        entries.insert(path.second, status);
+        ++count;
+
+        // So that the next sync notices when they are resolved, as after any other sync
+        if (tag == SyncFileStatus::StatusError || tag == SyncFileStatus::StatusExcluded)
+            _syncProblems.emplace(relativePath, status.tag());
+    });
+    qCInfo(lcStatusTracker) << "Loaded" << count << "cached file statuses";
+}
+
+void SyncFileStatusTracker::saveStatusCache()
+{
+    if (_unsavedStatuses.isEmpty() && _removedStatusPaths.isEmpty())
+        return;
+
+    QHash<QString, int> statuses;
+    statuses.reserve(_unsavedStatuses.size());
+    for (const auto &relativePath : qAsConst(_unsavedStatuses)) {
+        SyncFileStatus status;
+        int value = 0;
+        if (cachedStatus(relativePath, &status)) {
+            // Statuses of up to date files are resolved from the journal quickly
+            // enough, only those of the directories and the problems are kept.
+            const auto tag = status.tag();
+            const bool isDirectory = _statusCache.contains(relativePath);
+            if (tag == SyncFileStatus::StatusWarning || tag == SyncFileStatus::StatusError || tag == SyncFileStatus::StatusExcluded
+                || (tag == SyncFileStatus::StatusUpToDate && isDirectory)) {
+                value = tag | (status.shared() ? sharedStatusFlag : 0);
+            }
+        }
+        statuses.insert(relativePath, value);
     }
+    _syncEngine->journal()->updateFileStatusCache(_removedStatusPaths, statuses);
+    _unsavedStatuses.clear();
+    _removedStatusPaths.clear();
 }
 
 QString SyncFileStatusTracker::getSystemDestination(const QString &relativePath)
@@ -29,6 +29,13 @@ class SyncEngine;
 /**
  * @brief Takes care of tracking the status of individual files as they
  *        go through the SyncEngine, to be reported as overlay icons in the shell.
+ *
+ * The resolved statuses are cached, every change of one goes through
+ * fileStatusChanged() and updates the cache, so that the shell's status
+ * requests are answered without any journal lookup. The statuses of the
+ * directories and the problems of the last sync are kept in the journal
+ * across restarts.
+ *
  * @ingroup libsync
  */
 class OWNCLOUDSYNC_EXPORT SyncFileStatusTracker : public QObject
@@ -48,6 +55,7 @@ signals:
 
 private slots:
     void slotAboutToPropagate(SyncFileItemVector &items);
+    void slotAboutToPropagateMore(SyncFileItemVector &items);
     void slotItemCompleted(const SyncFileItemPtr &item);
     void slotSyncFinished();
     void slotSyncEngineRunningChanged();
@@ -66,7 +74,20 @@ private:
         PathKnown };
     SyncFileStatus resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
 
+    enum CacheFlag { UseCache,
+        RefreshCache };
+    SyncFileStatus fileStatus(const QString &relativePath, CacheFlag cacheFlag);
+    SyncFileStatus resolveAndCacheStatus(const QString &relativePath, SharedFlag sharedState);
+
+    bool cachedStatus(const QString &relativePath, SyncFileStatus *status);
+    void cacheStatus(const QString &relativePath, SyncFileStatus status, bool changed);
+    void removeCachedStatuses(const QString &relativePath);
+    void loadStatusCache();
+    void saveStatusCache();
+
     void invalidateParentPaths(const QString &path);
+    // Marks the items that will be propagated as syncing, their errors as problems
+    void announceItems(const SyncFileItemVector &items);
     QString getSystemDestination(const QString &relativePath);
     void incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
     void decSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedState);
@@ -79,6 +100,13 @@ private:
     // We'll show a file/directory as SYNC as long as its sync count is > 0.
     // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
     QHash<QString, int> _syncCount;
+
+    // The resolved statuses, by directory then file name
+    QHash<QString, QHash<QString, SyncFileStatus>> _statusCache;
+    bool _statusCacheLoaded = false;
+    // Changed since the cache was last saved to the journal
+    QSet<QString> _unsavedStatuses;
+    QStringList _removedStatusPaths;
 };
 }
 
@@ -47,6 +47,34 @@ void SyncOptions::fillFromEnvironmentVariables()
     int maxParallel = qgetenv("OWNCLOUD_MAX_PARALLEL").toInt();
     if (maxParallel > 0)
         _parallelNetworkJobs = maxParallel;
+
+    int maxParallelChunks = qgetenv("OWNCLOUD_MAX_PARALLEL_CHUNKS").toInt();
+    if (maxParallelChunks > 0)
+        _maxParallelChunkUploads = maxParallelChunks;
+
+    QByteArray downloadSegmentsEnv = qgetenv("OWNCLOUD_DOWNLOAD_SEGMENTS");
+    if (!downloadSegmentsEnv.isEmpty())
+        _parallelDownloadSegments = downloadSegmentsEnv.toInt();
+
+    QByteArray minSegmentedDownloadSizeEnv = qgetenv("OWNCLOUD_MIN_SEGMENTED_DOWNLOAD_SIZE");
+    if (!minSegmentedDownloadSizeEnv.isEmpty())
+        _minSegmentedDownloadSize = minSegmentedDownloadSizeEnv.toLongLong();
+
+    int localDiscoveryThreads = qgetenv("OWNCLOUD_LOCAL_DISCOVERY_THREADS").toInt();
+    if (localDiscoveryThreads > 0)
+        _parallelLocalDiscoveryJobs = localDiscoveryThreads;
+
+    QByteArray journalSnapshotEnv = qgetenv("OWNCLOUD_JOURNAL_SNAPSHOT");
+    if (!journalSnapshotEnv.isEmpty())
+        _useJournalSnapshot = journalSnapshotEnv != "0";
+
+    QByteArray streamPropagationEnv = qgetenv("OWNCLOUD_STREAM_PROPAGATION");
+    if (!streamPropagationEnv.isEmpty())
+        _streamPropagation = streamPropagationEnv != "0";
+
+    QByteArray deltaUploadEnv = qgetenv("OWNCLOUD_EXPERIMENTAL_DELTA_UPLOAD");
+    if (!deltaUploadEnv.isEmpty())
+        _experimentalDeltaUpload = deltaUploadEnv != "0";
 }
 
 void SyncOptions::verifyChunkSizes()
@@ -16,6 +16,7 @@
 
 #include "owncloudlib.h"
 #include "common/vfs.h"
+#include "syncresourcebudget.h"
 
 #include <QRegularExpression>
 #include <QSharedPointer>
@@ -72,10 +73,62 @@ public:
     /** The maximum number of active jobs in parallel  */
     int _parallelNetworkJobs = 6;
 
+    /** The maximum number of chunks of one file that are uploaded in parallel.
+     *
+     * The propagator's transfer window limits this further. 1 disables parallel
+     * chunk uploads.
+     */
+    int _maxParallelChunkUploads = 4;
+
+    /** Large downloads are split into this many byte ranges fetched in parallel.
+     *
+     * 0 or 1 disables segmented downloads.
+     */
+    int _parallelDownloadSegments = 4;
+
+    /** Files smaller than this (in Bytes) are always downloaded in one piece */
+    qint64 _minSegmentedDownloadSize = 100 * 1000 * 1000; // 100MB
+
+    /** The number of threads listing local directories during discovery.
+     *
+     * 0 means one per core.
+     */
+    int _parallelLocalDiscoveryJobs = 0;
+
+    /** Whether discovery reads the journal from an in-memory snapshot.
+     *
+     * Faster for large folders that barely change, costs memory for every file.
+     */
+    bool _useJournalSnapshot = false;
+
+    /** Whether propagation starts while discovery still runs.
+     *
+     * Subtrees that are completely discovered and don't depend on anything
+     * outside of them are propagated right away. Removals, renames and type
+     * changes still wait for the end of the discovery.
+     */
+    bool _streamPropagation = false;
+
+    /** Experimental: whether chunked uploads only send the data that changed.
+     *
+     * Unchanged ranges are referenced in the version that is replaced. That
+     * needs the dav/chunkingDelta extension of chunking v2, which no released
+     * server implements. Has no effect without it.
+     */
+    bool _experimentalDeltaUpload = false;
+
+    /** This sync's part of the resources shared with other running syncs.
+     *
+     * If set, it further limits _parallelNetworkJobs and _parallelLocalDiscoveryJobs.
+     */
+    QSharedPointer<SyncResourceBudget::Share> _resourceShare;
+
     /** Reads settings from env vars where available.
      *
      * Currently reads _initialChunkSize, _minChunkSize, _maxChunkSize,
-     * _targetChunkUploadDuration, _parallelNetworkJobs.
+     * _targetChunkUploadDuration, _parallelNetworkJobs, _maxParallelChunkUploads, _parallelDownloadSegments,
+     * _minSegmentedDownloadSize, _parallelLocalDiscoveryJobs, _useJournalSnapshot,
+     * _streamPropagation, _experimentalDeltaUpload.
      */
     void fillFromEnvironmentVariables();
 
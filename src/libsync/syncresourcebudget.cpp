@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncresourcebudget.h"
+
+#include <QLoggingCategory>
+#include <QThread>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcSyncResourceBudget, "nextcloud.sync.resourcebudget", QtInfoMsg)
+
+int SyncResourceBudget::Share::networkJobs(int wanted) const
+{
+    if (!_budget)
+        return wanted;
+    const auto total = _budget->_networkJobs > 0 ? _budget->_networkJobs : wanted;
+    return qBound(1, _budget->portion(this, total), qMax(1, wanted));
+}
+
+int SyncResourceBudget::Share::localDiscoveryThreads(int wanted) const
+{
+    if (!_budget)
+        return wanted;
+    return qBound(1, _budget->portion(this, _budget->_localDiscoveryThreads), qMax(1, wanted));
+}
+
+SyncResourceBudget::SyncResourceBudget(int networkJobs, int localDiscoveryThreads)
+    : _networkJobs(qMax(0, networkJobs))
+    , _localDiscoveryThreads(localDiscoveryThreads > 0 ? localDiscoveryThreads : qMax(1, QThread::idealThreadCount()))
+{
+}
+
+SyncResourceBudget::~SyncResourceBudget()
+{
+    for (const auto &share : qAsConst(_shares))
+        share->_budget = nullptr;
+}
+
+QSharedPointer<SyncResourceBudget::Share> SyncResourceBudget::acquire(bool priority)
+{
+    auto share = QSharedPointer<Share>::create();
+    share->_budget = this;
+    share->_priority = priority;
+    _shares.append(share);
+    qCInfo(lcSyncResourceBudget) << "Sync started, running syncs:" << _shares.size()
+                                 << "priority:" << priority;
+    return share;
+}
+
+void SyncResourceBudget::release(const QSharedPointer<Share> &share)
+{
+    if (!share || share->_budget != this)
+        return;
+    share->_budget = nullptr;
+    _shares.removeAll(share);
+}
+
+int SyncResourceBudget::portion(const Share *share, int total) const
+{
+    const auto weight = [](const Share *s) { return s->_priority ? 2 : 1; };
+    int totalWeight = 0;
+    for (const auto &s : _shares)
+        totalWeight += weight(s.data());
+    if (totalWeight == 0)
+        return total;
+    return total * weight(share) / totalWeight;
+}
+
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QSharedPointer>
+#include <QVector>
+
+namespace OCC {
+
+/**
+ * @brief Splits the parallel network jobs and local discovery threads across
+ * the syncs that run at the same time
+ *
+ * Every running sync holds a Share. The budget is divided in proportion to the
+ * weight of the shares, a priority share weighs twice as much as a normal one.
+ * Every sync gets at least one job and one thread, and never more than it
+ * would use on its own.
+ *
+ * Without a fixed number of network jobs, the syncs running at the same time
+ * split what each of them would use alone, so they don't put more load on
+ * the server than a single sync.
+ *
+ * The shares are recomputed whenever a sync starts or finishes, the engines
+ * pick the new values up when they schedule their next job.
+ *
+ * Only to be used from the main thread.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT SyncResourceBudget
+{
+public:
+    class OWNCLOUDSYNC_EXPORT Share
+    {
+    public:
+        /** The number of parallel network jobs this sync may run.
+         *
+         * wanted is what the sync would use without other syncs running.
+         */
+        int networkJobs(int wanted) const;
+
+        /// Same as above for the threads listing local directories
+        int localDiscoveryThreads(int wanted) const;
+
+        bool hasPriority() const { return _priority; }
+
+    private:
+        friend class SyncResourceBudget;
+
+        SyncResourceBudget *_budget = nullptr; // null once released
+        bool _priority = false;
+    };
+
+    /** 0 networkJobs splits what every sync wants, 0 localDiscoveryThreads means one per core */
+    explicit SyncResourceBudget(int networkJobs = 0, int localDiscoveryThreads = 0);
+    ~SyncResourceBudget();
+
+    /// 0 if the syncs split what they want
+    int networkJobs() const { return _networkJobs; }
+    int localDiscoveryThreads() const { return _localDiscoveryThreads; }
+
+    /// Returns the share of a sync that is about to start
+    QSharedPointer<Share> acquire(bool priority = false);
+
+    /** To be called when the sync finished.
+     *
+     * The share is unlimited afterwards, in case an engine still holds it.
+     */
+    void release(const QSharedPointer<Share> &share);
+
+    int activeShares() const { return _shares.size(); }
+
+private:
+    int portion(const Share *share, int total) const;
+
+    int _networkJobs;
+    int _localDiscoveryThreads;
+    QVector<QSharedPointer<Share>> _shares;
+};
+
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "transferconcurrencycontroller.h"
+
+#include <QLoggingCategory>
+#include <QtMath>
+
+#include <algorithm>
+
+using namespace std::chrono;
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTransferConcurrency, "nextcloud.sync.propagator.concurrency", QtInfoMsg)
+
+namespace {
+    // Requests up to this size are used to measure the round trip time
+    const qint64 smallRequestSize = 64 * 1024;
+
+    const qint64 defaultSmallFileSize = 100 * 1024;
+    const qint64 maximumSmallFileSize = 10 * 1024 * 1024;
+
+    // The window is re-evaluated at most this often, or every two round trips if that is longer
+    const milliseconds minimumInterval(1000);
+
+    // A probe must improve the throughput by 5% to be kept
+    const double requiredImprovement = 1.05;
+
+    // Round trip times this much above the best one mean that requests are queueing
+    const double rttInflationFactor = 4.0;
+}
+
+void TransferConcurrencyController::reset(int maximumWindow)
+{
+    _maximumWindow = qMax(1, maximumWindow);
+    // Start where the fixed limit used to be
+    _window = qMin(3, qCeil(_maximumWindow / 2.));
+    _lastAction = Action::Hold;
+    _holdIntervals = 0;
+    _clock.start();
+
+    _intervalStart = milliseconds(-1);
+    _intervalBytes = 0;
+    _intervalSamples = 0;
+    _intervalOverloaded = 0;
+    _intervalSaturated = false;
+
+    _lastThroughput = 0;
+    _throughputPerTransfer = 0;
+    _smoothedRtt = 0;
+    _minimumRtt = 0;
+}
+
+qint64 TransferConcurrencyController::smallFileSize() const
+{
+    if (_throughputPerTransfer <= 0 || _smoothedRtt <= 0)
+        return defaultSmallFileSize;
+
+    // What a single transfer moves during one round trip
+    const auto bytesPerRoundTrip = static_cast<qint64>(_throughputPerTransfer * _smoothedRtt / 1000);
+    return qBound(defaultSmallFileSize, bytesPerRoundTrip, maximumSmallFileSize);
+}
+
+void TransferConcurrencyController::addSample(qint64 bytes, milliseconds duration, Outcome outcome, int runningTransfers)
+{
+    if (!_clock.isValid())
+        _clock.start();
+    addSample(bytes, duration, outcome, runningTransfers, milliseconds(_clock.elapsed()));
+}
+
+void TransferConcurrencyController::addSample(qint64 bytes, milliseconds duration, Outcome outcome, int runningTransfers, milliseconds now)
+{
+    if (outcome == Outcome::OtherError)
+        return;
+
+    if (_intervalStart < milliseconds(0))
+        _intervalStart = now - duration;
+
+    ++_intervalSamples;
+    if (runningTransfers >= _window)
+        _intervalSaturated = true;
+
+    if (outcome == Outcome::ServerOverloaded) {
+        ++_intervalOverloaded;
+    } else {
+        _intervalBytes += bytes;
+        const auto msecs = qMax<qint64>(1, duration.count());
+        if (bytes <= smallRequestSize) {
+            _smoothedRtt = _smoothedRtt > 0 ? 0.875 * _smoothedRtt + 0.125 * msecs : msecs;
+            _minimumRtt = _minimumRtt > 0 ? qMin(_minimumRtt, double(msecs)) : msecs;
+        } else {
+            const double throughput = bytes * 1000.0 / msecs;
+            _throughputPerTransfer = _throughputPerTransfer > 0 ? 0.75 * _throughputPerTransfer + 0.25 * throughput : throughput;
+        }
+    }
+
+    const auto intervalLength = std::max(minimumInterval, milliseconds(qRound64(2 * _smoothedRtt)));
+    if (now - _intervalStart >= intervalLength)
+        evaluate(now);
+}
+
+void TransferConcurrencyController::evaluate(milliseconds now)
+{
+    const auto elapsed = qMax<qint64>(1, (now - _intervalStart).count());
+    const double throughput = _intervalBytes * 1000.0 / elapsed;
+
+    if (_intervalOverloaded > 0 && _intervalOverloaded * 10 >= _intervalSamples) {
+        setWindow(_window / 2, Action::Decreased, "server overloaded");
+        _holdIntervals = 3;
+    } else if (_minimumRtt > 0 && _smoothedRtt > rttInflationFactor * _minimumRtt && throughput <= _lastThroughput) {
+        setWindow(_window - 1, Action::Decreased, "round trip time increased");
+        _holdIntervals = 1;
+    } else if (_lastAction == Action::Increased && throughput < _lastThroughput * requiredImprovement) {
+        // The last probe didn't help, go back and wait before trying again
+        setWindow(_window - 1, Action::Decreased, "no throughput gain");
+        _holdIntervals = 5;
+    } else if (_holdIntervals > 0) {
+        --_holdIntervals;
+        _lastAction = Action::Hold;
+    } else if (_intervalSaturated && _window < _maximumWindow) {
+        setWindow(_window + 1, Action::Increased, "probing");
+    } else {
+        _lastAction = Action::Hold;
+    }
+
+    _lastThroughput = throughput;
+    _intervalStart = now;
+    _intervalBytes = 0;
+    _intervalSamples = 0;
+    _intervalOverloaded = 0;
+    _intervalSaturated = false;
+}
+
+void TransferConcurrencyController::setWindow(int window, Action action, const char *reason)
+{
+    window = qBound(1, window, _maximumWindow);
+    _lastAction = action;
+    if (window == _window)
+        return;
+
+    qCInfo(lcTransferConcurrency) << "Parallel transfers" << _window << "->" << window << "-" << reason
+                                  << "rtt:" << qRound64(_smoothedRtt) << "min rtt:" << qRound64(_minimumRtt);
+    _window = window;
+}
+
+TransferConcurrencyController::Outcome TransferConcurrencyController::outcome(int httpStatusCode, QNetworkReply::NetworkError error, bool timedOut)
+{
+    if (timedOut)
+        return Outcome::ServerOverloaded;
+    switch (httpStatusCode) {
+    case 429: // Too Many Requests
+    case 502: // Bad Gateway
+    case 503: // Service Unavailable
+    case 504: // Gateway Timeout
+        return Outcome::ServerOverloaded;
+    default:
+        break;
+    }
+    return error == QNetworkReply::NoError ? Outcome::Success : Outcome::OtherError;
+}
+
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QElapsedTimer>
+#include <QNetworkReply>
+
+#include <chrono>
+
+namespace OCC {
+
+/**
+ * @brief Decides how many transfers the propagator runs in parallel
+ *
+ * The window starts at the old fixed value and is then tuned the way TCP
+ * congestion control does it:
+ *  - while all transfer slots are busy, the window is increased by one and kept
+ *    if the measured throughput improved, otherwise it goes back and waits a bit
+ *    before probing again,
+ *  - it is halved when the server reports overload (429, 502, 503, 504, timeouts),
+ *  - it is decreased by one when the round trip time of small requests grows far
+ *    beyond the best one seen, which means requests are queueing on the way.
+ *
+ * Bandwidth limits don't need special handling: the BandwidthManager splits the
+ * budget across the running transfers, and more parallelism never improves the
+ * throughput so the window doesn't grow.
+ *
+ * The controller is fed with one sample per finished transfer request.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT TransferConcurrencyController
+{
+public:
+    enum class Outcome {
+        Success,
+        ServerOverloaded, //< the server or a proxy can't keep up, back off
+        OtherError //< says nothing about the connection, ignored
+    };
+
+    /** Starts over for a sync that allows at most maximumWindow parallel transfers */
+    void reset(int maximumWindow);
+
+    int window() const { return _window; }
+    int maximumWindow() const { return _maximumWindow; }
+
+    /** Transfers of files below this size are dominated by the round trip time.
+     *
+     * The propagator starts extra jobs for them beyond the window.
+     */
+    qint64 smallFileSize() const;
+
+    /** Smoothed round trip time of small requests, 0 if not known yet */
+    std::chrono::milliseconds roundTripTime() const { return std::chrono::milliseconds(qRound64(_smoothedRtt)); }
+
+    /** Records a finished transfer request.
+     *
+     * runningTransfers is the number of jobs that were active when it finished,
+     * including this one.
+     */
+    void addSample(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome, int runningTransfers);
+
+    /// Same as above with the time from an arbitrary monotonic clock, for tests
+    void addSample(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome, int runningTransfers, std::chrono::milliseconds now);
+
+    static Outcome outcome(int httpStatusCode, QNetworkReply::NetworkError error, bool timedOut);
+
+private:
+    enum class Action {
+        Hold,
+        Increased,
+        Decreased
+    };
+
+    void evaluate(std::chrono::milliseconds now);
+    void setWindow(int window, Action action, const char *reason);
+
+    int _maximumWindow = 1;
+    int _window = 1;
+    Action _lastAction = Action::Hold;
+    int _holdIntervals = 0;
+
+    QElapsedTimer _clock;
+
+    // Current measuring interval
+    std::chrono::milliseconds _intervalStart = std::chrono::milliseconds(-1);
+    qint64 _intervalBytes = 0;
+    int _intervalSamples = 0;
+    int _intervalOverloaded = 0;
+    bool _intervalSaturated = false;
+
+    double _lastThroughput = 0; // bytes per second, of the previous interval
+    double _throughputPerTransfer = 0; // bytes per second, smoothed
+    double _smoothedRtt = 0; // msec
+    double _minimumRtt = 0; // msec
+};
+
+}
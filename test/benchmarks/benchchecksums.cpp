@@ -0,0 +1,149 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "common/checksums.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTemporaryDir>
+
+using namespace OCC;
+
+/*
+ * Measures the checksum throughput in GB/s, for every algorithm on its own,
+ * for several algorithms computed in one pass and for several files
+ * checksummed concurrently through ComputeChecksum.
+ *
+ *   ChecksumsBench --size 512 --files 8
+ *   ChecksumsBench --types SHA1,Adler32 --repeat 5
+ *
+ * The files are read once before measuring so that all runs are served from
+ * the page cache and the numbers show the CPU cost of the digests.
+ */
+
+namespace {
+
+bool writeFile(const QString &path, qint64 size)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QByteArray block(1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < block.size(); ++i)
+        block[i] = static_cast<char>(qrand());
+    for (qint64 written = 0; written < size; written += block.size()) {
+        if (file.write(block.constData(), qMin<qint64>(block.size(), size - written)) < 0)
+            return false;
+    }
+    return true;
+}
+
+double gbPerSecond(qint64 bytes, qint64 nsecs)
+{
+    return nsecs > 0 ? double(bytes) / nsecs : 0.0;
+}
+
+/* Best time of \a repeat runs of \a run in nanoseconds */
+template <typename Run>
+qint64 measure(int repeat, Run run)
+{
+    qint64 best = -1;
+    for (int i = 0; i < repeat; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        run();
+        const auto elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+void checksumFile(const QString &path, const QVector<QByteArray> &types)
+{
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        ComputeChecksum::computeNow(&file, types);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption sizeOption(QStringLiteral("size"), QStringLiteral("Size of every test file in MiB"), QStringLiteral("MiB"), QStringLiteral("256"));
+    QCommandLineOption filesOption(QStringLiteral("files"), QStringLiteral("Number of files checksummed concurrently"), QStringLiteral("count"), QStringLiteral("4"));
+    QCommandLineOption typesOption(QStringLiteral("types"), QStringLiteral("Comma separated list of checksum types"), QStringLiteral("types"),
+        QStringLiteral("MD5,SHA1,SHA256,SHA3-256,Adler32"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Runs per measurement, the fastest is reported"), QStringLiteral("count"), QStringLiteral("3"));
+    parser.addOptions({ sizeOption, filesOption, typesOption, repeatOption });
+    parser.process(app);
+
+    const qint64 size = parser.value(sizeOption).toLongLong() * 1024 * 1024;
+    const int fileCount = qMax(1, parser.value(filesOption).toInt());
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+    QVector<QByteArray> types;
+    for (const auto &type : parser.value(typesOption).split(QLatin1Char(','), Qt::SkipEmptyParts))
+        types.append(type.toLatin1());
+
+    QTemporaryDir tempDir;
+    QStringList paths;
+    for (int i = 0; i < fileCount; ++i) {
+        paths.append(tempDir.filePath(QStringLiteral("file%1").arg(i)));
+        if (!writeFile(paths.last(), size)) {
+            qCritical() << "Could not write" << paths.last();
+            return -1;
+        }
+    }
+
+    // Warm up the page cache
+    checksumFile(paths.first(), { checkSumAdlerC });
+
+    for (const auto &type : qAsConst(types)) {
+        const auto ns = measure(repeat, [&] { checksumFile(paths.first(), { type }); });
+        qInfo().noquote() << QStringLiteral("%1: %2 GB/s").arg(QString::fromLatin1(type), -10).arg(gbPerSecond(size, ns), 0, 'f', 2);
+    }
+
+    if (types.size() > 1) {
+        const auto separateNs = measure(repeat, [&] {
+            for (const auto &type : qAsConst(types))
+                checksumFile(paths.first(), { type });
+        });
+        const auto combinedNs = measure(repeat, [&] { checksumFile(paths.first(), types); });
+        qInfo().noquote() << QStringLiteral("all types, one pass per type: %1 ms, one pass for all: %2 ms")
+                                 .arg(separateNs / 1000000)
+                                 .arg(combinedNs / 1000000);
+    }
+
+    for (const auto &type : qAsConst(types)) {
+        const auto ns = measure(repeat, [&] {
+            int pending = fileCount;
+            QEventLoop loop;
+            for (const auto &path : qAsConst(paths)) {
+                auto computeChecksum = new ComputeChecksum(&loop);
+                computeChecksum->setChecksumType(type);
+                QObject::connect(computeChecksum, &ComputeChecksum::done, &loop, [&] {
+                    if (--pending == 0)
+                        loop.quit();
+                });
+                computeChecksum->start(path);
+            }
+            loop.exec();
+        });
+        qInfo().noquote() << QStringLiteral("%1 x %2 concurrently: %3 GB/s")
+                                 .arg(fileCount)
+                                 .arg(QString::fromLatin1(type), -10)
+                                 .arg(gbPerSecond(size * fileCount, ns), 0, 'f', 2);
+    }
+    return 0;
+}
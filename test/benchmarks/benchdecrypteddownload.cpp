@@ -0,0 +1,188 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "clientsideencryption.h"
+#include "common/constants.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <cstring>
+#include <functional>
+
+using namespace OCC;
+
+/*
+ * Compares the two ways an end-to-end encrypted download was stored:
+ *
+ *   DecryptedDownloadBench --size 5120 --dir /path/on/the/sync/disk
+ *
+ * "two passes" writes the encrypted data into a temporary and decrypts it
+ * into a second one afterwards, like the propagator did before.
+ * "streaming" decrypts the data as it arrives, like GETEncryptedFileJob.
+ *
+ * The download is simulated by encrypting in memory, in packets of the size
+ * GETFileJob reads; "network" is the time that alone takes. The bytes written
+ * are counted where the data is written, the disk's cache is not flushed.
+ */
+
+namespace {
+
+const qint64 mib = 1024 * 1024;
+
+/* Encrypts size bytes in packets, the tag comes with the last one */
+bool simulateDownload(const QByteArray &key, const QByteArray &iv, qint64 size, int packetSize,
+    const std::function<bool(const char *, qint64)> &receive)
+{
+    EncryptionHelper::CipherCtx ctx;
+    if (!ctx || !EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)
+        || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, iv.size(), nullptr)
+        || !EVP_EncryptInit_ex(ctx, nullptr, nullptr, reinterpret_cast<const unsigned char *>(key.constData()), reinterpret_cast<const unsigned char *>(iv.constData()))) {
+        qWarning() << "Could not set up the encryption";
+        return false;
+    }
+
+    QByteArray packet(packetSize + Constants::e2EeTagSize, Qt::Uninitialized);
+    auto data = reinterpret_cast<unsigned char *>(packet.data());
+    for (qint64 sent = 0; sent < size;) {
+        const auto length = static_cast<int>(qMin<qint64>(packetSize, size - sent));
+        memset(data, static_cast<char>(sent / packetSize), length);
+        int len = 0;
+        if (!EVP_EncryptUpdate(ctx, data, &len, data, length)) {
+            qWarning() << "Could not encrypt";
+            return false;
+        }
+        sent += length;
+        qint64 packetLength = length;
+        if (sent == size) {
+            if (!EVP_EncryptFinal_ex(ctx, data + length, &len)
+                || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, Constants::e2EeTagSize, data + length)) {
+                qWarning() << "Could not get the tag";
+                return false;
+            }
+            packetLength += Constants::e2EeTagSize;
+        }
+        if (!receive(packet.constData(), packetLength))
+            return false;
+    }
+    return true;
+}
+
+struct Result
+{
+    qint64 ms = -1;
+    qint64 bytesWritten = 0;
+};
+
+Result network(const QByteArray &key, const QByteArray &iv, qint64 size, int packetSize)
+{
+    Result result;
+    QElapsedTimer timer;
+    timer.start();
+    if (simulateDownload(key, iv, size, packetSize, [](const char *, qint64) { return true; }))
+        result.ms = timer.elapsed();
+    return result;
+}
+
+Result twoPasses(const QByteArray &key, const QByteArray &iv, qint64 size, int packetSize, const QDir &dir)
+{
+    Result result;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile encrypted(dir.filePath(QStringLiteral(".bench-download.~encrypted")));
+    QFile decrypted(dir.filePath(QStringLiteral(".bench-download.~decrypted")));
+    if (!encrypted.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        qWarning() << "Could not open" << encrypted.fileName() << encrypted.errorString();
+        return result;
+    }
+    const auto downloaded = simulateDownload(key, iv, size, packetSize, [&](const char *data, qint64 length) {
+        const auto written = encrypted.write(data, length);
+        result.bytesWritten += qMax<qint64>(written, 0);
+        return written == length;
+    });
+    encrypted.close();
+    if (downloaded && EncryptionHelper::fileDecryption(key, iv, &encrypted, &decrypted)) {
+        decrypted.close();
+        result.bytesWritten += decrypted.size();
+        result.ms = timer.elapsed();
+    }
+    encrypted.remove();
+    decrypted.remove();
+    return result;
+}
+
+Result streaming(const QByteArray &key, const QByteArray &iv, qint64 size, int packetSize, const QDir &dir)
+{
+    Result result;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile decrypted(dir.filePath(QStringLiteral(".bench-download.~decrypted")));
+    if (!decrypted.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        qWarning() << "Could not open" << decrypted.fileName() << decrypted.errorString();
+        return result;
+    }
+    EncryptionHelper::StreamingDecryptor decryptor(key, iv, size + Constants::e2EeTagSize);
+    const auto downloaded = simulateDownload(key, iv, size, packetSize, [&](const char *data, qint64 length) {
+        const auto chunk = decryptor.chunkDecryption(data, length);
+        if (chunk.isEmpty() && !decryptor.isFinished())
+            return false;
+        const auto written = decrypted.write(chunk);
+        result.bytesWritten += qMax<qint64>(written, 0);
+        return written == chunk.size();
+    });
+    decrypted.close();
+    if (downloaded && decryptor.isFinished())
+        result.ms = timer.elapsed();
+    decrypted.remove();
+    return result;
+}
+
+void report(const char *name, const Result &result, qint64 size)
+{
+    if (result.ms < 0) {
+        qInfo() << name << "failed";
+        return;
+    }
+    qInfo().noquote() << QStringLiteral("%1: %2 ms, %3 MiB written, %4 MiB/s")
+                             .arg(QLatin1String(name), -10)
+                             .arg(result.ms)
+                             .arg(result.bytesWritten / mib)
+                             .arg(size / mib * 1000 / qMax<qint64>(result.ms, 1));
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption sizeOption(QStringLiteral("size"), QStringLiteral("Size of the file in MiB"), QStringLiteral("mib"), QStringLiteral("512"));
+    QCommandLineOption dirOption(QStringLiteral("dir"), QStringLiteral("Where to write the temporaries"), QStringLiteral("path"), QDir::tempPath());
+    QCommandLineOption packetOption(QStringLiteral("packet"), QStringLiteral("Bytes received at once"), QStringLiteral("bytes"), QStringLiteral("8192"));
+    parser.addOptions({ sizeOption, dirOption, packetOption });
+    parser.process(app);
+
+    const qint64 size = qMax<qint64>(1, parser.value(sizeOption).toLongLong()) * mib;
+    const QDir dir(parser.value(dirOption));
+    const int packetSize = qBound(1024, parser.value(packetOption).toInt(), 16 * 1024 * 1024);
+
+    const auto key = EncryptionHelper::generateRandom(16);
+    const auto iv = EncryptionHelper::generateRandom(16);
+
+    qInfo() << "Downloading" << size / mib << "MiB into" << dir.absolutePath();
+    report("network", network(key, iv, size, packetSize), size);
+    report("two passes", twoPasses(key, iv, size, packetSize, dir), size);
+    report("streaming", streaming(key, iv, size, packetSize, dir), size);
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "config_csync.h"
+#include "csync_exclude.h"
+#include "common/utility.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+
+using namespace OCC;
+
+/*
+ * Matches generated file paths against an exclude list, once with the
+ * compiled ExcludeMatcher and once with the per base path regular expressions
+ * ExcludedFiles used before, and checks that both agree.
+ *
+ *   ExcludesBench --paths 1000000
+ *   ExcludesBench --excludes /path/to/sync-exclude.lst --repeat 5
+ *
+ * "traversal" checks the bname and, if triggered, the full path patterns,
+ * like the discovery does. "full" checks every component of the path.
+ */
+
+#define EXCLUDE_LIST_FILE SOURCEDIR "/../../sync-exclude.lst"
+
+extern void csync_exclude_expand_escapes(QByteArray &input);
+
+namespace {
+
+enum Result {
+    NotExcluded,
+    Excluded,
+    ExcludedAndRemove,
+    Triggered,
+};
+
+QStringList loadPatterns(const QString &path)
+{
+    QStringList patterns;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return patterns;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        csync_exclude_expand_escapes(line);
+        patterns.append(QString::fromUtf8(line));
+    }
+    return patterns;
+}
+
+QStringList generatePaths(int count)
+{
+    const QStringList dirs = { QStringLiteral("Documents"), QStringLiteral("Photos"), QStringLiteral("src"), QStringLiteral("build"),
+        QStringLiteral("node_modules"), QStringLiteral("2021"), QStringLiteral("Projects"), QStringLiteral(".git"),
+        QStringLiteral("Shared with me"), QStringLiteral("lib"), QStringLiteral("Desktop"), QStringLiteral("Backup") };
+    const QStringList names = { QStringLiteral("report"), QStringLiteral("IMG_"), QStringLiteral("notes"), QStringLiteral("main"),
+        QStringLiteral("Thumbs"), QStringLiteral(".~lock.letter"), QStringLiteral("invoice"), QStringLiteral("data") };
+    const QStringList extensions = { QStringLiteral(".txt"), QStringLiteral(".jpg"), QStringLiteral(".cpp"), QStringLiteral(".o"),
+        QStringLiteral(".pdf"), QStringLiteral("~"), QStringLiteral(".part"), QStringLiteral(".swp"), QStringLiteral(".db"),
+        QStringLiteral("#"), QString() };
+
+    QRandomGenerator random(42);
+    QStringList paths;
+    paths.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString path;
+        const int depth = random.bounded(8);
+        for (int d = 0; d < depth; ++d)
+            path += dirs.at(random.bounded(dirs.size())) + QLatin1Char('/');
+        path += names.at(random.bounded(names.size())) + QString::number(random.bounded(1000))
+            + extensions.at(random.bounded(extensions.size()));
+        paths.append(path);
+    }
+    return paths;
+}
+
+/*
+ * The patterns of the sync root, split the same way as ExcludedFiles::prepare()
+ * does, fed to an ExcludeMatcher and to the regular expressions for files
+ * ExcludedFiles used to generate.
+ */
+struct Matchers
+{
+    Matchers(const QStringList &patterns, bool wildcardsMatchSlash)
+        : matcher(wildcardsMatchSlash, Utility::fsCasePreserving() ? Qt::CaseInsensitive : Qt::CaseSensitive)
+    {
+        QString fullKeep, fullRemove, bnameKeep, bnameRemove, bnameDirKeep, bnameDirRemove, trigger;
+        auto append = [](QString &pattern, const QString &regex) {
+            if (!pattern.isEmpty())
+                pattern.append(QLatin1Char('|'));
+            pattern.append(regex);
+        };
+        for (auto exclude : patterns) {
+            const bool dirOnly = exclude.endsWith(QLatin1Char('/'));
+            if (dirOnly)
+                exclude.chop(1);
+            const bool remove = exclude.startsWith(QLatin1Char(']'));
+            if (remove)
+                exclude.remove(0, 1);
+            const auto regex = ExcludedFiles::convertToRegexpSyntax(exclude, wildcardsMatchSlash);
+            if (!exclude.contains(QLatin1Char('/'))) {
+                matcher.addBnamePattern(exclude, dirOnly, remove);
+                if (dirOnly)
+                    append(remove ? bnameDirRemove : bnameDirKeep, regex);
+                else
+                    append(remove ? bnameRemove : bnameKeep, regex);
+            } else {
+                matcher.addFullPattern(exclude, dirOnly, remove);
+                // The triggers of the matcher are tested by TestExcludedFiles,
+                // here every full pattern triggers on any name.
+                matcher.addTrigger(QStringLiteral("*"), dirOnly);
+                if (!dirOnly) {
+                    append(remove ? fullRemove : fullKeep, regex);
+                    append(trigger, QStringLiteral(".*"));
+                }
+            }
+        }
+        matcher.compile();
+
+        for (auto pattern : { &fullKeep, &fullRemove, &bnameKeep, &bnameRemove, &bnameDirKeep, &bnameDirRemove, &trigger }) {
+            if (pattern->isEmpty())
+                *pattern = QStringLiteral("a^");
+        }
+        bnameRegex.setPattern(QStringLiteral("^(?P<exclude>%1)$|^(?P<excluderemove>%2)$|^(?P<trigger>%3)$")
+                                  .arg(bnameKeep, bnameRemove, trigger));
+        fullTraversalRegex.setPattern(QStringLiteral("^(?P<exclude>%1)(?:$|/)|^(?P<excluderemove>%2)(?:$|/)")
+                                          .arg(fullKeep, fullRemove));
+        fullRegex.setPattern(QStringLiteral("(?P<exclude>^(?:%1)(?:$|/)|(?:^|/)(?:%2)(?:$|/)|(?:^|/)(?:%3)/)"
+                                            "|"
+                                            "(?P<excluderemove>^(?:%4)(?:$|/)|(?:^|/)(?:%5)(?:$|/)|(?:^|/)(?:%6)/)")
+                                 .arg(fullKeep, bnameKeep, bnameDirKeep, fullRemove, bnameRemove, bnameDirRemove));
+        for (auto regex : { &bnameRegex, &fullTraversalRegex, &fullRegex }) {
+            if (Utility::fsCasePreserving())
+                regex->setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+            regex->optimize();
+        }
+    }
+
+    static Result regexResult(const QRegularExpressionMatch &match)
+    {
+        if (!match.hasMatch())
+            return NotExcluded;
+        if (match.capturedStart(QStringLiteral("exclude")) != -1)
+            return Excluded;
+        if (match.capturedStart(QStringLiteral("excluderemove")) != -1)
+            return ExcludedAndRemove;
+        return Triggered;
+    }
+
+    static QStringRef bname(const QString &path)
+    {
+        return path.midRef(path.lastIndexOf(QLatin1Char('/')) + 1);
+    }
+
+    Result regexTraversal(const QString &path) const
+    {
+        const auto result = regexResult(bnameRegex.match(bname(path)));
+        if (result != Triggered)
+            return result;
+        return regexResult(fullTraversalRegex.match(path));
+    }
+
+    Result matcherTraversal(const QString &path) const
+    {
+        const auto result = static_cast<Result>(matcher.bnameMatch(bname(path), ItemTypeFile));
+        if (result != Triggered)
+            return result;
+        return static_cast<Result>(matcher.traversalMatch(path, ItemTypeFile));
+    }
+
+    Result regexFull(const QString &path) const { return regexResult(fullRegex.match(path)); }
+    Result matcherFull(const QString &path) const { return static_cast<Result>(matcher.fullMatch(path, ItemTypeFile)); }
+
+    ExcludeMatcher matcher;
+    QRegularExpression bnameRegex;
+    QRegularExpression fullTraversalRegex;
+    QRegularExpression fullRegex;
+};
+
+template <typename F>
+qint64 bestOf(int repeat, const QStringList &paths, F match, int *excluded)
+{
+    qint64 best = -1;
+    for (int i = 0; i < repeat; ++i) {
+        int count = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for (const auto &path : paths)
+            count += match(path) != NotExcluded;
+        const auto elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        *excluded = count;
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption pathsOption(QStringLiteral("paths"), QStringLiteral("Number of generated paths"), QStringLiteral("count"), QStringLiteral("1000000"));
+    QCommandLineOption excludesOption(QStringLiteral("excludes"), QStringLiteral("Exclude list to use"), QStringLiteral("file"), QStringLiteral(EXCLUDE_LIST_FILE));
+    QCommandLineOption slashOption(QStringLiteral("wildcards-match-slash"), QStringLiteral("Let * and ? match a /, as on Windows"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Runs per matcher, the fastest is reported"), QStringLiteral("count"), QStringLiteral("3"));
+    parser.addOptions({ pathsOption, excludesOption, slashOption, repeatOption });
+    parser.process(app);
+
+    const auto patterns = loadPatterns(parser.value(excludesOption));
+    if (patterns.isEmpty()) {
+        qWarning() << "No exclude patterns in" << parser.value(excludesOption);
+        return 1;
+    }
+    const auto paths = generatePaths(parser.value(pathsOption).toInt());
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+
+    QElapsedTimer compileTimer;
+    compileTimer.start();
+    const Matchers matchers(patterns, parser.isSet(slashOption));
+    qInfo() << patterns.size() << "patterns compiled in" << compileTimer.elapsed() << "ms," << paths.size() << "paths";
+
+    int mismatches = 0;
+    for (const auto &path : paths) {
+        if (matchers.regexTraversal(path) != matchers.matcherTraversal(path) || matchers.regexFull(path) != matchers.matcherFull(path)) {
+            if (++mismatches <= 10)
+                qWarning() << "Results differ for" << path;
+        }
+    }
+
+    auto report = [&](const char *name, qint64 regexNs, qint64 matcherNs, int excluded) {
+        qInfo().noquote() << QStringLiteral("%1: regex %2 ns/path, matcher %3 ns/path, speedup %4, %5 excluded")
+                                 .arg(QLatin1String(name), 9)
+                                 .arg(double(regexNs) / paths.size(), 0, 'f', 1)
+                                 .arg(double(matcherNs) / paths.size(), 0, 'f', 1)
+                                 .arg(matcherNs > 0 ? double(regexNs) / matcherNs : 0.0, 0, 'f', 2)
+                                 .arg(excluded);
+    };
+
+    int excluded = 0;
+    const auto regexTraversal = bestOf(repeat, paths, [&](const QString &path) { return matchers.regexTraversal(path); }, &excluded);
+    const auto matcherTraversal = bestOf(repeat, paths, [&](const QString &path) { return matchers.matcherTraversal(path); }, &excluded);
+    report("traversal", regexTraversal, matcherTraversal, excluded);
+
+    const auto regexFull = bestOf(repeat, paths, [&](const QString &path) { return matchers.regexFull(path); }, &excluded);
+    const auto matcherFull = bestOf(repeat, paths, [&](const QString &path) { return matchers.matcherFull(path); }, &excluded);
+    report("full", regexFull, matcherFull, excluded);
+
+    if (mismatches > 0) {
+        qWarning() << mismatches << "paths matched differently";
+        return 1;
+    }
+    return 0;
+}
@@ -8,42 +8,298 @@
 #include "syncenginetestutils.h"
 #include <syncengine.h>
 
+#include <QCommandLineParser>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
 using namespace OCC;
 
-int numDirs = 0;
-int numFiles = 0;
+/*
+ * Usage examples:
+ *
+ *   LargeSyncBench --files 1000,10000,100000 --shapes balanced,wide,deep --output result.json
+ *   LargeSyncBench --files 1000000 --shapes wide --baseline result.json --tolerance 15
+ *
+ * Every (shape, file count, direction) combination runs in a fresh FakeFolder.
+ * Two syncs are measured: the initial one that transfers the whole tree and a
+ * second one where nothing changed.
+ */
+
+namespace {
 
-template<int filesPerDir, int dirPerDir, int maxDepth>
-void addBunchOfFiles(int depth, const QString &path, FileModifier &fi) {
-    for (int fileNum = 1; fileNum <= filesPerDir; ++fileNum) {
+struct TreeShape
+{
+    QString name;
+    int filesPerDir;
+    int dirsPerDir;
+    int maxDepth;
+    qint64 defaultFileSize;
+};
+
+const QVector<TreeShape> treeShapes = {
+    { QStringLiteral("balanced"), 10, 8, 8, 64 },
+    { QStringLiteral("wide"), 1000, 100, 2, 64 },
+    { QStringLiteral("deep"), 4, 2, 40, 64 },
+    { QStringLiteral("large"), 10, 4, 6, 8 * 1024 * 1024 },
+};
+
+struct TreeStats
+{
+    int files = 0;
+    int dirs = 0;
+};
+
+// Fills the tree depth first until targetFiles files were created
+void addBunchOfFiles(const TreeShape &shape, qint64 fileSize, int targetFiles,
+    int depth, const QString &path, FileModifier &fi, TreeStats &stats)
+{
+    for (int fileNum = 1; fileNum <= shape.filesPerDir && stats.files < targetFiles; ++fileNum) {
         QString name = QStringLiteral("file") + QString::number(fileNum);
-        fi.insert(path.isEmpty() ? name : path + "/" + name);
-        numFiles++;
+        fi.insert(path.isEmpty() ? name : path + "/" + name, fileSize);
+        stats.files++;
     }
-    if (depth >= maxDepth)
+    if (depth >= shape.maxDepth)
         return;
-    for (int dirNum = 1; dirNum <= dirPerDir; ++dirNum) {
+    for (int dirNum = 1; dirNum <= shape.dirsPerDir && stats.files < targetFiles; ++dirNum) {
         QString name = QStringLiteral("dir") + QString::number(dirNum);
         QString subPath = path.isEmpty() ? name : path + "/" + name;
         fi.mkdir(subPath);
-        numDirs++;
-        addBunchOfFiles<filesPerDir, dirPerDir, maxDepth>(depth + 1, subPath, fi);
+        stats.dirs++;
+        addBunchOfFiles(shape, fileSize, targetFiles, depth + 1, subPath, fi, stats);
     }
 }
 
-int main(int argc, char *argv[])
+/* Peak resident set size in KiB, -1 if unknown */
+qint64 peakRssKb()
 {
-    QCoreApplication app(argc, argv);
-    FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
-    addBunchOfFiles<10, 8, 4>(0, "", fakeFolder.localModifier());
+#if defined(Q_OS_LINUX)
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (status.open(QIODevice::ReadOnly)) {
+        const auto lines = status.readAll().split('\n');
+        for (const auto &line : lines) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/* Resets the peak RSS so the next measurement only covers one run (Linux only) */
+void resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+#endif
+}
+
+QJsonObject measureSync(FakeFolder &fakeFolder, const QString &label)
+{
+    auto &journal = fakeFolder.syncJournal();
+    auto &stopWatch = fakeFolder.syncEngine().stopWatch();
+    journal.resetStatistics();
+    resetPeakRss();
 
-    qDebug() << "NUMFILES" << numFiles;
-    qDebug() << "NUMDIRS" << numDirs;
     QElapsedTimer timer;
     timer.start();
-    bool result1 = fakeFolder.syncOnce();
-    qDebug() << "FIRST SYNC: " << result1 << timer.restart();
-    bool result2 = fakeFolder.syncOnce();
-    qDebug() << "SECOND SYNC: " << result2 << timer.restart();
-    return (result1 && result2) ? 0 : -1;
+    const bool success = fakeFolder.syncOnce();
+    const qint64 totalMs = timer.elapsed();
+
+    // Lap times are relative to the start of the sync
+    const auto discoveryEnd = static_cast<qint64>(stopWatch.durationOfLap(QStringLiteral("Discovery Finished")));
+    const auto reconcileEnd = static_cast<qint64>(stopWatch.durationOfLap(QStringLiteral("Post-Reconcile Finished")));
+    const auto syncEnd = static_cast<qint64>(stopWatch.durationOfLap(QStringLiteral("Sync Finished")));
+    const auto dbStats = journal.statistics();
+
+    QJsonObject result;
+    result[QStringLiteral("label")] = label;
+    result[QStringLiteral("success")] = success;
+    result[QStringLiteral("totalMs")] = totalMs;
+    result[QStringLiteral("discoveryMs")] = discoveryEnd;
+    result[QStringLiteral("reconcileMs")] = qMax<qint64>(0, reconcileEnd - discoveryEnd);
+    result[QStringLiteral("propagationMs")] = qMax<qint64>(0, syncEnd - reconcileEnd);
+    result[QStringLiteral("journalCommitMs")] = dbStats.commitTimeNs / 1000000;
+    result[QStringLiteral("journalCommits")] = static_cast<qint64>(dbStats.commitCount);
+    result[QStringLiteral("sqlStatements")] = static_cast<qint64>(dbStats.statementCount);
+    result[QStringLiteral("peakRssKb")] = peakRssKb();
+
+    qInfo().noquote() << QStringLiteral("  %1: %2 in %3 ms (discovery %4, reconcile %5, propagation %6, commit %7) %8 statements, peak RSS %9 KiB")
+                             .arg(label, success ? QStringLiteral("ok") : QStringLiteral("FAILED"))
+                             .arg(totalMs)
+                             .arg(result[QStringLiteral("discoveryMs")].toInt())
+                             .arg(result[QStringLiteral("reconcileMs")].toInt())
+                             .arg(result[QStringLiteral("propagationMs")].toInt())
+                             .arg(result[QStringLiteral("journalCommitMs")].toInt())
+                             .arg(dbStats.statementCount)
+                             .arg(result[QStringLiteral("peakRssKb")].toInt());
+    return result;
+}
+
+QJsonObject runScenario(const TreeShape &shape, int targetFiles, qint64 fileSize, bool upload, bool verbose)
+{
+    FakeFolder fakeFolder{ FileInfo{} };
+    if (!verbose) {
+        Logger::instance()->setLogRules({ QStringLiteral("*.debug=false"), QStringLiteral("*.info=false") });
+    }
+
+    TreeStats stats;
+    if (upload) {
+        addBunchOfFiles(shape, fileSize, targetFiles, 0, QString(), fakeFolder.localModifier(), stats);
+    } else {
+        addBunchOfFiles(shape, fileSize, targetFiles, 0, QString(), fakeFolder.remoteModifier(), stats);
+    }
+
+    const QString direction = upload ? QStringLiteral("up") : QStringLiteral("down");
+    const QString name = QStringLiteral("%1-%2-%3").arg(shape.name).arg(targetFiles).arg(direction);
+    qInfo().noquote() << name << stats.files << "files" << stats.dirs << "dirs";
+
+    QJsonObject scenario;
+    scenario[QStringLiteral("name")] = name;
+    scenario[QStringLiteral("shape")] = shape.name;
+    scenario[QStringLiteral("direction")] = direction;
+    scenario[QStringLiteral("files")] = stats.files;
+    scenario[QStringLiteral("dirs")] = stats.dirs;
+    scenario[QStringLiteral("fileSize")] = fileSize;
+    scenario[QStringLiteral("syncs")] = QJsonArray{
+        measureSync(fakeFolder, QStringLiteral("initial")),
+        measureSync(fakeFolder, QStringLiteral("noop")),
+    };
+    return scenario;
+}
+
+/* Returns the number of syncs that got slower than the baseline by more than the tolerance */
+int compareWithBaseline(const QJsonArray &results, const QJsonArray &baseline, double tolerancePercent)
+{
+    // Differences below this are noise, whatever the relative difference
+    const qint64 minimumDeltaMs = 50;
+
+    QHash<QString, QJsonObject> baselineSyncs;
+    for (const auto &scenario : baseline) {
+        const auto scenarioObject = scenario.toObject();
+        for (const auto &sync : scenarioObject[QStringLiteral("syncs")].toArray()) {
+            const auto syncObject = sync.toObject();
+            baselineSyncs.insert(scenarioObject[QStringLiteral("name")].toString() + QLatin1Char('/') + syncObject[QStringLiteral("label")].toString(), syncObject);
+        }
+    }
+
+    int regressions = 0;
+    for (const auto &scenario : results) {
+        const auto scenarioObject = scenario.toObject();
+        for (const auto &sync : scenarioObject[QStringLiteral("syncs")].toArray()) {
+            const auto syncObject = sync.toObject();
+            const auto key = scenarioObject[QStringLiteral("name")].toString() + QLatin1Char('/') + syncObject[QStringLiteral("label")].toString();
+            if (!baselineSyncs.contains(key)) {
+                qInfo().noquote() << key << "not in baseline";
+                continue;
+            }
+            const auto before = baselineSyncs[key][QStringLiteral("totalMs")].toVariant().toLongLong();
+            const auto after = syncObject[QStringLiteral("totalMs")].toVariant().toLongLong();
+            const bool regressed = after - before > minimumDeltaMs && after > before * (1.0 + tolerancePercent / 100.0);
+            qInfo().noquote() << key << before << "ms ->" << after << "ms" << (regressed ? "REGRESSION" : "");
+            if (regressed)
+                regressions++;
+        }
+    }
+    return regressions;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures sync runs against a fake server"));
+    parser.addHelpOption();
+    QCommandLineOption filesOption(QStringLiteral("files"), QStringLiteral("Comma separated list of file counts"), QStringLiteral("counts"), QStringLiteral("1000"));
+    QCommandLineOption shapesOption(QStringLiteral("shapes"), QStringLiteral("Comma separated list of tree shapes: balanced, wide, deep, large"), QStringLiteral("shapes"), QStringLiteral("balanced"));
+    QCommandLineOption fileSizeOption(QStringLiteral("file-size"), QStringLiteral("Size of every file in bytes, overrides the shape default"), QStringLiteral("bytes"));
+    QCommandLineOption directionOption(QStringLiteral("direction"), QStringLiteral("up, down or both"), QStringLiteral("direction"), QStringLiteral("up"));
+    QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write the results as JSON to this file"), QStringLiteral("file"));
+    QCommandLineOption baselineOption(QStringLiteral("baseline"), QStringLiteral("Compare the results against this JSON file"), QStringLiteral("file"));
+    QCommandLineOption toleranceOption(QStringLiteral("tolerance"), QStringLiteral("Allowed slowdown against the baseline in percent"), QStringLiteral("percent"), QStringLiteral("20"));
+    QCommandLineOption verboseOption(QStringLiteral("verbose"), QStringLiteral("Keep the sync engine logging"));
+    parser.addOptions({ filesOption, shapesOption, fileSizeOption, directionOption, outputOption, baselineOption, toleranceOption, verboseOption });
+    parser.process(app);
+
+    QVector<bool> directions;
+    const auto direction = parser.value(directionOption);
+    if (direction == QLatin1String("up") || direction == QLatin1String("both"))
+        directions.append(true);
+    if (direction == QLatin1String("down") || direction == QLatin1String("both"))
+        directions.append(false);
+    if (directions.isEmpty()) {
+        qCritical() << "Unknown direction" << direction;
+        return -1;
+    }
+
+    QJsonArray results;
+    bool allSucceeded = true;
+    for (const auto &shapeName : parser.value(shapesOption).split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+        auto shape = std::find_if(treeShapes.cbegin(), treeShapes.cend(), [&](const TreeShape &s) { return s.name == shapeName; });
+        if (shape == treeShapes.cend()) {
+            qCritical() << "Unknown shape" << shapeName;
+            return -1;
+        }
+        const qint64 fileSize = parser.isSet(fileSizeOption) ? parser.value(fileSizeOption).toLongLong() : shape->defaultFileSize;
+        for (const auto &count : parser.value(filesOption).split(QLatin1Char(','), Qt::SkipEmptyParts)) {
+            for (const bool upload : qAsConst(directions)) {
+                const auto scenario = runScenario(*shape, count.toInt(), fileSize, upload, parser.isSet(verboseOption));
+                for (const auto &sync : scenario[QStringLiteral("syncs")].toArray()) {
+                    allSucceeded &= sync.toObject()[QStringLiteral("success")].toBool();
+                }
+                results.append(scenario);
+            }
+        }
+    }
+
+    QJsonObject report;
+    report[QStringLiteral("benchmark")] = QStringLiteral("LargeSync");
+    report[QStringLiteral("version")] = 1;
+    report[QStringLiteral("results")] = results;
+
+    if (parser.isSet(outputOption)) {
+        QFile output(parser.value(outputOption));
+        if (!output.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical() << "Could not write" << output.fileName();
+            return -1;
+        }
+        output.write(QJsonDocument(report).toJson());
+    }
+
+    if (!allSucceeded)
+        return -1;
+
+    if (parser.isSet(baselineOption)) {
+        QFile baselineFile(parser.value(baselineOption));
+        if (!baselineFile.open(QIODevice::ReadOnly)) {
+            qCritical() << "Could not read" << baselineFile.fileName();
+            return -1;
+        }
+        const auto baseline = QJsonDocument::fromJson(baselineFile.readAll()).object()[QStringLiteral("results")].toArray();
+        if (compareWithBaseline(results, baseline, parser.value(toleranceOption).toDouble()) > 0)
+            return 2;
+    }
+    return 0;
 }
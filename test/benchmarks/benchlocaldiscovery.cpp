@@ -0,0 +1,108 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include "localdiscoveryexecutor.h"
+
+#include <QCommandLineParser>
+#include <QThread>
+
+using namespace OCC;
+
+/*
+ * Lists a local tree with LocalDiscoveryExecutor using an increasing number of
+ * threads to show how the local scan scales with the core count.
+ *
+ *   LocalDiscoveryBench --files 400000 --threads 1,2,4,8,16
+ *   LocalDiscoveryBench --path /some/existing/tree
+ */
+
+namespace {
+
+int createTree(int targetFiles, int filesPerDir, int dirsPerDir, int depth, const QString &path, DiskFileModifier &fi, int &files)
+{
+    int dirs = 0;
+    for (int fileNum = 1; fileNum <= filesPerDir && files < targetFiles; ++fileNum) {
+        const auto name = QStringLiteral("file") + QString::number(fileNum);
+        fi.insert(path.isEmpty() ? name : path + QLatin1Char('/') + name, 1);
+        files++;
+    }
+    if (depth == 0)
+        return dirs;
+    for (int dirNum = 1; dirNum <= dirsPerDir && files < targetFiles; ++dirNum) {
+        const auto name = QStringLiteral("dir") + QString::number(dirNum);
+        const auto subPath = path.isEmpty() ? name : path + QLatin1Char('/') + name;
+        fi.mkdir(subPath);
+        dirs += 1 + createTree(targetFiles, filesPerDir, dirsPerDir, depth - 1, subPath, fi, files);
+    }
+    return dirs;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption filesOption(QStringLiteral("files"), QStringLiteral("Number of files in the generated tree"), QStringLiteral("count"), QStringLiteral("100000"));
+    QCommandLineOption pathOption(QStringLiteral("path"), QStringLiteral("Scan this directory instead of generating a tree"), QStringLiteral("path"));
+    QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("Comma separated list of thread counts"), QStringLiteral("counts"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Runs per thread count, the fastest is reported"), QStringLiteral("count"), QStringLiteral("3"));
+    parser.addOptions({ filesOption, pathOption, threadsOption, repeatOption });
+    parser.process(app);
+
+    QTemporaryDir tempDir;
+    QString root = parser.value(pathOption);
+    if (root.isEmpty()) {
+        root = tempDir.path();
+        DiskFileModifier fi(root);
+        int files = 0;
+        const int dirs = createTree(parser.value(filesOption).toInt(), 50, 10, 6, QString(), fi, files);
+        qInfo() << "Created" << files << "files in" << dirs << "directories";
+    }
+
+    QVector<int> threadCounts;
+    if (parser.isSet(threadsOption)) {
+        for (const auto &count : parser.value(threadsOption).split(QLatin1Char(','), Qt::SkipEmptyParts))
+            threadCounts.append(count.toInt());
+    } else {
+        for (int count = 1; count < QThread::idealThreadCount(); count *= 2)
+            threadCounts.append(count);
+        threadCounts.append(QThread::idealThreadCount());
+    }
+
+    VfsOff vfs;
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+
+    // Warm up the dentry and inode caches so that all runs see the same state
+    LocalDiscoveryExecutor(&vfs, 1).scanTree(root);
+
+    qint64 singleThreadMs = -1;
+    for (const int threadCount : qAsConst(threadCounts)) {
+        LocalDiscoveryExecutor executor(&vfs, threadCount);
+        qint64 bestMs = -1;
+        qint64 entries = 0;
+        for (int i = 0; i < repeat; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            entries = executor.scanTree(root);
+            const auto elapsed = timer.elapsed();
+            if (bestMs < 0 || elapsed < bestMs)
+                bestMs = elapsed;
+        }
+        if (singleThreadMs < 0)
+            singleThreadMs = bestMs;
+        qInfo().noquote() << QStringLiteral("threads %1: %2 entries in %3 ms, speedup %4")
+                                 .arg(threadCount, 3)
+                                 .arg(entries)
+                                 .arg(bestMs, 6)
+                                 .arg(bestMs > 0 ? double(singleThreadMs) / bestMs : 0.0, 0, 'f', 2);
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include "logger.h"
+#include <syncengine.h>
+
+#include <QCommandLineParser>
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <QThread>
+
+using namespace OCC;
+
+/*
+ * Compares the logger writing every message before doLog() returns with the
+ * default one, queueing the messages for the writer thread.
+ *
+ *   LoggerBench --files 10000
+ *   LoggerBench --threads 8 --messages 200000
+ *
+ * A sync of generated files is measured with debug logging on, the way users
+ * are asked to run the client when reporting a problem. Then a number of
+ * threads log as fast as they can, which is where the dropping kicks in.
+ * The time includes writing out what is still queued at the end.
+ */
+
+Q_LOGGING_CATEGORY(lcLoggerBench, "nextcloud.bench.logger", QtDebugMsg)
+
+namespace {
+
+struct Run
+{
+    qint64 ms = -1;
+    qint64 logBytes = 0;
+    quint64 dropped = 0;
+    bool success = true;
+};
+
+template <typename F>
+Run measure(const QString &logFile, bool asynchronous, F work)
+{
+    auto logger = Logger::instance();
+    logger->setLogAsynchronous(asynchronous);
+    logger->setLogFile(logFile);
+    const auto droppedBefore = logger->droppedMessages();
+
+    Run run;
+    QElapsedTimer timer;
+    timer.start();
+    run.success = work();
+    logger->flush();
+    run.ms = timer.elapsed();
+
+    run.dropped = logger->droppedMessages() - droppedBefore;
+    logger->setLogFile(QString());
+    run.logBytes = QFileInfo(logFile).size();
+    QFile::remove(logFile);
+    return run;
+}
+
+bool syncFiles(int files, const QString &logFile)
+{
+    FakeFolder fakeFolder{ FileInfo{} };
+    // FakeFolder logs to stdout
+    Logger::instance()->setLogFile(logFile);
+    for (int i = 0; i < files; ++i)
+        fakeFolder.localModifier().insert(QStringLiteral("dir%1/file%2").arg(i / 100).arg(i), 64);
+    return fakeFolder.syncOnce();
+}
+
+bool logFromThreads(int threadCount, int messages)
+{
+    QVector<QThread *> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.append(QThread::create([t, messages] {
+            for (int i = 0; i < messages; ++i)
+                qCDebug(lcLoggerBench) << "Thread" << t << "message" << i << "of some typical length for a sync log";
+        }));
+        threads.last()->start();
+    }
+    for (auto thread : threads) {
+        thread->wait();
+        delete thread;
+    }
+    return true;
+}
+
+void report(const char *name, const Run &synchronous, const Run &asynchronous)
+{
+    qInfo().noquote() << QStringLiteral("%1: synchronous %2 ms (%3 KiB), asynchronous %4 ms (%5 KiB, %6 dropped), speedup %7%8")
+                             .arg(QLatin1String(name), 7)
+                             .arg(synchronous.ms)
+                             .arg(synchronous.logBytes / 1024)
+                             .arg(asynchronous.ms)
+                             .arg(asynchronous.logBytes / 1024)
+                             .arg(asynchronous.dropped)
+                             .arg(asynchronous.ms > 0 ? double(synchronous.ms) / asynchronous.ms : 0.0, 0, 'f', 2)
+                             .arg(synchronous.success && asynchronous.success ? QString() : QStringLiteral(" FAILED"));
+}
+
+template <typename F>
+void bestOf(int repeat, const QString &logFile, bool asynchronous, F work, Run *best)
+{
+    for (int i = 0; i < repeat; ++i) {
+        const auto run = measure(logFile, asynchronous, work);
+        if (best->ms < 0 || run.ms < best->ms)
+            *best = run;
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption filesOption(QStringLiteral("files"), QStringLiteral("Number of files to sync"), QStringLiteral("count"), QStringLiteral("5000"));
+    QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("Number of threads logging at once"), QStringLiteral("count"), QStringLiteral("4"));
+    QCommandLineOption messagesOption(QStringLiteral("messages"), QStringLiteral("Messages logged per thread"), QStringLiteral("count"), QStringLiteral("100000"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Runs per logger, the fastest is reported"), QStringLiteral("count"), QStringLiteral("3"));
+    parser.addOptions({ filesOption, threadsOption, messagesOption, repeatOption });
+    parser.process(app);
+
+    const int files = parser.value(filesOption).toInt();
+    const int threadCount = parser.value(threadsOption).toInt();
+    const int messages = parser.value(messagesOption).toInt();
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+
+    QTemporaryDir dir;
+    const auto logFile = dir.filePath(QStringLiteral("bench.log"));
+    Logger::instance()->setLogDebug(true);
+
+    Run syncSynchronous, syncAsynchronous;
+    auto sync = [files, logFile] { return syncFiles(files, logFile); };
+    bestOf(repeat, logFile, false, sync, &syncSynchronous);
+    bestOf(repeat, logFile, true, sync, &syncAsynchronous);
+
+    Run threadsSynchronous, threadsAsynchronous;
+    auto log = [threadCount, messages] { return logFromThreads(threadCount, messages); };
+    bestOf(repeat, logFile, false, log, &threadsSynchronous);
+    bestOf(repeat, logFile, true, log, &threadsAsynchronous);
+
+    Logger::instance()->setLogDebug(false);
+    Logger::instance()->setLogFile(QStringLiteral("-"));
+    qInfo() << files << "files synced," << threadCount << "threads logging" << messages << "messages each";
+    report("sync", syncSynchronous, syncAsynchronous);
+    report("threads", threadsSynchronous, threadsAsynchronous);
+
+    return syncSynchronous.success && syncAsynchronous.success ? 0 : -1;
+}
@@ -0,0 +1,128 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncfileitem.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace OCC;
+
+/*
+ * Measures the memory the items of a large sync take before propagation.
+ *
+ *   SyncFileItemBench --items 1000000 --locked 1
+ *
+ * The items are filled like discovery fills them for new remote files, with
+ * the given percentage of them locked. The resident memory is read before and
+ * after, so the result includes the allocator's overhead.
+ */
+
+namespace {
+
+/* Current resident set size in KiB, the peak one where unknown, -1 if neither is available */
+qint64 rssKb()
+{
+#if defined(Q_OS_LINUX)
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (status.open(QIODevice::ReadOnly)) {
+        const auto lines = status.readAll().split('\n');
+        for (const auto &line : lines) {
+            if (line.startsWith("VmRSS:")) {
+                return line.mid(6).trimmed().split(' ').first().toLongLong();
+            }
+        }
+    }
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+SyncFileItemVector createItems(int count, int lockedPercent)
+{
+    SyncFileItemVector items;
+    items.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        auto item = SyncFileItemPtr::create();
+        const auto path = QStringLiteral("dir%1/sub%2/file%3.txt").arg(i / 10000).arg(i / 100 % 100).arg(i);
+        item->_file = path;
+        item->_originalFile = path;
+        item->_type = ItemTypeFile;
+        item->_direction = SyncFileItem::Down;
+        item->_instruction = CSYNC_INSTRUCTION_NEW;
+        item->_etag = QByteArray::number(i, 16).rightJustified(16, '0');
+        item->_fileId = QByteArray::number(i).rightJustified(8, '0') + "ocabcdefgh";
+        item->_checksumHeader = "SHA1:" + QByteArray(40, 'a');
+        item->_remotePerm = RemotePermissions::fromServerString(QStringLiteral("WDNVR"));
+        item->_size = i;
+        item->_modtime = 1600000000 + i;
+        if (i % 100 < lockedPercent) {
+            item->_locked = SyncFileItem::LockStatus::LockedItem;
+            auto &extra = item->mutableExtra();
+            extra._lockOwnerId = QStringLiteral("alice");
+            extra._lockOwnerDisplayName = QStringLiteral("Alice");
+            extra._lockTime = 1600000000;
+            extra._lockTimeout = 1800;
+        }
+        items.append(item);
+    }
+    return items;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption itemsOption(QStringLiteral("items"), QStringLiteral("Number of items to create"), QStringLiteral("count"), QStringLiteral("1000000"));
+    QCommandLineOption lockedOption(QStringLiteral("locked"), QStringLiteral("Percentage of locked items"), QStringLiteral("percent"), QStringLiteral("1"));
+    parser.addOptions({ itemsOption, lockedOption });
+    parser.process(app);
+
+    const int count = qMax(1, parser.value(itemsOption).toInt());
+    const int lockedPercent = qBound(0, parser.value(lockedOption).toInt(), 100);
+
+    const auto rssBefore = rssKb();
+    QElapsedTimer timer;
+    timer.start();
+    const auto items = createItems(count, lockedPercent);
+    const auto ms = timer.elapsed();
+    const auto rssAfter = rssKb();
+
+    qInfo() << "sizeof(SyncFileItem):" << sizeof(SyncFileItem) << "bytes, sizeof(SyncFileItem::Extra):" << sizeof(SyncFileItem::Extra) << "bytes";
+    if (rssBefore < 0 || rssAfter < 0) {
+        qInfo() << items.size() << "items created in" << ms << "ms, memory use unknown on this platform";
+        return 0;
+    }
+    const auto kb = rssAfter - rssBefore;
+    qInfo().noquote() << QStringLiteral("%1 items (%2% locked) created in %3 ms: %4 MiB, %5 bytes per item")
+                             .arg(items.size())
+                             .arg(lockedPercent)
+                             .arg(ms)
+                             .arg(kb / 1024)
+                             .arg(kb * 1024 / items.size());
+    return 0;
+}
@@ -353,6 +353,44 @@ static void check_readdir_bigunicode(void **state)
     assert_int_equal(files_cnt, 0);
 }
 
+static void check_readdir_batch(void **state)
+{
+    (void) state; /* unused */
+
+    const char *t1 = "batch/sub/";
+    create_dirs( t1 );
+    create_file( "batch/", "Räuber Max.txt", "Der Max ist ein schlimmer finger");
+    create_file( "batch/", "пя́тница.txt", "Am Freitag tanzt der Ürk");
+
+    csync_vio_handle_t *dh = csync_vio_local_opendir(QStringLiteral("%1/batch").arg(CSYNC_TEST_DIR));
+    assert_non_null(dh);
+
+    std::vector<csync_file_stat_t> entries;
+    int rc = csync_vio_local_readdir_batch(dh, &entries, nullptr);
+    assert_int_equal(rc, 0);
+    assert_int_equal(entries.size(), 3);
+
+    for (const auto &entry : entries) {
+        assert_true(entry.inode != 0);
+        if (entry.path == "sub") {
+            assert_int_equal(entry.type, ItemTypeDirectory);
+        } else {
+            assert_int_equal(entry.type, ItemTypeFile);
+            assert_true(entry.path == QStringLiteral("Räuber Max.txt").toUtf8() || entry.path == QStringLiteral("пя́тница.txt").toUtf8());
+            assert_true(entry.size > 0);
+            assert_true(entry.modtime > 0);
+        }
+    }
+
+    /* Everything was read already */
+    rc = csync_vio_local_readdir_batch(dh, &entries, nullptr);
+    assert_int_equal(rc, 0);
+    assert_int_equal(entries.size(), 0);
+
+    rc = csync_vio_local_closedir(dh);
+    assert_int_equal(rc, 0);
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -360,6 +398,7 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_readdir_batch, setup_testenv, teardown),
     };
 
     return cmocka_run_group_tests(tests, nullptr, nullptr);
@@ -398,14 +398,31 @@ FileInfo *FakePutReply::perform(FileInfo &remoteRootFileInfo, const QNetworkRequ
 {
     QString fileName = getFilePathFromUrl(request.url());
     Q_ASSERT(!fileName.isEmpty());
+    if (request.hasRawHeader("OC-Chunk-Source-Range")) {
+        // A chunk of a delta upload without data, it is taken from the destination by the MOVE
+        const auto range = request.rawHeader("OC-Chunk-Source-Range").split('-');
+        Q_ASSERT(range.size() == 2);
+        Q_ASSERT(putPayload.isEmpty());
+        const auto first = range[0].toLongLong();
+        // Like on the server, the chunk itself is empty
+        auto fileInfo = remoteRootFileInfo.create(fileName, 0, '\0');
+        fileInfo->chunkOffset = request.rawHeader("OC-Chunk-Offset").toLongLong();
+        fileInfo->chunkSourceOffset = first;
+        fileInfo->chunkSourceSize = range[1].toLongLong() - first + 1;
+        return fileInfo;
+    }
     FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
     if (fileInfo) {
         fileInfo->size = putPayload.size();
         fileInfo->contentChar = putPayload.at(0);
+        fileInfo->chunkSourceOffset = -1;
     } else {
         // Assume that the file is filled with the same character
         fileInfo = remoteRootFileInfo.create(fileName, putPayload.size(), putPayload.at(0));
     }
+    if (request.hasRawHeader("OC-Chunk-Offset")) {
+        fileInfo->chunkOffset = request.rawHeader("OC-Chunk-Offset").toLongLong();
+    }
     fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(request.rawHeader("X-OC-Mtime").toLongLong());
     remoteRootFileInfo.find(fileName, /*invalidateEtags=*/true);
     return fileInfo;
@@ -627,8 +644,20 @@ void FakeGetReply::respond()
     }
     payload = fileInfo->contentChar;
     size = fileInfo->size;
+    int status = 200;
+    static const QRegularExpression rangePattern(QStringLiteral("^bytes=(\\d+)-(\\d*)$"));
+    const auto rangeMatch = rangePattern.match(QString::fromLatin1(request().rawHeader("Range")));
+    if (rangeMatch.hasMatch() && rangeMatch.captured(1).toLongLong() < fileInfo->size) {
+        const auto start = rangeMatch.captured(1).toLongLong();
+        auto end = fileInfo->size - 1;
+        if (!rangeMatch.captured(2).isEmpty())
+            end = qMin(end, rangeMatch.captured(2).toLongLong());
+        size = end - start + 1;
+        status = 206;
+        setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + '-' + QByteArray::number(end) + '/' + QByteArray::number(fileInfo->size));
+    }
     setHeader(QNetworkRequest::ContentLengthHeader, size);
-    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
     setRawHeader("OC-ETag", fileInfo->etag);
     setRawHeader("ETag", fileInfo->etag);
     setRawHeader("OC-FileId", fileInfo->fileId);
@@ -694,7 +723,9 @@ void FakeGetWithDataReply::respond()
         emit finished();
         return;
     }
-    setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+    if (sendContentLength) {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+    }
     setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
     setRawHeader("OC-ETag", fileInfo->etag);
     setRawHeader("ETag", fileInfo->etag);
@@ -757,21 +788,31 @@ FileInfo *FakeChunkMoveReply::perform(FileInfo &uploadsFileInfo, FileInfo &remot
 
     QString fileName = getFilePathFromUrl(QUrl::fromEncoded(request.rawHeader("Destination")));
     Q_ASSERT(!fileName.isEmpty());
+    FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
 
     // Compute the size and content from the chunks if possible
     for (auto chunkName : sourceFolder->children.keys()) {
         auto &x = sourceFolder->children[chunkName];
         Q_ASSERT(!x.isDir);
-        Q_ASSERT(x.size > 0); // There should not be empty chunks
-        size += x.size;
-        Q_ASSERT(!payload || payload == x.contentChar);
-        payload = x.contentChar;
+        auto chunkSize = x.size;
+        auto chunkPayload = x.contentChar;
+        if (x.chunkSourceOffset >= 0) {
+            // Reused range of the file that is replaced
+            Q_ASSERT(fileInfo);
+            Q_ASSERT(x.chunkSourceOffset + x.chunkSourceSize <= fileInfo->size);
+            chunkSize = x.chunkSourceSize;
+            chunkPayload = fileInfo->contentChar;
+        }
+        Q_ASSERT(chunkSize > 0); // There should not be empty chunks
+        Q_ASSERT(x.chunkOffset < 0 || x.chunkOffset == size); // Nor gaps or overlaps
+        size += chunkSize;
+        Q_ASSERT(!payload || payload == chunkPayload);
+        payload = chunkPayload;
         ++count;
     }
     Q_ASSERT(sourceFolder->children.count() == count); // There should not be holes or extra files
 
     // NOTE: This does not actually assemble the file data from the chunks!
-    FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
     if (fileInfo) {
         // The client should put this header
         Q_ASSERT(request.hasRawHeader("If"));
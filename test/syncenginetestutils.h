@@ -163,6 +163,11 @@ public:
     QByteArray extraDavProperties;
     qint64 size = 0;
     char contentChar = 'W';
+    // Chunks of an upload: their OC-Chunk-Offset, and for the empty chunks of a
+    // delta upload the range of the file the upload replaces they stand for
+    qint64 chunkOffset = -1;
+    qint64 chunkSourceOffset = -1;
+    qint64 chunkSourceSize = 0;
 
     // Sorted by name to be able to compare trees
     QMap<QString, FileInfo> children;
@@ -304,6 +309,7 @@ public:
     QByteArray payload;
     quint64 offset = 0;
     bool aborted = false;
+    bool sendContentLength = true;
 
     FakeGetWithDataReply(FileInfo &remoteRootFileInfo, const QByteArray &data, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
 
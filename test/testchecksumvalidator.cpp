@@ -180,6 +180,33 @@ using namespace OCC::Utility;
         delete vali;
     }
 
+    void testUploadChecksummingMultiple() {
+        auto *vali = new ComputeChecksum(this);
+        vali->setChecksumType(OCC::checkSumSHA1C);
+        vali->setAdditionalChecksumTypes({ OCC::checkSumMD5C, "Klaas32" });
+
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const auto expectedSha1 = calcSha1(&file);
+        file.seek(0);
+        const auto expectedMd5 = calcMd5(&file);
+        file.seek(0);
+        QCOMPARE(ComputeChecksum::computeNow(&file, QVector<QByteArray>{ OCC::checkSumMD5C, OCC::checkSumSHA1C }),
+            (QVector<QByteArray>{ expectedMd5, expectedSha1 }));
+
+        QSignalSpy spy(vali, &ComputeChecksum::done);
+        vali->start(_testfile);
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.first().at(0).toByteArray(), QByteArray(OCC::checkSumSHA1C));
+        QCOMPARE(spy.first().at(1).toByteArray(), expectedSha1);
+        QCOMPARE(vali->checksum(OCC::checkSumSHA1C), expectedSha1);
+        QCOMPARE(vali->checksum(OCC::checkSumMD5C), expectedMd5);
+        QVERIFY(vali->checksum("Klaas32").isNull());
+        QVERIFY(vali->checksum(OCC::checkSumSHA2C).isNull());
+
+        delete vali;
+    }
+
     void testDownloadChecksummingAdler() {
 #ifndef ZLIB_FOUND
         QSKIP("ZLIB not found.", SkipSingle);
@@ -247,6 +247,117 @@ private slots:
         QCOMPARE(generateHash(chunkedOutputDecrypted.readAll()), originalFileHash);
         chunkedOutputDecrypted.close();
     }
+
+    void testStreamingEncryptor_data()
+    {
+        QTest::addColumn<int>("totalBytes");
+
+        QTest::newRow("empty") << 0;
+        QTest::newRow("small") << 100;
+        QTest::newRow("large") << 300 * 1024;
+    }
+
+    void testStreamingEncryptor()
+    {
+        QFETCH(int, totalBytes);
+
+        QTemporaryFile inputFile;
+        QVERIFY(inputFile.open());
+        QCOMPARE(inputFile.write(EncryptionHelper::generateRandom(totalBytes)), qint64(totalBytes));
+        inputFile.close();
+
+        const auto encryptionKey = EncryptionHelper::generateRandom(16);
+        const auto initializationVector = EncryptionHelper::generateRandom(16);
+
+        QTemporaryFile encryptedFile;
+        QByteArray tag;
+        QVERIFY(EncryptionHelper::fileEncryption(encryptionKey, initializationVector, &inputFile, &encryptedFile, tag));
+        QVERIFY(encryptedFile.open());
+        const auto expected = encryptedFile.readAll();
+
+        EncryptionHelper::StreamingEncryptor encryptor(encryptionKey, initializationVector, inputFile.fileName());
+        QVERIFY(encryptor.open(QIODevice::ReadOnly));
+        QCOMPARE(encryptor.size(), qint64(expected.size()));
+
+        // A read stops at the end of the file, the tag comes with the next one
+        const auto readUpTo = [&encryptor](int size) {
+            QByteArray data;
+            while (data.size() < size && !encryptor.atEnd()) {
+                const auto more = encryptor.read(qMin(size - data.size(), 4000));
+                if (more.isEmpty())
+                    break;
+                data += more;
+            }
+            return data;
+        };
+
+        QCOMPARE(readUpTo(expected.size()), expected);
+        QVERIFY(encryptor.atEnd());
+        QCOMPARE(encryptor.tag(), tag);
+
+        // Sending a chunk again, going back further, and only the tag
+        for (const auto pos : { totalBytes / 2, totalBytes / 2, totalBytes / 4, totalBytes }) {
+            QVERIFY(encryptor.seek(pos));
+            QCOMPARE(readUpTo(5000), expected.mid(pos, 5000));
+        }
+        QCOMPARE(encryptor.tag(), tag);
+    }
+
+    void testStreamingDecryptorResume_data()
+    {
+        QTest::addColumn<int>("totalBytes");
+        QTest::addColumn<int>("resumeAt");
+
+        QTest::newRow("start") << 100 << 0;
+        QTest::newRow("middle") << 300 * 1024 << 150 * 1024 + 7;
+        QTest::newRow("tag only") << 300 * 1024 << 300 * 1024;
+        QTest::newRow("empty") << 0 << 0;
+    }
+
+    void testStreamingDecryptorResume()
+    {
+        QFETCH(int, totalBytes);
+        QFETCH(int, resumeAt);
+
+        QTemporaryFile inputFile;
+        QVERIFY(inputFile.open());
+        const auto plainText = EncryptionHelper::generateRandom(totalBytes);
+        QCOMPARE(inputFile.write(plainText), qint64(totalBytes));
+        inputFile.close();
+
+        const auto encryptionKey = EncryptionHelper::generateRandom(16);
+        const auto initializationVector = EncryptionHelper::generateRandom(16);
+
+        QTemporaryFile encryptedFile;
+        QByteArray tag;
+        QVERIFY(EncryptionHelper::fileEncryption(encryptionKey, initializationVector, &inputFile, &encryptedFile, tag));
+        QVERIFY(encryptedFile.open());
+        const auto encrypted = encryptedFile.readAll();
+        const auto rest = encrypted.mid(resumeAt);
+
+        // What a download decrypted before it was interrupted
+        QBuffer decrypted;
+        decrypted.setData(plainText.left(resumeAt));
+        QVERIFY(decrypted.open(QIODevice::ReadOnly));
+
+        EncryptionHelper::StreamingDecryptor decryptor(encryptionKey, initializationVector, encrypted.size());
+        QVERIFY(decryptor.resume(&decrypted, resumeAt));
+        QCOMPARE(decryptor.chunkDecryption(rest.constData(), rest.size()), plainText.mid(resumeAt));
+        QVERIFY(decryptor.isFinished());
+
+        // A changed temporary doesn't match the tag
+        if (resumeAt > 0) {
+            auto changed = plainText.left(resumeAt);
+            changed[resumeAt / 2] = changed[resumeAt / 2] ^ 1;
+            QBuffer changedDecrypted(&changed);
+            QVERIFY(changedDecrypted.open(QIODevice::ReadOnly));
+
+            EncryptionHelper::StreamingDecryptor failingDecryptor(encryptionKey, initializationVector, encrypted.size());
+            QVERIFY(failingDecryptor.resume(&changedDecrypted, resumeAt));
+            QVERIFY(failingDecryptor.chunkDecryption(rest.constData(), rest.size()).isEmpty());
+            QVERIFY(!failingDecryptor.isFinished());
+        }
+    }
 };
 
 QTEST_APPLESS_MAIN(TestClientSideEncryption)
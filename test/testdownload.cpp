@@ -9,6 +9,9 @@
 #include "syncenginetestutils.h"
 #include <syncengine.h>
 #include <owncloudpropagator.h>
+#include <propagatedownload.h>
+#include <clientsideencryption.h>
+#include "common/constants.h"
 
 using namespace OCC;
 
@@ -91,6 +94,74 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testSegmentedDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._parallelDownloadSegments = 4;
+        options._minSegmentedDownloadSize = 1000 * 1000;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.remoteModifier().insert("A/big", 40 * 1000 * 1000);
+        fakeFolder.remoteModifier().insert("A/small", 1000);
+
+        QByteArrayList ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big")) {
+                ranges.append(request.rawHeader("Range"));
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(ranges, QByteArrayList({ "bytes=0-9999999", "bytes=10000000-19999999", "bytes=20000000-29999999", "bytes=30000000-39999999" }));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testSegmentedDownloadResume()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._parallelDownloadSegments = 4;
+        options._minSegmentedDownloadSize = 1000 * 1000;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.remoteModifier().insert("A/big", 40 * 1000 * 1000);
+
+        // The second segment breaks off after the first 3 MB
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big")
+                && request.rawHeader("Range").startsWith("bytes=10000000-")) {
+                return new BrokenFakeGetReply(fakeFolder.remoteModifier(), op, request, this);
+            }
+            return nullptr;
+        });
+
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(getItem(completeSpy, "A/big")->_status, SyncFileItem::SoftError);
+        const auto info = fakeFolder.syncJournal().getDownloadInfo("A/big");
+        QVERIFY(info._valid);
+        QCOMPARE(info._segments.size(), 4);
+        QCOMPARE(info._segments[1].downloaded, stopAfter);
+
+        // The broken segment continues where it stopped
+        QByteArrayList ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big")) {
+                ranges.append(request.rawHeader("Range"));
+            }
+            return nullptr;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(ranges.contains("bytes=" + QByteArray::number(10000000 + stopAfter) + "-19999999"));
+        for (const auto &segment : info._segments) {
+            // Completed segments are not downloaded again
+            if (segment.downloaded == segment.end - segment.start)
+                QVERIFY(!ranges.contains("bytes=" + QByteArray::number(segment.start) + '-' + QByteArray::number(segment.end - 1)));
+        }
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testErrorMessage () {
         // This test's main goal is to test that the error string from the server is shown in the UI
 
@@ -242,6 +313,83 @@ private slots:
         QCOMPARE(getItem(completeSpy, "A/resendme")->_status, SyncFileItem::NormalError);
         QVERIFY(getItem(completeSpy, "A/resendme")->_errorString.contains(serverMessage));
     }
+
+    void testEncryptedDownload_data()
+    {
+        QTest::addColumn<bool>("sendContentLength");
+        QTest::addColumn<bool>("corruptTag");
+
+        QTest::newRow("content length") << true << false;
+        QTest::newRow("no content length") << false << false;
+        QTest::newRow("no content length, corrupt tag") << false << true;
+    }
+
+    void testEncryptedDownload()
+    {
+        QFETCH(bool, sendContentLength);
+        QFETCH(bool, corruptTag);
+
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        // More than one read of the job, so the tag is held back across them
+        const auto plainText = EncryptionHelper::generateRandom(100 * 1024 + 7);
+        QTemporaryFile plainFile;
+        QVERIFY(plainFile.open());
+        QCOMPARE(plainFile.write(plainText), qint64(plainText.size()));
+        plainFile.close();
+
+        EncryptedFile encryptedInfo;
+        encryptedInfo.encryptionKey = EncryptionHelper::generateRandom(16);
+        encryptedInfo.initializationVector = EncryptionHelper::generateRandom(16);
+        QTemporaryFile encryptedFile;
+        QVERIFY(encryptedFile.open());
+        encryptedFile.close();
+        QByteArray tag;
+        QVERIFY(EncryptionHelper::fileEncryption(encryptedInfo.encryptionKey, encryptedInfo.initializationVector, &plainFile, &encryptedFile, tag));
+        encryptedFile.close();
+        QVERIFY(encryptedFile.open());
+        auto encrypted = encryptedFile.readAll();
+        QCOMPARE(encrypted.size(), plainText.size() + Constants::e2EeTagSize);
+        if (corruptTag) {
+            encrypted[encrypted.size() - 1] = char(encrypted.at(encrypted.size() - 1) ^ 1);
+        }
+
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/a1")) {
+                auto reply = new FakeGetWithDataReply(fakeFolder.remoteModifier(), encrypted, op, request, this);
+                reply->sendContentLength = sendContentLength;
+                return reply;
+            }
+            return nullptr;
+        });
+
+        QTemporaryFile decrypted;
+        QVERIFY(decrypted.open());
+        auto job = new GETEncryptedFileJob(fakeFolder.account(), QStringLiteral("A/a1"), &decrypted, {}, {}, 0, encryptedInfo);
+        // The job deletes itself once it's done
+        auto replyError = QNetworkReply::UnknownNetworkError;
+        qint64 contentLength = 0;
+        auto finished = false;
+        auto decryptionFailed = false;
+        connect(job, &GETFileJob::finishedSignal, this, [&] {
+            replyError = job->reply()->error();
+            contentLength = job->contentLength();
+            finished = job->finishDecryption();
+            decryptionFailed = job->decryptionFailed();
+        });
+        QSignalSpy finishedSpy(job, &GETFileJob::finishedSignal);
+        job->start();
+        QVERIFY(finishedSpy.wait());
+
+        QCOMPARE(replyError, QNetworkReply::NoError);
+        QCOMPARE(contentLength, sendContentLength ? qint64(encrypted.size()) : qint64(-1));
+        QCOMPARE(finished, !corruptTag);
+        QCOMPARE(decryptionFailed, corruptTag);
+        if (!corruptTag) {
+            decrypted.seek(0);
+            QCOMPARE(decrypted.readAll(), plainText);
+        }
+    }
 };
 
 QTEST_GUILESS_MAIN(TestDownload)
@@ -62,6 +62,16 @@ static auto check_dir_traversal(const char *path)
     return excludedFiles->traversalPatternMatch(path, ItemTypeDirectory);
 }
 
+static const ExcludeMatcher &matcher(const char *basePath)
+{
+    return excludedFiles->_matchers[QString::fromUtf8(basePath)];
+}
+
+static bool hasPattern(const QStringList &patterns, const char *part)
+{
+    return !patterns.filter(QString::fromUtf8(part)).isEmpty();
+}
+
 
 private slots:
     void testFun()
@@ -97,14 +107,13 @@ private slots:
         QCOMPARE(check_file_full("/tmp/check_csync2/foo"), CSYNC_NOT_EXCLUDED);
         QVERIFY(excludedFiles->_allExcludes[QStringLiteral("/")].contains("/tmp/check_csync1/*"));
 
-        QVERIFY(excludedFiles->_fullRegexFile[QStringLiteral("/")].pattern().contains("csync1"));
-        QVERIFY(excludedFiles->_fullTraversalRegexFile[QStringLiteral("/")].pattern().contains("csync1"));
-        QVERIFY(!excludedFiles->_bnameTraversalRegexFile[QStringLiteral("/")].pattern().contains("csync1"));
+        QVERIFY(hasPattern(matcher("/").fullPatterns(), "csync1"));
+        QVERIFY(!hasPattern(matcher("/").bnamePatterns(), "csync1"));
+        QVERIFY(!hasPattern(matcher("/").triggers(), "csync1"));
 
         excludedFiles->addManualExclude("foo");
-        QVERIFY(excludedFiles->_bnameTraversalRegexFile[QStringLiteral("/")].pattern().contains("foo"));
-        QVERIFY(excludedFiles->_fullRegexFile[QStringLiteral("/")].pattern().contains("foo"));
-        QVERIFY(!excludedFiles->_fullTraversalRegexFile[QStringLiteral("/")].pattern().contains("foo"));
+        QVERIFY(hasPattern(matcher("/").bnamePatterns(), "foo"));
+        QVERIFY(!hasPattern(matcher("/").fullPatterns(), "foo"));
     }
 
     void check_csync_exclude_add_per_dir()
@@ -116,12 +125,12 @@ private slots:
         QVERIFY(excludedFiles->_allExcludes[QStringLiteral("/tmp/check_csync1/")].contains("*"));
 
         excludedFiles->addManualExclude("foo");
-        QVERIFY(excludedFiles->_fullRegexFile[QStringLiteral("/")].pattern().contains("foo"));
+        QVERIFY(hasPattern(matcher("/").bnamePatterns(), "foo"));
 
         excludedFiles->addManualExclude("foo/bar", "/tmp/check_csync1/");
-        QVERIFY(excludedFiles->_fullRegexFile[QStringLiteral("/tmp/check_csync1/")].pattern().contains("bar"));
-        QVERIFY(excludedFiles->_fullTraversalRegexFile[QStringLiteral("/tmp/check_csync1/")].pattern().contains("bar"));
-        QVERIFY(!excludedFiles->_bnameTraversalRegexFile[QStringLiteral("/tmp/check_csync1/")].pattern().contains("foo"));
+        QVERIFY(hasPattern(matcher("/tmp/check_csync1/").fullPatterns(), "bar"));
+        QVERIFY(!hasPattern(matcher("/tmp/check_csync1/").bnamePatterns(), "foo"));
+        QVERIFY(!hasPattern(matcher("/tmp/check_csync1/").triggers(), "foo"));
     }
 
     void check_csync_excluded()
@@ -554,6 +563,63 @@ private slots:
         QCOMPARE(translate("?𠜎?"), "[^/]\\𠜎[^/]"); // 𠜎 is 4-byte utf8
     }
 
+    void check_exclude_matcher_regex_translation()
+    {
+        // The compiled patterns match the same names as the regular expressions they translate to
+        const QStringList patterns = { "abc", "*.o", "foo*", "*", "a?c", "a*c", "*a*b*", "[ab]*", "a[!xyz]c", "a[x-z]c",
+            "a[xyzc", "a\\*b\\?c\\[d\\\\e", "a\\zc", ".~lock.*#", "*.💩", "пятницы.*", "?𠜎?", "?", "a?b", "[💩x]", "[!a]",
+            "x[😀-😂]", "*?.💩" };
+        const QStringList names = { "", "abc", "ABC", "x.o", ".o", "x.oo", "foo", "foobar", "xfoo", "a", "abbc", "ac", "axbyc",
+            "bcd", "cab", "ayc", "aac", "a[xyzc", "a*b?c[d\\e", "a\\zc", ".~lock.file#", "x.💩", "пятницы.txt",
+            "a𠜎b", "a/c", "x/a.o", "foo/bar", "💩", "a💩b", "😁", "x😁", "x😃", "💩.💩" };
+
+        for (const bool wildcardsMatchSlash : { false, true }) {
+            for (const auto &pattern : patterns) {
+                ExcludeMatcher matcher(wildcardsMatchSlash);
+                matcher.addBnamePattern(pattern, false, false);
+                matcher.compile();
+                const QRegularExpression regex(
+                    QStringLiteral("^(?:%1)$").arg(ExcludedFiles::convertToRegexpSyntax(pattern, wildcardsMatchSlash)));
+                for (const auto &name : names) {
+                    const auto match = matcher.bnameMatch(QStringRef(&name), ItemTypeFile);
+                    if ((match == ExcludeMatcher::Excluded) != regex.match(name).hasMatch())
+                        QFAIL(qPrintable(QStringLiteral("'%1' and '%2' with %3").arg(pattern, name, regex.pattern())));
+                }
+            }
+        }
+    }
+
+    void check_exclude_matcher_surrogate_pairs()
+    {
+        // A character outside of the BMP is a single character, not two
+        ExcludeMatcher matcher;
+        matcher.addBnamePattern("?", false, false);
+        matcher.addBnamePattern("a[💩x]b", false, false);
+        matcher.addBnamePattern("c[!💩]d", false, false);
+        matcher.addBnamePattern("e[😀-😂]", false, false);
+        matcher.addBnamePattern("*😀", true, false);
+        matcher.addFullPattern("f/?", false, false);
+        matcher.compile();
+
+        const auto bname = [&matcher](const QString &name, ItemType type = ItemTypeFile) {
+            return matcher.bnameMatch(QStringRef(&name), type);
+        };
+        QCOMPARE(bname("💩"), ExcludeMatcher::Excluded);
+        QCOMPARE(bname("💩💩"), ExcludeMatcher::NoMatch);
+        QCOMPARE(bname("a💩b"), ExcludeMatcher::Excluded);
+        QCOMPARE(bname("a😀b"), ExcludeMatcher::NoMatch);
+        QCOMPARE(bname("c😀d"), ExcludeMatcher::Excluded);
+        QCOMPARE(bname("c💩d"), ExcludeMatcher::NoMatch);
+        QCOMPARE(bname("e😁"), ExcludeMatcher::Excluded);
+        QCOMPARE(bname("e😃"), ExcludeMatcher::NoMatch);
+        QCOMPARE(bname("x😀", ItemTypeDirectory), ExcludeMatcher::Excluded);
+        QCOMPARE(bname("x😁", ItemTypeDirectory), ExcludeMatcher::NoMatch);
+
+        QCOMPARE(matcher.fullMatch("f/😀", ItemTypeFile), ExcludeMatcher::Excluded);
+        QCOMPARE(matcher.traversalMatch("f/😀", ItemTypeFile), ExcludeMatcher::Excluded);
+        QCOMPARE(matcher.traversalMatch("f/😀😀", ItemTypeFile), ExcludeMatcher::NoMatch);
+    }
+
     void check_csync_bname_trigger()
     {
         setup();
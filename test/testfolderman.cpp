@@ -14,10 +14,26 @@
 #include "account.h"
 #include "accountstate.h"
 #include "configfile.h"
+#include "syncenginetestutils.h"
 #include "testhelper.h"
 
 using namespace OCC;
 
+namespace {
+
+/* Connected without asking a server */
+class ConnectedAccountState : public AccountState
+{
+public:
+    explicit ConnectedAccountState(AccountPtr account)
+        : AccountState(std::move(account))
+    {
+        slotConnectionValidatorResult(ConnectionValidator::Connected, {});
+    }
+};
+
+}
+
 class TestFolderMan: public QObject
 {
     Q_OBJECT
@@ -208,7 +224,83 @@ private slots:
         QCOMPARE(folderman->findGoodPathForNewSyncFolder(dirPath + "/ownCloud2", url),
             QString(dirPath + "/ownCloud22"));
     }
+
+    void testParallelSyncScheduling()
+    {
+        QTemporaryDir dir;
+        ConfigFile::setConfDir(dir.path()); // we don't want to pollute the user's config file
+        QVERIFY(dir.isValid());
+        QDir dir2(dir.path());
+        QVERIFY(dir2.mkpath("A"));
+        QVERIFY(dir2.mkpath("B"));
+        QVERIFY(dir2.mkpath("C"));
+        QString dirPath = dir2.canonicalPath();
+
+        // The server never answers, so the syncs keep running until they are terminated
+        auto fakeQnam = new FakeQNAM({});
+        fakeQnam->setOverride([fakeQnam](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) {
+            return new FakeHangingReply(op, request, fakeQnam);
+        });
+        AccountPtr account = Account::create();
+        account->setCredentials(new FakeCredentials(fakeQnam));
+        account->setUrl(QUrl("http://example.de"));
+
+        // Folders only start syncing while their account is connected
+        AccountStatePtr newAccountState(new ConnectedAccountState(account));
+        QVERIFY(newAccountState->isConnected());
+
+        FolderMan *folderman = FolderMan::instance();
+        QCOMPARE(folderman, &_fm);
+        auto folderA = folderman->addFolder(newAccountState.data(), folderDefinition(dirPath + "/A"));
+        auto folderB = folderman->addFolder(newAccountState.data(), folderDefinition(dirPath + "/B"));
+        auto folderC = folderman->addFolder(newAccountState.data(), folderDefinition(dirPath + "/C"));
+        QVERIFY(folderA && folderB && folderC);
+        folderman->_maxParallelSyncs = 2;
+
+        // Local changes go ahead of the folders queued before
+        folderman->scheduleFolder(folderA);
+        folderman->scheduleFolder(folderB);
+        folderman->scheduleFolderForLocalChanges(folderC);
+        QCOMPARE(folderman->scheduleQueue().size(), 3);
+        QCOMPARE(folderman->scheduleQueue().head(), folderC);
+
+        // Only as many folders start as there are slots, in the order of the queue
+        folderman->slotStartScheduledFolderSync();
+        QCOMPARE(folderman->currentSyncFolders(), QVector<Folder *>({ folderC, folderA }));
+        QCOMPARE(folderman->scheduleQueue().size(), 1);
+        QCOMPARE(folderman->scheduleQueue().head(), folderB);
+
+        // The engines start from the event loop, both really sync at the same time
+        QTRY_VERIFY(folderC->isSyncRunning() && folderA->isSyncRunning());
+        QVERIFY(!folderB->isSyncRunning());
+        QCOMPARE(folderman->currentSyncFolders().size(), 2);
+
+        // The folder with local changes gets the larger part of the resources,
+        // together they don't run more jobs than one sync alone
+        const auto shareC = folderman->resourceShare(folderC);
+        const auto shareA = folderman->resourceShare(folderA);
+        QVERIFY(shareC && shareA);
+        QVERIFY(shareC->hasPriority());
+        QVERIFY(!shareA->hasPriority());
+        QVERIFY(shareC->networkJobs(6) > shareA->networkJobs(6));
+        QVERIFY(shareC->networkJobs(6) + shareA->networkJobs(6) <= 6);
+
+        folderman->slotStartScheduledFolderSync();
+        QCOMPARE(folderman->currentSyncFolders().size(), 2);
+        QVERIFY(!folderman->resourceShare(folderB));
+
+        // A finished sync frees its slot, and the next folder starts on its own
+        folderA->slotTerminateSync();
+        QTRY_VERIFY(!folderman->currentSyncFolders().contains(folderA));
+        QVERIFY(!folderman->resourceShare(folderA));
+        QTRY_VERIFY(folderB->isSyncRunning());
+        QCOMPARE(folderman->currentSyncFolders(), QVector<Folder *>({ folderC, folderB }));
+        QVERIFY(folderC->isSyncRunning());
+        QVERIFY(folderman->scheduleQueue().isEmpty());
+
+        folderman->unloadAndDeleteAllFolders();
+    }
 };
 
-QTEST_APPLESS_MAIN(TestFolderMan)
+QTEST_GUILESS_MAIN(TestFolderMan)
 #include "testfolderman.moc"
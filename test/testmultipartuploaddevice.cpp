@@ -0,0 +1,226 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "multipartuploaddevice.h"
+#include "common/checksums.h"
+
+#include <QCryptographicHash>
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace OCC;
+
+namespace {
+
+QString writeFile(const QTemporaryDir &dir, const QString &name, const QByteArray &content)
+{
+    const auto path = dir.filePath(name);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(content) != content.size())
+        return {};
+    return path;
+}
+
+/* The X-File-MD5 header value, as BulkPropagatorJob sends it */
+QByteArray md5(const QByteArray &data)
+{
+    return makeChecksumHeader(checkSumMD5C, QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex());
+}
+
+/* Reads the device in small pieces, like the network does */
+QByteArray readInPieces(QIODevice &device, qint64 *total = nullptr)
+{
+    QByteArray result;
+    QByteArray piece(16 * 1024, Qt::Uninitialized);
+    qint64 count = 0;
+    while (true) {
+        const auto read = device.read(piece.data(), piece.size());
+        if (read <= 0)
+            break;
+        count += read;
+        if (!total)
+            result.append(piece.constData(), static_cast<int>(read));
+    }
+    if (total)
+        *total = count;
+    return result;
+}
+
+}
+
+class TestMultipartUploadDevice : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBody()
+    {
+        QTemporaryDir dir;
+        const QByteArray contentA(100 * 1000, 'A');
+        const QByteArray contentB = "small";
+        const QByteArray contentC;
+
+        std::vector<SingleUploadFileData> files;
+        files.push_back({ writeFile(dir, "a", contentA), contentA.size(), { { "X-File-MD5", md5(contentA) }, { "X-File-Path", "/a" } } });
+        files.push_back({ writeFile(dir, "b", contentB), contentB.size(), { { "X-File-Path", "/b" } } });
+        files.push_back({ writeFile(dir, "c", contentC), contentC.size(), { { "X-File-MD5", md5(contentC) }, { "X-File-Path", "/c" } } });
+
+        // A buffer smaller than the first file
+        MultipartUploadDevice device(std::move(files), nullptr, 4096);
+        QVERIFY(device.contentType().startsWith("multipart/related; boundary=\""));
+        const auto boundary = device.contentType().mid(29).chopped(1);
+
+        QByteArray expected;
+        expected += "--" + boundary + "\r\nX-File-MD5: " + md5(contentA) + "\r\nX-File-Path: /a\r\n\r\n" + contentA + "\r\n";
+        expected += "--" + boundary + "\r\nX-File-Path: /b\r\n\r\n" + contentB + "\r\n";
+        expected += "--" + boundary + "\r\nX-File-MD5: " + md5(contentC) + "\r\nX-File-Path: /c\r\n\r\n" + contentC + "\r\n";
+        expected += "--" + boundary + "--\r\n";
+
+        QVERIFY(device.open(QIODevice::ReadOnly));
+        QCOMPARE(device.size(), qint64(expected.size()));
+        QCOMPARE(device.bytesAvailable(), qint64(expected.size()));
+        QCOMPARE(readInPieces(device), expected);
+        QVERIFY(device.atEnd());
+        QVERIFY(!device.failed());
+    }
+
+    // The progress of the body is mapped to the file being read from where its data starts
+    void testPartStart()
+    {
+        QTemporaryDir dir;
+        // a spans several reads
+        const QByteArray contentA(40 * 1000, 'A');
+        const QByteArray contentB(10 * 1000, 'B');
+        std::vector<SingleUploadFileData> files;
+        files.push_back({ writeFile(dir, "a", contentA), contentA.size(), { { "X-File-Path", "/a" } } });
+        files.push_back({ writeFile(dir, "b", contentB), contentB.size(), { { "X-File-Path", "/b" } } });
+
+        // Every read fills the small buffer several times, so b starts in the middle of one
+        MultipartUploadDevice device(std::move(files), nullptr, 4096);
+        QVERIFY(device.open(QIODevice::ReadOnly));
+        QByteArray body;
+        QVector<qint64> partStarts;
+        QByteArray piece(16 * 1024, Qt::Uninitialized);
+        while (true) {
+            const auto read = device.read(piece.data(), piece.size());
+            if (read <= 0)
+                break;
+            body.append(piece.constData(), static_cast<int>(read));
+            if (partStarts.isEmpty() || partStarts.last() != device.partStart())
+                partStarts.append(device.partStart());
+        }
+        QVERIFY(!device.failed());
+
+        const QVector<qint64> expected = { body.indexOf(contentA), body.indexOf(contentB) };
+        QCOMPARE(partStarts, expected);
+    }
+
+    void testChangedFile()
+    {
+        QTemporaryDir dir;
+        const QByteArray content(10 * 1000, 'A');
+        const auto path = writeFile(dir, "a", content);
+
+        // The file changed after the checksum was computed
+        std::vector<SingleUploadFileData> files;
+        files.push_back({ path, content.size(), { { "X-File-MD5", md5(QByteArray(content.size(), 'B')) } } });
+        MultipartUploadDevice device(std::move(files), nullptr, 4096);
+        QVERIFY(device.open(QIODevice::ReadOnly));
+        readInPieces(device);
+        QVERIFY(device.failed());
+
+        // The file got shorter
+        files.clear();
+        files.push_back({ path, content.size() + 10, {} });
+        MultipartUploadDevice shorter(std::move(files), nullptr, 4096);
+        QVERIFY(shorter.open(QIODevice::ReadOnly));
+        readInPieces(shorter);
+        QVERIFY(shorter.failed());
+
+        // The file is gone
+        files.clear();
+        files.push_back({ dir.filePath("missing"), 10, {} });
+        MultipartUploadDevice missing(std::move(files), nullptr, 4096);
+        QVERIFY(missing.open(QIODevice::ReadOnly));
+        readInPieces(missing);
+        QVERIFY(missing.failed());
+    }
+
+    // The header is built from the file like BulkPropagatorJob does it
+    void testChecksumHeader()
+    {
+        QTemporaryDir dir;
+        const QByteArray content(10 * 1000, 'A');
+        const auto path = writeFile(dir, "a", content);
+        const auto header = makeChecksumHeader(checkSumMD5C, ComputeChecksum::computeNowOnFile(path, checkSumMD5C));
+        QVERIFY(header.startsWith("MD5:"));
+
+        std::vector<SingleUploadFileData> files;
+        files.push_back({ path, content.size(), { { "X-File-MD5", header }, { "X-File-Path", "/a" } } });
+        MultipartUploadDevice device(std::move(files), nullptr, 4096);
+        QVERIFY(device.open(QIODevice::ReadOnly));
+        readInPieces(device);
+        QVERIFY(!device.failed());
+
+        // The same header fails once the content changed
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QCOMPARE(file.write(QByteArray(content.size(), 'B')), qint64(content.size()));
+        file.close();
+        files.clear();
+        files.push_back({ path, content.size(), { { "X-File-MD5", header }, { "X-File-Path", "/a" } } });
+        MultipartUploadDevice changed(std::move(files), nullptr, 4096);
+        QVERIFY(changed.open(QIODevice::ReadOnly));
+        readInPieces(changed);
+        QVERIFY(changed.failed());
+
+        // Other checksum types are not verified
+        files.clear();
+        files.push_back({ path, content.size(), { { "X-File-MD5", makeChecksumHeader(checkSumSHA1C, "0123") } } });
+        MultipartUploadDevice otherType(std::move(files), nullptr, 4096);
+        QVERIFY(otherType.open(QIODevice::ReadOnly));
+        readInPieces(otherType);
+        QVERIFY(!otherType.failed());
+    }
+
+    // The memory held while streaming doesn't grow with the batch
+    void testConstantMemory_data()
+    {
+        QTest::addColumn<int>("fileCount");
+        QTest::newRow("10 files") << 10;
+        QTest::newRow("100 files") << 100;
+        QTest::newRow("1000 files") << 1000;
+    }
+
+    void testConstantMemory()
+    {
+        QFETCH(int, fileCount);
+        const qint64 bufferSize = 64 * 1024;
+        const QByteArray content(10 * 1000, 'x');
+
+        QTemporaryDir dir;
+        std::vector<SingleUploadFileData> files;
+        for (int i = 0; i < fileCount; ++i) {
+            const auto name = QString::number(i);
+            files.push_back({ writeFile(dir, name, content), content.size(), { { "X-File-MD5", md5(content) }, { "X-File-Path", name.toUtf8() } } });
+        }
+
+        MultipartUploadDevice device(std::move(files), nullptr, bufferSize);
+        QVERIFY(device.open(QIODevice::ReadOnly));
+        qint64 total = 0;
+        readInPieces(device, &total);
+        QVERIFY(!device.failed());
+        QCOMPARE(total, device.size());
+        QVERIFY(total > fileCount * content.size());
+
+        // The buffer, plus at most the part header that didn't fit anymore
+        QVERIFY(device.peakBufferedSize() <= bufferSize + 1024);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestMultipartUploadDevice)
+#include "testmultipartuploaddevice.moc"
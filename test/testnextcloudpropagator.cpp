@@ -9,12 +9,31 @@
 
 #include "propagatedownload.h"
 #include "owncloudpropagator_p.h"
+#include "transferconcurrencycontroller.h"
+#include "syncresourcebudget.h"
 
 using namespace OCC;
+using namespace std::chrono_literals;
 namespace OCC {
 QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous);
 }
 
+/* Feeds the controller with one interval worth of transfers per loop on a link where a
+ * single transfer reaches at most perTransfer bytes/s and all of them together capacity bytes/s.
+ */
+static void simulateTransfers(TransferConcurrencyController &controller, std::chrono::milliseconds &now, int intervals,
+    qint64 perTransfer, qint64 capacity, TransferConcurrencyController::Outcome outcome = TransferConcurrencyController::Outcome::Success)
+{
+    for (int i = 0; i < intervals; ++i) {
+        const int window = controller.window();
+        const qint64 throughput = qMin(window * perTransfer, capacity);
+        for (int j = 0; j < window; ++j) {
+            now += std::chrono::milliseconds(1000 / window + 1);
+            controller.addSample(throughput / window, 500ms, outcome, window, now);
+        }
+    }
+}
+
 class TestNextcloudPropagator : public QObject
 {
     Q_OBJECT
@@ -76,6 +95,113 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testTransferConcurrencyGrowsOnLatencyBoundLinks()
+    {
+        TransferConcurrencyController controller;
+        controller.reset(20);
+        QCOMPARE(controller.window(), 3);
+
+        // Each transfer only gets 1 MB/s but the link can do 20 MB/s
+        auto now = 0ms;
+        simulateTransfers(controller, now, 60, 1000 * 1000, 20 * 1000 * 1000);
+        QVERIFY(controller.window() >= 15);
+        QVERIFY(controller.window() <= controller.maximumWindow());
+    }
+
+    void testTransferConcurrencyStaysLowWhenLimited()
+    {
+        TransferConcurrencyController controller;
+        controller.reset(20);
+
+        // 3 transfers already saturate the link, for example because of a bandwidth limit
+        auto now = 0ms;
+        simulateTransfers(controller, now, 60, 1000 * 1000, 3 * 1000 * 1000);
+        QVERIFY(controller.window() >= 3);
+        QVERIFY(controller.window() <= 4);
+    }
+
+    void testTransferConcurrencyBacksOffWhenOverloaded()
+    {
+        TransferConcurrencyController controller;
+        controller.reset(20);
+
+        auto now = 0ms;
+        simulateTransfers(controller, now, 60, 1000 * 1000, 20 * 1000 * 1000);
+        const auto window = controller.window();
+        simulateTransfers(controller, now, 1, 1000 * 1000, 20 * 1000 * 1000, TransferConcurrencyController::Outcome::ServerOverloaded);
+        QCOMPARE(controller.window(), window / 2);
+
+        // Unrelated errors don't count
+        const auto before = controller.window();
+        simulateTransfers(controller, now, 5, 1000 * 1000, 20 * 1000 * 1000, TransferConcurrencyController::Outcome::OtherError);
+        QCOMPARE(controller.window(), before);
+    }
+
+    void testTransferConcurrencySmallFileSize()
+    {
+        TransferConcurrencyController controller;
+        controller.reset(6);
+        QCOMPARE(controller.smallFileSize(), qint64(100 * 1024));
+
+        // 200 ms round trips at 10 MB/s per transfer: 2 MB fit in a round trip
+        controller.addSample(1024, 200ms, TransferConcurrencyController::Outcome::Success, 1, 200ms);
+        controller.addSample(10 * 1000 * 1000, 1000ms, TransferConcurrencyController::Outcome::Success, 1, 1200ms);
+        QCOMPARE(controller.roundTripTime(), 200ms);
+        QCOMPARE(controller.smallFileSize(), qint64(2 * 1000 * 1000));
+    }
+
+    void testTransferConcurrencyOutcome()
+    {
+        using Outcome = TransferConcurrencyController::Outcome;
+        QCOMPARE(TransferConcurrencyController::outcome(200, QNetworkReply::NoError, false), Outcome::Success);
+        QCOMPARE(TransferConcurrencyController::outcome(503, QNetworkReply::ServiceUnavailableError, false), Outcome::ServerOverloaded);
+        QCOMPARE(TransferConcurrencyController::outcome(429, QNetworkReply::UnknownContentError, false), Outcome::ServerOverloaded);
+        QCOMPARE(TransferConcurrencyController::outcome(0, QNetworkReply::OperationCanceledError, true), Outcome::ServerOverloaded);
+        QCOMPARE(TransferConcurrencyController::outcome(404, QNetworkReply::ContentNotFoundError, false), Outcome::OtherError);
+    }
+
+    void testSyncResourceBudget()
+    {
+        SyncResourceBudget budget(12, 4);
+
+        auto first = budget.acquire();
+        QCOMPARE(first->networkJobs(6), 6);
+        QCOMPARE(first->networkJobs(20), 12);
+        QCOMPARE(first->localDiscoveryThreads(8), 4);
+
+        // A priority sync gets twice the part of a normal one
+        auto second = budget.acquire();
+        auto third = budget.acquire(true);
+        QCOMPARE(budget.activeShares(), 3);
+        QCOMPARE(first->networkJobs(20), 3);
+        QCOMPARE(second->networkJobs(20), 3);
+        QCOMPARE(third->networkJobs(20), 6);
+        QCOMPARE(first->localDiscoveryThreads(8), 1);
+        QCOMPARE(third->localDiscoveryThreads(8), 2);
+
+        // Finished syncs give their part back
+        budget.release(second);
+        budget.release(third);
+        QCOMPARE(budget.activeShares(), 1);
+        QCOMPARE(first->networkJobs(20), 12);
+        QCOMPARE(third->networkJobs(20), 20);
+
+        // Every sync can run at least one job
+        for (int i = 0; i < 20; ++i)
+            budget.acquire();
+        QCOMPARE(first->networkJobs(6), 1);
+
+        // By default the syncs together run as many jobs as one of them alone
+        SyncResourceBudget defaultBudget;
+        auto alone = defaultBudget.acquire();
+        QCOMPARE(alone->networkJobs(6), 6);
+        QCOMPARE(alone->networkJobs(20), 20);
+        auto normal = defaultBudget.acquire();
+        auto priority = defaultBudget.acquire(true);
+        QVERIFY(alone->networkJobs(6) + normal->networkJobs(6) + priority->networkJobs(6) <= 6);
+        QCOMPARE(priority->networkJobs(6), 3);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestNextcloudPropagator)
@@ -0,0 +1,189 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "socketapi/socketstatusbroadcaster.h"
+#include "socketapi/socketapi_p.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QSignalSpy>
+#include <QtTest>
+
+using namespace OCC;
+
+namespace {
+
+struct FakeListener
+{
+    FakeListener()
+    {
+        buffer.open(QIODevice::WriteOnly);
+        listener = QSharedPointer<SocketListener>::create(&buffer);
+    }
+
+    QStringList takeLines()
+    {
+        auto lines = QString::fromUtf8(buffer.data()).split(QLatin1Char('\n'), QString::SkipEmptyParts);
+        buffer.buffer().clear();
+        buffer.seek(0);
+        return lines;
+    }
+
+    QBuffer buffer;
+    QSharedPointer<SocketListener> listener;
+};
+
+QString statusLine(const char *status, const QString &path)
+{
+    return QStringLiteral("STATUS:%1:%2").arg(QLatin1String(status), QDir::toNativeSeparators(path));
+}
+
+}
+
+class TestSocketStatusBroadcaster : public QObject
+{
+    Q_OBJECT
+
+    QMap<QIODevice *, QSharedPointer<SocketListener>> _listeners;
+
+private slots:
+    void cleanup()
+    {
+        _listeners.clear();
+    }
+
+    void testCoalesce()
+    {
+        FakeListener fake;
+        fake.listener->registerMonitoredDirectory(qHash(QStringLiteral("/sync")));
+        fake.listener->registerMonitoredDirectory(qHash(QStringLiteral("/sync/A")));
+        _listeners.insert(&fake.buffer, fake.listener);
+
+        SocketStatusBroadcaster broadcaster(_listeners);
+        broadcaster.setDelay(10);
+        // Like SyncFileStatusTracker, a file and its parents, twice
+        broadcaster.push(QStringLiteral("/sync/A/a1"), SyncFileStatus::StatusSync);
+        broadcaster.push(QStringLiteral("/sync/A"), SyncFileStatus::StatusSync);
+        broadcaster.push(QStringLiteral("/sync/A/a2"), SyncFileStatus::StatusSync);
+        broadcaster.push(QStringLiteral("/sync/A"), SyncFileStatus::StatusSync);
+        broadcaster.push(QStringLiteral("/sync/A/a1"), SyncFileStatus::StatusUpToDate);
+        // Nobody looks at that directory
+        broadcaster.push(QStringLiteral("/sync/B/b1"), SyncFileStatus::StatusSync);
+
+        QVERIFY(fake.buffer.data().isEmpty());
+        QCOMPARE(broadcaster.stats().queueDepth, 4);
+        QTRY_VERIFY(!fake.buffer.data().isEmpty());
+
+        QCOMPARE(fake.takeLines(), QStringList({ statusLine("OK", QStringLiteral("/sync/A/a1")),
+                                       statusLine("SYNC", QStringLiteral("/sync/A")),
+                                       statusLine("SYNC", QStringLiteral("/sync/A/a2")) }));
+
+        const auto stats = broadcaster.stats();
+        QCOMPARE(stats.queueDepth, 0);
+        QCOMPARE(stats.queued, 6ull);
+        QCOMPARE(stats.merged, 2ull);
+        QCOMPARE(stats.dropped, 0ull);
+        QCOMPARE(stats.sent, 3ull);
+    }
+
+    void testSubscription()
+    {
+        FakeListener monitoring;
+        monitoring.listener->registerMonitoredDirectory(qHash(QStringLiteral("/sync/A")));
+        FakeListener subscribed;
+        subscribed.listener->subscribeToDirectory(QStringLiteral("/sync/A"));
+        _listeners.insert(&monitoring.buffer, monitoring.listener);
+        _listeners.insert(&subscribed.buffer, subscribed.listener);
+
+        SocketStatusBroadcaster broadcaster(_listeners);
+        const QStringList paths = { QStringLiteral("/sync/A"), QStringLiteral("/sync/A/a1"),
+            QStringLiteral("/sync/A/sub/deep"), QStringLiteral("/sync/AB/x") };
+        for (const auto &path : paths)
+            broadcaster.push(path, SyncFileStatus::StatusSync);
+        broadcaster.flush();
+
+        QCOMPARE(monitoring.takeLines(), QStringList({ statusLine("SYNC", QStringLiteral("/sync/A/a1")) }));
+        QCOMPARE(subscribed.takeLines(), QStringList({ statusLine("SYNC", QStringLiteral("/sync/A")),
+                                             statusLine("SYNC", QStringLiteral("/sync/A/a1")),
+                                             statusLine("SYNC", QStringLiteral("/sync/A/sub/deep")) }));
+
+        subscribed.listener->unsubscribeFromDirectory(QStringLiteral("/sync/A"));
+        broadcaster.push(QStringLiteral("/sync/A/sub/deep"), SyncFileStatus::StatusUpToDate);
+        broadcaster.flush();
+        QVERIFY(subscribed.takeLines().isEmpty());
+    }
+
+    void testRateLimit()
+    {
+        FakeListener fake;
+        fake.listener->subscribeToDirectory(QStringLiteral("/sync"));
+        _listeners.insert(&fake.buffer, fake.listener);
+
+        SocketStatusBroadcaster broadcaster(_listeners);
+        broadcaster.setDelay(10);
+        broadcaster.setMaxBatchSize(10);
+        for (int i = 0; i < 25; ++i)
+            broadcaster.push(QStringLiteral("/sync/f%1").arg(i), SyncFileStatus::StatusSync);
+
+        broadcaster.flush();
+        QCOMPARE(fake.takeLines().size(), 10);
+        QCOMPARE(broadcaster.stats().queueDepth, 15);
+
+        // The rest follows with the next delays
+        QTRY_COMPARE(broadcaster.stats().queueDepth, 0);
+        QCOMPARE(fake.takeLines().size(), 15);
+        QCOMPARE(broadcaster.stats().sent, 25ull);
+    }
+
+    void testFlushAll()
+    {
+        FakeListener fake;
+        fake.listener->subscribeToDirectory(QStringLiteral("/sync"));
+        _listeners.insert(&fake.buffer, fake.listener);
+
+        SocketStatusBroadcaster broadcaster(_listeners);
+        broadcaster.setMaxBatchSize(10);
+        for (int i = 0; i < 25; ++i)
+            broadcaster.push(QStringLiteral("/sync/f%1").arg(i), SyncFileStatus::StatusSync);
+
+        // Nothing is left behind the message that follows
+        broadcaster.flushAll();
+        const auto lines = fake.takeLines();
+        QCOMPARE(lines.size(), 25);
+        QCOMPARE(lines.last(), statusLine("SYNC", QStringLiteral("/sync/f24")));
+        QCOMPARE(broadcaster.stats().queueDepth, 0);
+        QCOMPARE(broadcaster.stats().sent, 25ull);
+    }
+
+    void testOverflow()
+    {
+        FakeListener fake;
+        fake.listener->subscribeToDirectory(QStringLiteral("/sync"));
+        _listeners.insert(&fake.buffer, fake.listener);
+
+        SocketStatusBroadcaster broadcaster(_listeners);
+        broadcaster.setMaxQueueSize(10);
+        QSignalSpy overflowed(&broadcaster, &SocketStatusBroadcaster::overflowed);
+        for (int i = 0; i < 10; ++i)
+            broadcaster.push(QStringLiteral("/sync/f%1").arg(i), SyncFileStatus::StatusSync);
+        // Replacing a queued status doesn't grow the queue
+        broadcaster.push(QStringLiteral("/sync/f0"), SyncFileStatus::StatusUpToDate);
+        QCOMPARE(overflowed.count(), 0);
+
+        broadcaster.push(QStringLiteral("/sync/f10"), SyncFileStatus::StatusSync);
+        QCOMPARE(overflowed.count(), 1);
+        QCOMPARE(broadcaster.stats().queueDepth, 0);
+        QCOMPARE(broadcaster.stats().dropped, 11ull);
+
+        broadcaster.push(QStringLiteral("/sync/f11"), SyncFileStatus::StatusSync);
+        broadcaster.flush();
+        QCOMPARE(fake.takeLines(), QStringList({ statusLine("SYNC", QStringLiteral("/sync/f11")) }));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSocketStatusBroadcaster)
+#include "testsocketstatusbroadcaster.moc"
@@ -1030,6 +1030,40 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    /**
+     * Checks that bulk uploads are split by size and that several batches run at once
+     */
+    void testConcurrentBulkUploadBatches()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"bulkupload", "1.0"} } } });
+
+        int nPOST = 0;
+        int running = 0;
+        int maxRunning = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            const auto contentType = request.header(QNetworkRequest::ContentTypeHeader).toString();
+            if (op != QNetworkAccessManager::PostOperation || !contentType.startsWith(QStringLiteral("multipart/related; boundary="))) {
+                return nullptr;
+            }
+            ++nPOST;
+            maxRunning = qMax(maxRunning, ++running);
+            auto reply = new DelayedReply<FakePutMultiFileReply>(100, fakeFolder.remoteModifier(), op, request, contentType, outgoingData->readAll(), &fakeFolder.syncEngine());
+            QObject::connect(reply, &QNetworkReply::finished, reply, [&] { --running; });
+            return reply;
+        });
+
+        // Too much data for one batch
+        for (int i = 0; i < 40; ++i) {
+            fakeFolder.localModifier().insert(QStringLiteral("A/file%1").arg(i), 500 * 1000);
+        }
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(nPOST > 1);
+        QVERIFY(maxRunning > 1);
+    }
+
     void testRemoteMoveFailedInsufficientStorageLocalMoveRolledBack()
     {
         FakeFolder fakeFolder{FileInfo{}};
@@ -1244,6 +1278,76 @@ private slots:
         auto expectedState = fakeFolder.currentLocalState();
         QCOMPARE(fakeFolder.currentRemoteState(), expectedState);
     }
+
+    void testStreamPropagation()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._streamPropagation = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.remoteModifier().mkdir(QStringLiteral("fast"));
+        fakeFolder.remoteModifier().mkdir(QStringLiteral("fast/sub"));
+        fakeFolder.remoteModifier().insert(QStringLiteral("fast/f1"));
+        fakeFolder.remoteModifier().insert(QStringLiteral("fast/sub/f2"));
+        fakeFolder.remoteModifier().mkdir(QStringLiteral("slow"));
+        fakeFolder.remoteModifier().insert(QStringLiteral("slow/f3"));
+        fakeFolder.remoteModifier().insert(QStringLiteral("f4"));
+
+        // "fast" gets downloaded while "slow" is still being listed
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND" && request.url().path().endsWith(QLatin1String("/slow")))
+                return new DelayedReply<FakePropfindReply>(300, fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+            return nullptr;
+        });
+
+        bool discoveryFinished = false;
+        QStringList completedDuringDiscovery;
+        int aboutToPropagateCount = 0;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress, [&](const ProgressInfo &progress) {
+            if (progress.status() == ProgressInfo::Reconcile)
+                discoveryFinished = true;
+        });
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            if (!discoveryFinished)
+                completedDuringDiscovery.append(item->_file);
+        });
+        connect(&fakeFolder.syncEngine(), &SyncEngine::aboutToPropagate, [&] { ++aboutToPropagateCount; });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(aboutToPropagateCount, 1);
+
+        completedDuringDiscovery.sort();
+        QCOMPARE(completedDuringDiscovery, QStringList({ "fast", "fast/f1", "fast/sub", "fast/sub/f2" }));
+    }
+
+    void testStreamPropagationKeepsRenames()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._streamPropagation = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+
+        // A rename into a directory, a removal and a new directory next to them
+        fakeFolder.remoteModifier().rename(QStringLiteral("A"), QStringLiteral("B/A"));
+        fakeFolder.remoteModifier().remove(QStringLiteral("C"));
+        fakeFolder.remoteModifier().mkdir(QStringLiteral("D"));
+        fakeFolder.remoteModifier().insert(QStringLiteral("D/d1"));
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET, 1);
+        QVERIFY(fakeFolder.currentLocalState().find("B/A/a1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("C"));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -7,6 +7,7 @@
 #include <QtTest>
 
 #include "syncfileitem.h"
+#include "common/syncjournalfilerecord.h"
 
 using namespace OCC;
 
@@ -63,6 +64,56 @@ private slots:
         QVERIFY(!(b < b));
         QVERIFY(!(c < c));
     }
+
+    void testExtra() {
+        SyncFileItem item;
+        QVERIFY(item.extra()._directDownloadUrl.isEmpty());
+        QCOMPARE(item.extra()._lockOwnerType, SyncFileItem::LockOwnerType::UserLock);
+
+        item.mutableExtra()._directDownloadUrl = QStringLiteral("https://example.com/file");
+        SyncFileItem copy = item;
+        copy.mutableExtra()._directDownloadUrl.clear();
+        QCOMPARE(item.extra()._directDownloadUrl, QStringLiteral("https://example.com/file"));
+        QVERIFY(copy.extra()._directDownloadUrl.isEmpty());
+
+        item.clearExtra();
+        QVERIFY(item.extra()._directDownloadUrl.isEmpty());
+    }
+
+    void testLockRoundTrip() {
+        SyncFileItem item;
+        item._file = QStringLiteral("locked.txt");
+        item._locked = SyncFileItem::LockStatus::LockedItem;
+        item.mutableExtra()._lockOwnerId = QStringLiteral("alice");
+        item.mutableExtra()._lockOwnerType = SyncFileItem::LockOwnerType::AppLock;
+        item.mutableExtra()._lockTimeout = 1800;
+
+        const auto record = item.toSyncJournalFileRecordWithInode(QStringLiteral("/nonexistent/locked.txt"));
+        QVERIFY(record._lockstate._locked);
+        QCOMPARE(record._lockstate._lockOwnerId, QStringLiteral("alice"));
+
+        const auto restored = SyncFileItem::fromSyncJournalFileRecord(record);
+        QCOMPARE(restored->_locked, SyncFileItem::LockStatus::LockedItem);
+        QCOMPARE(restored->extra()._lockOwnerId, QStringLiteral("alice"));
+        QCOMPARE(restored->extra()._lockOwnerType, SyncFileItem::LockOwnerType::AppLock);
+        QCOMPARE(restored->extra()._lockTimeout, qint64(1800));
+    }
+
+    void testEncryptedFileNameRoundTrip() {
+        SyncFileItem item;
+        item._file = QStringLiteral("e2e/file.txt");
+        item._isEncrypted = true;
+        item.mutableExtra()._encryptedFileName = QStringLiteral("e2e/9f8c3a");
+
+        const auto record = item.toSyncJournalFileRecordWithInode(QStringLiteral("/nonexistent/e2e/file.txt"));
+        QCOMPARE(record._e2eMangledName, QByteArray("e2e/9f8c3a"));
+        QCOMPARE(SyncFileItem::fromSyncJournalFileRecord(record)->extra()._encryptedFileName, QStringLiteral("e2e/9f8c3a"));
+
+        item.clearExtra();
+        const auto plainRecord = item.toSyncJournalFileRecordWithInode(QStringLiteral("/nonexistent/e2e/file.txt"));
+        QVERIFY(plainRecord._e2eMangledName.isEmpty());
+        QVERIFY(SyncFileItem::fromSyncJournalFileRecord(plainRecord)->extra()._encryptedFileName.isEmpty());
+    }
 };
 
 QTEST_APPLESS_MAIN(TestSyncFileItem)
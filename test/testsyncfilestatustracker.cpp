@@ -467,6 +467,43 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void cachedStatusAfterRestart() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.serverErrorPaths().append("A/a1");
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.localModifier().appendByte("B/b1");
+        fakeFolder.syncOnce();
+        QCOMPARE(fakeFolder.syncEngine().syncFileStatusTracker().fileStatus("A"), SyncFileStatus(SyncFileStatus::StatusWarning));
+
+        // A new tracker gets the problems of the last sync from the journal
+        {
+            SyncFileStatusTracker restarted(&fakeFolder.syncEngine());
+            QCOMPARE(restarted.fileStatus(""), SyncFileStatus(SyncFileStatus::StatusWarning));
+            QCOMPARE(restarted.fileStatus("A"), SyncFileStatus(SyncFileStatus::StatusWarning));
+            QCOMPARE(restarted.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusError));
+            QCOMPARE(restarted.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+            QCOMPARE(restarted.fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        }
+
+        // And notices when they are resolved, or the files are gone
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.syncEngine().journal()->wipeErrorBlacklistEntry("A/a1");
+        fakeFolder.remoteModifier().remove("B");
+        SyncFileStatusTracker restarted(&fakeFolder.syncEngine());
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+        QVERIFY(fakeFolder.syncOnce());
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(restarted.fileStatus(""), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(restarted.fileStatus("A"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(restarted.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+
+        SyncFileStatusTracker restartedAgain(&fakeFolder.syncEngine());
+        QCOMPARE(restartedAgain.fileStatus(""), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(restartedAgain.fileStatus("A"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(restartedAgain.fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusNone));
+        QCOMPARE(restartedAgain.fileStatus("B/b1"), SyncFileStatus(SyncFileStatus::StatusNone));
+    }
+
     void renameError() {
         // when rename has failed - the old file name must be restored
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
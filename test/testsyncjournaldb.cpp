@@ -8,6 +8,7 @@
 
 #include <sqlite3.h>
 
+#include "common/ownsql.h"
 #include "common/syncjournaldb.h"
 #include "common/syncjournalfilerecord.h"
 
@@ -126,6 +127,92 @@ private slots:
         }
     }
 
+    void testFileRecords()
+    {
+        // More than fit into one multi-row statement, with a remainder
+        QVector<SyncJournalFileRecord> records;
+        for (int i = 0; i < 70; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "bulk/file" + QByteArray::number(i);
+            record._inode = 5000 + i;
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            record._checksumHeader = i % 2 ? "SHA1:bulkchecksum" : "MD5:bulkchecksum";
+            record._modtime = Utility::qDateTimeToTime_t(QDateTime::currentDateTimeUtc());
+            record._fileSize = i;
+            records.append(record);
+        }
+        QVERIFY(_db.setFileRecords(records));
+
+        for (const auto &record : qAsConst(records)) {
+            SyncJournalFileRecord storedRecord;
+            QVERIFY(_db.getFileRecord(record._path, &storedRecord));
+            QVERIFY(storedRecord == record);
+        }
+    }
+
+    void testQueuedFileRecords()
+    {
+        SyncJournalFileRecord record;
+        record._path = "queued";
+        record._inode = 6000;
+        record._remotePerm = RemotePermissions::fromDbValue("RW");
+        record._modtime = Utility::qDateTimeToTime_t(QDateTime::currentDateTimeUtc());
+        _db.queueFileRecord(record);
+
+        // Reads see queued records even if the writer didn't get to them yet
+        SyncJournalFileRecord storedRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("queued"), &storedRecord));
+        QVERIFY(storedRecord == record);
+
+        record._fileSize = 42;
+        _db.queueFileRecord(record);
+        QVERIFY(_db.flushQueuedFileRecords());
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("queued"), &storedRecord));
+        QCOMPARE(storedRecord._fileSize, qint64(42));
+    }
+
+    void testQueuedFileRecordsTransactionAndClose()
+    {
+        QTemporaryDir tempDir;
+        const QString dbFile = tempDir.path() + "/queued.db";
+        SyncJournalDb db(dbFile);
+        QVERIFY(db.open());
+
+        const auto countRecords = [&dbFile] {
+            SqlDatabase other;
+            if (!other.openReadOnly(dbFile)) {
+                return -1;
+            }
+            SqlQuery query("SELECT COUNT(*) FROM metadata;", other);
+            if (!query.exec() || !query.next().hasData) {
+                return -1;
+            }
+            return query.intValue(0);
+        };
+
+        SyncJournalFileRecord record;
+        record._path = "queued";
+        record._inode = 6001;
+        record._remotePerm = RemotePermissions::fromDbValue("RW");
+        record._modtime = Utility::qDateTimeToTime_t(QDateTime::currentDateTimeUtc());
+
+        // The writer adds to the open transaction but leaves committing it to its owner
+        db.commitIfNeededAndStartNewTransaction(QStringLiteral("test"));
+        db.queueFileRecord(record);
+        QTest::qWait(500);
+        QCOMPARE(countRecords(), 0);
+        db.commit(QStringLiteral("test"), false);
+        QCOMPARE(countRecords(), 1);
+
+        // Closing writes what is queued and the writer doesn't reopen the database afterwards
+        record._path = "queued2";
+        db.queueFileRecord(record);
+        db.close();
+        QTest::qWait(500);
+        QVERIFY(!db.isOpen());
+        QCOMPARE(countRecords(), 2);
+    }
+
     void testDownloadInfo()
     {
         using Info = SyncJournalDb::DownloadInfo;
@@ -141,6 +228,12 @@ private slots:
         Info storedRecord = _db.getDownloadInfo("foo");
         QVERIFY(storedRecord == record);
 
+        record._segments = { { 0, 5000000000, 1234 }, { 5000000000, 10000000000, 0 } };
+        _db.setDownloadInfo("foo", record);
+        storedRecord = _db.getDownloadInfo("foo");
+        QCOMPARE(storedRecord._segments.size(), 2);
+        QVERIFY(storedRecord == record);
+
         _db.setDownloadInfo("foo", Info());
         Info wipedRecord = _db.getDownloadInfo("foo");
         QVERIFY(!wipedRecord._valid);
@@ -320,6 +413,157 @@ private slots:
         QVERIFY(checkElements());
     }
 
+    void testFileRecordSnapshot()
+    {
+        auto makeEntry = [&](const QByteArray &path, ItemType type) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._type = type;
+            record._etag = "etag";
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            QVERIFY(_db.setFileRecord(record));
+        };
+        makeEntry("snap", ItemTypeDirectory);
+        makeEntry("snap/a", ItemTypeFile);
+        makeEntry("snap/a.txt", ItemTypeFile);
+        makeEntry("snap/a-b", ItemTypeFile);
+        makeEntry("snap/dir", ItemTypeDirectory);
+        makeEntry("snap/dir/file", ItemTypeFile);
+        makeEntry("snap/dir/sub", ItemTypeDirectory);
+        makeEntry("snap/dir/sub/file", ItemTypeFile);
+        makeEntry("snap/dir0", ItemTypeFile);
+        // Sorts between "snap/dir/..." and "snap/dir0"
+        makeEntry("snap/dir0.txt", ItemTypeFile);
+        makeEntry("snap/nodir/orphan", ItemTypeFile);
+
+        auto list = [&](const QByteArray &path) {
+            QByteArrayList result;
+            _db.listFilesInPath(path, [&](const SyncJournalFileRecord &record) { result.append(record._path); });
+            return result;
+        };
+        auto get = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            _db.getFileRecord(path, &record);
+            return record;
+        };
+        const QByteArrayList paths = { "snap", "snap/dir", "snap/dir/sub", "snap/nodir", "snap/a" };
+
+        QMap<QByteArray, QByteArrayList> expected;
+        for (const auto &path : paths)
+            expected[path] = list(path);
+
+        QVERIFY(_db.loadFileRecordSnapshot());
+        // Same results and order as the queries
+        for (const auto &path : paths)
+            QCOMPARE(list(path), expected[path]);
+        QVERIFY(list("snap").contains("snap/dir0.txt"));
+        QVERIFY(get("snap/dir/sub/file").isValid());
+        QVERIFY(!get("snap/missing").isValid());
+        QVERIFY(!get("snap/nodir").isValid());
+
+        // Changes go to the snapshot as well
+        makeEntry("snap/new", ItemTypeFile);
+        QVERIFY(get("snap/new").isValid());
+        QVERIFY(_db.updateLocalMetadata("snap/a", 1234, 42, 7));
+        QCOMPARE(get("snap/a")._fileSize, qint64(42));
+        _db.deleteFileRecord("snap/dir", true);
+        QVERIFY(!get("snap/dir/file").isValid());
+        QVERIFY(get("snap/dir0").isValid());
+        QVERIFY(get("snap/dir0.txt").isValid());
+        QVERIFY(list("snap").contains("snap/dir0.txt"));
+        _db.schedulePathForRemoteDiscovery("snap/a");
+        QCOMPARE(get("snap")._etag, QByteArray("_invalid_"));
+        _db.clearEtagStorageFilter();
+
+        const auto snapshotList = list("snap");
+        _db.discardFileRecordSnapshot();
+        QCOMPARE(list("snap"), snapshotList);
+        QCOMPARE(get("snap/a")._fileSize, qint64(42));
+        QVERIFY(get("snap/new").isValid());
+        QVERIFY(!get("snap/dir/sub").isValid());
+
+        _db.deleteFileRecord("snap", true);
+    }
+
+    void testMetadataShards()
+    {
+        SyncJournalDb db(_tempDir.path() + "/shards.db");
+        auto makeEntry = [&](const QByteArray &path, const QByteArray &checksum = QByteArray()) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._remotePerm = RemotePermissions::fromDbValue("RW");
+            record._checksumHeader = checksum;
+            QVERIFY(db.setFileRecord(record));
+        };
+        auto get = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            db.getFileRecord(path, &record);
+            return record;
+        };
+        auto below = [&](const QByteArray &path) {
+            QByteArrayList result;
+            db.getFilesBelowPath(path, [&](const SyncJournalFileRecord &record) { result.append(record._path); });
+            return result;
+        };
+        auto list = [&](const QByteArray &path) {
+            QByteArrayList result;
+            db.listFilesInPath(path, [&](const SyncJournalFileRecord &record) { result.append(record._path); });
+            return result;
+        };
+
+        // Written without shards, moved into them when opened again
+        for (const auto path : { "a", "a/x", "a/x/y", "b", "b/z", "b-c", "d", "e", "f" })
+            makeEntry(path);
+        makeEntry("a/x/sum", "SHA1:abc");
+        const auto allPaths = below("");
+        QCOMPARE(allPaths.size(), 10);
+
+        db.setMetadataShardCount(3);
+        QVERIFY(!db.isOpen());
+        QVERIFY(db.open());
+        QCOMPARE(db.metadataShardFilePaths().size(), 3);
+        QCOMPARE(below(""), allPaths);
+        QCOMPARE(list(""), QByteArrayList({ "a", "b-c", "b", "d", "e", "f" }));
+        QCOMPARE(list("a/x"), QByteArrayList({ "a/x/sum", "a/x/y" }));
+        QCOMPARE(get("a/x/sum")._checksumHeader, QByteArray("SHA1:abc"));
+
+        // Checksum types mapped after the move
+        makeEntry("e/new", "MD5:def");
+        QCOMPARE(get("e/new")._checksumHeader, QByteArray("MD5:def"));
+
+        // The shards may know a checksum type under an id the journal lost and reused
+        db.close();
+        for (const auto &fileName : db.metadataShardFilePaths()) {
+            SqlDatabase shard;
+            QVERIFY(shard.openOrCreateReadWrite(fileName));
+            SqlQuery query("UPDATE checksumtype SET name = 'SHA256' WHERE name = 'MD5';", shard);
+            QVERIFY(query.exec());
+            shard.close();
+        }
+        QVERIFY(db.open());
+        QCOMPARE(get("e/new")._checksumHeader, QByteArray("SHA256:def"));
+        makeEntry("e/md5", "MD5:ghi");
+        QCOMPARE(get("e/md5")._checksumHeader, QByteArray("MD5:ghi"));
+        QCOMPARE(get("a/x/sum")._checksumHeader, QByteArray("SHA1:abc"));
+
+        QVERIFY(db.deleteFileRecord("a", true));
+        QVERIFY(!get("a/x/y").isValid());
+        QVERIFY(get("b/z").isValid());
+
+        QVERIFY(db.loadFileRecordSnapshot());
+        const auto snapshotList = list("");
+        db.discardFileRecordSnapshot();
+        QCOMPARE(list(""), snapshotList);
+
+        // And back
+        const auto shardedPaths = below("");
+        db.setMetadataShardCount(0);
+        QVERIFY(db.open());
+        QCOMPARE(below(""), shardedPaths);
+        QVERIFY(db.metadataShardFilePaths().isEmpty());
+        db.close();
+    }
+
     void testPinState()
     {
         auto make = [&](const QByteArray &path, PinState state) {
@@ -0,0 +1,199 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "common/tracing.h"
+
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace OCC;
+
+namespace {
+
+// Just enough of a protobuf reader for the fields the tracer writes
+struct ProtoField
+{
+    quint32 number = 0;
+    quint64 value = 0;
+    QByteArray bytes;
+};
+
+QVector<ProtoField> parseMessage(const QByteArray &data)
+{
+    QVector<ProtoField> fields;
+    int pos = 0;
+    auto varint = [&]() {
+        quint64 result = 0;
+        int shift = 0;
+        while (pos < data.size()) {
+            const auto byte = static_cast<quint8>(data[pos++]);
+            result |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+            shift += 7;
+        }
+        return result;
+    };
+    while (pos < data.size()) {
+        const auto key = varint();
+        ProtoField field;
+        field.number = static_cast<quint32>(key >> 3);
+        if ((key & 7) == 0) {
+            field.value = varint();
+        } else if ((key & 7) == 2) {
+            const auto size = static_cast<int>(varint());
+            field.bytes = data.mid(pos, size);
+            pos += size;
+        } else {
+            qWarning() << "Unexpected wire type" << (key & 7);
+            return {};
+        }
+        fields.append(field);
+    }
+    return fields;
+}
+
+ProtoField find(const QVector<ProtoField> &fields, quint32 number)
+{
+    for (const auto &field : fields) {
+        if (field.number == number)
+            return field;
+    }
+    return {};
+}
+
+struct Event
+{
+    quint64 type;
+    quint64 track;
+    QByteArray name;
+    QByteArray detail;
+};
+
+struct Trace
+{
+    QHash<quint64, QByteArray> trackNames; // thread or lane name by uuid
+    QVector<Event> events;
+    bool firstPacketClearsState = false;
+};
+
+Trace readTrace(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+
+    Trace trace;
+    QHash<quint64, QByteArray> names;
+    QHash<quint64, QByteArray> annotationNames;
+    const auto packets = parseMessage(file.readAll());
+    for (int i = 0; i < packets.size(); ++i) {
+        const auto packet = parseMessage(packets[i].bytes);
+        if (i == 0)
+            trace.firstPacketClearsState = find(packet, 13).value & 1;
+
+        for (const auto &interned : parseMessage(find(packet, 12).bytes)) {
+            const auto entry = parseMessage(interned.bytes);
+            if (interned.number == 2)
+                names.insert(find(entry, 1).value, find(entry, 2).bytes);
+            else if (interned.number == 3)
+                annotationNames.insert(find(entry, 1).value, find(entry, 2).bytes);
+        }
+
+        const auto track = parseMessage(find(packet, 60).bytes);
+        if (!track.isEmpty()) {
+            const auto thread = parseMessage(find(track, 4).bytes);
+            trace.trackNames.insert(find(track, 1).value, thread.isEmpty() ? find(track, 2).bytes : find(thread, 5).bytes);
+        }
+
+        const auto event = parseMessage(find(packet, 11).bytes);
+        if (!event.isEmpty()) {
+            const auto annotation = parseMessage(find(event, 4).bytes);
+            const auto detail = annotationNames.value(find(annotation, 1).value) == "detail" ? find(annotation, 6).bytes : QByteArray();
+            trace.events.append({ find(event, 9).value, find(event, 11).value, names.value(find(event, 10).value), detail });
+        }
+    }
+    return trace;
+}
+
+}
+
+class TestTracing : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testDisabled()
+    {
+        QVERIFY(!Tracing::isEnabled());
+        QVERIFY(Tracing::fileName().isEmpty());
+        // Nothing to write to, nothing happens
+        Tracing::Scope scope("test", "scope");
+        Tracing::AsyncSlice slice;
+        slice.begin("test", "slice");
+        slice.end();
+    }
+
+    void testTrace()
+    {
+        QTemporaryDir dir;
+        const auto fileName = dir.filePath(QStringLiteral("sync.perfetto-trace"));
+        QVERIFY(Tracing::start(fileName));
+        QVERIFY(Tracing::isEnabled());
+        QCOMPARE(Tracing::fileName(), fileName);
+
+        {
+            Tracing::Scope scope("test", "outer", QStringLiteral("some/path"));
+            Tracing::instant("test", "mark");
+        }
+        Tracing::AsyncSlice one, two, three;
+        one.begin("network", "one");
+        two.begin("network", "two");
+        one.end();
+        three.begin("network", "three");
+        two.end();
+        // Its end when destroyed comes after the trace was stopped
+        three.begin("network", "three again");
+
+        Tracing::stop();
+        QVERIFY(!Tracing::isEnabled());
+        QVERIFY(Tracing::fileName().isEmpty());
+
+        const auto trace = readTrace(fileName);
+        QVERIFY(trace.firstPacketClearsState);
+        QCOMPARE(trace.events.size(), 10);
+
+        const auto &outer = trace.events[0];
+        QCOMPARE(outer.type, 1ull);
+        QCOMPARE(outer.name, QByteArray("outer"));
+        QCOMPARE(outer.detail, QByteArray("some/path"));
+        QCOMPARE(trace.trackNames.value(outer.track), QByteArray("main"));
+        QCOMPARE(trace.events[1].type, 3ull);
+        QCOMPARE(trace.events[1].name, QByteArray("mark"));
+        QCOMPARE(trace.events[2].type, 2ull);
+        QCOMPARE(trace.events[2].track, outer.track);
+
+        // Overlapping slices of a category get a lane each, freed lanes are reused
+        const auto &beginOne = trace.events[3];
+        const auto &beginTwo = trace.events[4];
+        QCOMPARE(trace.trackNames.value(beginOne.track), QByteArray("network 1"));
+        QCOMPARE(trace.trackNames.value(beginTwo.track), QByteArray("network 2"));
+        QCOMPARE(trace.events[5].type, 2ull);
+        QCOMPARE(trace.events[5].track, beginOne.track);
+        QCOMPARE(trace.events[6].name, QByteArray("three"));
+        QCOMPARE(trace.events[6].track, beginOne.track);
+        QCOMPARE(trace.events[7].track, beginTwo.track);
+        // Beginning again ends the previous slice first
+        QCOMPARE(trace.events[8].type, 2ull);
+        QCOMPARE(trace.events[8].track, beginOne.track);
+        QCOMPARE(trace.events[9].name, QByteArray("three again"));
+        QCOMPARE(trace.events[9].track, beginOne.track);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestTracing)
+#include "testtracing.moc"
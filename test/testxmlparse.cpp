@@ -613,6 +613,105 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserIncremental() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/dav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<oc:size>121780</oc:size>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/dav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVW</oc:permissions>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "<oc:unknown-property>foo</oc:unknown-property>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:downloadURL/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        QVector<LsColEntry> entries;
+        QMap<QString, QMap<QString, QString>> maps;
+        connect(&parser, &LsColXMLParser::directoryListingEntries, this, [&](const QVector<LsColEntry> &batch) { entries += batch; });
+        connect(&parser, &LsColXMLParser::directoryListingIterated, this, [&](const QString &name, const QMap<QString, QString> &map) { maps[name] = map; });
+        connect(&parser, &LsColXMLParser::directoryListingSubfolders, this, &TestXmlParse::slotDirectoryListingSubFolders);
+        connect(&parser, &LsColXMLParser::finishedWithoutError, this, &TestXmlParse::slotFinishedSuccessfully);
+
+        // Feed it in small pieces that split tags and texts
+        QHash<QString, ExtraFolderInfo> sizes;
+        parser.startParsing(&sizes, "/oc/remote.php/dav/sharefolder");
+        int entriesBeforeLastResponse = -1;
+        for (int pos = 0; pos < testXml.size(); pos += 7) {
+            if (entriesBeforeLastResponse < 0 && pos >= testXml.size() - 100)
+                entriesBeforeLastResponse = entries.size();
+            QVERIFY(parser.addData(testXml.mid(pos, 7)));
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        // The first entry was delivered before the reply was complete
+        QCOMPARE(entriesBeforeLastResponse, 1);
+        QCOMPARE(entries.size(), 2);
+        QCOMPARE(entries[0].href, QStringLiteral("/oc/remote.php/dav/sharefolder"));
+        QCOMPARE(entries[0].value(LsColEntry::Size), QStringLiteral("121780"));
+        QVERIFY(entries[0].value(LsColEntry::ResourceType).contains("collection"));
+        QCOMPARE(entries[1].href, QStringLiteral("/oc/remote.php/dav/sharefolder/quitte.pdf"));
+        QCOMPARE(entries[1].value(LsColEntry::Id), QStringLiteral("00004215ocobzus5kn6s"));
+        QCOMPARE(entries[1].value(LsColEntry::GetContentLength), QStringLiteral("121780"));
+        QVERIFY(!entries[1].contains(LsColEntry::DownloadUrl));
+        QVERIFY(!entries[1].contains(LsColEntry::Size));
+
+        // The maps carry the same, including properties that aren't interned
+        QCOMPARE(maps.size(), 2);
+        const auto fileMap = maps.value(QStringLiteral("/oc/remote.php/dav/sharefolder/quitte.pdf"));
+        QCOMPARE(fileMap.value(QStringLiteral("permissions")), QStringLiteral("RDNVW"));
+        QCOMPARE(fileMap.value(QStringLiteral("unknown-property")), QStringLiteral("foo"));
+        QVERIFY(!fileMap.contains(QStringLiteral("downloadURL")));
+
+        QCOMPARE(sizes.size(), 1);
+        QCOMPARE(_subdirs, QStringList(QStringLiteral("/oc/remote.php/dav/sharefolder/")));
+    }
+
+    void testParserIncrementalTruncated() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/dav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>";
+
+        LsColXMLParser parser;
+        connect(&parser, &LsColXMLParser::finishedWithoutError, this, &TestXmlParse::slotFinishedSuccessfully);
+        parser.startParsing(nullptr, "/oc/remote.php/dav/sharefolder");
+        QVERIFY(parser.addData(testXml));
+        QVERIFY(!parser.finish());
+        QVERIFY(!_success);
+    }
 };
 
     QTEST_GUILESS_MAIN(TestXmlParse)